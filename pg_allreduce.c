@@ -1,194 +1,631 @@
 #include "pg_handle.h"
 #include "rdma_utils.h"
+#include "pg_allreduce.h"
+#include "pg_tuning.h"
+#include "pg_coll.h"
+#include "pg_trace.h"
+#include "pg_pool.h"
+#include "pg_repro.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/time.h>  // For gettimeofday
 
 
-static size_t get_datatype_size(DATATYPE datatype) {
-    switch (datatype) {
-        case INT:
-            return sizeof(int);
-        case DOUBLE:
-            return sizeof(double);
-        default:
-            return 0;
-    }
+// Caller's chunk-ready callback of a streaming all-reduce
+typedef struct {
+    pg_chunk_ready_fn_t fn;
+    void *ctx;
+    void *recvbuf;            // offsets are reported relative to it
+} chunk_notify_t;
+
+// Reports chunk 'k' of 'buf' as final, when the caller asked for it
+static void notify_chunk(const chunk_notify_t *notify, void *buf, const size_t *chunk_offsets,
+                         const int *chunk_counts, int k, size_t dtype_size) {
+    if (!notify || chunk_counts[k] == 0) return;
+    size_t offset = (size_t)((char *)buf + chunk_offsets[k] - (char *)notify->recvbuf);
+    notify->fn(notify->recvbuf, (int)(offset / dtype_size), chunk_counts[k], notify->ctx);
 }
 
-static void perform_operation(void *dst, const void *src, int count, DATATYPE datatype, OPERATION op) {
-    int i;
-    if (datatype == INT) {
-        int *d = (int *)dst;
-        const int *s = (const int *)src;
+// Ring all-reduce of 'buf' in place on an acquired slot (or lane).
+// The vector is split into num_servers contiguous chunks; chunk k holds
+// chunk_counts[k] elements. The chunk an element lives in decides the rank
+// order its reduction is accumulated in (see ring_position). Each chunk is
+// reported to 'notify' (may be NULL) once it is final on this rank and the
+// ring no longer reads it, so the caller may overwrite it right away.
+static int ring_all_reduce(PGHandle *pg_handle, pg_slot_t *slot, void *buf, const int *chunk_counts,
+                           const pg_reducer_t *reducer, const pg_coll_params_t *params,
+                           const chunk_notify_t *notify) {
+    size_t dtype_size = reducer->elem_size;
+    int n = pg_handle->num_servers;
+    int idx = ring_position(pg_handle, slot);
+    int ret = 0;
+
+    size_t *chunk_offsets = malloc(n * sizeof(size_t));
+    if (!chunk_offsets) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    size_t total_size = 0;
+    size_t max_chunk_bytes = 0;
+    for (int k = 0; k < n; k++) {
+        chunk_offsets[k] = total_size;
+        total_size += (size_t)chunk_counts[k] * dtype_size;
+        max_chunk_bytes = MAX(max_chunk_bytes, (size_t)chunk_counts[k] * dtype_size);
+    }
+
+    // Chunks larger than the segment size (at most the slot) are moved in
+    // segments. Every rank runs the same number of segments per step (the
+    // largest chunk decides), because each segment is a synchronization point
+    // between neighbors.
+    pg_protocol_t protocol = params->protocol;
+    size_t seg_size = ring_segment_size(slot, params, dtype_size);
+    int num_segments = (int)((max_chunk_bytes + seg_size - 1) / seg_size);
+
+    // Received segments are reduced through one segment of pool scratch
+    pg_pool_block_t *temp = pg_pool_get(pg_handle, seg_size);
+    if (!temp) {
+        free(chunk_offsets);
+        return -1;
+    }
+    void *temp_buf = temp->addr;
+
+    // Phase 1: Reduce-scatter using ring algorithm
+    // Each server will accumulate values for its designated chunk
+    for (int step = 0; step < n - 1 && ret == 0; step++) {
+        // Calculate which chunk to send/receive
+        int send_chunk_id = (idx - step + n) % n;
+        int recv_chunk_id = (idx - step - 1 + n) % n;
         
-        if (op == SUM) {
-            for (i = 0; i < count; i++) {
-                d[i] += s[i];
-            }
-        } else if (op == MULT) {
-            for (i = 0; i < count; i++) {
-                d[i] *= s[i];
-            }
+        uint64_t t = pg_trace_begin(pg_handle);
+        slot->trace_step = step;
+        // The last step completes the chunk, so it applies the post-scale
+        if (ring_step_reduce(pg_handle, slot, protocol, seg_size, num_segments,
+                             (char *)buf + chunk_offsets[send_chunk_id],
+                             chunk_counts[send_chunk_id] * dtype_size,
+                             (char *)buf + chunk_offsets[recv_chunk_id],
+                             chunk_counts[recv_chunk_id] * dtype_size,
+                             temp_buf, reducer, step == n - 2) != 0) {
+            ret = -1;
         }
-    } else if (datatype == DOUBLE) {
-        double *d = (double *)dst;
-        const double *s = (const double *)src;
+        pg_trace_record(pg_handle, slot, PG_TRACE_STEP, t, chunk_counts[recv_chunk_id] * dtype_size);
+    }
+
+    // Phase 2: All-gather using ring algorithm
+    // Each server broadcasts its chunk to all others
+    for (int step = 0; step < n - 1 && ret == 0; step++) {
+        // Calculate which chunk to send/receive
+        int send_chunk_id = (idx - step + n + 1) % n;
+        int recv_chunk_id = (idx - step + n) % n;
         
-        if (op == SUM) {
-            for (i = 0; i < count; i++) {
-                d[i] += s[i];
-            }
-        } else if (op == MULT) {
-            for (i = 0; i < count; i++) {
-                d[i] *= s[i];
-            }
+        // Allgather steps follow the n - 1 reduce-scatter steps in the trace
+        uint64_t t = pg_trace_begin(pg_handle);
+        slot->trace_step = n - 1 + step;
+        if (ring_step_copy(pg_handle, slot, protocol, seg_size, num_segments,
+                           (char *)buf + chunk_offsets[send_chunk_id],
+                           chunk_counts[send_chunk_id] * dtype_size,
+                           (char *)buf + chunk_offsets[recv_chunk_id],
+                           chunk_counts[recv_chunk_id] * dtype_size) != 0) {
+            ret = -1;
         }
+        pg_trace_record(pg_handle, slot, PG_TRACE_STEP, t, chunk_counts[recv_chunk_id] * dtype_size);
+        // A chunk is final once reduced (our own) or received, but it is
+        // forwarded on the next step: only a chunk that went out is reported.
+        // The chunk received last is never forwarded.
+        if (ret == 0) {
+            notify_chunk(notify, buf, chunk_offsets, chunk_counts, send_chunk_id, dtype_size);
+        }
+        if (ret == 0 && step == n - 2) {
+            notify_chunk(notify, buf, chunk_offsets, chunk_counts, recv_chunk_id, dtype_size);
+        }
+    }
+    slot->trace_step = -1;
+
+    // Drain the last acknowledgement before the slot changes hands
+    if (ret == 0 && ring_finish(pg_handle, slot) != 0) {
+        ret = -1;
     }
+
+    pg_pool_put(pg_handle, temp);
+    free(chunk_offsets);
+    return ret;
 }
 
+// Reverse-ring part of a two-ring all-reduce, run by a helper thread
+typedef struct {
+    PGHandle *pg_handle;
+    pg_slot_t *lane;
+    void *buf;
+    const int *chunk_counts;
+    const pg_reducer_t *reducer;
+    const pg_coll_params_t *params;
+    const chunk_notify_t *notify;
+    int ret;
+} lane_job_t;
 
-// Rendezvous method: Local write + remote read
-static int transfer_data_rendezvous(PGHandle *pg_handle, size_t actual_size) {
-    if(ring_barrier(pg_handle) != 0) {
-        fprintf(stderr, "Rank %d: BARRIER ring_barrier failed\n", pg_handle->rank);
-        return 1;
+static void *lane_thread(void *arg) {
+    lane_job_t *job = (lane_job_t *)arg;
+    job->ret = ring_all_reduce(job->pg_handle, job->lane, job->buf, job->chunk_counts,
+                               job->reducer, job->params, job->notify);
+    return NULL;
+}
+
+// Whether an all-reduce on the slot uses the exchanged costs: only the
+// collectives of tag 0 in the bulk class, which every rank runs in the same
+// order, so the cost exchanges line up
+static int balanced(const PGHandle *pg_handle, const pg_slot_t *slot) {
+    return pg_handle->config.balance && slot->tag == 0 && slot->priority == PG_PRIORITY_BULK;
+}
+
+// Ring all-reduce of 'count' elements of 'buf' in place. When ring_split_count
+// splits the vector, the head runs on the slot and the tail on its reverse
+// lane at the same time, each through half of the slot's staging, so every
+// link carries traffic in both directions.
+static int multi_ring_all_reduce(PGHandle *pg_handle, pg_slot_t *slot, void *buf, int count,
+                                 const pg_reducer_t *reducer, const pg_coll_params_t *params,
+                                 const chunk_notify_t *notify) {
+    size_t dtype_size = reducer->elem_size;
+    int n = pg_handle->num_servers;
+    int split = ring_split_count(pg_handle, count, dtype_size);
+    int *chunk_counts = malloc(2 * n * sizeof(int));
+    if (!chunk_counts) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    if (balanced(pg_handle, slot)) {
+        ring_balanced_counts(pg_handle, 0, split, chunk_counts);
+        ring_balanced_counts(pg_handle, 1, count - split, chunk_counts + n);
+    } else {
+        for (int k = 0; k < n; k++) {
+            chunk_counts[k] = ring_chunk_count(split, n, k);
+            chunk_counts[n + k] = ring_chunk_count(count - split, n, k);
+        }
     }
 
-    if(rdma_write_to_right(pg_handle, actual_size) != 0) {
-        fprintf(stderr, "Rank %d: rdma_write_to_right failed\n", pg_handle->rank);
-        return 1;
+    if (split == count) {
+        int ret = ring_all_reduce(pg_handle, slot, buf, chunk_counts, reducer, params, notify);
+        free(chunk_counts);
+        return ret;
     }
-    // Wait for completion
-    if(poll_for_completion(pg_handle) != 0) {
-        fprintf(stderr, "Rank %d: poll_for_completion failed\n", pg_handle->rank);
-        return 1;
+
+    pg_slot_t *lane = &pg_handle->slots[PG_MAX_SLOTS + slot->index];
+    pg_coll_params_t half = *params;
+    if (half.segment_bytes == 0 || half.segment_bytes > lane->size) {
+        half.segment_bytes = lane->size;
+    }
+    lane->error = 0;
+    lane_job_t job = {pg_handle, lane, (char *)buf + (size_t)split * dtype_size, chunk_counts + n,
+                      reducer, &half, notify, -1};
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, lane_thread, &job) != 0) {
+        fprintf(stderr, "Rank %d: Failed to start the reverse ring\n", pg_handle->rank);
+        free(chunk_counts);
+        return -1;
     }
+    int ret = ring_all_reduce(pg_handle, slot, buf, chunk_counts, reducer, &half, notify);
+    pthread_join(thread, NULL);
+    if (job.ret != 0) {
+        ret = -1;
+    }
+    free(chunk_counts);
+    return ret;
+}
+
+
+int pg_all_reduce(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op, PGHandle* pg_handle) {
+    return pg_all_reduce_tagged(sendbuf, recvbuf, count, datatype, op, 0, pg_handle);
+}
 
-    if(ring_barrier(pg_handle) != 0) {
-        fprintf(stderr, "Rank %d: BARRIER ring_barrier failed\n", pg_handle->rank);
-        return 1;
+int pg_all_reduce_tagged(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op, int tag, PGHandle* pg_handle) {
+    pg_op_opts_t opts = {tag, PG_PRIORITY_BULK};
+    return pg_all_reduce_ex(sendbuf, recvbuf, count, datatype, op, &opts, pg_handle);
+}
+
+// Per-call options, or the defaults (tag 0, bulk) for NULL; NULL when invalid
+static const pg_op_opts_t *check_opts(const pg_op_opts_t *opts, pg_op_opts_t *defaults) {
+    if (!opts) {
+        defaults->tag = 0;
+        defaults->priority = PG_PRIORITY_BULK;
+        return defaults;
+    }
+    if (opts->priority != PG_PRIORITY_BULK && opts->priority != PG_PRIORITY_HIGH) {
+        fprintf(stderr, "Invalid priority for all_reduce\n");
+        return NULL;
     }
-    
+    return opts;
+}
+
+static int all_reduce_in_class(void* sendbuf, void* recvbuf, int count, const pg_reducer_t* reducer,
+                               int tag, pg_priority_t priority, const pg_coll_params_t* params,
+                               const chunk_notify_t* notify, PGHandle* pg_handle);
+
+// Folds the cost per byte of one all-reduce into this rank's moving average
+static void balance_record(PGHandle *pg_handle, uint64_t busy_ns, uint64_t busy_bytes) {
+    if (busy_bytes == 0) return;
+    double cost = (double)busy_ns / busy_bytes;
+    pg_balance_t *balance = &pg_handle->balance;
+    balance->local_cost = balance->local_cost > 0.0 ? 0.75 * balance->local_cost + 0.25 * cost : cost;
+}
+
+// Every rank contributes its cost at its own index; the sum is the cost of
+// every rank, identical everywhere, and sizes the chunks from now on
+static int balance_exchange(PGHandle *pg_handle) {
+    int n = pg_handle->num_servers;
+    double *local = calloc(n, sizeof(double));
+    double *costs = calloc(n, sizeof(double));
+    if (!local || !costs) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(local);
+        free(costs);
+        return -1;
+    }
+    local[pg_handle->rank] = pg_handle->balance.local_cost;
+    pg_handle->balance.calls = 0;
+
+    pg_reducer_t reducer;
+    builtin_reducer(&reducer, DOUBLE, SUM);
+    pg_coll_params_t params;
+    pg_tuning_select(pg_handle, n * sizeof(double), DOUBLE, &params);
+    pg_handle->balance.exchanging = 1;
+    int ret = all_reduce_in_class(local, costs, n, &reducer, 0, PG_PRIORITY_BULK, &params, NULL, pg_handle);
+    pg_handle->balance.exchanging = 0;
+    free(local);
+    if (ret != 0) {
+        free(costs);
+        return -1;
+    }
+    free(pg_handle->balance.costs);
+    pg_handle->balance.costs = costs;
     return 0;
 }
 
+// All-reduce on a slot of the given traffic class with explicit parameters;
+// final chunks are reported to 'notify' when it is not NULL
+static int all_reduce_in_class(void* sendbuf, void* recvbuf, int count, const pg_reducer_t* reducer,
+                               int tag, pg_priority_t priority, const pg_coll_params_t* params,
+                               const chunk_notify_t* notify, PGHandle* pg_handle) {
+    if (!sendbuf || !recvbuf || count <= 0 || !pg_handle || tag < 0 || !params) {
+        fprintf(stderr, "Invalid parameters for all_reduce\n");
+        return -1;
+    }
 
+    pg_slot_t *slot = acquire_slot_priority(pg_handle, tag, priority);
+    if (!slot) {
+        return -1;
+    }
 
-int pg_all_reduce(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op, PGHandle* pg_handle) {
-    if (!sendbuf || !recvbuf || count <= 0 || !pg_handle ) {
+    int ret;
+    int exchange = 0;
+    if (params->algorithm == PG_ALGO_ATOMIC && !reducer->fn &&
+        atomic_applicable(pg_handle, count, reducer->datatype)) {
+        ret = atomic_all_reduce(pg_handle, slot, sendbuf, recvbuf, count, reducer->op);
+        // The whole result arrives at once
+        if (ret == 0 && notify) {
+            notify->fn(recvbuf, 0, count, notify->ctx);
+        }
+    } else {
+        // Copy input to output buffer initially. The pre-scale rides on this
+        // copy; a single rank has no ring step to apply the post-scale, so it
+        // rides along as well.
+        double scale = reducer->pre_scale * (pg_handle->num_servers == 1 ? reducer->post_scale : 1.0);
+        if (scale != 1.0) {
+            scale_copy(recvbuf, sendbuf, count, reducer->datatype, scale);
+        } else if (recvbuf != sendbuf) {
+            memcpy(recvbuf, sendbuf, count * reducer->elem_size);
+        }
+        pg_slot_t *lane = &pg_handle->slots[PG_MAX_SLOTS + slot->index];
+        slot->busy_ns = slot->busy_bytes = lane->busy_ns = lane->busy_bytes = 0;
+        ret = multi_ring_all_reduce(pg_handle, slot, recvbuf, count, reducer, params, notify);
+        if (ret == 0 && balanced(pg_handle, slot) && !pg_handle->balance.exchanging &&
+            (size_t)count * reducer->elem_size >= PG_BALANCE_MIN_BYTES) {
+            balance_record(pg_handle, slot->busy_ns + lane->busy_ns, slot->busy_bytes + lane->busy_bytes);
+            exchange = ++pg_handle->balance.calls >= pg_handle->config.balance_interval;
+        }
+    }
+
+    release_slot(pg_handle, slot);
+    if (exchange && balance_exchange(pg_handle) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int pg_all_reduce_with_params(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                              int tag, const pg_coll_params_t* params, PGHandle* pg_handle) {
+    pg_reducer_t reducer;
+    if (!pg_handle) {
         fprintf(stderr, "Invalid parameters for all_reduce\n");
         return -1;
     }
+    if (group_reducer(&reducer, datatype, op, pg_handle->num_servers) != 0) {
+        return -1;
+    }
+    return all_reduce_in_class(sendbuf, recvbuf, count, &reducer, tag, PG_PRIORITY_BULK,
+                               params, NULL, pg_handle);
+}
+
+int pg_all_reduce_ex(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                     const pg_op_opts_t* opts, PGHandle* pg_handle) {
+    return pg_all_reduce_streaming(sendbuf, recvbuf, count, datatype, op, opts, NULL, NULL, pg_handle);
+}
 
-    void *rdma_recvbuf = pg_handle->recvbuf;
-    void *rdma_sendbuf = pg_handle->sendbuf;
-    
-    size_t dtype_size = get_datatype_size(datatype);
-    if (dtype_size == 0) {
-        fprintf(stderr, "Invalid datatype\n");
+// Common body of the streaming and the scaled all-reduce
+static int all_reduce_scaled(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                             double pre_scale, double post_scale, const pg_op_opts_t* opts,
+                             pg_chunk_ready_fn_t on_ready, void* ctx, PGHandle* pg_handle) {
+    pg_op_opts_t defaults;
+    pg_reducer_t reducer;
+    if (!sendbuf || !recvbuf || !pg_handle) {
+        fprintf(stderr, "Invalid parameters for all_reduce\n");
         return -1;
     }
-    
-    size_t total_size = count * dtype_size;
-    int n = pg_handle->num_servers;
-    int idx = pg_handle->rank;
-    
-    // Calculate chunk size for each server
-    int chunk_size = count / n;
-    int remainder = count % n;
-    
-    // Copy input to output buffer initially
-    memcpy(recvbuf, sendbuf, total_size);
-    void *temp_buf = malloc(total_size);
-    if (!temp_buf) {
-        fprintf(stderr, "Memory allocation failed\n");
+    if (!(opts = check_opts(opts, &defaults)) ||
+        group_reducer(&reducer, datatype, op, pg_handle->num_servers) != 0) {
         return -1;
     }
-    
-    // Phase 1: Reduce-scatter using ring algorithm
-    // Each server will accumulate values for its designated chunk
-    for (int step = 0; step < n - 1; step++) {
-        memset(rdma_sendbuf, 0, pg_handle->bufsize);
-        memset(rdma_recvbuf, 0, pg_handle->bufsize);
-        // Calculate which chunk to send/receive
-        int send_chunk_id = (idx - step + n) % n;
-        int recv_chunk_id = (idx - step - 1 + n) % n;
-        
-        // Calculate offsets and sizes
-        size_t send_offset = send_chunk_id * chunk_size * dtype_size;
-        size_t recv_offset = recv_chunk_id * chunk_size * dtype_size;
-        
-        int send_count = chunk_size;
-        int recv_count = chunk_size;
-        
-        // Handle remainder elements for last chunk
-        if (send_chunk_id == n - 1) {
-            send_count = chunk_size + remainder;
+    if ((pre_scale != 1.0 || post_scale != 1.0) && (!floating_datatype(datatype) || reducer.op != SUM)) {
+        fprintf(stderr, "Scale factors need SUM or AVG on a floating datatype\n");
+        return -1;
+    }
+    reducer.pre_scale = pre_scale;
+    reducer.post_scale *= post_scale;
+
+    // Exact fixed-point sums: the result is final only once they are rounded
+    // back, and the scales take passes of their own
+    if (pg_handle->config.deterministic && datatype == DOUBLE && reducer.op == SUM) {
+        void *input = sendbuf;
+        if (reducer.pre_scale != 1.0 && count > 0) {
+            scale_copy(recvbuf, sendbuf, count, DOUBLE, reducer.pre_scale);
+            input = recvbuf;
         }
-        if (recv_chunk_id == n - 1) {
-            recv_count = chunk_size + remainder;
+        int ret = pg_all_reduce_deterministic(input, recvbuf, count, opts, pg_handle);
+        if (ret == 0 && reducer.post_scale != 1.0) scale_copy(recvbuf, recvbuf, count, DOUBLE, reducer.post_scale);
+        if (ret == 0 && on_ready) on_ready(recvbuf, 0, count, ctx);
+        return ret;
+    }
+    pg_coll_params_t params;
+    pg_tuning_select(pg_handle, (size_t)count * reducer.elem_size, datatype, &params);
+    chunk_notify_t notify = {on_ready, ctx, recvbuf};
+    return all_reduce_in_class(sendbuf, recvbuf, count, &reducer, opts->tag, opts->priority,
+                               &params, on_ready ? &notify : NULL, pg_handle);
+}
+
+int pg_all_reduce_streaming(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                            const pg_op_opts_t* opts, pg_chunk_ready_fn_t on_ready, void* ctx,
+                            PGHandle* pg_handle) {
+    return all_reduce_scaled(sendbuf, recvbuf, count, datatype, op, 1.0, 1.0, opts, on_ready, ctx, pg_handle);
+}
+
+int pg_all_reduce_scaled(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                         double pre_scale, double post_scale, const pg_op_opts_t* opts, PGHandle* pg_handle) {
+    return all_reduce_scaled(sendbuf, recvbuf, count, datatype, op, pre_scale, post_scale, opts,
+                             NULL, NULL, pg_handle);
+}
+
+int pg_all_reduce_custom(void* sendbuf, void* recvbuf, int count, size_t elem_size,
+                         pg_reduce_fn_t fn, void* ctx, const pg_op_opts_t* opts, PGHandle* pg_handle) {
+    pg_op_opts_t defaults;
+    if (!pg_handle || !fn || elem_size == 0) {
+        fprintf(stderr, "Invalid parameters for all_reduce_custom\n");
+        return -1;
+    }
+    if (!(opts = check_opts(opts, &defaults))) {
+        return -1;
+    }
+    pg_reducer_t reducer = {elem_size, INT, SUM, fn, ctx, 1.0, 1.0};
+    // Only the ring runs caller kernels; the datatype just keeps the tuning
+    // table's size classes (the atomic path is skipped for custom reducers)
+    pg_coll_params_t params;
+    pg_tuning_select(pg_handle, (size_t)count * elem_size, DOUBLE, &params);
+    return all_reduce_in_class(sendbuf, recvbuf, count, &reducer, opts->tag, opts->priority,
+                               &params, NULL, pg_handle);
+}
+
+// Chunk sizes of a single-ring all-reduce of 'count' elements on the slot:
+// those of the exchanged costs when the slot is balanced, equal ones otherwise
+static void slot_chunk_counts(const PGHandle *pg_handle, const pg_slot_t *slot, int count,
+                              int *chunk_counts) {
+    if (balanced(pg_handle, slot)) {
+        ring_balanced_counts(pg_handle, 0, count, chunk_counts);
+    } else {
+        for (int k = 0; k < pg_handle->num_servers; k++) {
+            chunk_counts[k] = ring_chunk_count(count, pg_handle->num_servers, k);
         }
-        
-        size_t send_bytes = send_count * dtype_size;
-        size_t recv_bytes = recv_count * dtype_size;
-        
-        // Copy data to send buffer
-        memcpy(rdma_sendbuf, (char *)recvbuf + send_offset, send_bytes);
+    }
+}
 
-        
-        // Transfer data using selected method (rendezvous or eager)
-        transfer_data_rendezvous(pg_handle, send_bytes);
+// Copies tensors [first, last) into / out of a fused bucket. The bucket is laid
+// out chunk-major: chunk k is the concatenation of chunk k of every tensor
+// (tensor_chunks[t * n + k] elements), so each element lands in the same
+// chunk as in a per-tensor pg_all_reduce. 'cursor' is scratch of n entries.
+static void fused_copy(void *bucket, void **bufs, const int *tensor_chunks, const int *chunk_counts,
+                       size_t *cursor, int first, int last, int n, size_t dtype_size, int unpack) {
+    size_t start = 0;
+    for (int k = 0; k < n; k++) {
+        cursor[k] = start;
+        start += (size_t)chunk_counts[k] * dtype_size;
+    }
+    for (int t = first; t < last; t++) {
+        char *tensor_part = (char *)bufs[t];
+        for (int k = 0; k < n; k++) {
+            size_t bytes = (size_t)tensor_chunks[(size_t)t * n + k] * dtype_size;
+            char *pos = (char *)bucket + cursor[k];
+            if (unpack) {
+                memcpy(tensor_part, pos, bytes);
+            } else {
+                memcpy(pos, tensor_part, bytes);
+            }
+            cursor[k] += bytes;
+            tensor_part += bytes;
+        }
+    }
+}
 
-        
+// Bytes of a tensor in a fused bucket. Under PG_DETERMINISTIC every tensor
+// starts on a PG_REPRO_BLOCK boundary, so it gets the exponent blocks (and
+// therefore the bits) of its own pg_all_reduce_deterministic call.
+static size_t fused_bytes(int count, size_t dtype_size, int deterministic) {
+    if (deterministic) {
+        count = (count + PG_REPRO_BLOCK - 1) / PG_REPRO_BLOCK * PG_REPRO_BLOCK;
+    }
+    return (size_t)count * dtype_size;
+}
 
-        memcpy(temp_buf, rdma_recvbuf, recv_bytes);
-        
-        // Perform reduction operation
-        perform_operation((char *)recvbuf + recv_offset,
-                         temp_buf,
-                         recv_count,
-                         datatype,
-                         op);
+// Exact DOUBLE SUM of tensors [first, last) through one deterministic call,
+// each zero-padded to its blocks; 'post_scale' (AVG) is applied on the way
+// out, as all_reduce_scaled does after the exact sum
+static int fused_deterministic(double *bucket, void **sendbufs, void **recvbufs, const int *counts,
+                               int first, int last, double post_scale, PGHandle *pg_handle) {
+    size_t pos = 0;
+    for (int t = first; t < last; t++) {
+        size_t bytes = fused_bytes(counts[t], sizeof(double), 1);
+        memcpy((char *)bucket + pos, sendbufs[t], (size_t)counts[t] * sizeof(double));
+        memset((char *)bucket + pos + (size_t)counts[t] * sizeof(double), 0,
+               bytes - (size_t)counts[t] * sizeof(double));
+        pos += bytes;
+    }
+    if (pg_all_reduce_deterministic(bucket, bucket, (int)(pos / sizeof(double)), NULL, pg_handle) != 0) {
+        return -1;
+    }
+    pos = 0;
+    for (int t = first; t < last; t++) {
+        if (post_scale != 1.0) {
+            scale_copy(recvbufs[t], (char *)bucket + pos, counts[t], DOUBLE, post_scale);
+        } else {
+            memcpy(recvbufs[t], (char *)bucket + pos, (size_t)counts[t] * sizeof(double));
+        }
+        pos += fused_bytes(counts[t], sizeof(double), 1);
     }
+    return 0;
+}
 
-    // Phase 2: All-gather using ring algorithm
-    // Each server broadcasts its chunk to all others
-    for (int step = 0; step < n - 1; step++) {
-        // Calculate which chunk to send/receive
-        int send_chunk_id = (idx - step + n + 1) % n;
-        int recv_chunk_id = (idx - step + n) % n;
-        
-        // Calculate offsets and sizes
-        size_t send_offset = send_chunk_id * chunk_size * dtype_size;
-        size_t recv_offset = recv_chunk_id * chunk_size * dtype_size;
-        
-        int send_count = chunk_size;
-        int recv_count = chunk_size;
-        
-        // Handle remainder elements for last chunk
-        if (send_chunk_id == n - 1) {
-            send_count = chunk_size + remainder;
+int pg_all_reduce_multi(void** sendbufs, void** recvbufs, const int* counts, int num_tensors,
+                        DATATYPE datatype, OPERATION op, PGHandle* pg_handle) {
+    if (!sendbufs || !recvbufs || !counts || num_tensors <= 0 || !pg_handle) {
+        fprintf(stderr, "Invalid parameters for all_reduce_multi\n");
+        return -1;
+    }
+    pg_reducer_t reducer;
+    if (group_reducer(&reducer, datatype, op, pg_handle->num_servers) != 0) {
+        return -1;
+    }
+    size_t dtype_size = reducer.elem_size;
+    for (int t = 0; t < num_tensors; t++) {
+        if (!sendbufs[t] || !recvbufs[t] || counts[t] <= 0) {
+            fprintf(stderr, "Invalid tensor %d for all_reduce_multi\n", t);
+            return -1;
         }
-        if (recv_chunk_id == n - 1) {
-            recv_count = chunk_size + remainder;
+    }
+
+    int n = pg_handle->num_servers;
+    int deterministic = pg_handle->config.deterministic && datatype == DOUBLE && reducer.op == SUM;
+    size_t bucket_cap = pg_handle->fusion_bucket_bytes;
+    void *bucket = NULL;
+    pg_pool_block_t *bucket_block = NULL;
+    int *chunk_counts = malloc(n * sizeof(int));
+    int *tensor_chunks = malloc((size_t)num_tensors * n * sizeof(int));
+    size_t *cursor = malloc(n * sizeof(size_t));
+    if (!chunk_counts || !tensor_chunks || !cursor) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(chunk_counts);
+        free(tensor_chunks);
+        free(cursor);
+        return -1;
+    }
+
+    int ret = 0;
+    int first = 0;
+    while (first < num_tensors && ret == 0) {
+        // A tensor that fills a bucket on its own is reduced directly,
+        // without packing it into the bucket and back; so is one that a
+        // per-tensor call splits over two rings, which a bucket cannot mimic
+        // (exact sums do not depend on the rings)
+        if (fused_bytes(counts[first], dtype_size, deterministic) >= bucket_cap ||
+            (!deterministic && ring_split_count(pg_handle, counts[first], dtype_size) != counts[first])) {
+            ret = pg_all_reduce(sendbufs[first], recvbufs[first], counts[first], datatype, op, pg_handle);
+            first++;
+            continue;
+        }
+
+        // Gather the following small tensors while they fit in one bucket
+        int last = first;
+        size_t bucket_bytes = 0;
+        while (last < num_tensors &&
+               bucket_bytes + fused_bytes(counts[last], dtype_size, deterministic) <= bucket_cap &&
+               (deterministic || ring_split_count(pg_handle, counts[last], dtype_size) == counts[last])) {
+            bucket_bytes += fused_bytes(counts[last], dtype_size, deterministic);
+            last++;
+        }
+
+        if (!bucket) {
+            bucket_block = pg_pool_get(pg_handle, bucket_cap);
+            if (!bucket_block) {
+                ret = -1;
+                break;
+            }
+            bucket = bucket_block->addr;
+        }
+        if (deterministic) {
+            ret = fused_deterministic(bucket, sendbufs, recvbufs, counts, first, last, reducer.post_scale,
+                                      pg_handle);
+            first = last;
+            continue;
+        }
+
+        pg_coll_params_t params;
+        pg_tuning_select(pg_handle, bucket_bytes, datatype, &params);
+        pg_slot_t *slot = acquire_slot(pg_handle, 0);
+        if (!slot) {
+            ret = -1;
+            break;
+        }
+        // Every tensor is chunked as its own pg_all_reduce would be on this
+        // slot (balanced sizes under PG_BALANCE), read while holding the slot
+        // so a cost exchange cannot change them in between
+        memset(chunk_counts, 0, n * sizeof(int));
+        for (int t = first; t < last; t++) {
+            slot_chunk_counts(pg_handle, slot, counts[t], tensor_chunks + (size_t)t * n);
+            for (int k = 0; k < n; k++) {
+                chunk_counts[k] += tensor_chunks[(size_t)t * n + k];
+            }
+        }
+        fused_copy(bucket, sendbufs, tensor_chunks, chunk_counts, cursor, first, last, n, dtype_size, 0);
+        ret = ring_all_reduce(pg_handle, slot, bucket, chunk_counts, &reducer, &params, NULL);
+        release_slot(pg_handle, slot);
+        if (ret == 0) {
+            fused_copy(bucket, recvbufs, tensor_chunks, chunk_counts, cursor, first, last, n, dtype_size, 1);
+        }
+        first = last;
+    }
+
+    pg_pool_put(pg_handle, bucket_block);
+    free(chunk_counts);
+    free(tensor_chunks);
+    free(cursor);
+    return ret;
+}
+
+int pg_get_chunk_counts(PGHandle* pg_handle, int count, int* chunk_counts) {
+    if (!pg_handle || count < 0 || !chunk_counts) {
+        fprintf(stderr, "Invalid parameters for pg_get_chunk_counts\n");
+        return -1;
+    }
+    if (pg_handle->config.balance) {
+        ring_balanced_counts(pg_handle, 0, count, chunk_counts);
+    } else {
+        for (int k = 0; k < pg_handle->num_servers; k++) {
+            chunk_counts[k] = ring_chunk_count(count, pg_handle->num_servers, k);
         }
-        
-        size_t send_bytes = send_count * dtype_size;
-        size_t recv_bytes = recv_count * dtype_size;
-        
-        // Copy data to send buffer
-        memcpy(rdma_sendbuf, (char *)recvbuf + send_offset, send_bytes);
-        
-        // Transfer data using selected method (rendezvous or eager)
-        transfer_data_rendezvous(pg_handle, send_bytes);
-        
-        // Copy received chunk to result buffer
-        memcpy((char *)recvbuf + recv_offset, rdma_recvbuf, recv_bytes);
-        
     }
-    
     return 0;
-}
\ No newline at end of file
+}
+
+int pg_set_fusion_bucket_size(PGHandle* pg_handle, size_t bytes) {
+    if (!pg_handle || bytes == 0 || bytes > pg_handle->config.pool_max_bytes / 2) {
+        return -1;
+    }
+    pg_handle->fusion_bucket_bytes = bytes;
+    return 0;
+}
@@ -3,18 +3,238 @@
 
 #include "pg_handle.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * @brief Perform an all-reduce operation across the process group.
  * @param sendbuf Pointer to the local input buffer (count elements of 'datatype').
  * @param recvbuf Pointer to the output buffer of length 'count'.
  * @param count Number of elements in sendbuf and recvbuf.
- * @param datatype DATATYPE describing the element type (e.g., INT, DOUBLE).
- * @param op OPERATION to apply (e.g., SUM, MULT).
+ * @param datatype DATATYPE describing the element type (INT, DOUBLE, FLOAT, INT64,
+ *        or FP16 / BF16 stored as uint16_t and reduced in fp32).
+ * @param op OPERATION to apply (SUM, MULT, MIN, MAX; BAND and BOR on INT / INT64 only;
+ *        AVG on the floating types, with the division fused into the ring, see
+ *        pg_all_reduce_scaled).
  * @param pg_handle Pointer to the process group handle returned from connect_process_group.
- * @return 0 on success, -1 on failure.
+ * @return 0 on success, -1 on failure (including an op the datatype does not support).
  */
 int pg_all_reduce(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op, PGHandle* pg_handle);
 
+/**
+ * @brief Tagged all-reduce: several of these may be in flight on one handle at once.
+ * Each tag has its own staging slot and flag region, so independent
+ * collectives issued from different threads do not interfere. Tags range
+ * over 0 .. PG_NUM_SLOTS - 1 (bulk) and 0 .. PG_NUM_HIGH_SLOTS - 1
+ * (high priority, when reserved); others fail. Calls on the same tag must be
+ * issued in the same order on every rank.
+ * pg_all_reduce is pg_all_reduce_tagged with tag 0.
+ * @param tag Tag below the slot count of the class; every rank must pass the
+ *        same tag for the same collective.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_all_reduce_tagged(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op, int tag, PGHandle* pg_handle);
+
+/**
+ * @brief All-reduce with per-call options: the tag of pg_all_reduce_tagged and
+ * a priority class. PG_PRIORITY_HIGH collectives run on the reserved
+ * high-priority slots, QPs (with their own SL / traffic class, see
+ * PG_SL_HIGH and PG_TRAFFIC_CLASS_HIGH) and CQ, so a small latency-critical
+ * all-reduce neither queues behind bulk transfers on the NIC nor waits for a
+ * bulk collective's slot or completions. Tags map to slots within a class.
+ * pg_all_reduce_tagged is pg_all_reduce_ex with PG_PRIORITY_BULK.
+ * @param opts Options (tag and priority must be identical on all ranks), or NULL for tag 0, bulk.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_all_reduce_ex(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                     const pg_op_opts_t* opts, PGHandle* pg_handle);
+
+/**
+ * @brief pg_all_reduce_ex that reports each part of recvbuf as soon as it
+ * holds its final value and the ring no longer reads it, so the caller can
+ * start consuming the reduced data, also in place (e.g. an optimizer
+ * updating the first parameter shards), while the rest is still in flight.
+ * The ring reports one chunk of about count / num_servers elements per
+ * allgather step, once it has been forwarded to the right neighbor: this
+ * rank's own chunk first, then the others in ring order, the last two
+ * together. The atomic path and a DOUBLE SUM under PG_DETERMINISTIC
+ * (pg_repro.h) report all of recvbuf at once. Every element is reported
+ * exactly once, before the call returns.
+ * 'on_ready' runs on the calling thread, or with PG_NUM_RINGS=2 also on the
+ * reverse ring's helper thread, so two calls may overlap (on disjoint
+ * ranges). It should return quickly, since the ring waits for it, and must
+ * not start collectives on this handle. pg_all_reduce_ex is this call
+ * without a callback.
+ * @param opts Tag and priority as in pg_all_reduce_ex, or NULL.
+ * @param on_ready Called with recvbuf, the first final element and the
+ *        number of final elements; NULL for no notifications.
+ * @param ctx Passed through to on_ready.
+ * @return 0 on success, -1 on failure (parts may have been reported before a failure).
+ */
+int pg_all_reduce_streaming(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                            const pg_op_opts_t* opts, pg_chunk_ready_fn_t on_ready, void* ctx,
+                            PGHandle* pg_handle);
+
+/**
+ * @brief Scaled SUM or AVG: recvbuf = post_scale * (sum over ranks of
+ * pre_scale * sendbuf), AVG dividing by num_servers on top, on a floating
+ * datatype (e.g. pre-scaling FP16 gradients by 1 / num_servers against
+ * overflow). Neither scale costs a pass over the vector: the pre-scale is
+ * applied by the copy of sendbuf into recvbuf (in place, that copy becomes a
+ * scaling pass), the post-scale by the reduce-scatter step that completes
+ * each chunk, before the allgather distributes it. Each result is rounded
+ * once more than the plain sum; FP16 / BF16 scale in fp32.
+ * Under PG_DETERMINISTIC a DOUBLE result is scaled after the exact sum.
+ * @param pre_scale Factor on every input, 1.0 for none.
+ * @param post_scale Factor on every result, 1.0 for none.
+ * @param opts Tag and priority as in pg_all_reduce_ex, or NULL.
+ * @return 0 on success, -1 on failure (including scales with another op or
+ *         an integer datatype).
+ */
+int pg_all_reduce_scaled(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                         double pre_scale, double post_scale, const pg_op_opts_t* opts, PGHandle* pg_handle);
+
+/**
+ * @brief All-reduce with a caller-supplied element-wise reduction, run on the
+ * ring (never the atomic path). 'fn' gets contiguous runs of received
+ * elements and must be associative and commutative; every rank must pass an
+ * equivalent function. This is what the C++ API (pg_allreduce.hpp) builds its
+ * compile-time specialized kernels on.
+ * @param elem_size Bytes per element.
+ * @param fn Reduction, dst[i] = dst[i] op src[i].
+ * @param ctx Passed through to fn.
+ * @param opts Tag and priority as in pg_all_reduce_ex, or NULL.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_all_reduce_custom(void* sendbuf, void* recvbuf, int count, size_t elem_size,
+                         pg_reduce_fn_t fn, void* ctx, const pg_op_opts_t* opts, PGHandle* pg_handle);
+
+/**
+ * @brief Tagged all-reduce with explicit algorithm, protocol and segment size,
+ * bypassing the tuning table (used by pg_autotune). Runs in the bulk class;
+ * pg_all_reduce_ex picks the same parameters with pg_tuning_select.
+ * @param params Parameters; must be identical on all ranks.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_all_reduce_with_params(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                              int tag, const pg_coll_params_t* params, PGHandle* pg_handle);
+
+/**
+ * @brief Fused all-reduce of many small tensors (gradient bucketing).
+ * Consecutive tensors are packed into buckets of at most the handle's fusion
+ * bucket size and each bucket is all-reduced in a single ring pass. A tensor
+ * that fills a bucket by itself, or that a per-tensor call would split over
+ * two rings (PG_NUM_RINGS), is reduced directly without packing.
+ * Every element is reduced in the same rank order as in a per-tensor
+ * pg_all_reduce (on the same chunk sizes, also under PG_BALANCE), so results
+ * are bitwise identical to the per-tensor calls. Under PG_DETERMINISTIC a
+ * DOUBLE SUM / AVG bucket is one pg_all_reduce_deterministic call, each tensor
+ * padded to whole PG_REPRO_BLOCKs, again matching the per-tensor bits.
+ * @param sendbufs Array of num_tensors input buffers.
+ * @param recvbufs Array of num_tensors output buffers (may alias sendbufs).
+ * @param counts Number of elements of each tensor.
+ * @param num_tensors Number of tensors.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_all_reduce_multi(void** sendbufs, void** recvbufs, const int* counts, int num_tensors,
+                        DATATYPE datatype, OPERATION op, PGHandle* pg_handle);
+
+/**
+ * @brief Chunk sizes, by ring position, of a single-ring pg_all_reduce of
+ * 'count' elements on tag 0: equal chunks, or with PG_BALANCE the sizes
+ * derived from the costs the ranks exchanged last (see ring_balanced_counts).
+ * @param chunk_counts Output, num_servers entries summing to count.
+ * @return 0 on success, -1 on invalid arguments.
+ */
+int pg_get_chunk_counts(PGHandle* pg_handle, int count, int* chunk_counts);
+
+/**
+ * @brief Sets the fusion bucket size used by pg_all_reduce_multi.
+ * @param bytes Bucket capacity in bytes (default PG_FUSION_BUCKET_BYTES), at
+ * most half of PG_POOL_MAX_BYTES, as the bucket comes from the scratch pool.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_set_fusion_bucket_size(PGHandle* pg_handle, size_t bytes);
+
+/**
+ * @brief All-reduce of a strided buffer (e.g. a column block or padded rows of
+ * a matrix) without packing it. The logical vector is the layout->count *
+ * layout->blocklen elements in block order; the elements between blocks are
+ * neither read nor written. Blocks of at least PG_SGE_MIN_BYTES are sent
+ * straight from recvbuf with multi-SGE RDMA writes (registered for the call
+ * unless covered by pg_register_buffer); shorter ones are gathered into the
+ * staging buffer. Received data is reduced into the blocks in place.
+ * The result is bitwise identical to pg_all_reduce of the packed vector; under
+ * PG_DETERMINISTIC a DOUBLE SUM is packed and reduced with
+ * pg_all_reduce_deterministic like pg_all_reduce does.
+ * @param sendbuf Input with the given layout.
+ * @param recvbuf Output with the same layout (may alias sendbuf).
+ * @param layout Block count, block length and stride in elements (stride >= blocklen).
+ * @return 0 on success, -1 on failure.
+ */
+int pg_all_reduce_strided(void* sendbuf, void* recvbuf, const pg_vector_t* layout,
+                          DATATYPE datatype, OPERATION op, PGHandle* pg_handle);
+
+/**
+ * @brief Registers a user buffer with the handle's protection domain so that
+ * strided all-reduces on it send directly without registering per call.
+ * At most PG_MAX_USER_MRS buffers can be registered; the buffer must stay
+ * allocated until pg_deregister_buffer or pg_close.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_register_buffer(PGHandle* pg_handle, void* addr, size_t length);
+
+/**
+ * @brief Releases a registration made with pg_register_buffer. No collective
+ * may be using the buffer.
+ * @param addr The address passed to pg_register_buffer.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_deregister_buffer(PGHandle* pg_handle, void* addr);
+
+/**
+ * @brief Sparse all-reduce (SUM) of (index, value) pairs into a dense result.
+ * The lists of all ranks are circulated around the ring and merged on arrival;
+ * when the lists together are larger than the dense ring traffic, the call
+ * switches to a dense pg_all_reduce. Either way recvbuf is bitwise identical to
+ * pg_all_reduce of the equivalent dense buffers. Under PG_DETERMINISTIC a DOUBLE
+ * sum always takes the dense path, which is then exact (pg_repro.h).
+ * @param indices Element indices in [0, count); duplicates are summed.
+ * @param values nnz values of 'datatype'.
+ * @param nnz Number of local pairs (may be 0).
+ * @param recvbuf Dense output of 'count' elements.
+ * @param count Length of the dense vector; identical on all ranks.
+ * @param op Must be SUM.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_all_reduce_sparse(const int* indices, const void* values, int nnz, void* recvbuf, int count,
+                         DATATYPE datatype, OPERATION op, PGHandle* pg_handle);
+
+/**
+ * @brief All-reduce of a dense buffer that is sent sparsely when the group's
+ * combined density (non-zeros of all ranks / count) is at most
+ * 'density_threshold' and below the sparse/dense break-even point, and densely
+ * otherwise. Ops other than SUM, and DOUBLE under PG_DETERMINISTIC, always
+ * take the dense path. The result is bitwise identical to pg_all_reduce.
+ * @param density_threshold Largest combined density sent sparsely, e.g. 0.01.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_all_reduce_sparsify(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                           double density_threshold, PGHandle* pg_handle);
+
+/**
+ * @brief Conversions between float and the FP16 (IEEE half) / BF16 storage
+ * formats, rounding to nearest even like the reduction kernels do.
+ */
+float pg_fp16_to_float(uint16_t value);
+uint16_t pg_float_to_fp16(float value);
+float pg_bf16_to_float(uint16_t value);
+uint16_t pg_float_to_bf16(float value);
+
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif // PG_ALLREDUCE_H
\ No newline at end of file
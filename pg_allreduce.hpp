@@ -0,0 +1,227 @@
+#ifndef PG_ALLREDUCE_HPP
+#define PG_ALLREDUCE_HPP
+
+/*
+ * pg_allreduce.hpp
+ *
+ * Header-only C++20 interface on top of the C library:
+ *
+ *   pg::process_group group({"node1", "node2", "node3"}, rank);
+ *   std::vector<float> grads(n);
+ *   group.all_reduce<float>(grads);                          // in place, sum
+ *   group.all_reduce<int>(send, recv, pg::ops::max{});
+ *   group.all_reduce<double>(grads, [](double a, double b) { return a + 2 * b; });
+ *
+ * all_reduce<T, Op> instantiates one reduction kernel per (T, Op) pair with
+ * the operation resolved at compile time (no per-call DATATYPE / OPERATION
+ * switch) and hands it to pg_all_reduce_custom, so the transport, slots and
+ * tuning are the C core's. Op is one of the pg::ops tags or any functor
+ * 'T op(T, T) const'; it must be associative and commutative, identical on
+ * every rank, and safe to call from two threads at once (the reverse ring
+ * reduces concurrently). pg::fp16 and pg::bf16 are reduced in float, with
+ * functors called on floats.
+ */
+
+#include <climits>
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "pg_allreduce.h"
+#include "pg_barrier.h"
+#include "pg_close.h"
+#include "pg_connect.h"
+#include "pg_half.h"
+
+namespace pg {
+
+/** @brief IEEE half storage (same layout as the FP16 datatype). */
+struct fp16 { std::uint16_t bits; };
+
+/** @brief bfloat16 storage (same layout as the BF16 datatype). */
+struct bf16 { std::uint16_t bits; };
+
+/** @brief Built-in operations; band and bor are for integer types only. */
+namespace ops {
+struct sum {};
+struct mult {};
+struct min {};
+struct max {};
+struct band {};
+struct bor {};
+}  // namespace ops
+
+namespace detail {
+
+template <class T>
+inline constexpr bool is_half_v = std::is_same_v<T, fp16> || std::is_same_v<T, bf16>;
+
+template <class T>
+inline float widen(T v) {
+    if constexpr (std::is_same_v<T, fp16>) return pg_half_fp16_to_float(v.bits);
+    else return pg_half_bf16_to_float(v.bits);
+}
+
+template <class T>
+inline T narrow(float v) {
+    if constexpr (std::is_same_v<T, fp16>) return T{pg_half_float_to_fp16(v)};
+    else return T{pg_half_float_to_bf16(v)};
+}
+
+template <class Op>
+inline constexpr bool is_builtin_op_v =
+    std::is_same_v<Op, ops::sum> || std::is_same_v<Op, ops::mult> ||
+    std::is_same_v<Op, ops::min> || std::is_same_v<Op, ops::max> ||
+    std::is_same_v<Op, ops::band> || std::is_same_v<Op, ops::bor>;
+
+// The type an Op sees: float for the half formats, T otherwise
+template <class T>
+using value_t = std::conditional_t<is_half_v<T>, float, T>;
+
+template <class Op, class V>
+inline V combine(const Op &op, V a, V b) {
+    if constexpr (std::is_same_v<Op, ops::sum>) {
+        return a + b;
+    } else if constexpr (std::is_same_v<Op, ops::mult>) {
+        return a * b;
+    } else if constexpr (std::is_same_v<Op, ops::min>) {
+        return b < a ? b : a;
+    } else if constexpr (std::is_same_v<Op, ops::max>) {
+        return a < b ? b : a;
+    } else if constexpr (std::is_same_v<Op, ops::band>) {
+        static_assert(std::is_integral_v<V>, "ops::band needs an integer type");
+        return a & b;
+    } else if constexpr (std::is_same_v<Op, ops::bor>) {
+        static_assert(std::is_integral_v<V>, "ops::bor needs an integer type");
+        return a | b;
+    } else {
+        return op(a, b);
+    }
+}
+
+// dst[i] = dst[i] op src[i]; the pg_reduce_fn_t handed to the C core, with
+// ctx pointing at the Op instance
+template <class T, class Op>
+void reduce_kernel(void *dst, const void *src, int count, void *ctx) {
+    T *__restrict d = static_cast<T *>(dst);
+    const T *__restrict s = static_cast<const T *>(src);
+    const Op &op = *static_cast<const Op *>(ctx);
+    for (int i = 0; i < count; i++) {
+        if constexpr (is_half_v<T>) {
+            d[i] = narrow<T>(combine(op, widen(d[i]), widen(s[i])));
+        } else {
+            d[i] = combine(op, d[i], s[i]);
+        }
+    }
+}
+
+}  // namespace detail
+
+/** @brief A pg::ops tag, or a functor reducing two values of T (floats for fp16 / bf16). */
+template <class Op, class T>
+concept reduction = detail::is_builtin_op_v<Op> ||
+    std::is_invocable_r_v<detail::value_t<T>, const Op &, detail::value_t<T>, detail::value_t<T>>;
+
+/**
+ * @brief Owns a connected process group; pg_close runs on destruction.
+ * Movable, not copyable.
+ */
+class process_group {
+public:
+    /**
+     * @brief Connects rank 'rank' of the ring over 'servers'.
+     * @param config Transport configuration, or nullptr for the defaults with
+     * the PG_* environment overrides (see connect_process_group_ex).
+     * @throws std::runtime_error if the group cannot be connected.
+     */
+    process_group(const std::vector<std::string> &servers, int rank,
+                  const pg_config_t *config = nullptr) {
+        int size = static_cast<int>(servers.size());
+        // The handle owns the list (also on failure), so hand it malloc'd copies
+        char **list = static_cast<char **>(std::malloc(servers.size() * sizeof(char *)));
+        if (!list) throw std::runtime_error("pg: out of memory");
+        for (int i = 0; i < size; i++) {
+            list[i] = strdup(servers[i].c_str());
+        }
+        void *handle = nullptr;
+        if (connect_process_group_ex(list, size, &handle, rank, config) != 0) {
+            throw std::runtime_error("pg: connect_process_group failed");
+        }
+        handle_ = static_cast<PGHandle *>(handle);
+    }
+
+    ~process_group() {
+        if (handle_) pg_close(handle_);
+    }
+
+    process_group(const process_group &) = delete;
+    process_group &operator=(const process_group &) = delete;
+
+    process_group(process_group &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    process_group &operator=(process_group &&other) noexcept {
+        if (this != &other) {
+            if (handle_) pg_close(handle_);
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    int rank() const { return handle_->rank; }
+    int size() const { return handle_->num_servers; }
+
+    /** @brief The underlying handle, for the rest of the C API. */
+    PGHandle *native() const { return handle_; }
+
+    /**
+     * @brief recv = reduction of every rank's send. send and recv may be the
+     * same memory. 'opts' selects the tag and traffic class as in
+     * pg_all_reduce_ex.
+     * @throws std::invalid_argument on mismatched sizes, std::runtime_error
+     * if the collective fails.
+     */
+    template <class T, reduction<T> Op = ops::sum>
+    void all_reduce(std::span<const T> send, std::span<T> recv, Op op = {},
+                    pg_op_opts_t opts = {0, PG_PRIORITY_BULK}) {
+        static_assert(std::is_trivially_copyable_v<T>, "all_reduce needs a trivially copyable T");
+        if (send.size() != recv.size() || send.size() > static_cast<size_t>(INT_MAX)) {
+            throw std::invalid_argument("pg: all_reduce buffer sizes");
+        }
+        if (recv.empty()) return;
+        if (pg_all_reduce_custom(const_cast<T *>(send.data()), recv.data(),
+                                 static_cast<int>(recv.size()), sizeof(T),
+                                 &detail::reduce_kernel<T, Op>, &op, &opts, handle_) != 0) {
+            throw std::runtime_error("pg: all_reduce failed");
+        }
+    }
+
+    /** @brief In-place all_reduce. */
+    template <class T, reduction<T> Op = ops::sum>
+    void all_reduce(std::span<T> data, Op op = {}, pg_op_opts_t opts = {0, PG_PRIORITY_BULK}) {
+        all_reduce<T, Op>(std::span<const T>(data), data, op, opts);
+    }
+
+    /**
+     * @brief Returns once every rank has entered the barrier (pg_barrier_ex).
+     * @throws std::runtime_error if the barrier fails.
+     */
+    void barrier(pg_op_opts_t opts = {0, PG_PRIORITY_HIGH}) {
+        if (pg_barrier_ex(&opts, handle_) != 0) {
+            throw std::runtime_error("pg: barrier failed");
+        }
+    }
+
+private:
+    PGHandle *handle_ = nullptr;
+};
+
+}  // namespace pg
+
+#endif /* PG_ALLREDUCE_HPP */
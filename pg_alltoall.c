@@ -0,0 +1,240 @@
+#include "pg_handle.h"
+#include "rdma_utils.h"
+#include "pg_connect.h"
+#include "pg_coll.h"
+#include "pg_alltoall.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Mesh region layout (identical on every rank):
+//   [flag blocks][send staging: bufsize][recv staging: bufsize]
+// Slot s uses [slot->offset, slot->offset + slot->size) of both staging
+// buffers, split into one sub-slot per peer.
+
+// Offset of flag block [slot][peer] in the mesh region
+static size_t peer_ctrl_offset(const PGHandle *pg_handle, const pg_slot_t *slot, int peer) {
+    return ((size_t)slot->index * pg_handle->num_servers + peer) * sizeof(pg_peer_ctrl_t);
+}
+
+// Offset of the sub-slot owned by 'peer' in the send (recv = 0) or recv (recv = 1) staging
+static size_t staging_offset(const PGHandle *pg_handle, const pg_slot_t *slot, int peer,
+                             size_t sub_size, int recv) {
+    return pg_handle->mesh_ctrl_size + (recv ? pg_handle->bufsize : 0) + slot->offset +
+           (size_t)peer * sub_size;
+}
+
+// Stage the next chunk for 'peer' in our send staging and write it into the
+// peer's recv staging, followed by the ready flag
+static int send_chunk(PGHandle *pg_handle, pg_slot_t *slot, int peer, const char *src,
+                      size_t length, size_t sub_size) {
+    int n = pg_handle->num_servers;
+    pg_peer_ctrl_t *blk = &pg_handle->mesh_ctrl[slot->index * n + peer];
+    char *region = (char *)pg_handle->mesh_region;
+    char *staging = region + staging_offset(pg_handle, slot, peer, sub_size, 0);
+
+    memcpy(staging, src, length);
+    if (reserve_completion(pg_handle, slot) != 0) return 1;
+
+    // The data write is covered by the completion of the flag write behind it
+    // on the same QP, which also lands after the data at the receiver
+    blk->ready_src++;
+    if (rdma_write_to_peer(pg_handle, slot, peer, staging, length,
+                           staging_offset(pg_handle, slot, pg_handle->rank, sub_size, 1),
+                           PG_WR_MESH, 0) != 0 ||
+        rdma_write_to_peer(pg_handle, slot, peer, &blk->ready_src, sizeof(uint64_t),
+                           peer_ctrl_offset(pg_handle, slot, pg_handle->rank) +
+                               offsetof(pg_peer_ctrl_t, ready_seq),
+                           PG_WR_CTRL, 1) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// Copy the chunk 'peer' wrote into our staging out and hand the sub-slot back
+static int recv_chunk(PGHandle *pg_handle, pg_slot_t *slot, int peer, char *dst,
+                      size_t length, size_t sub_size) {
+    int n = pg_handle->num_servers;
+    pg_peer_ctrl_t *blk = &pg_handle->mesh_ctrl[slot->index * n + peer];
+    char *region = (char *)pg_handle->mesh_region;
+
+    memcpy(dst, region + staging_offset(pg_handle, slot, peer, sub_size, 1), length);
+    if (reserve_completion(pg_handle, slot) != 0) return 1;
+
+    blk->consumed_src++;
+    return rdma_write_to_peer(pg_handle, slot, peer, &blk->consumed_src, sizeof(uint64_t),
+                              peer_ctrl_offset(pg_handle, slot, pg_handle->rank) +
+                                  offsetof(pg_peer_ctrl_t, consumed_seq),
+                              PG_WR_CTRL, 1);
+}
+
+// Exchange with all peers on an acquired slot. Every peer is served in turn
+// whenever its flags allow, so no pair of ranks ever waits on each other.
+static int mesh_exchange(PGHandle *pg_handle, pg_slot_t *slot,
+                         const char *sendbuf, const size_t *send_bytes, const size_t *send_offsets,
+                         char *recvbuf, const size_t *recv_bytes, const size_t *recv_offsets,
+                         size_t sub_size) {
+    int n = pg_handle->num_servers;
+    int rank = pg_handle->rank;
+    size_t *sent = calloc(n, sizeof(size_t));
+    size_t *received = calloc(n, sizeof(size_t));
+    if (!sent || !received) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(sent);
+        free(received);
+        return -1;
+    }
+
+    int ret = 0;
+    uint64_t idle = 0;
+    for (;;) {
+        int busy = 0;
+        int progress = 0;
+        for (int k = 1; k < n && ret == 0; k++) {
+            int peer = (rank + k) % n;
+            pg_peer_ctrl_t *blk = &pg_handle->mesh_ctrl[slot->index * n + peer];
+
+            if (sent[peer] < send_bytes[peer]) {
+                busy = 1;
+                // The peer has copied out everything we wrote so far
+                if (__atomic_load_n(&blk->consumed_seq, __ATOMIC_ACQUIRE) >= blk->ready_src) {
+                    size_t length = MIN(sub_size, send_bytes[peer] - sent[peer]);
+                    ret = send_chunk(pg_handle, slot, peer, sendbuf + send_offsets[peer] + sent[peer],
+                                     length, sub_size);
+                    sent[peer] += length;
+                    progress = 1;
+                }
+            }
+            if (ret == 0 && received[peer] < recv_bytes[peer]) {
+                busy = 1;
+                if (__atomic_load_n(&blk->ready_seq, __ATOMIC_ACQUIRE) > blk->consumed_src) {
+                    size_t length = MIN(sub_size, recv_bytes[peer] - received[peer]);
+                    ret = recv_chunk(pg_handle, slot, peer, recvbuf + recv_offsets[peer] + received[peer],
+                                     length, sub_size);
+                    received[peer] += length;
+                    progress = 1;
+                }
+            }
+        }
+        if (ret != 0 || !busy) break;
+
+        if (poll_cq_once(pg_handle, slot->priority) < 0) {
+            ret = -1;
+            break;
+        }
+        idle = progress ? 0 : idle + 1;
+        if (idle > MAX_TIMEOUT) {
+            fprintf(stderr, "Rank %d: alltoall timeout waiting for peers\n", rank);
+            ret = -1;
+            break;
+        }
+    }
+
+    // The last flag writes must complete before the slot changes hands
+    if (poll_for_completion(pg_handle, slot) != 0) {
+        ret = -1;
+    }
+    free(sent);
+    free(received);
+    return ret ? -1 : 0;
+}
+
+int pg_alltoallv(const void* sendbuf, const int* sendcounts, const int* sdispls,
+                 void* recvbuf, const int* recvcounts, const int* rdispls,
+                 DATATYPE datatype, PGHandle* pg_handle) {
+    if (!sendbuf || !sendcounts || !sdispls || !recvbuf || !recvcounts || !rdispls || !pg_handle) {
+        fprintf(stderr, "Invalid parameters for alltoallv\n");
+        return -1;
+    }
+    size_t dtype_size = get_datatype_size(datatype);
+    if (dtype_size == 0) {
+        fprintf(stderr, "Invalid datatype\n");
+        return -1;
+    }
+
+    int n = pg_handle->num_servers;
+    int rank = pg_handle->rank;
+    for (int p = 0; p < n; p++) {
+        if (sendcounts[p] < 0 || sdispls[p] < 0 || recvcounts[p] < 0 || rdispls[p] < 0) {
+            fprintf(stderr, "Invalid count or displacement for rank %d in alltoallv\n", p);
+            return -1;
+        }
+    }
+    if (sendcounts[rank] != recvcounts[rank]) {
+        fprintf(stderr, "Rank %d: alltoallv send and receive counts to self differ\n", rank);
+        return -1;
+    }
+
+    size_t *send_bytes = malloc(n * sizeof(size_t));
+    size_t *send_offsets = malloc(n * sizeof(size_t));
+    size_t *recv_bytes = malloc(n * sizeof(size_t));
+    size_t *recv_offsets = malloc(n * sizeof(size_t));
+    char *needed = calloc(n, 1);
+    int ret = -1;
+    if (!send_bytes || !send_offsets || !recv_bytes || !recv_offsets || !needed) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto out;
+    }
+
+    int num_needed = 0;
+    for (int p = 0; p < n; p++) {
+        send_bytes[p] = (size_t)sendcounts[p] * dtype_size;
+        send_offsets[p] = (size_t)sdispls[p] * dtype_size;
+        recv_bytes[p] = (size_t)recvcounts[p] * dtype_size;
+        recv_offsets[p] = (size_t)rdispls[p] * dtype_size;
+        needed[p] = p != rank && (sendcounts[p] > 0 || recvcounts[p] > 0);
+        num_needed += needed[p];
+    }
+    memcpy((char *)recvbuf + (size_t)rdispls[rank] * dtype_size,
+           (const char *)sendbuf + (size_t)sdispls[rank] * dtype_size,
+           (size_t)sendcounts[rank] * dtype_size);
+    send_bytes[rank] = recv_bytes[rank] = 0;
+    if (num_needed == 0) {
+        ret = 0;
+        goto out;
+    }
+    if (pg_connect_peers(pg_handle, needed, PG_PRIORITY_BULK) != 0) goto out;
+
+    pg_slot_t *slot = acquire_slot(pg_handle, 0);
+    if (!slot) goto out;
+    size_t sub_size = (slot->size / n) & ~(size_t)63;
+    if (sub_size == 0) {
+        fprintf(stderr, "Rank %d: staging slot too small for %d peers\n", rank, n);
+    } else {
+        ret = mesh_exchange(pg_handle, slot, (const char *)sendbuf, send_bytes, send_offsets,
+                            (char *)recvbuf, recv_bytes, recv_offsets, sub_size);
+    }
+    release_slot(pg_handle, slot);
+
+out:
+    free(send_bytes);
+    free(send_offsets);
+    free(recv_bytes);
+    free(recv_offsets);
+    free(needed);
+    return ret;
+}
+
+int pg_alltoall(const void* sendbuf, void* recvbuf, int count, DATATYPE datatype, PGHandle* pg_handle) {
+    if (!sendbuf || !recvbuf || count < 0 || !pg_handle) {
+        fprintf(stderr, "Invalid parameters for alltoall\n");
+        return -1;
+    }
+    int n = pg_handle->num_servers;
+    int *counts = malloc(n * sizeof(int));
+    int *displs = malloc(n * sizeof(int));
+    if (!counts || !displs) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(counts);
+        free(displs);
+        return -1;
+    }
+    for (int p = 0; p < n; p++) {
+        counts[p] = count;
+        displs[p] = p * count;
+    }
+    int ret = pg_alltoallv(sendbuf, counts, displs, recvbuf, counts, displs, datatype, pg_handle);
+    free(counts);
+    free(displs);
+    return ret;
+}
@@ -0,0 +1,57 @@
+#ifndef PG_ALLTOALL_H
+#define PG_ALLTOALL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_alltoall.h
+ *
+ * All-to-all exchanges with direct RDMA writes to every peer. The ring QPs
+ * only reach the neighbors, so each rank connects a mesh QP to a peer the
+ * first time it exchanges data with it (see pg_connect_peers); ranks that
+ * never talk keep no connection.
+ *
+ * Data moves through the mesh staging region: every peer owns a sub-slot of
+ * slot_size / num_servers bytes in the receiver's staging, and larger blocks
+ * are sent in chunks guarded by per-peer ready / consumed flags.
+ */
+
+#include "pg_handle.h"
+
+/**
+ * @brief All-to-all: block p of sendbuf goes to rank p, and block q of recvbuf
+ * receives rank q's block for this rank.
+ * @param sendbuf num_servers blocks of 'count' elements.
+ * @param recvbuf num_servers blocks of 'count' elements (must not alias sendbuf).
+ * @param count Elements per block, identical on all ranks.
+ * @param datatype DATATYPE of the elements.
+ * @param pg_handle Pointer to the process group handle.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_alltoall(const void* sendbuf, void* recvbuf, int count, DATATYPE datatype, PGHandle* pg_handle);
+
+/**
+ * @brief All-to-all with per-peer counts and displacements (in elements).
+ * sendcounts[p] on this rank must equal recvcounts[this rank] on rank p.
+ * Mesh connections are only made to peers with a non-zero send or receive count.
+ * @param sendbuf Send buffer; block p is sendcounts[p] elements at sdispls[p].
+ * @param sendcounts Elements sent to each rank.
+ * @param sdispls Element offset of each send block.
+ * @param recvbuf Receive buffer; block q is recvcounts[q] elements at rdispls[q].
+ * @param recvcounts Elements received from each rank.
+ * @param rdispls Element offset of each receive block.
+ * @param datatype DATATYPE of the elements.
+ * @param pg_handle Pointer to the process group handle.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_alltoallv(const void* sendbuf, const int* sendcounts, const int* sdispls,
+                 void* recvbuf, const int* recvcounts, const int* rdispls,
+                 DATATYPE datatype, PGHandle* pg_handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_ALLTOALL_H */
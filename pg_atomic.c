@@ -0,0 +1,172 @@
+#include "pg_handle.h"
+#include "rdma_utils.h"
+#include "pg_connect.h"
+#include "pg_coll.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Atomic all-reduce of tiny INT vectors: every non-root rank applies its
+// elements to per-element 64-bit accumulators on the root with remote atomics
+// (fetch-and-add for SUM, a compare-and-swap loop for the other ops), then
+// counts itself in the root's arrival word. The root combines its own
+// elements once all ranks have arrived and writes the result to every rank.
+//
+// For SUM the accumulator is a plain 64-bit sum; its low 32 bits are the
+// wrapped INT sum. For the other ops the low 32 bits hold the combined value
+// and ATOMIC_PRESENT marks that some rank has stored into it, so the root
+// never has to initialize the accumulators with the op's identity.
+
+#define ATOMIC_ROOT 0
+#define ATOMIC_PRESENT (1ULL << 32)
+
+// Offset of a word of the root's atomic area for a slot in its mesh region
+static size_t atomic_offset(const PGHandle *pg_handle, const pg_slot_t *slot, size_t field) {
+    return pg_handle->mesh_atomic_offset + slot->index * sizeof(pg_atomic_area_t) + field;
+}
+
+// Accumulator value after applying 'value' with 'op' to accumulator 'old'
+static uint64_t combine(uint64_t old, int value, OPERATION op) {
+    int current = value;
+    if (old & ATOMIC_PRESENT) {
+        current = (int)(uint32_t)old;
+        perform_operation(&current, &value, 1, INT, op);
+    }
+    return ATOMIC_PRESENT | (uint32_t)current;
+}
+
+// Non-root: apply our elements to the root's accumulators, then arrive
+static int atomic_contribute(PGHandle *pg_handle, pg_slot_t *slot, const int *values, int count,
+                             OPERATION op) {
+    pg_atomic_area_t *area = &pg_handle->mesh_atomic[slot->index];
+
+    if (op == SUM) {
+        for (int i = 0; i < count; i++) {
+            if (reserve_completion(pg_handle, slot) != 0 ||
+                rdma_atomic_to_peer(pg_handle, slot, ATOMIC_ROOT, &area->fetched[i],
+                                    atomic_offset(pg_handle, slot, offsetof(pg_atomic_area_t, acc) +
+                                                  i * sizeof(uint64_t)),
+                                    0, (uint64_t)(int64_t)values[i], 0) != 0) {
+                return 1;
+            }
+        }
+        if (poll_for_completion(pg_handle, slot) != 0) return 1;
+    } else {
+        // Compare-and-swap rounds: every element starts by guessing an empty
+        // accumulator and retries with the value the root actually held
+        uint64_t guess[PG_ATOMIC_MAX_COUNT] = {0};
+        int done[PG_ATOMIC_MAX_COUNT] = {0};
+        int remaining = count;
+        while (remaining > 0) {
+            for (int i = 0; i < count; i++) {
+                if (done[i]) continue;
+                if (reserve_completion(pg_handle, slot) != 0 ||
+                    rdma_atomic_to_peer(pg_handle, slot, ATOMIC_ROOT, &area->fetched[i],
+                                        atomic_offset(pg_handle, slot, offsetof(pg_atomic_area_t, acc) +
+                                                      i * sizeof(uint64_t)),
+                                        1, guess[i], combine(guess[i], values[i], op)) != 0) {
+                    return 1;
+                }
+            }
+            if (poll_for_completion(pg_handle, slot) != 0) return 1;
+            for (int i = 0; i < count; i++) {
+                if (done[i]) continue;
+                if (area->fetched[i] == guess[i]) {
+                    done[i] = 1;
+                    remaining--;
+                } else {
+                    guess[i] = area->fetched[i];
+                }
+            }
+        }
+    }
+
+    // Our atomics have completed at the root, so it may count us
+    if (rdma_atomic_to_peer(pg_handle, slot, ATOMIC_ROOT, &area->fetched_arrival,
+                            atomic_offset(pg_handle, slot, offsetof(pg_atomic_area_t, arrivals)),
+                            0, 1, 0) != 0) {
+        return 1;
+    }
+    return poll_for_completion(pg_handle, slot);
+}
+
+// Root: wait for all ranks, add our own elements, reset and broadcast
+static int atomic_finish_root(PGHandle *pg_handle, pg_slot_t *slot, const int *values, int count,
+                              OPERATION op) {
+    pg_atomic_area_t *area = &pg_handle->mesh_atomic[slot->index];
+    int n = pg_handle->num_servers;
+
+    if (wait_ctrl_word(pg_handle, &area->arrivals, n - 1) != 0) {
+        fprintf(stderr, "Rank %d: atomic all-reduce timeout waiting for ranks\n", pg_handle->rank);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        uint64_t acc = area->acc[i];
+        int value = values[i];
+        if (op == SUM || (acc & ATOMIC_PRESENT)) {
+            value = (int)(uint32_t)acc;
+            perform_operation(&value, &values[i], 1, INT, op);
+        }
+        area->result[i] = value;
+        // Every rank's atomics are done; the next call may reuse the words
+        area->acc[i] = 0;
+    }
+    area->arrivals = 0;
+
+    // Result first, then the sequence number behind it on the same QP
+    for (int p = 0; p < n; p++) {
+        if (p == ATOMIC_ROOT) continue;
+        if (reserve_completion(pg_handle, slot) != 0 ||
+            rdma_write_to_peer(pg_handle, slot, p, area->result, count * sizeof(int32_t),
+                               atomic_offset(pg_handle, slot, offsetof(pg_atomic_area_t, result)),
+                               PG_WR_MESH, 0) != 0 ||
+            rdma_write_to_peer(pg_handle, slot, p, &area->seq_src, sizeof(uint64_t),
+                               atomic_offset(pg_handle, slot, offsetof(pg_atomic_area_t, result_seq)),
+                               PG_WR_CTRL, 1) != 0) {
+            return 1;
+        }
+    }
+    return poll_for_completion(pg_handle, slot);
+}
+
+int atomic_applicable(const PGHandle *pg_handle, int count, DATATYPE datatype) {
+    return pg_handle->atomic_supported && datatype == INT && count <= PG_ATOMIC_MAX_COUNT;
+}
+
+int atomic_all_reduce(PGHandle *pg_handle, pg_slot_t *slot, const int *sendbuf, int *recvbuf,
+                      int count, OPERATION op) {
+    int n = pg_handle->num_servers;
+    int rank = pg_handle->rank;
+    if (n == 1) {
+        memmove(recvbuf, sendbuf, count * sizeof(int));
+        return 0;
+    }
+
+    // The root talks to everyone, every other rank only to the root
+    char *needed = calloc(n, 1);
+    if (!needed) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    for (int p = 0; p < n; p++) {
+        needed[p] = rank == ATOMIC_ROOT || p == ATOMIC_ROOT;
+    }
+    int ret = pg_connect_peers(pg_handle, needed, slot->priority);
+    free(needed);
+    if (ret != 0) return -1;
+
+    pg_atomic_area_t *area = &pg_handle->mesh_atomic[slot->index];
+    uint64_t seq = ++area->seq_src;
+    if (rank == ATOMIC_ROOT) {
+        ret = atomic_finish_root(pg_handle, slot, sendbuf, count, op);
+    } else {
+        ret = atomic_contribute(pg_handle, slot, sendbuf, count, op);
+        if (ret == 0 && wait_ctrl_word(pg_handle, &area->result_seq, seq) != 0) {
+            fprintf(stderr, "Rank %d: atomic all-reduce result did not arrive\n", rank);
+            ret = 1;
+        }
+    }
+    if (ret != 0) return -1;
+    memcpy(recvbuf, area->result, count * sizeof(int));
+    return 0;
+}
@@ -0,0 +1,279 @@
+/**
+ * pg_autotune.c
+ *
+ * Builds the per-cluster tuning table used by pg_all_reduce.
+ *
+ * Run it on every host of the group, like the test program:
+ *
+ *   pg_autotune -myindex <rank> -list <server0> <server1> ... [-o <file>]
+ *               [-max-bytes <bytes>] [-iters <n>]
+ *
+ * For every group size 2, 4, 8, ... up to the full group (sub-groups are
+ * formed by the first ranks of the list) and every message size of a
+ * geometric sweep, all protocol / segment-size variants are timed on the
+ * live group. The fastest variant by mean time across ranks wins, and the
+ * winners are merged into size ranges. Rank 0's table is broadcast and every
+ * rank writes the same file (default PG_TUNING_FILE), which
+ * connect_process_group then loads.
+ */
+
+#include "pg_connect.h"
+#include "pg_allreduce.h"
+#include "pg_close.h"
+#include "pg_tuning.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define AUTOTUNE_MIN_BYTES 8
+#define AUTOTUNE_DEFAULT_MAX_BYTES ((size_t)64 << 20)
+#define AUTOTUNE_DEFAULT_ITERS 5
+
+/* Segment sizes tried for every protocol (0 = whole staging slot) */
+static const size_t segment_sizes[] = {0, 64 << 10, 256 << 10, 1 << 20};
+#define NUM_SEGMENT_SIZES (sizeof(segment_sizes) / sizeof(segment_sizes[0]))
+
+static const pg_protocol_t protocols[] = {PG_PROTOCOL_PUSH, PG_PROTOCOL_PULL};
+#define NUM_PROTOCOLS (sizeof(protocols) / sizeof(protocols[0]))
+
+/**
+ * Parses -myindex and -list like the test program.
+ * @return 0 if successful, -1 if error
+ */
+static int parse_args(char *argv[], char ***serverlist, int *myindex, int *num_servers) {
+    *serverlist = NULL;
+    *myindex = -1;
+    *num_servers = 0;
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "-myindex") == 0 && argv[i + 1] != NULL) {
+            *myindex = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-list") == 0) {
+            while (argv[i + 1 + *num_servers] != NULL && argv[i + 1 + *num_servers][0] != '-') {
+                (*num_servers)++;
+            }
+            if (*num_servers == 0) return -1;
+            *serverlist = argv + i + 1;
+            i += *num_servers;
+        }
+    }
+    return (*serverlist && *myindex >= 0 && *myindex < *num_servers) ? 0 : -1;
+}
+
+// Value of "-name <value>" on the command line, or NULL
+static const char *option(char *argv[], const char *name) {
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return NULL;
+}
+
+// Connect the first 'size' servers of the list (the handle owns a copy)
+static PGHandle *connect_group(char **serverlist, int size, int rank) {
+    char **names = malloc(size * sizeof(char *));
+    if (!names) return NULL;
+    for (int i = 0; i < size; i++) names[i] = strdup(serverlist[i]);
+    void *handle = NULL;
+    if (connect_process_group(names, size, &handle, rank) != 0) return NULL;
+    return (PGHandle *)handle;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Mean over ranks of the time per call of one variant, or a negative value on failure
+static double time_variant(PGHandle *pg_handle, double *sendbuf, double *recvbuf, int count,
+                           const pg_coll_params_t *params, int iters) {
+    if (pg_all_reduce_with_params(sendbuf, recvbuf, count, DOUBLE, SUM, 0, params, pg_handle) != 0) {
+        return -1.0;
+    }
+    double start = now_seconds();
+    for (int i = 0; i < iters; i++) {
+        if (pg_all_reduce_with_params(sendbuf, recvbuf, count, DOUBLE, SUM, 0, params, pg_handle) != 0) {
+            return -1.0;
+        }
+    }
+    double local = (now_seconds() - start) / iters;
+    double total = 0.0;
+    if (pg_all_reduce(&local, &total, 1, DOUBLE, SUM, pg_handle) != 0) return -1.0;
+    return total / pg_handle->num_servers;
+}
+
+static int same_params(const pg_coll_params_t *a, const pg_coll_params_t *b) {
+    return a->algorithm == b->algorithm && a->protocol == b->protocol &&
+           a->segment_bytes == b->segment_bytes;
+}
+
+// Tune one (sub-)group; appends its rules and returns the new rule count, or -1
+static int tune_group(PGHandle *pg_handle, size_t max_bytes, int iters,
+                      pg_tuning_rule_t *rules, int num_rules) {
+    int n = pg_handle->num_servers;
+    int max_count = (int)(max_bytes / sizeof(double));
+    double *sendbuf = malloc(max_count * sizeof(double));
+    double *recvbuf = malloc(max_count * sizeof(double));
+    if (!sendbuf || !recvbuf) {
+        free(sendbuf);
+        free(recvbuf);
+        return -1;
+    }
+    for (int i = 0; i < max_count; i++) sendbuf[i] = 1.0;
+
+    size_t prev_bytes = 0;
+    for (size_t bytes = AUTOTUNE_MIN_BYTES; bytes <= max_bytes; bytes *= 4) {
+        int count = (int)(bytes / sizeof(double));
+        size_t max_chunk = (count / n + count % n) * sizeof(double);
+        pg_coll_params_t best = {PG_ALGO_RING, PG_PROTOCOL_PUSH, 0};
+        double best_time = -1.0;
+
+        for (size_t p = 0; p < NUM_PROTOCOLS; p++) {
+            for (size_t s = 0; s < NUM_SEGMENT_SIZES; s++) {
+                // Segments at least as large as a chunk behave like whole-slot segments
+                if (segment_sizes[s] != 0 && segment_sizes[s] >= max_chunk) continue;
+                pg_coll_params_t params = {PG_ALGO_RING, protocols[p], segment_sizes[s]};
+                double t = time_variant(pg_handle, sendbuf, recvbuf, count, &params, iters);
+                if (t < 0) {
+                    free(sendbuf);
+                    free(recvbuf);
+                    return -1;
+                }
+                if (best_time < 0 || t < best_time) {
+                    best_time = t;
+                    best = params;
+                }
+            }
+        }
+        if (pg_handle->rank == 0) {
+            printf("ranks=%d bytes=%-10zu best=%s/%s/seg=%zu %.1f us\n", n, bytes,
+                   pg_algorithm_name(best.algorithm), pg_protocol_name(best.protocol),
+                   best.segment_bytes, best_time * 1e6);
+        }
+
+        // The rule of this size starts halfway (geometrically) from the previous size
+        size_t lower = prev_bytes == 0 ? 0 : bytes / 2;
+        if (num_rules > 0 && rules[num_rules - 1].ranks == n &&
+            same_params(&rules[num_rules - 1].params, &best)) {
+            rules[num_rules - 1].max_bytes = SIZE_MAX;
+        } else if (num_rules < PG_TUNING_MAX_RULES) {
+            if (num_rules > 0 && rules[num_rules - 1].ranks == n) {
+                rules[num_rules - 1].max_bytes = lower;
+            }
+            pg_tuning_rule_t rule = {n, lower, SIZE_MAX, best};
+            rules[num_rules++] = rule;
+        }
+        prev_bytes = bytes;
+    }
+
+    free(sendbuf);
+    free(recvbuf);
+    return num_rules;
+}
+
+// Broadcast rank 0's rules over the full group (an all-reduce SUM where only rank 0 contributes)
+static int broadcast_rules(PGHandle *pg_handle, pg_tuning_rule_t *rules, int *num_rules) {
+    const int fields = 6;
+    double count = pg_handle->rank == 0 ? *num_rules : 0.0;
+    double total = 0.0;
+    if (pg_all_reduce(&count, &total, 1, DOUBLE, SUM, pg_handle) != 0) return -1;
+    int num = (int)total;
+    if (num == 0) {
+        *num_rules = 0;
+        return 0;
+    }
+
+    double *packed = calloc(num * fields, sizeof(double));
+    double *result = calloc(num * fields, sizeof(double));
+    if (!packed || !result) {
+        free(packed);
+        free(result);
+        return -1;
+    }
+    if (pg_handle->rank == 0) {
+        for (int i = 0; i < num; i++) {
+            packed[i * fields + 0] = rules[i].ranks;
+            packed[i * fields + 1] = (double)rules[i].min_bytes;
+            packed[i * fields + 2] = rules[i].max_bytes == SIZE_MAX ? -1.0 : (double)rules[i].max_bytes;
+            packed[i * fields + 3] = rules[i].params.algorithm;
+            packed[i * fields + 4] = rules[i].params.protocol;
+            packed[i * fields + 5] = (double)rules[i].params.segment_bytes;
+        }
+    }
+    int ret = pg_all_reduce(packed, result, num * fields, DOUBLE, SUM, pg_handle);
+    for (int i = 0; ret == 0 && i < num; i++) {
+        rules[i].ranks = (int)result[i * fields + 0];
+        rules[i].min_bytes = (size_t)result[i * fields + 1];
+        rules[i].max_bytes = result[i * fields + 2] < 0 ? SIZE_MAX : (size_t)result[i * fields + 2];
+        rules[i].params.algorithm = (pg_algorithm_t)result[i * fields + 3];
+        rules[i].params.protocol = (pg_protocol_t)result[i * fields + 4];
+        rules[i].params.segment_bytes = (size_t)result[i * fields + 5];
+    }
+    *num_rules = num;
+    free(packed);
+    free(result);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    char **serverlist;
+    int rank, num_servers;
+    if (argc < 3 || parse_args(argv, &serverlist, &rank, &num_servers) != 0) {
+        fprintf(stderr, "Usage: %s -myindex <rank> -list <server0> <server1> ... "
+                        "[-o <file>] [-max-bytes <bytes>] [-iters <n>]\n", argv[0]);
+        return 1;
+    }
+    const char *path = option(argv, "-o") ? option(argv, "-o") : PG_TUNING_FILE;
+    size_t max_bytes = option(argv, "-max-bytes") ? strtoull(option(argv, "-max-bytes"), NULL, 0)
+                                                  : AUTOTUNE_DEFAULT_MAX_BYTES;
+    int iters = option(argv, "-iters") ? atoi(option(argv, "-iters")) : AUTOTUNE_DEFAULT_ITERS;
+    if (max_bytes < AUTOTUNE_MIN_BYTES || iters < 1) {
+        fprintf(stderr, "Invalid -max-bytes or -iters\n");
+        return 1;
+    }
+
+    PGHandle *world = connect_group(serverlist, num_servers, rank);
+    if (!world) {
+        fprintf(stderr, "Rank %d: connect_process_group failed\n", rank);
+        return 1;
+    }
+
+    pg_tuning_rule_t *rules = calloc(PG_TUNING_MAX_RULES, sizeof(pg_tuning_rule_t));
+    int num_rules = 0;
+    int ret = rules ? 0 : 1;
+
+    // Group sizes 2, 4, 8, ... and the full group
+    for (int size = 2; ret == 0; size *= 2) {
+        if (size > num_servers) size = num_servers;
+        if (rank < size) {
+            PGHandle *group = size == num_servers ? world : connect_group(serverlist, size, rank);
+            if (!group) {
+                fprintf(stderr, "Rank %d: failed to connect sub-group of %d\n", rank, size);
+                ret = 1;
+                break;
+            }
+            int tuned = tune_group(group, max_bytes, iters, rules, num_rules);
+            if (group != world) pg_close(group);
+            if (tuned < 0) {
+                ret = 1;
+                break;
+            }
+            num_rules = tuned;
+        }
+        // Keep the ranks outside the sub-group in step
+        int token = 0, sum = 0;
+        if (pg_all_reduce(&token, &sum, 1, INT, SUM, world) != 0) ret = 1;
+        if (size == num_servers) break;
+    }
+
+    if (ret == 0 && broadcast_rules(world, rules, &num_rules) != 0) ret = 1;
+    if (ret == 0 && pg_tuning_save(path, rules, num_rules) != 0) ret = 1;
+    if (ret == 0) {
+        printf("Rank %d: wrote %d tuning rules to %s\n", rank, num_rules, path);
+    }
+
+    free(rules);
+    pg_close(world);
+    return ret;
+}
@@ -0,0 +1,123 @@
+#include "pg_handle.h"
+#include "rdma_utils.h"
+#include "pg_connect.h"
+#include "pg_trace.h"
+#include "pg_barrier.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Spins between two reads of the clock while waiting for a flag
+#define BARRIER_CLOCK_SPINS 1024
+
+// Rounds of a group of n ranks: the smallest k with 2^k >= n
+static int barrier_rounds(int n) {
+    int rounds = 0;
+    while (rounds < PG_BARRIER_MAX_ROUNDS && (1L << rounds) < n) rounds++;
+    return rounds;
+}
+
+// Offset of the flag of a round of a slot in the mesh region
+static size_t round_offset(const PGHandle *pg_handle, const pg_slot_t *slot, int round) {
+    return pg_handle->mesh_barrier_offset + slot->index * sizeof(pg_barrier_area_t) +
+           offsetof(pg_barrier_area_t, round_seq) + round * sizeof(uint64_t);
+}
+
+// Connects the mesh QPs of a class to the peers of every round. After the
+// first barrier they are all there, and only log(n) QPs are looked at.
+static int connect_round_peers(PGHandle *pg_handle, int rounds, pg_priority_t priority) {
+    int n = pg_handle->num_servers;
+    int rank = pg_handle->rank;
+    int connected = pg_handle->mesh_region != NULL;
+    for (int k = 0; connected && k < rounds; k++) {
+        int dist = 1 << k;
+        connected = pg_handle->peers[(rank + dist) % n].qps[priority] &&
+                    pg_handle->peers[(rank - dist + n) % n].qps[priority];
+    }
+    if (connected) return 0;
+
+    char *needed = calloc(n, 1);
+    if (!needed) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    for (int k = 0; k < rounds; k++) {
+        int dist = 1 << k;
+        needed[(rank + dist) % n] = needed[(rank - dist + n) % n] = 1;
+    }
+    int ret = pg_connect_peers(pg_handle, needed, priority);
+    free(needed);
+    return ret;
+}
+
+// Writes the flag of round k to the rank 2^k above: inline when the QP takes
+// it, otherwise from seq_src, which holds 'seq' until the next barrier on
+// the slot and lies in the registered mesh region
+static int write_flag(PGHandle *pg_handle, pg_slot_t *slot, int k, const uint64_t *seq) {
+    int peer = (pg_handle->rank + (1 << k)) % pg_handle->num_servers;
+    size_t offset = round_offset(pg_handle, slot, k);
+    if (pg_handle->peers[peer].inline_ok[slot->priority]) {
+        return rdma_write_inline_to_peer(pg_handle, slot, peer, seq, sizeof(*seq), offset, PG_WR_BARRIER);
+    }
+    return rdma_write_to_peer(pg_handle, slot, peer, &pg_handle->mesh_barrier[slot->index].seq_src,
+                              sizeof(*seq), offset, PG_WR_BARRIER, 1);
+}
+
+// Spins until the flag of 'round' reaches 'seq', reaping the completions of
+// our own flag writes meanwhile
+static int wait_round(PGHandle *pg_handle, pg_slot_t *slot, int round, uint64_t seq, uint64_t deadline) {
+    volatile uint64_t *flag = &pg_handle->mesh_barrier[slot->index].round_seq[round];
+    for (uint64_t spins = 1; __atomic_load_n(flag, __ATOMIC_ACQUIRE) < seq; spins++) {
+        if (__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE) > 0 &&
+            poll_cq_once(pg_handle, slot->priority) < 0) {
+            return 1;
+        }
+        if (spins % BARRIER_CLOCK_SPINS == 0 && pg_trace_clock_ns() > deadline) {
+            int n = pg_handle->num_servers;
+            fprintf(stderr, "Rank %d: barrier timeout waiting for rank %d in round %d (flag=%lu, want %lu)\n",
+                    pg_handle->rank, (pg_handle->rank - (1 << round) + n) % n, round,
+                    (unsigned long)*flag, (unsigned long)seq);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int pg_barrier_ex(const pg_op_opts_t* opts, PGHandle* pg_handle) {
+    pg_op_opts_t defaults = {0, PG_PRIORITY_HIGH};
+    if (!opts) opts = &defaults;
+    if (!pg_handle || (opts->priority != PG_PRIORITY_BULK && opts->priority != PG_PRIORITY_HIGH)) {
+        fprintf(stderr, "Invalid parameters for barrier\n");
+        return -1;
+    }
+    int n = pg_handle->num_servers;
+    if (n == 1) return 0;
+
+    pg_slot_t *slot = acquire_slot_priority(pg_handle, opts->tag, opts->priority);
+    if (!slot) return -1;
+    int rounds = barrier_rounds(n);
+    // Without reserved slots a high-priority call runs in the bulk class
+    int ret = connect_round_peers(pg_handle, rounds, slot->priority);
+
+    uint64_t t = pg_trace_begin(pg_handle);
+    if (ret == 0) {
+        uint64_t seq = ++pg_handle->mesh_barrier[slot->index].seq_src;
+        uint64_t deadline = pg_trace_clock_ns() + (uint64_t)pg_handle->config.barrier_timeout_ms * 1000000;
+        for (int k = 0; k < rounds && ret == 0; k++) {
+            if (reserve_completion(pg_handle, slot) != 0 || write_flag(pg_handle, slot, k, &seq) != 0 ||
+                wait_round(pg_handle, slot, k, seq, deadline) != 0) {
+                ret = -1;
+            }
+        }
+    }
+    // The flag writes must complete before the slot changes hands
+    if (poll_for_completion(pg_handle, slot) != 0) {
+        ret = -1;
+    }
+    pg_trace_record(pg_handle, slot, PG_TRACE_BARRIER, t, 0);
+    release_slot(pg_handle, slot);
+    return ret;
+}
+
+int pg_barrier(PGHandle* pg_handle) {
+    return pg_barrier_ex(NULL, pg_handle);
+}
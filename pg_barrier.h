@@ -0,0 +1,53 @@
+#ifndef PG_BARRIER_H
+#define PG_BARRIER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_barrier.h
+ *
+ * Dissemination barrier over the mesh QPs. In round k = 0 .. ceil(log2 n) - 1
+ * every rank writes a flag to the rank 2^k above it (mod n) and waits for the
+ * flag of the rank 2^k below it; after the last round every rank has heard,
+ * directly or through others, from every other rank.
+ *
+ * Each flag is one 8-byte inline RDMA write (no DMA read of the source), or a
+ * plain one on devices whose QPs cannot inline, into a dedicated word of the
+ * peer's mesh region, carrying the number of the barrier; a flag counts once
+ * it reaches that number, so flags are never reset and a peer that already
+ * entered the next barrier is harmless. The waits spin on local memory
+ * without sleeping.
+ *
+ * Latency target: one fabric hop per round, i.e. a few microseconds per
+ * round and ceil(log2 n) rounds (about 2-3 us for 2 ranks, 10-20 us for 64
+ * ranks on current InfiniBand / RoCE). The first barrier additionally
+ * connects the mesh QPs to the 2 log2(n) peers it talks to.
+ */
+
+#include "pg_handle.h"
+
+/**
+ * @brief Returns once every rank of the group has entered the barrier.
+ * Runs in the high-priority class (PG_PRIORITY_HIGH) on tag 0.
+ * @param pg_handle Pointer to the process group handle.
+ * @return 0 on success, -1 on failure (including a peer silent for
+ *         PG_BARRIER_TIMEOUT_MS).
+ */
+int pg_barrier(PGHandle* pg_handle);
+
+/**
+ * @brief pg_barrier on the slot of a tag and traffic class, e.g. to keep a
+ * barrier from waiting for the slot of a long collective on tag 0.
+ * @param opts Tag and priority as in pg_all_reduce_ex, or NULL for pg_barrier's.
+ * @param pg_handle Pointer to the process group handle.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_barrier_ex(const pg_op_opts_t* opts, PGHandle* pg_handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_BARRIER_H */
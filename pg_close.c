@@ -1,5 +1,8 @@
 #include "pg_handle.h"
 #include "rdma_utils.h"
+#include "pg_numa.h"
+#include "pg_trace.h"
+#include "pg_pool.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -8,23 +11,44 @@ int pg_close(PGHandle* pg_handle) {
         return -1;
     }
 
+    // Ring-step trace, when requested (PG_TRACE_FILE)
+    if (pg_handle->trace.events && pg_handle->config.trace_file[0] != '\0') {
+        pg_trace_dump(pg_handle, pg_handle->config.trace_file);
+    }
+
     // 1. Clean up Queue Pairs
-    if (pg_handle->qps) {
+    for (int c = 0; c < PG_NUM_PRIORITIES; c++) {
         // Destroy QPs for both left and right neighbors
         for (int i = 0; i < 2; i++) {
-            if (pg_handle->qps[i]) {
-                if (ibv_destroy_qp(pg_handle->qps[i])) {
+            if (pg_handle->classes[c].qps[i]) {
+                if (ibv_destroy_qp(pg_handle->classes[c].qps[i])) {
                     fprintf(stderr, "Failed to destroy QP %d\n", i);
                 }
             }
         }
-        free(pg_handle->qps);
     }
 
-    // 2. Clean up Completion Queue
-    if (pg_handle->cq) {
-        if (ibv_destroy_cq(pg_handle->cq)) {
-            fprintf(stderr, "Failed to destroy CQ\n");
+    // Mesh QPs, connected on demand
+    if (pg_handle->peers) {
+        for (int i = 0; i < pg_handle->num_servers; i++) {
+            for (int c = 0; c < PG_NUM_PRIORITIES; c++) {
+                if (pg_handle->peers[i].qps[c] && ibv_destroy_qp(pg_handle->peers[i].qps[c])) {
+                    fprintf(stderr, "Failed to destroy mesh QP %d\n", i);
+                }
+            }
+        }
+        free(pg_handle->peers);
+    }
+    if (pg_handle->mesh_listen_fd >= 0) {
+        close(pg_handle->mesh_listen_fd);
+    }
+
+    // 2. Clean up Completion Queues
+    for (int c = 0; c < PG_NUM_PRIORITIES; c++) {
+        if (pg_handle->classes[c].cq) {
+            if (ibv_destroy_cq(pg_handle->classes[c].cq)) {
+                fprintf(stderr, "Failed to destroy CQ\n");
+            }
         }
     }
 
@@ -41,6 +65,27 @@ int pg_close(PGHandle* pg_handle) {
         }
     }
 
+    if (pg_handle->mr_ctrl) {
+        if (ibv_dereg_mr(pg_handle->mr_ctrl)) {
+            fprintf(stderr, "Failed to deregister control MR\n");
+        }
+    }
+
+    for (int i = 0; i < pg_handle->num_user_mrs; i++) {
+        if (ibv_dereg_mr(pg_handle->user_mrs[i].mr)) {
+            fprintf(stderr, "Failed to deregister user buffer MR\n");
+        }
+    }
+
+    if (pg_handle->mr_mesh) {
+        if (ibv_dereg_mr(pg_handle->mr_mesh)) {
+            fprintf(stderr, "Failed to deregister mesh MR\n");
+        }
+    }
+
+    // Pool blocks (and their registrations)
+    pg_pool_free(pg_handle);
+
     // 4. Clean up Protection Domain
     if (pg_handle->pd) {
         if (ibv_dealloc_pd(pg_handle->pd)) {
@@ -57,11 +102,19 @@ int pg_close(PGHandle* pg_handle) {
 
     // 6. Free allocated buffers
     if (pg_handle->sendbuf) {
-        free(pg_handle->sendbuf);
+        pg_numa_free(pg_handle->sendbuf, pg_handle->bufsize);
     }
     
     if (pg_handle->recvbuf) {
-        free(pg_handle->recvbuf);
+        pg_numa_free(pg_handle->recvbuf, pg_handle->bufsize);
+    }
+
+    if (pg_handle->ctrl) {
+        pg_numa_free(pg_handle->ctrl, pg_handle->ctrl_size);
+    }
+
+    if (pg_handle->mesh_region) {
+        pg_numa_free(pg_handle->mesh_region, pg_handle->mesh_size);
     }
 
     // 7. Free remote info arrays
@@ -73,6 +126,22 @@ int pg_close(PGHandle* pg_handle) {
         free(pg_handle->remote_addrs);
     }
 
+    if (pg_handle->remote_ctrl_rkeys) {
+        free(pg_handle->remote_ctrl_rkeys);
+    }
+
+    if (pg_handle->remote_ctrl_addrs) {
+        free(pg_handle->remote_ctrl_addrs);
+    }
+
+    if (pg_handle->remote_send_rkeys) {
+        free(pg_handle->remote_send_rkeys);
+    }
+
+    if (pg_handle->remote_send_addrs) {
+        free(pg_handle->remote_send_addrs);
+    }
+
     // 8. Free server names
     if (pg_handle->servernames) {
         for (int i = 0; i < pg_handle->num_servers; i++) {
@@ -83,7 +152,25 @@ int pg_close(PGHandle* pg_handle) {
         free(pg_handle->servernames);
     }
 
-    // 9. Finally, free the handle itself
+    if (pg_handle->tuning_rules) {
+        free(pg_handle->tuning_rules);
+    }
+    free(pg_handle->ring_order);
+    free(pg_handle->balance.costs);
+    pg_trace_free(pg_handle);
+
+    // 9. Destroy slot and posting locks
+    for (int i = 0; i < PG_MAX_SLOTS * PG_MAX_RINGS; i++) {
+        pthread_mutex_destroy(&pg_handle->slots[i].lock);
+    }
+    for (int c = 0; c < PG_NUM_PRIORITIES; c++) {
+        pthread_mutex_destroy(&pg_handle->classes[c].post_lock);
+        pthread_mutex_destroy(&pg_handle->classes[c].cq_lock);
+    }
+    pthread_mutex_destroy(&pg_handle->mesh_lock);
+    pthread_mutex_destroy(&pg_handle->user_mr_lock);
+
+    // 10. Finally, free the handle itself
     free(pg_handle);
 
     return 0;
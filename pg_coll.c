@@ -0,0 +1,505 @@
+#include "pg_coll.h"
+#include "pg_half.h"
+#include "pg_trace.h"
+#include "rdma_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+
+size_t get_datatype_size(DATATYPE datatype) {
+    switch (datatype) {
+        case INT:
+            return sizeof(int);
+        case DOUBLE:
+            return sizeof(double);
+        case FLOAT:
+            return sizeof(float);
+        case INT64:
+            return sizeof(int64_t);
+        case FP16:
+        case BF16:
+            return sizeof(uint16_t);
+        default:
+            return 0;
+    }
+}
+
+int floating_datatype(DATATYPE datatype) {
+    return datatype == DOUBLE || datatype == FLOAT || datatype == FP16 || datatype == BF16;
+}
+
+int reduction_supported(DATATYPE datatype, OPERATION op) {
+    if (get_datatype_size(datatype) == 0) return 0;
+    switch (op) {
+        case SUM:
+        case MULT:
+        case MIN:
+        case MAX:
+            return 1;
+        case BAND:
+        case BOR:
+            return datatype == INT || datatype == INT64;
+        default:
+            return 0;
+    }
+}
+
+float pg_fp16_to_float(uint16_t value) { return pg_half_fp16_to_float(value); }
+uint16_t pg_float_to_fp16(float value) { return pg_half_float_to_fp16(value); }
+float pg_bf16_to_float(uint16_t value) { return pg_half_bf16_to_float(value); }
+uint16_t pg_float_to_bf16(float value) { return pg_half_float_to_bf16(value); }
+
+// One loop per (type, op) so each one vectorizes on its own
+#define REDUCE_LOOP(T, EXPR)                                  \
+    for (int i = 0; i < count; i++) {                         \
+        T a = d[i], b = s[i];                                 \
+        d[i] = (EXPR);                                        \
+    }
+
+#define REDUCE_KERNEL(NAME, T, BITWISE)                                            \
+    static void NAME(T *restrict d, const T *restrict s, int count, OPERATION op) { \
+        switch (op) {                                                              \
+            case SUM:  REDUCE_LOOP(T, a + b); break;                               \
+            case MULT: REDUCE_LOOP(T, a * b); break;                               \
+            case MIN:  REDUCE_LOOP(T, b < a ? b : a); break;                       \
+            case MAX:  REDUCE_LOOP(T, b > a ? b : a); break;                       \
+            BITWISE                                                                \
+            default: break;                                                        \
+        }                                                                          \
+    }
+
+#define BITWISE_CASES(T)                                      \
+    case BAND: REDUCE_LOOP(T, a & b); break;                  \
+    case BOR:  REDUCE_LOOP(T, a | b); break;
+
+REDUCE_KERNEL(reduce_int, int, BITWISE_CASES(int))
+REDUCE_KERNEL(reduce_int64, int64_t, BITWISE_CASES(int64_t))
+REDUCE_KERNEL(reduce_float, float, )
+REDUCE_KERNEL(reduce_double, double, )
+
+// SUM that scales each result on the way out (AVG, post-scaling)
+#define SCALED_SUM_KERNEL(NAME, T)                                                \
+    static void NAME(T *restrict d, const T *restrict s, int count, T scale) {   \
+        for (int i = 0; i < count; i++) {                                         \
+            d[i] = (d[i] + s[i]) * scale;                                         \
+        }                                                                         \
+    }
+
+SCALED_SUM_KERNEL(scaled_sum_float, float)
+SCALED_SUM_KERNEL(scaled_sum_double, double)
+
+// Half-width types are widened a block at a time, reduced with the float
+// kernel and rounded back once, so every combine computes in fp32 and the
+// wire format stays 2 bytes per element
+#define HALF_BLOCK 256
+
+static void reduce_half(uint16_t *d, const uint16_t *s, int count, OPERATION op, int bf16, float scale) {
+    float a[HALF_BLOCK], b[HALF_BLOCK];
+    for (int base = 0; base < count; base += HALF_BLOCK) {
+        int len = MIN(HALF_BLOCK, count - base);
+        if (bf16) {
+            for (int i = 0; i < len; i++) {
+                a[i] = pg_half_bf16_to_float(d[base + i]);
+                b[i] = pg_half_bf16_to_float(s[base + i]);
+            }
+        } else {
+            for (int i = 0; i < len; i++) {
+                a[i] = pg_half_fp16_to_float(d[base + i]);
+                b[i] = pg_half_fp16_to_float(s[base + i]);
+            }
+        }
+        if (scale != 1.0f) {
+            scaled_sum_float(a, b, len, scale);
+        } else {
+            reduce_float(a, b, len, op);
+        }
+        if (bf16) {
+            for (int i = 0; i < len; i++) d[base + i] = pg_half_float_to_bf16(a[i]);
+        } else {
+            for (int i = 0; i < len; i++) d[base + i] = pg_half_float_to_fp16(a[i]);
+        }
+    }
+}
+
+void perform_operation(void *dst, const void *src, int count, DATATYPE datatype, OPERATION op) {
+    switch (datatype) {
+        case INT:
+            reduce_int((int *)dst, (const int *)src, count, op);
+            break;
+        case DOUBLE:
+            reduce_double((double *)dst, (const double *)src, count, op);
+            break;
+        case FLOAT:
+            reduce_float((float *)dst, (const float *)src, count, op);
+            break;
+        case INT64:
+            reduce_int64((int64_t *)dst, (const int64_t *)src, count, op);
+            break;
+        case FP16:
+            reduce_half((uint16_t *)dst, (const uint16_t *)src, count, op, 0, 1.0f);
+            break;
+        case BF16:
+            reduce_half((uint16_t *)dst, (const uint16_t *)src, count, op, 1, 1.0f);
+            break;
+        default:
+            break;
+    }
+}
+
+// dst[i] = (dst[i] + src[i]) * scale on a floating datatype
+static void scaled_sum(void *dst, const void *src, int count, DATATYPE datatype, double scale) {
+    switch (datatype) {
+        case DOUBLE:
+            scaled_sum_double((double *)dst, (const double *)src, count, scale);
+            break;
+        case FLOAT:
+            scaled_sum_float((float *)dst, (const float *)src, count, (float)scale);
+            break;
+        case FP16:
+        case BF16:
+            reduce_half((uint16_t *)dst, (const uint16_t *)src, count, SUM, datatype == BF16, (float)scale);
+            break;
+        default:
+            break;
+    }
+}
+
+void scale_copy(void *dst, const void *src, int count, DATATYPE datatype, double scale) {
+    switch (datatype) {
+        case DOUBLE: {
+            double *d = dst;
+            const double *s = src;
+            for (int i = 0; i < count; i++) d[i] = s[i] * scale;
+            break;
+        }
+        case FLOAT: {
+            float *d = dst;
+            const float *s = src;
+            float f = (float)scale;
+            for (int i = 0; i < count; i++) d[i] = s[i] * f;
+            break;
+        }
+        case FP16:
+        case BF16: {
+            uint16_t *d = dst;
+            const uint16_t *s = src;
+            float f = (float)scale;
+            for (int i = 0; i < count; i++) {
+                d[i] = datatype == BF16 ? pg_half_float_to_bf16(pg_half_bf16_to_float(s[i]) * f)
+                                        : pg_half_float_to_fp16(pg_half_fp16_to_float(s[i]) * f);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void builtin_reducer(pg_reducer_t *reducer, DATATYPE datatype, OPERATION op) {
+    reducer->elem_size = get_datatype_size(datatype);
+    reducer->datatype = datatype;
+    reducer->op = op;
+    reducer->fn = NULL;
+    reducer->ctx = NULL;
+    reducer->pre_scale = 1.0;
+    reducer->post_scale = 1.0;
+}
+
+int group_reducer(pg_reducer_t *reducer, DATATYPE datatype, OPERATION op, int n) {
+    if (get_datatype_size(datatype) == 0) {
+        fprintf(stderr, "Invalid datatype\n");
+        return -1;
+    }
+    int average = op == AVG && floating_datatype(datatype);
+    if (!average && !reduction_supported(datatype, op)) {
+        fprintf(stderr, "Operation %d is not defined on datatype %d\n", op, datatype);
+        return -1;
+    }
+    builtin_reducer(reducer, datatype, average ? SUM : op);
+    if (average) {
+        reducer->post_scale = 1.0 / n;
+    }
+    return 0;
+}
+
+void apply_reducer(const pg_reducer_t *reducer, void *dst, const void *src, int count, int final) {
+    if (reducer->fn) {
+        reducer->fn(dst, src, count, reducer->ctx);
+    } else if (final && reducer->post_scale != 1.0) {
+        scaled_sum(dst, src, count, reducer->datatype, reducer->post_scale);
+    } else {
+        perform_operation(dst, src, count, reducer->datatype, reducer->op);
+    }
+}
+
+
+int ring_chunk_count(int count, int n, int chunk_id) {
+    int chunk_size = count / n;
+    return chunk_id == n - 1 ? chunk_size + count % n : chunk_size;
+}
+
+// Weight of chunk k: 1 / the pace of the ranks reducing it, which is the
+// largest cost unless the slowest rank is the one skipping the chunk
+static double chunk_weight(const PGHandle *pg_handle, int ring, int k, int slowest, double max2) {
+    double pace = ring_rank_at(pg_handle, ring, k) == slowest ? max2 : pg_handle->balance.costs[slowest];
+    return pace > 0.0 ? 1.0 / pace : 0.0;
+}
+
+void ring_balanced_counts(const PGHandle *pg_handle, int ring, int count, int *chunk_counts) {
+    int n = pg_handle->num_servers;
+    const double *costs = pg_handle->balance.costs;
+    int slowest = 0;
+    double max2 = 0.0;
+    double equal = 0.0;
+    if (costs) {
+        for (int q = 1; q < n; q++) {
+            if (costs[q] > costs[slowest]) {
+                max2 = costs[slowest];
+                slowest = q;
+            } else if (costs[q] > max2) {
+                max2 = costs[q];
+            }
+        }
+        for (int k = 0; k < n; k++) equal += chunk_weight(pg_handle, ring, k, slowest, max2) / n;
+    }
+    // No exchange yet, or unusable (zero) costs: equal chunks
+    if (equal <= 0.0) {
+        for (int k = 0; k < n; k++) chunk_counts[k] = ring_chunk_count(count, n, k);
+        return;
+    }
+
+    double total = 0.0;
+    for (int k = 0; k < n; k++) {
+        double w = chunk_weight(pg_handle, ring, k, slowest, max2);
+        total += MAX(MIN(w, PG_BALANCE_MAX_SKEW * equal), equal / PG_BALANCE_MAX_SKEW);
+    }
+    // Rounded down, with the remainder on the last chunk like ring_chunk_count
+    int assigned = 0;
+    for (int k = 0; k < n - 1; k++) {
+        double w = chunk_weight(pg_handle, ring, k, slowest, max2);
+        w = MAX(MIN(w, PG_BALANCE_MAX_SKEW * equal), equal / PG_BALANCE_MAX_SKEW);
+        chunk_counts[k] = (int)(count * (w / total));
+        assigned += chunk_counts[k];
+    }
+    chunk_counts[n - 1] = count - assigned;
+}
+
+int ring_rank_at(const PGHandle *pg_handle, int ring, int pos) {
+    int n = pg_handle->num_servers;
+    pos %= n;
+    return pg_handle->ring_order[ring ? (n - pos) % n : pos];
+}
+
+int ring_position(const PGHandle *pg_handle, const pg_slot_t *slot) {
+    int n = pg_handle->num_servers;
+    return slot->ring ? (n - pg_handle->ring_pos) % n : pg_handle->ring_pos;
+}
+
+int ring_split_count(const PGHandle *pg_handle, int count, size_t dtype_size) {
+    // Two ranks already use both directions of their only link
+    if (pg_handle->num_rings < 2 || pg_handle->num_servers < 3 || count < 2 * pg_handle->num_servers ||
+        (size_t)count * dtype_size < pg_handle->config.multi_ring_min_bytes) {
+        return count;
+    }
+    return count / 2;
+}
+
+
+// Push method: ring barrier, remote write into the right neighbor, ring barrier.
+// The first barrier makes sure the receiver's staging buffer is free, the
+// second one that the written data has landed.
+static int transfer_data_rendezvous(PGHandle *pg_handle, pg_slot_t *slot, size_t actual_size) {
+    uint64_t t = pg_trace_begin(pg_handle);
+    if(ring_barrier(pg_handle, slot) != 0) {
+        fprintf(stderr, "Rank %d: BARRIER ring_barrier failed\n", pg_handle->rank);
+        return 1;
+    }
+    pg_trace_record(pg_handle, slot, PG_TRACE_BARRIER, t, 0);
+
+    t = pg_trace_begin(pg_handle);
+    if(rdma_write_to_right(pg_handle, slot, actual_size) != 0) {
+        fprintf(stderr, "Rank %d: rdma_write_to_right failed\n", pg_handle->rank);
+        return 1;
+    }
+    pg_trace_record(pg_handle, slot, PG_TRACE_POST, t, actual_size);
+
+    // Wait for completion
+    t = pg_trace_begin(pg_handle);
+    if(poll_for_completion(pg_handle, slot) != 0) {
+        fprintf(stderr, "Rank %d: poll_for_completion failed\n", pg_handle->rank);
+        return 1;
+    }
+    pg_trace_record(pg_handle, slot, PG_TRACE_COMPLETION, t, actual_size);
+
+    t = pg_trace_begin(pg_handle);
+    if(ring_barrier(pg_handle, slot) != 0) {
+        fprintf(stderr, "Rank %d: BARRIER ring_barrier failed\n", pg_handle->rank);
+        return 1;
+    }
+    pg_trace_record(pg_handle, slot, PG_TRACE_BARRIER, t, 0);
+    
+    return 0;
+}
+
+// Pull method, sender side: wait until the right neighbor has read the previous
+// segment out of our sendbuf, so the next one can be staged there
+static int pull_wait_send_free(PGHandle *pg_handle, pg_slot_t *slot) {
+    uint64_t seq = ++slot->xfer_seq;
+    uint64_t t = pg_trace_begin(pg_handle);
+    if (wait_ctrl_word(pg_handle, &pg_handle->ctrl[slot->index].consumed_seq, seq - 1) != 0) {
+        fprintf(stderr, "Rank %d: right neighbor did not consume segment %lu\n",
+                pg_handle->rank, (unsigned long)(seq - 1));
+        return 1;
+    }
+    pg_trace_record(pg_handle, slot, PG_TRACE_BARRIER, t, 0);
+    return 0;
+}
+
+// Pull method: publish the segment staged in our sendbuf to the right neighbor,
+// then RDMA-read the left neighbor's published segment into our recvbuf once it
+// is ready, and acknowledge the read. Only neighbors synchronize, and nobody
+// writes into a receiver's buffer, so no ring barrier is needed.
+static int transfer_data_pull(PGHandle *pg_handle, pg_slot_t *slot, size_t recv_size) {
+    pg_slot_ctrl_t *ctrl = &pg_handle->ctrl[slot->index];
+    uint64_t seq = slot->xfer_seq;
+
+    // Notify the right neighbor that segment 'seq' is ready in our sendbuf
+    uint64_t t = pg_trace_begin(pg_handle);
+    ctrl->ready_src = seq;
+    if (ctrl_write(pg_handle, slot, 1, offsetof(pg_slot_ctrl_t, ready_src),
+                   offsetof(pg_slot_ctrl_t, ready_seq)) != 0) {
+        return 1;
+    }
+    pg_trace_record(pg_handle, slot, PG_TRACE_POST, t, 0);
+
+    // Pull the left neighbor's segment when it is published
+    t = pg_trace_begin(pg_handle);
+    if (wait_ctrl_word(pg_handle, &ctrl->ready_seq, seq) != 0) {
+        fprintf(stderr, "Rank %d: left neighbor did not publish segment %lu\n",
+                pg_handle->rank, (unsigned long)seq);
+        return 1;
+    }
+    pg_trace_record(pg_handle, slot, PG_TRACE_BARRIER, t, 0);
+    t = pg_trace_begin(pg_handle);
+    if (rdma_read_from_left(pg_handle, slot, recv_size) != 0) {
+        fprintf(stderr, "Rank %d: rdma_read_from_left failed\n", pg_handle->rank);
+        return 1;
+    }
+    pg_trace_record(pg_handle, slot, PG_TRACE_POST, t, recv_size);
+    t = pg_trace_begin(pg_handle);
+    if (poll_for_completion(pg_handle, slot) != 0) {
+        fprintf(stderr, "Rank %d: poll_for_completion failed\n", pg_handle->rank);
+        return 1;
+    }
+    pg_trace_record(pg_handle, slot, PG_TRACE_COMPLETION, t, recv_size);
+
+    // Let the left neighbor reuse its sendbuf. The completion of this write is
+    // drained by the next poll on the slot, before consumed_src changes again.
+    ctrl->consumed_src = seq;
+    return ctrl_write(pg_handle, slot, 0, offsetof(pg_slot_ctrl_t, consumed_src),
+                      offsetof(pg_slot_ctrl_t, consumed_seq));
+}
+
+// Free the sendbuf for staging (pull mode only needs to wait for the reader)
+static int prepare_send(PGHandle *pg_handle, pg_slot_t *slot, pg_protocol_t protocol) {
+    if (protocol == PG_PROTOCOL_PULL) {
+        return pull_wait_send_free(pg_handle, slot);
+    }
+    return 0;
+}
+
+// Move one staged segment around the ring with the selected protocol
+static int transfer_data(PGHandle *pg_handle, pg_slot_t *slot, pg_protocol_t protocol,
+                         size_t send_size, size_t recv_size) {
+    if (protocol == PG_PROTOCOL_PULL) {
+        return transfer_data_pull(pg_handle, slot, recv_size);
+    }
+    return transfer_data_rendezvous(pg_handle, slot, send_size);
+}
+
+// Bytes of the [seg * seg_size, (seg + 1) * seg_size) window that fall inside a message of 'bytes'
+static size_t segment_bytes(size_t bytes, size_t seg_size, int seg) {
+    size_t begin = (size_t)seg * seg_size;
+    if (begin >= bytes) return 0;
+    return MIN(seg_size, bytes - begin);
+}
+
+size_t ring_segment_size(const pg_slot_t *slot, const pg_coll_params_t *params, size_t elem_size) {
+    size_t seg_size = slot->size;
+    if (params->segment_bytes > 0 && params->segment_bytes < seg_size) {
+        seg_size = params->segment_bytes;
+    }
+    return MAX(seg_size - (seg_size % elem_size), elem_size);
+}
+
+// Segmented ring step; received segments are copied to 'recv_ptr', or reduced
+// into it when temp_buf is given (and scaled when 'final'): through temp_buf
+// in push mode, straight from the slot in pull mode, where nothing but our
+// own READ writes the slot's recvbuf
+static int ring_step(PGHandle *pg_handle, pg_slot_t *slot, pg_protocol_t protocol,
+                     size_t seg_size, int num_segments,
+                     const void *send_ptr, size_t send_bytes, void *recv_ptr, size_t recv_bytes,
+                     void *temp_buf, const pg_reducer_t *reducer, int final) {
+    for (int seg = 0; seg < num_segments; seg++) {
+        size_t seg_send = segment_bytes(send_bytes, seg_size, seg);
+        size_t seg_recv = segment_bytes(recv_bytes, seg_size, seg);
+        size_t seg_offset = (size_t)seg * seg_size;
+
+        // Copy data to send buffer
+        if (prepare_send(pg_handle, slot, protocol) != 0) {
+            return 1;
+        }
+        uint64_t busy = pg_handle->config.balance ? pg_trace_clock_ns() : 0;
+        uint64_t t = pg_trace_begin(pg_handle);
+        memcpy(slot->sendbuf, (const char *)send_ptr + seg_offset, seg_send);
+        pg_trace_record(pg_handle, slot, PG_TRACE_COPY_IN, t, seg_send);
+        if (busy) slot->busy_ns += pg_trace_clock_ns() - busy;
+
+        // Transfer data using selected method (push or pull)
+        if (transfer_data(pg_handle, slot, protocol, seg_send, seg_recv) != 0) {
+            return 1;
+        }
+
+        busy = pg_handle->config.balance ? pg_trace_clock_ns() : 0;
+        t = pg_trace_begin(pg_handle);
+        if (temp_buf) {
+            const void *received = slot->recvbuf;
+            if (protocol != PG_PROTOCOL_PULL) {
+                memcpy(temp_buf, slot->recvbuf, seg_recv);
+                received = temp_buf;
+            }
+            apply_reducer(reducer, (char *)recv_ptr + seg_offset, received,
+                          (int)(seg_recv / reducer->elem_size), final);
+            pg_trace_record(pg_handle, slot, PG_TRACE_REDUCE, t, seg_recv);
+        } else {
+            memcpy((char *)recv_ptr + seg_offset, slot->recvbuf, seg_recv);
+            pg_trace_record(pg_handle, slot, PG_TRACE_COPY_OUT, t, seg_recv);
+        }
+        if (busy) {
+            slot->busy_ns += pg_trace_clock_ns() - busy;
+            slot->busy_bytes += seg_recv;
+        }
+    }
+    return 0;
+}
+
+int ring_step_copy(PGHandle *pg_handle, pg_slot_t *slot, pg_protocol_t protocol,
+                   size_t seg_size, int num_segments,
+                   const void *send_ptr, size_t send_bytes, void *recv_ptr, size_t recv_bytes) {
+    return ring_step(pg_handle, slot, protocol, seg_size, num_segments,
+                     send_ptr, send_bytes, recv_ptr, recv_bytes, NULL, NULL, 0);
+}
+
+int ring_step_reduce(PGHandle *pg_handle, pg_slot_t *slot, pg_protocol_t protocol,
+                     size_t seg_size, int num_segments,
+                     const void *send_ptr, size_t send_bytes, void *recv_ptr, size_t recv_bytes,
+                     void *temp_buf, const pg_reducer_t *reducer, int final) {
+    return ring_step(pg_handle, slot, protocol, seg_size, num_segments,
+                     send_ptr, send_bytes, recv_ptr, recv_bytes, temp_buf, reducer, final);
+}
+
+int ring_finish(PGHandle *pg_handle, pg_slot_t *slot) {
+    return poll_for_completion(pg_handle, slot);
+}
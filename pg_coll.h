@@ -0,0 +1,169 @@
+#ifndef PG_COLL_H
+#define PG_COLL_H
+
+/*
+ * pg_coll.h
+ *
+ * Building blocks shared by the collectives: datatype sizes, reduction
+ * kernels and the segmented ring step that moves data from every rank to its
+ * right neighbor with the push or pull protocol. Internal to the library.
+ *
+ * Both protocols move data between the registered staging slots, not user
+ * memory: a segment is copied into the sender's slot, and the push write or
+ * the pull RDMA READ lands in the receiver's slot. User buffers are not
+ * registered, so a READ cannot target the reduction buffer itself. In pull
+ * mode only the receiver's own READ writes its slot, so received segments
+ * are reduced straight out of it; push mode first copies them to temp_buf.
+ */
+
+#include <stddef.h>
+#include "pg_handle.h"
+
+/**
+ * Size in bytes of one element of 'datatype', or 0 for an unknown datatype.
+ */
+size_t get_datatype_size(DATATYPE datatype);
+
+/**
+ * Whether 'op' is an element-wise reduction defined on 'datatype' (the bitwise
+ * ops need an integer type). AVG is not one: see group_reducer.
+ */
+int reduction_supported(DATATYPE datatype, OPERATION op);
+
+/**
+ * dst[i] = dst[i] op src[i] for 'count' elements. FP16 and BF16 are combined
+ * in fp32 and rounded once (to nearest even) per call.
+ */
+void perform_operation(void *dst, const void *src, int count, DATATYPE datatype, OPERATION op);
+
+/* Element-wise reduction applied by the ring steps: a built-in (datatype, op)
+ * pair, or a caller's function over elements of elem_size bytes. The scales
+ * of a built-in floating SUM (AVG, pg_all_reduce_scaled) are fused into
+ * passes the collective makes anyway: pre_scale into the copy of the input,
+ * post_scale into the reduction that completes an element. */
+typedef struct {
+    size_t elem_size;
+    DATATYPE datatype;
+    OPERATION op;
+    pg_reduce_fn_t fn;        /* NULL = perform_operation(datatype, op) */
+    void *ctx;                /* passed to fn */
+    double pre_scale;         /* multiplies every input, 1.0 = none */
+    double post_scale;        /* multiplies every result, 1.0 = none */
+} pg_reducer_t;
+
+/**
+ * Fills 'reducer' with the built-in kernel of (datatype, op), unscaled.
+ */
+void builtin_reducer(pg_reducer_t *reducer, DATATYPE datatype, OPERATION op);
+
+/**
+ * Fills 'reducer' for a reduction over 'n' ranks: builtin_reducer, with AVG
+ * turned into SUM with a post_scale of 1 / n. Returns -1 (with a message)
+ * when the datatype is unknown or the op is not defined on it.
+ */
+int group_reducer(pg_reducer_t *reducer, DATATYPE datatype, OPERATION op, int n);
+
+/**
+ * Whether 'datatype' is a floating type, the only ones AVG and scaling apply to.
+ */
+int floating_datatype(DATATYPE datatype);
+
+/**
+ * dst[i] = dst[i] op src[i] for 'count' elements with the reducer's kernel,
+ * times post_scale when 'final' (the reduction completes the elements).
+ */
+void apply_reducer(const pg_reducer_t *reducer, void *dst, const void *src, int count, int final);
+
+/**
+ * dst[i] = src[i] * scale for 'count' elements of a floating datatype;
+ * dst may equal src. FP16 and BF16 are scaled in fp32 and rounded once.
+ */
+void scale_copy(void *dst, const void *src, int count, DATATYPE datatype, double scale);
+
+/**
+ * Elements of ring chunk 'chunk_id' when 'count' elements are split over n
+ * chunks: count / n each, with all of the remainder on the last chunk.
+ */
+int ring_chunk_count(int count, int n, int chunk_id);
+
+/**
+ * Chunk sizes of ring 'ring' for a 'count' element all-reduce. Equal chunks
+ * (ring_chunk_count) until the ranks have exchanged costs (PG_BALANCE).
+ * Then: in the reduce-scatter, chunk c is reduced by every rank but the one
+ * at position c, and a step lasts as long as its slowest reduction, so the
+ * slowest rank sets the pace of every step. Chunk c gets a weight of
+ * 1 / (largest cost among the ranks reducing it), capped at
+ * PG_BALANCE_MAX_SKEW times an equal share: the chunk the slowest rank
+ * skips grows, and every step then costs the same. Identical on all ranks.
+ */
+void ring_balanced_counts(const PGHandle *pg_handle, int ring, int count, int *chunk_counts);
+
+/**
+ * Rank at position 'pos' (taken modulo num_servers) of ring 'ring': ring 0
+ * follows the ring order, ring 1 runs through the same ranks backwards, so
+ * position 0 is the same rank on both.
+ */
+int ring_rank_at(const PGHandle *pg_handle, int ring, int pos);
+
+/**
+ * Our position on the slot's ring. Ring algorithms number chunks by position,
+ * so chunk c is accumulated in the order of ring_rank_at(ring, c), c + 1, ...
+ */
+int ring_position(const PGHandle *pg_handle, const pg_slot_t *slot);
+
+/**
+ * Elements of a 'count' element all-reduce handled by ring 0. The rest,
+ * [split, count), runs on ring 1 in parallel: with num_rings == 2, on 3 or
+ * more ranks and from multi_ring_min_bytes on. Returns count otherwise.
+ */
+int ring_split_count(const PGHandle *pg_handle, int count, size_t dtype_size);
+
+/**
+ * Segment size used on a slot: the slot size, or params->segment_bytes when
+ * smaller, rounded down to whole elements of 'elem_size'.
+ */
+size_t ring_segment_size(const pg_slot_t *slot, const pg_coll_params_t *params, size_t elem_size);
+
+/**
+ * One ring step: sends 'send_bytes' at 'send_ptr' to the right neighbor while
+ * receiving 'recv_bytes' from the left neighbor into 'recv_ptr', in
+ * 'num_segments' segments of 'seg_size'. Every rank must run the same number
+ * of segments. Returns 0 on success, 1 on failure.
+ */
+int ring_step_copy(PGHandle *pg_handle, pg_slot_t *slot, pg_protocol_t protocol,
+                   size_t seg_size, int num_segments,
+                   const void *send_ptr, size_t send_bytes, void *recv_ptr, size_t recv_bytes);
+
+/**
+ * Like ring_step_copy, but the received elements are reduced into 'recv_ptr'
+ * with the reducer (recv_ptr[i] = recv_ptr[i] op received[i]). 'temp_buf'
+ * must hold one segment; pull mode does not use it. 'final' marks the step
+ * after which recv_ptr holds every rank's contribution: its reduction applies
+ * the post_scale.
+ */
+int ring_step_reduce(PGHandle *pg_handle, pg_slot_t *slot, pg_protocol_t protocol,
+                     size_t seg_size, int num_segments,
+                     const void *send_ptr, size_t send_bytes, void *recv_ptr, size_t recv_bytes,
+                     void *temp_buf, const pg_reducer_t *reducer, int final);
+
+/**
+ * Waits for the slot's outstanding work requests (the last acknowledgement of
+ * the pull protocol) before the slot changes hands. Returns 0 on success.
+ */
+int ring_finish(PGHandle *pg_handle, pg_slot_t *slot);
+
+/**
+ * Whether an all-reduce of 'count' elements of 'datatype' can use the atomic
+ * path (remote atomics supported, INT, at most PG_ATOMIC_MAX_COUNT elements).
+ */
+int atomic_applicable(const PGHandle *pg_handle, int count, DATATYPE datatype);
+
+/**
+ * All-reduce of at most PG_ATOMIC_MAX_COUNT INT elements with remote atomics
+ * into rank 0 and a one-shot broadcast of the result, on an acquired slot.
+ * Connects the mesh QPs it needs on first use. Returns 0 on success, -1 on failure.
+ */
+int atomic_all_reduce(PGHandle *pg_handle, pg_slot_t *slot, const int *sendbuf, int *recvbuf,
+                      int count, OPERATION op);
+
+#endif // PG_COLL_H
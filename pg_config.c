@@ -0,0 +1,257 @@
+#include "pg_config.h"
+#include "pg_handle.h"
+#include "pg_tuning.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+void pg_config_init(pg_config_t *config) {
+    memset(config, 0, sizeof(*config));
+    config->device[0] = '\0';
+    config->ib_port = 1;
+    config->gid_index = -1;
+    config->mtu = 0;
+    config->cq_depth = 16;
+    config->qp_depth = 16;
+    config->timeout = 14;
+    config->retry_cnt = 7;
+    config->rnr_retry = 7;
+    config->min_rnr_timer = 12;
+    config->sl = 0;
+    config->traffic_class = 0;
+    config->sl_high = 0;
+    config->traffic_class_high = 0;
+    config->max_rd_atomic = 0;
+    config->buffer_size = RDMA_BUFFER_SIZE;
+    config->num_slots = PG_NUM_SLOTS;
+    config->num_high_slots = PG_NUM_HIGH_SLOTS;
+    config->fusion_bucket_bytes = PG_FUSION_BUCKET_BYTES;
+    config->sge_min_bytes = 512;
+    config->protocol = PG_PROTOCOL_PUSH;
+    config->numa_placement = PG_NUMA_LOCAL;
+    config->pin_threads = 0;
+    strcpy(config->tuning_file, PG_TUNING_FILE);
+    config->atomic_max_count = 8;
+    config->ring_order = PG_RING_ORDER_LIST;
+    config->topology_file[0] = '\0';
+    config->num_rings = 1;
+    config->multi_ring_min_bytes = 1024 * 1024;
+    config->trace_events = 0;
+    config->trace_file[0] = '\0';
+    config->port_base = PG_DEFAULT_PORT_BASE;
+    config->port_stride = PG_DEFAULT_PORT_STRIDE;
+    config->pool_max_bytes = 64 * 1024 * 1024;
+    config->pool_idle_ms = 1000;
+    config->balance = 0;
+    config->balance_interval = 16;
+    config->deterministic = 0;
+    config->wr_latency = 0;
+    config->barrier_timeout_ms = 30000;
+}
+
+// Parse an integer environment variable; leaves *out untouched when unset
+static int env_int(const char *name, int *out) {
+    const char *value = getenv(name);
+    if (!value || !*value) return 0;
+    char *end;
+    errno = 0;
+    long parsed = strtol(value, &end, 0);
+    if (errno != 0 || *end != '\0' || parsed < -2147483647L || parsed > 2147483647L) {
+        fprintf(stderr, "Invalid value for %s: '%s'\n", name, value);
+        return -1;
+    }
+    *out = (int)parsed;
+    return 0;
+}
+
+// Parse a size environment variable with an optional K/M/G suffix
+static int env_size(const char *name, size_t *out) {
+    const char *value = getenv(name);
+    if (!value || !*value) return 0;
+    char *end;
+    errno = 0;
+    unsigned long long parsed = strtoull(value, &end, 0);
+    if (errno == 0 && *end != '\0' && end[1] == '\0') {
+        switch (*end) {
+            case 'k': case 'K': parsed <<= 10; end++; break;
+            case 'm': case 'M': parsed <<= 20; end++; break;
+            case 'g': case 'G': parsed <<= 30; end++; break;
+            default: break;
+        }
+    }
+    if (errno != 0 || *end != '\0' || value[0] == '-') {
+        fprintf(stderr, "Invalid value for %s: '%s'\n", name, value);
+        return -1;
+    }
+    *out = (size_t)parsed;
+    return 0;
+}
+
+int pg_config_load_env(pg_config_t *config) {
+    const char *device = getenv("PG_DEVICE");
+    if (device && *device) {
+        if (strlen(device) >= sizeof(config->device)) {
+            fprintf(stderr, "Invalid value for PG_DEVICE: '%s'\n", device);
+            return -1;
+        }
+        strcpy(config->device, device);
+    }
+
+    const char *protocol = getenv("PG_PROTOCOL");
+    if (protocol && *protocol) {
+        if (strcmp(protocol, "push") == 0) {
+            config->protocol = PG_PROTOCOL_PUSH;
+        } else if (strcmp(protocol, "pull") == 0) {
+            config->protocol = PG_PROTOCOL_PULL;
+        } else {
+            fprintf(stderr, "Invalid value for PG_PROTOCOL: '%s'\n", protocol);
+            return -1;
+        }
+    }
+
+    const char *tuning_file = getenv("PG_TUNING_FILE");
+    if (tuning_file) {
+        if (strlen(tuning_file) >= sizeof(config->tuning_file)) {
+            fprintf(stderr, "Invalid value for PG_TUNING_FILE: '%s'\n", tuning_file);
+            return -1;
+        }
+        strcpy(config->tuning_file, tuning_file);
+    }
+
+    const char *numa = getenv("PG_NUMA");
+    if (numa && *numa) {
+        if (strcmp(numa, "none") == 0) {
+            config->numa_placement = PG_NUMA_NONE;
+        } else if (strcmp(numa, "local") == 0) {
+            config->numa_placement = PG_NUMA_LOCAL;
+        } else if (strcmp(numa, "remote") == 0) {
+            config->numa_placement = PG_NUMA_REMOTE;
+        } else {
+            fprintf(stderr, "Invalid value for PG_NUMA: '%s'\n", numa);
+            return -1;
+        }
+    }
+
+    const char *ring_order = getenv("PG_RING_ORDER");
+    if (ring_order && *ring_order) {
+        if (strcmp(ring_order, "list") == 0) {
+            config->ring_order = PG_RING_ORDER_LIST;
+        } else if (strcmp(ring_order, "file") == 0) {
+            config->ring_order = PG_RING_ORDER_FILE;
+        } else if (strcmp(ring_order, "probe") == 0) {
+            config->ring_order = PG_RING_ORDER_PROBE;
+        } else {
+            fprintf(stderr, "Invalid value for PG_RING_ORDER: '%s'\n", ring_order);
+            return -1;
+        }
+    }
+
+    const char *topology_file = getenv("PG_TOPOLOGY_FILE");
+    if (topology_file) {
+        if (strlen(topology_file) >= sizeof(config->topology_file)) {
+            fprintf(stderr, "Invalid value for PG_TOPOLOGY_FILE: '%s'\n", topology_file);
+            return -1;
+        }
+        strcpy(config->topology_file, topology_file);
+    }
+
+    const char *trace_file = getenv("PG_TRACE_FILE");
+    if (trace_file) {
+        if (strlen(trace_file) >= sizeof(config->trace_file)) {
+            fprintf(stderr, "Invalid value for PG_TRACE_FILE: '%s'\n", trace_file);
+            return -1;
+        }
+        strcpy(config->trace_file, trace_file);
+    }
+
+    if (env_int("PG_IB_PORT", &config->ib_port) != 0 ||
+        env_int("PG_GID_INDEX", &config->gid_index) != 0 ||
+        env_int("PG_MTU", &config->mtu) != 0 ||
+        env_int("PG_CQ_DEPTH", &config->cq_depth) != 0 ||
+        env_int("PG_QP_DEPTH", &config->qp_depth) != 0 ||
+        env_int("PG_TIMEOUT", &config->timeout) != 0 ||
+        env_int("PG_RETRY_CNT", &config->retry_cnt) != 0 ||
+        env_int("PG_RNR_RETRY", &config->rnr_retry) != 0 ||
+        env_int("PG_MIN_RNR_TIMER", &config->min_rnr_timer) != 0 ||
+        env_int("PG_SL", &config->sl) != 0 ||
+        env_int("PG_TRAFFIC_CLASS", &config->traffic_class) != 0 ||
+        env_int("PG_SL_HIGH", &config->sl_high) != 0 ||
+        env_int("PG_TRAFFIC_CLASS_HIGH", &config->traffic_class_high) != 0 ||
+        env_int("PG_MAX_RD_ATOMIC", &config->max_rd_atomic) != 0 ||
+        env_size("PG_BUFFER_SIZE", &config->buffer_size) != 0 ||
+        env_int("PG_NUM_SLOTS", &config->num_slots) != 0 ||
+        env_int("PG_NUM_HIGH_SLOTS", &config->num_high_slots) != 0 ||
+        env_size("PG_FUSION_BUCKET_BYTES", &config->fusion_bucket_bytes) != 0 ||
+        env_size("PG_SGE_MIN_BYTES", &config->sge_min_bytes) != 0 ||
+        env_int("PG_PIN_THREADS", &config->pin_threads) != 0 ||
+        env_int("PG_ATOMIC_MAX_COUNT", &config->atomic_max_count) != 0 ||
+        env_int("PG_NUM_RINGS", &config->num_rings) != 0 ||
+        env_size("PG_MULTI_RING_MIN_BYTES", &config->multi_ring_min_bytes) != 0 ||
+        env_size("PG_TRACE_EVENTS", &config->trace_events) != 0 ||
+        env_int("PG_PORT_BASE", &config->port_base) != 0 ||
+        env_int("PG_PORT_STRIDE", &config->port_stride) != 0 ||
+        env_size("PG_POOL_MAX_BYTES", &config->pool_max_bytes) != 0 ||
+        env_int("PG_POOL_IDLE_MS", &config->pool_idle_ms) != 0 ||
+        env_int("PG_BALANCE", &config->balance) != 0 ||
+        env_int("PG_BALANCE_INTERVAL", &config->balance_interval) != 0 ||
+        env_int("PG_DETERMINISTIC", &config->deterministic) != 0 ||
+        env_int("PG_WR_LATENCY", &config->wr_latency) != 0 ||
+        env_int("PG_BARRIER_TIMEOUT_MS", &config->barrier_timeout_ms) != 0) {
+        return -1;
+    }
+    return pg_config_validate(config);
+}
+
+int pg_config_validate(const pg_config_t *config) {
+    const char *bad = NULL;
+    if (config->ib_port < 1) bad = "ib_port";
+    else if (config->gid_index < -1) bad = "gid_index";
+    else if (config->mtu != 0 && config->mtu != 256 && config->mtu != 512 &&
+             config->mtu != 1024 && config->mtu != 2048 && config->mtu != 4096) bad = "mtu";
+    else if (config->cq_depth < 1) bad = "cq_depth";
+    else if (config->qp_depth < 1) bad = "qp_depth";
+    else if (config->timeout < 0 || config->timeout > 31) bad = "timeout";
+    else if (config->retry_cnt < 0 || config->retry_cnt > 7) bad = "retry_cnt";
+    else if (config->rnr_retry < 0 || config->rnr_retry > 7) bad = "rnr_retry";
+    else if (config->min_rnr_timer < 0 || config->min_rnr_timer > 31) bad = "min_rnr_timer";
+    else if (config->sl < 0 || config->sl > 15) bad = "sl";
+    else if (config->traffic_class < 0 || config->traffic_class > 255) bad = "traffic_class";
+    else if (config->sl_high < 0 || config->sl_high > 15) bad = "sl_high";
+    else if (config->traffic_class_high < 0 || config->traffic_class_high > 255) bad = "traffic_class_high";
+    else if (config->max_rd_atomic < 0 || config->max_rd_atomic > 255) bad = "max_rd_atomic";
+    else if (config->num_slots < 1 || config->num_slots > PG_MAX_SLOTS) bad = "num_slots";
+    else if (config->num_high_slots < 0 ||
+             config->num_high_slots > PG_MAX_SLOTS - config->num_slots) bad = "num_high_slots";
+    else if (config->buffer_size / (config->num_slots + config->num_high_slots) < 4096) bad = "buffer_size";
+    else if (config->fusion_bucket_bytes == 0) bad = "fusion_bucket_bytes";
+    else if (config->protocol != PG_PROTOCOL_PUSH && config->protocol != PG_PROTOCOL_PULL) bad = "protocol";
+    else if (config->numa_placement != PG_NUMA_NONE && config->numa_placement != PG_NUMA_LOCAL &&
+             config->numa_placement != PG_NUMA_REMOTE) bad = "numa_placement";
+    else if (config->atomic_max_count < 0 || config->atomic_max_count > PG_ATOMIC_MAX_COUNT) bad = "atomic_max_count";
+    else if (config->ring_order != PG_RING_ORDER_LIST && config->ring_order != PG_RING_ORDER_FILE &&
+             config->ring_order != PG_RING_ORDER_PROBE) bad = "ring_order";
+    else if (config->ring_order == PG_RING_ORDER_FILE && config->topology_file[0] == '\0') bad = "topology_file";
+    else if (config->num_rings < 1 || config->num_rings > PG_MAX_RINGS) bad = "num_rings";
+    else if (config->trace_events > ((size_t)1 << 30)) bad = "trace_events";
+    else if (config->port_stride < 1 || config->port_stride > 65535) bad = "port_stride";
+    else if (config->port_base < 1 ||
+             config->port_base > 65535 - PG_NUM_PORT_SERVICES * config->port_stride) bad = "port_base";
+    else if (config->pool_max_bytes / 2 < config->fusion_bucket_bytes ||
+             config->pool_max_bytes / 2 < config->buffer_size / (config->num_slots + config->num_high_slots))
+        bad = "pool_max_bytes";
+    else if (config->pool_idle_ms < 0) bad = "pool_idle_ms";
+    else if (config->balance != 0 && config->balance != 1) bad = "balance";
+    else if (config->balance_interval < 1) bad = "balance_interval";
+    else if (config->deterministic != 0 && config->deterministic != 1) bad = "deterministic";
+    else if (config->wr_latency != 0 && config->wr_latency != 1) bad = "wr_latency";
+    else if (config->barrier_timeout_ms < 1) bad = "barrier_timeout_ms";
+
+    if (bad) {
+        fprintf(stderr, "Invalid process group configuration: %s out of range\n", bad);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+#ifndef PG_CONFIG_H
+#define PG_CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_config.h
+ *
+ * Runtime transport configuration of a process group.
+ *
+ * Every field has a built-in default (pg_config_init) and can be overridden
+ * from the environment (pg_config_load_env):
+ *
+ *   PG_DEVICE              RDMA device name             (default: first device)
+ *   PG_IB_PORT             device port number           (1)
+ *   PG_GID_INDEX           GID index, -1 = auto         (-1)
+ *   PG_MTU                 path MTU cap in bytes, 0 = negotiated (0)
+ *   PG_CQ_DEPTH            completion queue entries     (16)
+ *   PG_QP_DEPTH            send/recv queue entries      (16)
+ *   PG_TIMEOUT             local ACK timeout exponent   (14)
+ *   PG_RETRY_CNT           transport retry count        (7)
+ *   PG_RNR_RETRY           RNR retry count              (7)
+ *   PG_MIN_RNR_TIMER       minimal RNR NAK timer        (12)
+ *   PG_SL                  service level                (0)
+ *   PG_TRAFFIC_CLASS       GRH traffic class            (0)
+ *   PG_SL_HIGH             service level of high-priority collectives (0)
+ *   PG_TRAFFIC_CLASS_HIGH  GRH traffic class of high-priority collectives (0)
+ *   PG_MAX_RD_ATOMIC       outstanding RDMA reads / atomics per QP,
+ *                          0 = device maximum           (0)
+ *   PG_BUFFER_SIZE         staging buffer bytes, pinned twice per handle (16M)
+ *   PG_NUM_SLOTS           concurrent staging slots     (4)
+ *   PG_NUM_HIGH_SLOTS      staging slots reserved for high-priority
+ *                          collectives, 0 = share the bulk slots (1)
+ *   PG_FUSION_BUCKET_BYTES fused bucket capacity        (4M)
+ *   PG_SGE_MIN_BYTES       strided blocks of at least this many bytes are
+ *                          sent straight from user memory with one SGE each,
+ *                          shorter ones are gathered into staging (512)
+ *   PG_PROTOCOL            ring transfer protocol, push or pull (push)
+ *   PG_NUMA                staging memory placement relative to the NIC,
+ *                          local, remote or none    (local)
+ *   PG_PIN_THREADS         pin the connecting thread to the buffer node (0)
+ *   PG_TUNING_FILE         tuning table written by pg_autotune ("pg_tuning.conf")
+ *   PG_ATOMIC_MAX_COUNT    INT all-reduces of at most this many elements use
+ *                          remote atomics, 0 = never    (8)
+ *   PG_RING_ORDER          order of the ranks around the ring: list (server
+ *                          list order), file (grouped by switch from
+ *                          PG_TOPOLOGY_FILE) or probe (measured)  (list)
+ *   PG_TOPOLOGY_FILE       "hostname location" lines, location a '/'
+ *                          separated switch path such as spine0/leaf3 ("")
+ *   PG_NUM_RINGS           rings a large all-reduce is split over, 1 or 2;
+ *                          2 also sends over every link in reverse   (1)
+ *   PG_MULTI_RING_MIN_BYTES smallest all-reduce split over PG_NUM_RINGS rings (1M)
+ *   PG_TRACE_EVENTS        ring-step trace records kept per rank (rounded up
+ *                          to a power of two), 0 = tracing off      (0)
+ *   PG_TRACE_FILE          Chrome trace written by pg_close, a '%d' in the
+ *                          path becomes the rank ("")
+ *   PG_PORT_BASE           first TCP port of the bootstrap   (18515)
+ *   PG_PORT_STRIDE         ports between two bootstrap services; at least
+ *                          the number of ranks sharing a host  (10)
+ *   PG_POOL_MAX_BYTES      scratch memory a handle keeps at most;
+ *                          at least twice a slot and the fusion bucket (64M)
+ *   PG_POOL_IDLE_MS        scratch blocks idle this long are released (1000)
+ *   PG_BALANCE             resize the ring chunks of all-reduces on tag 0
+ *                          from measured per-rank costs (0)
+ *   PG_BALANCE_INTERVAL    measured all-reduces between two cost exchanges (16)
+ *   PG_DETERMINISTIC       bitwise-reproducible DOUBLE SUM all-reduces (0)
+ *   PG_WR_LATENCY          latency histograms of the ring data transfers, on the
+ *                          NIC clock where completions carry timestamps (0)
+ *   PG_BARRIER_TIMEOUT_MS  time pg_barrier waits for a peer before failing (30000)
+ *
+ * Sizes accept an optional K, M or G suffix.
+ */
+
+#include <stddef.h>
+
+/* Maximum RDMA device name length (matches IBV_SYSFS_NAME_MAX) */
+#define PG_MAX_DEVICE_NAME 64
+
+/* Maximum tuning file path length */
+#define PG_MAX_PATH 256
+
+/* Bootstrap TCP services. Rank r listens for service s on
+ * port_base + s * port_stride + r (rank 0 only for the clock), so the
+ * defaults give the historical ports 18515 + r (QP exchange), 18525 + r
+ * (MR exchange), 18535 + r (mesh), 18545 + r (probes) and 18555 (clock).
+ * Ranks sharing a host need a stride of at least the number of ranks. */
+typedef enum {
+    PG_PORT_QP,
+    PG_PORT_MR,
+    PG_PORT_MESH,
+    PG_PORT_PROBE,
+    PG_PORT_CLOCK,
+    PG_NUM_PORT_SERVICES
+} pg_port_service_t;
+
+#define PG_DEFAULT_PORT_BASE 18515
+#define PG_DEFAULT_PORT_STRIDE 10
+
+/* Largest element count the atomic all-reduce path can handle */
+#define PG_ATOMIC_MAX_COUNT 16
+
+/* How a ring step moves a segment to the right neighbor */
+typedef enum {
+    PG_PROTOCOL_PUSH,   /* sender RDMA-writes into the receiver, fenced by ring barriers */
+    PG_PROTOCOL_PULL    /* sender publishes, receiver RDMA-reads when it is ready */
+} pg_protocol_t;
+
+/* How the ring order of the ranks is chosen at connect time */
+typedef enum {
+    PG_RING_ORDER_LIST,  /* position = rank */
+    PG_RING_ORDER_FILE,  /* ranks grouped by switch, from a topology file */
+    PG_RING_ORDER_PROBE  /* shortest ring over measured pairwise transfer times */
+} pg_ring_order_t;
+
+/* Where registered staging memory is placed relative to the NIC's NUMA node */
+typedef enum {
+    PG_NUMA_NONE,       /* no placement policy (first touch) */
+    PG_NUMA_LOCAL,      /* the NIC's node */
+    PG_NUMA_REMOTE      /* a node other than the NIC's (for benchmarking) */
+} pg_numa_placement_t;
+
+typedef struct {
+    char device[PG_MAX_DEVICE_NAME]; /* RDMA device name, "" = first device */
+    int ib_port;                     /* device port (1-based) */
+    int gid_index;                   /* GID index; -1 = LID on InfiniBand, first RoCE v2 GID on Ethernet */
+    int mtu;                         /* path MTU cap in bytes; 0 = min of both ports' active MTU */
+    int cq_depth;                    /* completion queue entries */
+    int qp_depth;                    /* send and receive queue entries per QP */
+    int timeout;                     /* local ACK timeout (4.096us * 2^timeout) */
+    int retry_cnt;                   /* transport retries */
+    int rnr_retry;                   /* RNR retries (7 = infinite) */
+    int min_rnr_timer;               /* minimal RNR NAK timer */
+    int sl;                          /* service level */
+    int traffic_class;               /* GRH traffic class (RoCE DSCP/ECN) */
+    int sl_high;                     /* service level of the high-priority class */
+    int traffic_class_high;          /* GRH traffic class of the high-priority class */
+    int max_rd_atomic;               /* outstanding RDMA reads / atomics per QP; 0 = device maximum */
+    size_t buffer_size;              /* bytes of each staging buffer (send and recv) */
+    int num_slots;                   /* bulk staging slots */
+    int num_high_slots;              /* high-priority staging slots; num_slots + num_high_slots <= PG_MAX_SLOTS */
+    size_t fusion_bucket_bytes;      /* bucket capacity of pg_all_reduce_multi */
+    size_t sge_min_bytes;            /* shortest strided block sent with its own SGE */
+    pg_protocol_t protocol;          /* ring transfer protocol */
+    pg_numa_placement_t numa_placement; /* staging memory placement */
+    int pin_threads;                 /* pin the connecting thread to the buffer node */
+    char tuning_file[PG_MAX_PATH];   /* tuning table, "" = none */
+    int atomic_max_count;            /* INT all-reduces up to this count use atomics; 0 = never */
+    pg_ring_order_t ring_order;      /* ring order of the ranks */
+    char topology_file[PG_MAX_PATH]; /* topology file of PG_RING_ORDER_FILE */
+    int num_rings;                   /* rings of a large all-reduce, 1..PG_MAX_RINGS */
+    size_t multi_ring_min_bytes;     /* smallest all-reduce split over num_rings rings */
+    size_t trace_events;             /* trace records kept, 0 = no tracing */
+    char trace_file[PG_MAX_PATH];    /* trace dumped at pg_close, "" = none */
+    int port_base;                   /* first bootstrap TCP port */
+    int port_stride;                 /* ports between two bootstrap services */
+    size_t pool_max_bytes;           /* cap of the scratch pool */
+    int pool_idle_ms;                /* idle time after which a scratch block is released */
+    int balance;                     /* adaptive chunk sizes for heterogeneous ranks */
+    int balance_interval;            /* measured all-reduces between cost exchanges */
+    int deterministic;               /* DOUBLE SUM through pg_all_reduce_deterministic */
+    int wr_latency;                  /* per-WR latency histograms (pg_latency.h) */
+    int barrier_timeout_ms;          /* pg_barrier gives up on a silent peer after this */
+} pg_config_t;
+
+/**
+ * @brief Fills a configuration with the built-in defaults.
+ * @param config Configuration to initialize.
+ */
+void pg_config_init(pg_config_t *config);
+
+/**
+ * @brief Applies PG_* environment variable overrides on top of a configuration.
+ * @param config Configuration to update.
+ * @return 0 on success, -1 if a variable holds an invalid value (config is left partially updated).
+ */
+int pg_config_load_env(pg_config_t *config);
+
+/**
+ * @brief Checks a configuration for out-of-range values.
+ * @param config Configuration to check.
+ * @return 0 if valid, -1 otherwise.
+ */
+int pg_config_validate(const pg_config_t *config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_CONFIG_H */
@@ -1,5 +1,16 @@
 
 #include "pg_connect.h"
+#include "pg_numa.h"
+#include "pg_tuning.h"
+#include "pg_topology.h"
+#include "pg_trace.h"
+#include "pg_pool.h"
+#include "pg_latency.h"
+#include <netinet/tcp.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
 
 
 ////////////////////////// Helpers //////////////////////////
@@ -55,37 +66,105 @@ static int tcp_connect(const char *hostname, int port) {
     return -1;
 }
 
-// Listen on a port, return accepted socket fd
-static int tcp_listen_accept(int port) {
+// Open a listening socket on a port (kept open), return its fd
+static int tcp_listen(int port, int backlog) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
     struct sockaddr_in addr = {0};
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
     addr.sin_port = htons(port);
-    bind(sock, (struct sockaddr *)&addr, sizeof(addr));
-    listen(sock, 1);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, backlog) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Listen on a port, return accepted socket fd. The port can be reused right
+// after a previous group on this host closed its connections on it.
+static int tcp_listen_accept(int port) {
+    int sock = tcp_listen(port, 1);
+    if (sock < 0) {
+        fprintf(stderr, "Cannot listen on port %d\n", port);
+        return -1;
+    }
     int client = accept(sock, NULL, NULL);
     close(sock);
     return client;
 }
 
+// TCP port on which 'rank' listens for a bootstrap service
+static int service_port(const PGHandle *handle, pg_port_service_t service, int rank) {
+    return handle->config.port_base + service * handle->config.port_stride + rank;
+}
 
+// Ranks sharing a host must not get the same port for two services
+static int check_port_layout(char **server_list, int size, const pg_config_t *config) {
+    for (int a = 0; a < size; ++a) {
+        for (int b = a + config->port_stride; b < size; b += config->port_stride) {
+            if ((b - a) / config->port_stride < PG_NUM_PORT_SERVICES &&
+                strcmp(server_list[a], server_list[b]) == 0) {
+                fprintf(stderr, "Ranks %d and %d share host %s and bootstrap ports; "
+                                "set PG_PORT_STRIDE to at least %d\n", a, b, server_list[a], size);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
 
+// Read / write exactly 'len' bytes on a socket; 0 on success
+static int tcp_read_full(int sock, void *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t r = read(sock, (char *)buf + done, len - done);
+        if (r <= 0) return -1;
+        done += r;
+    }
+    return 0;
+}
+
+static int tcp_write_full(int sock, const void *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t w = write(sock, (const char *)buf + done, len - done);
+        if (w <= 0) return -1;
+        done += w;
+    }
+    return 0;
+}
 
 
 
 /////////////////////////// Main Functions //////////////////////////
 
 
+// Map a path MTU in bytes to the verbs enum
+static enum ibv_mtu mtu_from_bytes(int bytes) {
+    switch (bytes) {
+        case 256: return IBV_MTU_256;
+        case 512: return IBV_MTU_512;
+        case 1024: return IBV_MTU_1024;
+        case 2048: return IBV_MTU_2048;
+        default: return IBV_MTU_4096;
+    }
+}
+
 // Helper to transition a QP to RTR(ready to receive) and RTS(ready to send)
 /**
  * @brief Connect a QP to a remote peer
+ * @param handle: process group handle (provides the transport configuration)
  * @param qp: pointer to the QP to connect
- * @param local: local QP info (lid, qpn, psn)
- * @param remote: remote QP info (lid, qpn, psn)
+ * @param local: local QP info (lid, qpn, psn, gid, mtu)
+ * @param remote: remote QP info (lid, qpn, psn, gid, mtu)
+ * @param priority: traffic class of the QP (selects its SL and traffic class)
  * @return 0 on success, -1 on failure
  */
-static int connect_qp(struct ibv_qp *qp, qp_info_t *local, qp_info_t *remote) {
+static int connect_qp(PGHandle *handle, struct ibv_qp *qp, qp_info_t *local, qp_info_t *remote,
+                      pg_priority_t priority) {
+    const pg_config_t *cfg = &handle->config;
+    const pg_traffic_class_t *cls = &handle->classes[priority];
     struct ibv_qp_attr attr;
     int flags;
 
@@ -93,28 +172,46 @@ static int connect_qp(struct ibv_qp *qp, qp_info_t *local, qp_info_t *remote) {
     memset(&attr, 0, sizeof(attr));
     attr.qp_state = IBV_QPS_INIT;
     attr.pkey_index = 0;
-    attr.port_num = 1;
+    attr.port_num = cfg->ib_port;
     attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ;
+    if (handle->atomic_supported) {
+        attr.qp_access_flags |= IBV_ACCESS_REMOTE_ATOMIC;
+    }
     flags = IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS;
     if (ibv_modify_qp(qp, &attr, flags)) {
         perror("Failed to move QP to INIT");
         return -1;
     }
 
+    // Path MTU: the smaller of both ports' active MTU, capped by the configuration
+    enum ibv_mtu path_mtu = MIN(local->mtu, remote->mtu);
+    if (cfg->mtu != 0) {
+        path_mtu = MIN(path_mtu, mtu_from_bytes(cfg->mtu));
+    }
+
     // RTR
     memset(&attr, 0, sizeof(attr));
     attr.qp_state = IBV_QPS_RTR;
-    attr.path_mtu = IBV_MTU_4096;
+    attr.path_mtu = path_mtu;
     attr.dest_qp_num = remote->qpn;
     attr.rq_psn = remote->psn;
-    attr.max_dest_rd_atomic = 1;
-    attr.min_rnr_timer = 12;
+    attr.max_dest_rd_atomic = handle->dest_rd_atomic;
+    attr.min_rnr_timer = cfg->min_rnr_timer;
     memset(&attr.ah_attr, 0, sizeof(attr.ah_attr));
-    attr.ah_attr.is_global = 0;
     attr.ah_attr.dlid = remote->lid;
-    attr.ah_attr.sl = 0;
+    attr.ah_attr.sl = cls->sl;
     attr.ah_attr.src_path_bits = 0;
-    attr.ah_attr.port_num = 1;
+    attr.ah_attr.port_num = cfg->ib_port;
+    if (handle->gid_index >= 0) {
+        // RoCE (or routed IB): address the peer by GID through a GRH
+        attr.ah_attr.is_global = 1;
+        attr.ah_attr.grh.dgid = remote->gid;
+        attr.ah_attr.grh.sgid_index = handle->gid_index;
+        attr.ah_attr.grh.hop_limit = 64;
+        attr.ah_attr.grh.traffic_class = cls->traffic_class;
+    } else {
+        attr.ah_attr.is_global = 0;
+    }
 
     flags = IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
             IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
@@ -128,10 +225,10 @@ static int connect_qp(struct ibv_qp *qp, qp_info_t *local, qp_info_t *remote) {
     memset(&attr, 0, sizeof(attr));
     attr.qp_state = IBV_QPS_RTS;
     attr.sq_psn = local->psn;
-    attr.timeout = 14;
-    attr.retry_cnt = 7;
-    attr.rnr_retry = 7;
-    attr.max_rd_atomic = 1;
+    attr.timeout = cfg->timeout;
+    attr.retry_cnt = cfg->retry_cnt;
+    attr.rnr_retry = cfg->rnr_retry;
+    attr.max_rd_atomic = handle->rd_atomic;
     flags = IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
             IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC;
 
@@ -144,12 +241,29 @@ static int connect_qp(struct ibv_qp *qp, qp_info_t *local, qp_info_t *remote) {
 }
 
 static int open_rdma_device(PGHandle *pg_handle) {
-    struct ibv_device **dev_list = ibv_get_device_list(NULL);
-    if (!dev_list) {
+    int num_devices = 0;
+    struct ibv_device **dev_list = ibv_get_device_list(&num_devices);
+    if (!dev_list || num_devices == 0) {
         fprintf(stderr, "Failed to get RDMA devices list\n");
+        if (dev_list) ibv_free_device_list(dev_list);
         return -1;
     }
-    pg_handle->ctx = ibv_open_device(dev_list[0]); // Open the first device
+    struct ibv_device *device = dev_list[0]; // Default to the first device
+    if (pg_handle->config.device[0] != '\0') {
+        device = NULL;
+        for (int i = 0; i < num_devices; ++i) {
+            if (strcmp(ibv_get_device_name(dev_list[i]), pg_handle->config.device) == 0) {
+                device = dev_list[i];
+                break;
+            }
+        }
+        if (!device) {
+            fprintf(stderr, "RDMA device %s not found\n", pg_handle->config.device);
+            ibv_free_device_list(dev_list);
+            return -1;
+        }
+    }
+    pg_handle->ctx = ibv_open_device(device);
     ibv_free_device_list(dev_list);
     if (!pg_handle->ctx) {
         fprintf(stderr, "Failed to open RDMA device\n");
@@ -157,91 +271,225 @@ static int open_rdma_device(PGHandle *pg_handle) {
     }
     return 0;
 }
+
+// Pick the GID index used for addressing. InfiniBand ports use LIDs unless a
+// GID index is configured; Ethernet (RoCE) ports always need a GID, and
+// default to the first RoCE v2 entry, preferring IPv4-mapped addresses.
+static int resolve_gid_index(PGHandle *handle) {
+    struct ibv_port_attr port_attr;
+    if (ibv_query_port(handle->ctx, handle->config.ib_port, &port_attr)) {
+        fprintf(stderr, "Failed to query port %d\n", handle->config.ib_port);
+        return -1;
+    }
+    handle->active_mtu = port_attr.active_mtu;
+    handle->gid_index = handle->config.gid_index;
+    if (handle->gid_index >= 0 || port_attr.link_layer != IBV_LINK_LAYER_ETHERNET) {
+        return 0;
+    }
+
+    int fallback = -1;
+    for (int i = 0; i < port_attr.gid_tbl_len; ++i) {
+        struct ibv_gid_entry entry;
+        if (ibv_query_gid_ex(handle->ctx, handle->config.ib_port, i, &entry, 0)) continue;
+        if (entry.gid_type != IBV_GID_TYPE_ROCE_V2) continue;
+        const uint8_t *raw = entry.gid.raw;
+        int ipv4_mapped = raw[10] == 0xff && raw[11] == 0xff &&
+                          !raw[0] && !raw[1] && !raw[2] && !raw[3] && !raw[4] &&
+                          !raw[5] && !raw[6] && !raw[7] && !raw[8] && !raw[9];
+        if (ipv4_mapped) {
+            handle->gid_index = i;
+            return 0;
+        }
+        if (fallback < 0) fallback = i;
+    }
+    if (fallback < 0) {
+        fprintf(stderr, "No RoCE v2 GID found on port %d; set PG_GID_INDEX\n", handle->config.ib_port);
+        return -1;
+    }
+    handle->gid_index = fallback;
+    return 0;
+}
  
 
 
 
 // Helper: Allocate and initialize PGHandle
-static PGHandle* allocate_pg_handle(char **server_list, int size, int rank) {
+static PGHandle* allocate_pg_handle(char **server_list, int size, int rank, const pg_config_t *config) {
     PGHandle *handle = (PGHandle *)calloc(1, sizeof(PGHandle));
     if (!handle) return NULL;
     handle->rank = rank;
     handle->num_servers = size;
     handle->servernames = server_list;
+    handle->config = *config;
+    handle->gid_index = -1;
+    handle->numa_node = -1;
+    handle->fusion_bucket_bytes = config->fusion_bucket_bytes;
     handle->remote_rkeys = calloc(size, sizeof(uint32_t));
     handle->remote_addrs = calloc(size, sizeof(uintptr_t));
+    handle->remote_ctrl_rkeys = calloc(size, sizeof(uint32_t));
+    handle->remote_ctrl_addrs = calloc(size, sizeof(uintptr_t));
+    handle->remote_send_rkeys = calloc(size, sizeof(uint32_t));
+    handle->remote_send_addrs = calloc(size, sizeof(uintptr_t));
+    handle->peers = calloc(size, sizeof(pg_peer_t));
+    handle->ring_order = calloc(size, sizeof(int));
+    handle->num_rings = config->num_rings;
+    handle->mesh_listen_fd = -1;
+    pthread_mutex_init(&handle->mesh_lock, NULL);
+    pthread_mutex_init(&handle->user_mr_lock, NULL);
+    pg_pool_init(handle);
+    for (int c = 0; c < PG_NUM_PRIORITIES; ++c) {
+        pg_traffic_class_t *cls = &handle->classes[c];
+        pthread_mutex_init(&cls->post_lock, NULL);
+        pthread_mutex_init(&cls->cq_lock, NULL);
+        cls->sl = c == PG_PRIORITY_HIGH ? config->sl_high : config->sl;
+        cls->traffic_class = c == PG_PRIORITY_HIGH ? config->traffic_class_high : config->traffic_class;
+    }
+    for (int i = 0; i < PG_MAX_SLOTS * PG_MAX_RINGS; ++i) {
+        handle->slots[i].index = i;
+        handle->slots[i].ring = i / PG_MAX_SLOTS;
+        handle->slots[i].tag = -1;
+        handle->slots[i].trace_step = -1;
+        pthread_mutex_init(&handle->slots[i].lock, NULL);
+    }
     return handle;
 }
 
-// Helper: Setup RDMA device, PD, CQ, QPs
-static int setup_rdma_resources(PGHandle *handle) {
-    if (open_rdma_device(handle) != 0) return -1;
-    handle->pd = ibv_alloc_pd(handle->ctx);
-    if (!handle->pd) return -1;
-    handle->cq = ibv_create_cq(handle->ctx, 16, NULL, NULL, 0);
-    if (!handle->cq) return -1;
-    handle->qps = calloc(2, sizeof(struct ibv_qp *));
-    if (!handle->qps) return -1;
+// Helper: Outstanding RDMA read / atomic depths (the configured value capped by
+// the device, or the device maximum), remote atomic support and SGEs per WR
+static int query_device_limits(PGHandle *handle) {
+    struct ibv_device_attr dev_attr;
+    if (ibv_query_device(handle->ctx, &dev_attr)) {
+        fprintf(stderr, "Failed to query RDMA device\n");
+        return -1;
+    }
+    int want = handle->config.max_rd_atomic;
+    handle->rd_atomic = MAX(want > 0 ? MIN(want, dev_attr.max_qp_init_rd_atom) : dev_attr.max_qp_init_rd_atom, 1);
+    handle->dest_rd_atomic = MAX(want > 0 ? MIN(want, dev_attr.max_qp_rd_atom) : dev_attr.max_qp_rd_atom, 1);
+    handle->atomic_supported = dev_attr.atomic_cap != IBV_ATOMIC_NONE;
+    handle->max_send_sge = MAX(MIN(dev_attr.max_sge, PG_MAX_SEND_SGE), 1);
+    return 0;
+}
+
+// Helper: Create an RC QP on the handle's PD and the CQ of a traffic class,
+// taking inline sends of up to 'max_inline' bytes
+static struct ibv_qp *create_qp(PGHandle *handle, pg_priority_t priority, uint32_t max_inline) {
     struct ibv_qp_init_attr qp_init_attr = {
-        .send_cq = handle->cq,
-        .recv_cq = handle->cq,
+        .send_cq = handle->classes[priority].cq,
+        .recv_cq = handle->classes[priority].cq,
         .cap = {
-            .max_send_wr = 16,
-            .max_recv_wr = 16,
-            .max_send_sge = 1,
+            .max_send_wr = handle->config.qp_depth,
+            .max_recv_wr = handle->config.qp_depth,
+            .max_send_sge = handle->max_send_sge,
             .max_recv_sge = 1,
+            .max_inline_data = max_inline,
         },
         .qp_type = IBV_QPT_RC,
     };
-    for (int i = 0; i < 2; ++i) {
-        handle->qps[i] = ibv_create_qp(handle->pd, &qp_init_attr);
-        if (!handle->qps[i]) return -1;
+    return ibv_create_qp(handle->pd, &qp_init_attr);
+}
+
+// Helper: Setup RDMA device, PD, and the CQ and ring QPs of every traffic class
+static int setup_rdma_resources(PGHandle *handle) {
+    if (open_rdma_device(handle) != 0) return -1;
+    if (resolve_gid_index(handle) != 0) return -1;
+    if (query_device_limits(handle) != 0) return -1;
+    pg_latency_setup(handle);
+    handle->pd = ibv_alloc_pd(handle->ctx);
+    if (!handle->pd) return -1;
+    for (int c = 0; c < PG_NUM_PRIORITIES; ++c) {
+        pg_traffic_class_t *cls = &handle->classes[c];
+        cls->cq = pg_latency_create_cq(handle, cls);
+        if (!cls->cq) return -1;
+        for (int i = 0; i < 2; ++i) {
+            cls->qps[i] = create_qp(handle, c, 0);
+            if (!cls->qps[i]) return -1;
+        }
     }
     return 0;
 }
 
-// Helper: Exchange QP info with neighbors
-static int exchange_qp_info(PGHandle *handle, qp_info_t myinfo[2], qp_info_t *left_info, qp_info_t *right_info) {
+// Helper: Fill the addressing info of a local QP (port LID, GID, MTU)
+static int local_qp_info(PGHandle *handle, struct ibv_qp *qp, uint32_t psn, qp_info_t *info) {
     struct ibv_port_attr port_attr;
-    ibv_query_port(handle->ctx, 1, &port_attr);
-    for (int i = 0; i < 2; ++i) {
-        myinfo[i].lid = port_attr.lid;
-        myinfo[i].qpn = handle->qps[i]->qp_num;
-        myinfo[i].psn = 100 + handle->rank * 10 + i;
-    }
-    int left = (handle->rank - 1 + handle->num_servers) % handle->num_servers;
-    int right = (handle->rank + 1) % handle->num_servers;
+    if (ibv_query_port(handle->ctx, handle->config.ib_port, &port_attr)) {
+        fprintf(stderr, "Failed to query port %d\n", handle->config.ib_port);
+        return -1;
+    }
+    memset(info, 0, sizeof(qp_info_t));
+    if (handle->gid_index >= 0 &&
+        ibv_query_gid(handle->ctx, handle->config.ib_port, handle->gid_index, &info->gid)) {
+        fprintf(stderr, "Failed to query GID %d\n", handle->gid_index);
+        return -1;
+    }
+    info->lid = port_attr.lid;
+    info->qpn = qp->qp_num;
+    info->psn = psn;
+    info->mtu = port_attr.active_mtu;
+    return 0;
+}
+
+// Helper: Exchange QP info with neighbors, one entry per traffic class:
+// to_left / to_right describe our left / right QPs, from_left / from_right
+// receive the matching QPs of the neighbors
+static int exchange_qp_info(PGHandle *handle, qp_info_t to_left[PG_NUM_PRIORITIES],
+                            qp_info_t to_right[PG_NUM_PRIORITIES], qp_info_t from_left[PG_NUM_PRIORITIES],
+                            qp_info_t from_right[PG_NUM_PRIORITIES]) {
+    for (int c = 0; c < PG_NUM_PRIORITIES; ++c) {
+        uint32_t psn = 100 + handle->rank * 10 + c * 2;
+        if (local_qp_info(handle, handle->classes[c].qps[0], psn, &to_left[c]) != 0 ||
+            local_qp_info(handle, handle->classes[c].qps[1], psn + 1, &to_right[c]) != 0) {
+            return -1;
+        }
+    }
+    size_t bytes = PG_NUM_PRIORITIES * sizeof(qp_info_t);
+    int right = handle->right_rank;
     int sock_left, sock_right;
-    if (handle->rank == 0) {
-        sock_right = tcp_connect(handle->servernames[right], QP_EXCHANGE_PORT_BASE + ((handle->rank + 1) % handle->num_servers));
+    if (handle->ring_pos == 0) {
+        sock_right = tcp_connect(handle->servernames[right], service_port(handle, PG_PORT_QP, right));
         if (sock_right < 0) return -1;
-        write(sock_right, &myinfo[1], sizeof(qp_info_t));
-        read(sock_right, right_info, sizeof(qp_info_t));
+        write(sock_right, to_right, bytes);
+        read(sock_right, from_right, bytes);
         close(sock_right);
-        sock_left = tcp_listen_accept(QP_EXCHANGE_PORT_BASE + handle->rank);
+        sock_left = tcp_listen_accept(service_port(handle, PG_PORT_QP, handle->rank));
         if (sock_left < 0) return -1;
-        read(sock_left, left_info, sizeof(qp_info_t));
-        write(sock_left, &myinfo[0], sizeof(qp_info_t));
+        read(sock_left, from_left, bytes);
+        write(sock_left, to_left, bytes);
         close(sock_left);
     } else {
-        sock_left = tcp_listen_accept(QP_EXCHANGE_PORT_BASE + handle->rank);
+        sock_left = tcp_listen_accept(service_port(handle, PG_PORT_QP, handle->rank));
         if (sock_left < 0) return -1;
-        read(sock_left, left_info, sizeof(qp_info_t));
-        write(sock_left, &myinfo[0], sizeof(qp_info_t));
+        read(sock_left, from_left, bytes);
+        write(sock_left, to_left, bytes);
         close(sock_left);
-        sock_right = tcp_connect(handle->servernames[right], QP_EXCHANGE_PORT_BASE + ((handle->rank + 1) % handle->num_servers));
+        sock_right = tcp_connect(handle->servernames[right], service_port(handle, PG_PORT_QP, right));
         if (sock_right < 0) return -1;
-        write(sock_right, &myinfo[1], sizeof(qp_info_t));
-        read(sock_right, right_info, sizeof(qp_info_t));
+        write(sock_right, to_right, bytes);
+        read(sock_right, from_right, bytes);
         close(sock_right);
     }
     return 0;
 }
 
+// Helper: Pick the NUMA node for registered memory relative to the NIC's node
+static int select_numa_node(PGHandle *handle) {
+    if (handle->config.numa_placement == PG_NUMA_NONE) return -1;
+    int nic_node = pg_numa_device_node(handle->ctx);
+    if (nic_node < 0) return -1;
+    if (handle->config.numa_placement == PG_NUMA_LOCAL) return nic_node;
+
+    int num_nodes = pg_numa_num_nodes();
+    if (num_nodes < 2) {
+        fprintf(stderr, "Warning: single NUMA node, remote placement unavailable\n");
+        return -1;
+    }
+    return (nic_node + 1) % num_nodes;
+}
+
 // Helper: Register send/recv buffers
 static int register_buffers(PGHandle *handle) {
-    handle->bufsize = RDMA_BUFFER_SIZE;
-    handle->sendbuf = malloc(handle->bufsize);
+    handle->numa_node = select_numa_node(handle);
+    handle->bufsize = handle->config.buffer_size;
+    handle->sendbuf = pg_numa_alloc(handle->bufsize, handle->numa_node);
     if (!handle->sendbuf) return -1;
     handle->mr_send = ibv_reg_mr(
         handle->pd,
@@ -252,7 +500,7 @@ static int register_buffers(PGHandle *handle) {
     if (!handle->mr_send) return -1;
     handle->local_rkey = handle->mr_send->rkey;
     handle->local_addr = (uintptr_t)handle->sendbuf;
-    handle->recvbuf = malloc(handle->bufsize);
+    handle->recvbuf = pg_numa_alloc(handle->bufsize, handle->numa_node);
     if (!handle->recvbuf) return -1;
     handle->mr_recv = ibv_reg_mr(
         handle->pd,
@@ -261,27 +509,66 @@ static int register_buffers(PGHandle *handle) {
         IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ
     );
     if (!handle->mr_recv) return -1;
+
+    // Control region: one cache-line sized flag block per slot and reverse lane
+    handle->ctrl_size = PG_MAX_SLOTS * PG_MAX_RINGS * sizeof(pg_slot_ctrl_t);
+    handle->ctrl = pg_numa_alloc(handle->ctrl_size, handle->numa_node);
+    if (!handle->ctrl) return -1;
+    handle->mr_ctrl = ibv_reg_mr(
+        handle->pd,
+        handle->ctrl,
+        handle->ctrl_size,
+        IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ
+    );
+    if (!handle->mr_ctrl) return -1;
+
+    // Split the staging buffers into equal slots for concurrent collectives:
+    // the bulk slots first, then the ones reserved for high priority
+    handle->num_slots = handle->config.num_slots;
+    handle->num_high_slots = handle->config.num_high_slots;
+    int total_slots = handle->num_slots + handle->num_high_slots;
+    size_t slot_size = handle->bufsize / total_slots;
+    for (int i = 0; i < total_slots; ++i) {
+        pg_slot_t *slot = &handle->slots[i];
+        slot->priority = i < handle->num_slots ? PG_PRIORITY_BULK : PG_PRIORITY_HIGH;
+        slot->offset = i * slot_size;
+        slot->size = slot_size;
+        slot->sendbuf = (char *)handle->sendbuf + slot->offset;
+        slot->recvbuf = (char *)handle->recvbuf + slot->offset;
+
+        // The reverse lane borrows the second half of the slot's staging
+        pg_slot_t *lane = &handle->slots[PG_MAX_SLOTS + i];
+        lane->priority = slot->priority;
+        lane->size = slot_size / 2;
+        lane->offset = slot->offset + slot_size - lane->size;
+        lane->sendbuf = (char *)handle->sendbuf + lane->offset;
+        lane->recvbuf = (char *)handle->recvbuf + lane->offset;
+    }
     return 0;
 }
 
 // Helper: Exchange memory region info
 static int exchange_mr_info(PGHandle *handle) {
-    // Calculate left and right neighbor indices in the ring
-    int left = (handle->rank - 1 + handle->num_servers) % handle->num_servers;
-    int right = (handle->rank + 1) % handle->num_servers;
+    // Left and right neighbor ranks in the ring order
+    int left = handle->left_rank;
+    int right = handle->right_rank;
 
     // Prepare my memory region info to send
     mr_info_t my_mrinfo, right_mrinfo, left_mrinfo;
     my_mrinfo.rkey = handle->mr_recv->rkey;
     my_mrinfo.addr = (uintptr_t)handle->recvbuf;
+    my_mrinfo.ctrl_rkey = handle->mr_ctrl->rkey;
+    my_mrinfo.ctrl_addr = (uintptr_t)handle->ctrl;
+    my_mrinfo.send_rkey = handle->mr_send->rkey;
+    my_mrinfo.send_addr = (uintptr_t)handle->sendbuf;
 
     int sock_left, sock_right;
 
-    // Rank 0: connect to right neighbor first, then accept from left
+    // Ring position 0: connect to right neighbor first, then accept from left
     // Other ranks: accept from left first, then connect to right
-    if (handle->rank == 0) {
+    if (handle->ring_pos == 0) {
         // Connect to right neighbor and exchange MR info
-        sock_right = tcp_connect(handle->servernames[right], MR_EXCHANGE_PORT_BASE + ((handle->rank + 1) % handle->num_servers));
+        sock_right = tcp_connect(handle->servernames[right], service_port(handle, PG_PORT_MR, right));
         if (sock_right < 0) return -1;
         // Send my MR info, receive right neighbor's MR info
         write(sock_right, &my_mrinfo, sizeof(mr_info_t));
@@ -290,9 +577,13 @@ static int exchange_mr_info(PGHandle *handle) {
         // Store right neighbor's MR info
         handle->remote_rkeys[right] = right_mrinfo.rkey;
         handle->remote_addrs[right] = right_mrinfo.addr;
+        handle->remote_ctrl_rkeys[right] = right_mrinfo.ctrl_rkey;
+        handle->remote_ctrl_addrs[right] = right_mrinfo.ctrl_addr;
+        handle->remote_send_rkeys[right] = right_mrinfo.send_rkey;
+        handle->remote_send_addrs[right] = right_mrinfo.send_addr;
 
         // Accept connection from left neighbor and exchange MR info
-        sock_left = tcp_listen_accept(MR_EXCHANGE_PORT_BASE + handle->rank);
+        sock_left = tcp_listen_accept(service_port(handle, PG_PORT_MR, handle->rank));
         if (sock_left < 0) return -1;
         // Receive left neighbor's MR info, send my MR info
         read(sock_left, &left_mrinfo, sizeof(mr_info_t));
@@ -301,9 +592,13 @@ static int exchange_mr_info(PGHandle *handle) {
         // Store left neighbor's MR info
         handle->remote_rkeys[left] = left_mrinfo.rkey;
         handle->remote_addrs[left] = left_mrinfo.addr;
+        handle->remote_ctrl_rkeys[left] = left_mrinfo.ctrl_rkey;
+        handle->remote_ctrl_addrs[left] = left_mrinfo.ctrl_addr;
+        handle->remote_send_rkeys[left] = left_mrinfo.send_rkey;
+        handle->remote_send_addrs[left] = left_mrinfo.send_addr;
     } else {
         // Accept connection from left neighbor and exchange MR info
-        sock_left = tcp_listen_accept(MR_EXCHANGE_PORT_BASE + handle->rank);
+        sock_left = tcp_listen_accept(service_port(handle, PG_PORT_MR, handle->rank));
         if (sock_left < 0) return -1;
         // Receive left neighbor's MR info, send my MR info
         read(sock_left, &left_mrinfo, sizeof(mr_info_t));
@@ -312,9 +607,13 @@ static int exchange_mr_info(PGHandle *handle) {
         // Store left neighbor's MR info
         handle->remote_rkeys[left] = left_mrinfo.rkey;
         handle->remote_addrs[left] = left_mrinfo.addr;
+        handle->remote_ctrl_rkeys[left] = left_mrinfo.ctrl_rkey;
+        handle->remote_ctrl_addrs[left] = left_mrinfo.ctrl_addr;
+        handle->remote_send_rkeys[left] = left_mrinfo.send_rkey;
+        handle->remote_send_addrs[left] = left_mrinfo.send_addr;
 
         // Connect to right neighbor and exchange MR info
-        sock_right = tcp_connect(handle->servernames[right], MR_EXCHANGE_PORT_BASE + ((handle->rank + 1) % handle->num_servers));
+        sock_right = tcp_connect(handle->servernames[right], service_port(handle, PG_PORT_MR, right));
         if (sock_right < 0) return -1;
         // Send my MR info, receive right neighbor's MR info
         write(sock_right, &my_mrinfo, sizeof(mr_info_t));
@@ -323,6 +622,10 @@ static int exchange_mr_info(PGHandle *handle) {
         // Store right neighbor's MR info
         handle->remote_rkeys[right] = right_mrinfo.rkey;
         handle->remote_addrs[right] = right_mrinfo.addr;
+        handle->remote_ctrl_rkeys[right] = right_mrinfo.ctrl_rkey;
+        handle->remote_ctrl_addrs[right] = right_mrinfo.ctrl_addr;
+        handle->remote_send_rkeys[right] = right_mrinfo.send_rkey;
+        handle->remote_send_addrs[right] = right_mrinfo.send_addr;
     }
 
     // Success
@@ -331,28 +634,492 @@ static int exchange_mr_info(PGHandle *handle) {
 
 // Helper: Final resource check
 static int final_resource_check(PGHandle *handle) {
-    if (!handle->ctx || !handle->pd || !handle->cq || !handle->qps ||
+    for (int c = 0; c < PG_NUM_PRIORITIES; ++c) {
+        if (!handle->classes[c].cq || !handle->classes[c].qps[0] || !handle->classes[c].qps[1]) {
+            return -1;
+        }
+    }
+    if (!handle->ctx || !handle->pd ||
         !handle->mr_send || !handle->mr_recv || !handle->sendbuf || !handle->recvbuf ||
-        !handle->remote_rkeys || !handle->remote_addrs) {
+        !handle->mr_ctrl || !handle->ctrl ||
+        !handle->remote_rkeys || !handle->remote_addrs ||
+        !handle->remote_ctrl_rkeys || !handle->remote_ctrl_addrs ||
+        !handle->remote_send_rkeys || !handle->remote_send_addrs || !handle->peers ||
+        !handle->ring_order) {
         return -1;
     }
     return 0;
 }
 
+////////////////////////// Lazy mesh //////////////////////////
+
+// Handshake of a mesh connection, sent by both sides
+typedef struct {
+    int rank;
+    int priority;         /* traffic class the QP belongs to */
+    qp_info_t qp;
+    uint32_t mesh_rkey;
+    uintptr_t mesh_addr;
+} peer_info_t;
+
+// Helper: Allocate and register the mesh region (flag blocks, atomic areas
+// and barrier flags, then send / recv staging)
+static int register_mesh_region(PGHandle *handle) {
+    size_t ctrl_bytes = (size_t)PG_MAX_SLOTS * handle->num_servers * sizeof(pg_peer_ctrl_t);
+    handle->mesh_atomic_offset = (ctrl_bytes + 63) & ~(size_t)63;
+    ctrl_bytes = handle->mesh_atomic_offset + PG_MAX_SLOTS * sizeof(pg_atomic_area_t);
+    handle->mesh_barrier_offset = (ctrl_bytes + 63) & ~(size_t)63;
+    ctrl_bytes = handle->mesh_barrier_offset + PG_MAX_SLOTS * sizeof(pg_barrier_area_t);
+    handle->mesh_ctrl_size = (ctrl_bytes + 4095) & ~(size_t)4095;
+    handle->mesh_size = handle->mesh_ctrl_size + 2 * handle->bufsize;
+    handle->mesh_region = pg_numa_alloc(handle->mesh_size, handle->numa_node);
+    if (!handle->mesh_region) return -1;
+    int access = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ;
+    if (handle->atomic_supported) {
+        access |= IBV_ACCESS_REMOTE_ATOMIC;
+    }
+    handle->mr_mesh = ibv_reg_mr(handle->pd, handle->mesh_region, handle->mesh_size, access);
+    if (!handle->mr_mesh) {
+        pg_numa_free(handle->mesh_region, handle->mesh_size);
+        handle->mesh_region = NULL;
+        return -1;
+    }
+    handle->mesh_ctrl = (pg_peer_ctrl_t *)handle->mesh_region;
+    handle->mesh_atomic = (pg_atomic_area_t *)((char *)handle->mesh_region + handle->mesh_atomic_offset);
+    handle->mesh_barrier = (pg_barrier_area_t *)((char *)handle->mesh_region + handle->mesh_barrier_offset);
+    return 0;
+}
+
+// Helper: Create a QP of class 'priority' for 'peer' (or, when peer < 0, for
+// the rank and class announced in the handshake), exchange handshakes on
+// 'sock' and connect. The side that accepted replies to the handshake; both
+// confirm the QP is ready with one byte before it is used, so no write can
+// reach a QP that is not yet in RTR.
+static int connect_peer_on_socket(PGHandle *handle, int sock, int peer, pg_priority_t priority) {
+    int accepted = peer < 0;
+    peer_info_t mine, theirs;
+    int ret = 0;
+    if (accepted) {
+        // The class of the QP to create is only known from the handshake
+        ret = tcp_read_full(sock, &theirs, sizeof(theirs));
+        if (ret == 0) {
+            peer = theirs.rank;
+            priority = theirs.priority;
+        }
+        if (ret == 0 && (peer <= handle->rank || peer >= handle->num_servers ||
+                         (int)priority < 0 || priority >= PG_NUM_PRIORITIES ||
+                         handle->peers[peer].qps[priority])) {
+            fprintf(stderr, "Rank %d: unexpected mesh connection from rank %d\n", handle->rank, peer);
+            ret = -1;
+        }
+        if (ret != 0) return -1;
+    }
+    // Inline for the barrier flags; a device that cannot inline that much
+    // gets a plain QP, and the flags go out as ordinary writes
+    int inline_ok = 1;
+    struct ibv_qp *qp = create_qp(handle, priority, PG_MAX_INLINE);
+    if (!qp) {
+        inline_ok = 0;
+        qp = create_qp(handle, priority, 0);
+    }
+    if (!qp) return -1;
+
+    memset(&mine, 0, sizeof(mine));
+    mine.rank = handle->rank;
+    mine.priority = priority;
+    mine.mesh_rkey = handle->mr_mesh->rkey;
+    mine.mesh_addr = (uintptr_t)handle->mesh_region;
+    ret = local_qp_info(handle, qp, 1000 + handle->rank * PG_NUM_PRIORITIES + priority, &mine.qp);
+    if (ret == 0 && accepted) {
+        ret = tcp_write_full(sock, &mine, sizeof(mine));
+    } else if (ret == 0) {
+        ret = tcp_write_full(sock, &mine, sizeof(mine));
+        if (ret == 0) ret = tcp_read_full(sock, &theirs, sizeof(theirs));
+        if (ret == 0 && (theirs.rank != peer || theirs.priority != (int)priority)) ret = -1;
+    }
+    if (ret == 0) ret = connect_qp(handle, qp, &mine.qp, &theirs.qp, priority);
+
+    char ready = 1;
+    if (ret == 0) ret = tcp_write_full(sock, &ready, 1);
+    if (ret == 0) ret = tcp_read_full(sock, &ready, 1);
+    if (ret != 0) {
+        fprintf(stderr, "Rank %d: failed to connect mesh QP\n", handle->rank);
+        ibv_destroy_qp(qp);
+        return -1;
+    }
+
+    handle->peers[peer].mesh_rkey = theirs.mesh_rkey;
+    handle->peers[peer].mesh_addr = theirs.mesh_addr;
+    handle->peers[peer].qps[priority] = qp;
+    handle->peers[peer].inline_ok[priority] = inline_ok;
+    return 0;
+}
+
+int pg_connect_peers(PGHandle *handle, const char *needed, pg_priority_t priority) {
+    int ret = 0;
+    pthread_mutex_lock(&handle->mesh_lock);
+    if (!handle->mesh_region && register_mesh_region(handle) != 0) {
+        fprintf(stderr, "Rank %d: failed to register mesh region\n", handle->rank);
+        ret = -1;
+    }
+
+    // Connect to the lower ranks, then accept the higher ones. Rank 0 only
+    // accepts, so every connect eventually finds its peer accepting.
+    for (int p = 0; ret == 0 && p < handle->rank; ++p) {
+        if (!needed[p] || handle->peers[p].qps[priority]) continue;
+        int sock = tcp_connect(handle->servernames[p], service_port(handle, PG_PORT_MESH, p));
+        if (sock < 0) {
+            ret = -1;
+            break;
+        }
+        ret = connect_peer_on_socket(handle, sock, p, priority);
+        close(sock);
+    }
+    for (int p = handle->rank + 1; ret == 0 && p < handle->num_servers; ++p) {
+        // Connections (of either class) arrive in any order; keep accepting
+        // until 'p' is there in our class
+        while (ret == 0 && needed[p] && !handle->peers[p].qps[priority]) {
+            if (handle->mesh_listen_fd < 0) {
+                fprintf(stderr, "Rank %d: no mesh listener on port %d\n", handle->rank,
+                        service_port(handle, PG_PORT_MESH, handle->rank));
+                ret = -1;
+                break;
+            }
+            int sock = accept(handle->mesh_listen_fd, NULL, NULL);
+            if (sock < 0) {
+                ret = -1;
+                break;
+            }
+            ret = connect_peer_on_socket(handle, sock, -1, priority);
+            close(sock);
+        }
+    }
+    pthread_mutex_unlock(&handle->mesh_lock);
+    return ret;
+}
+
+////////////////////////// Ring order //////////////////////////
+
+/* Topology probe per pair: round trips for the latency, then a stream of
+ * PG_PROBE_BYTES for the bandwidth */
+#define PG_PROBE_PINGS 32
+#define PG_PROBE_BYTES (1024 * 1024)
+
+// Probe listener of one rank, serving the sessions of the lower ranks
+typedef struct {
+    int listen_fd;
+    int sessions;
+    int ret;
+} probe_server_t;
+
+static double probe_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Echo the pings of one session, then acknowledge the streamed bytes
+static int serve_probe_session(int sock, char *scratch) {
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char byte;
+    for (int i = 0; i < PG_PROBE_PINGS; ++i) {
+        if (tcp_read_full(sock, &byte, 1) != 0 || tcp_write_full(sock, &byte, 1) != 0) return -1;
+    }
+    if (tcp_read_full(sock, scratch, PG_PROBE_BYTES) != 0) return -1;
+    return tcp_write_full(sock, &byte, 1);
+}
+
+static void *probe_server_thread(void *arg) {
+    probe_server_t *server = (probe_server_t *)arg;
+    char *scratch = malloc(PG_PROBE_BYTES);
+    server->ret = scratch ? 0 : -1;
+    for (int i = 0; i < server->sessions && server->ret == 0; ++i) {
+        int sock = accept(server->listen_fd, NULL, NULL);
+        if (sock < 0 || serve_probe_session(sock, scratch) != 0) server->ret = -1;
+        if (sock >= 0) close(sock);
+    }
+    free(scratch);
+    return NULL;
+}
+
+// Cost of the link to a higher rank: half the best round trip plus the time
+// to stream and acknowledge PG_PROBE_BYTES, in microseconds
+static int probe_peer(PGHandle *handle, int peer, const char *scratch, double *cost) {
+    int sock = tcp_connect(handle->servernames[peer], service_port(handle, PG_PORT_PROBE, peer));
+    if (sock < 0) return -1;
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int ret = 0;
+    char byte = 0;
+    double best_rtt = 0;
+    for (int i = 0; i < PG_PROBE_PINGS && ret == 0; ++i) {
+        double start = probe_now_us();
+        if (tcp_write_full(sock, &byte, 1) != 0 || tcp_read_full(sock, &byte, 1) != 0) ret = -1;
+        double rtt = probe_now_us() - start;
+        if (i == 0 || rtt < best_rtt) best_rtt = rtt;
+    }
+    double start = probe_now_us();
+    if (ret == 0 && (tcp_write_full(sock, scratch, PG_PROBE_BYTES) != 0 ||
+                     tcp_read_full(sock, &byte, 1) != 0)) {
+        ret = -1;
+    }
+    *cost = best_rtt / 2 + (probe_now_us() - start);
+    close(sock);
+    return ret;
+}
+
+// Measure the links to the higher ranks while serving the lower ranks'
+// probes; rank 0 collects the rows, computes the order and sends it back.
+// The probe runs over the TCP bootstrap network, so it only reflects the
+// RDMA fabric when both share the switches (otherwise use a topology file).
+static int probe_ring_order(PGHandle *handle, int *order) {
+    int n = handle->num_servers;
+    int rank = handle->rank;
+    probe_server_t server = {tcp_listen(service_port(handle, PG_PORT_PROBE, rank), n), rank, 0};
+    if (server.listen_fd < 0) {
+        fprintf(stderr, "Rank %d: cannot listen on probe port %d\n", rank,
+                service_port(handle, PG_PORT_PROBE, rank));
+        return -1;
+    }
+    double *cost = calloc((size_t)n * n, sizeof(double));
+    int *socks = calloc(n, sizeof(int));
+    char *scratch = calloc(PG_PROBE_BYTES, 1);
+    pthread_t thread;
+    int thread_started = 0;
+    int ret = 0;
+    if (!cost || !socks || !scratch) {
+        fprintf(stderr, "Memory allocation failed\n");
+        ret = -1;
+    } else if (rank > 0) {
+        if (pthread_create(&thread, NULL, probe_server_thread, &server) != 0) ret = -1;
+        else thread_started = 1;
+    }
+
+    double *row = cost ? cost + (size_t)rank * n : NULL;
+    for (int peer = rank + 1; ret == 0 && peer < n; ++peer) {
+        if (probe_peer(handle, peer, scratch, &row[peer]) != 0) {
+            fprintf(stderr, "Rank %d: topology probe of rank %d failed\n", rank, peer);
+            ret = -1;
+        }
+    }
+
+    if (rank == 0 && ret == 0) {
+        // Collect every rank's row (its links to the higher ranks)
+        for (int i = 1; i < n; ++i) socks[i] = -1;
+        for (int i = 1; ret == 0 && i < n; ++i) {
+            int sock = accept(server.listen_fd, NULL, NULL);
+            int from = -1;
+            if (sock < 0 || tcp_read_full(sock, &from, sizeof(int)) != 0 || from <= 0 || from >= n ||
+                socks[from] >= 0 || tcp_read_full(sock, cost + (size_t)from * n, n * sizeof(double)) != 0) {
+                fprintf(stderr, "Rank 0: bad topology probe report\n");
+                if (sock >= 0) close(sock);
+                ret = -1;
+                break;
+            }
+            socks[from] = sock;
+        }
+        if (ret == 0) {
+            for (int i = 0; i < n; ++i) {
+                for (int j = 0; j < i; ++j) cost[(size_t)i * n + j] = cost[(size_t)j * n + i];
+            }
+            pg_topology_order_from_costs(cost, n, order);
+        }
+        for (int i = 1; i < n; ++i) {
+            if (socks[i] < 0) continue;
+            if (ret == 0 && tcp_write_full(socks[i], order, n * sizeof(int)) != 0) ret = -1;
+            close(socks[i]);
+        }
+    } else if (ret == 0) {
+        int sock = tcp_connect(handle->servernames[0], service_port(handle, PG_PORT_PROBE, 0));
+        if (sock < 0 || tcp_write_full(sock, &rank, sizeof(int)) != 0 ||
+            tcp_write_full(sock, row, n * sizeof(double)) != 0 ||
+            tcp_read_full(sock, order, n * sizeof(int)) != 0) {
+            fprintf(stderr, "Rank %d: did not receive the ring order\n", rank);
+            ret = -1;
+        }
+        if (sock >= 0) close(sock);
+    }
+
+    if (thread_started) {
+        pthread_join(thread, NULL);
+        if (server.ret != 0) ret = -1;
+    }
+    close(server.listen_fd);
+    free(scratch);
+    free(socks);
+    free(cost);
+    return ret;
+}
+
+// Helper: Our position in handle->ring_order and the neighbors around it
+static int set_ring_position(PGHandle *handle) {
+    int n = handle->num_servers;
+    const int *order = handle->ring_order;
+    handle->ring_pos = -1;
+    for (int p = 0; p < n; ++p) {
+        if (order[p] == handle->rank) handle->ring_pos = p;
+    }
+    if (handle->ring_pos < 0) return -1;
+    handle->left_rank = order[(handle->ring_pos - 1 + n) % n];
+    handle->right_rank = order[(handle->ring_pos + 1) % n];
+    return 0;
+}
+
+// Helper: Decide the ring order (the same on every rank) and our neighbors in it
+static int setup_ring_order(PGHandle *handle) {
+    int n = handle->num_servers;
+    int *order = handle->ring_order;
+    if (!order) return -1;
+    int ret = 0;
+    switch (handle->config.ring_order) {
+        case PG_RING_ORDER_FILE:
+            ret = pg_topology_order_from_file(handle->config.topology_file, handle->servernames, n, order);
+            break;
+        case PG_RING_ORDER_PROBE:
+            ret = probe_ring_order(handle, order);
+            break;
+        default:
+            for (int p = 0; p < n; ++p) order[p] = p;
+            break;
+    }
+    if (ret != 0) return -1;
+    return set_ring_position(handle);
+}
+
 int connect_process_group(char **server_list, int size, void **pg_handle, int rank) {
-    PGHandle *handle = allocate_pg_handle(server_list, size, rank);
+    return connect_process_group_ex(server_list, size, pg_handle, rank, NULL);
+}
+
+////////////////////////// Trace clock //////////////////////////
+
+/* Round trips per rank when aligning trace clocks */
+#define PG_CLOCK_PINGS 16
+
+// Answer every ping of one session with rank 0's clock
+static int serve_clock_session(int sock) {
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char byte;
+    for (int i = 0; i < PG_CLOCK_PINGS; ++i) {
+        if (tcp_read_full(sock, &byte, 1) != 0) return -1;
+        uint64_t now = pg_trace_clock_ns();
+        if (tcp_write_full(sock, &now, sizeof(now)) != 0) return -1;
+    }
+    return 0;
+}
+
+// Offset of our trace clock to rank 0's (Cristian's method): rank 0's reading
+// minus the midpoint of the round trip it was taken in, from the shortest
+// round trip. Rank 0 serves the other ranks one after the other.
+static int sync_trace_clock(PGHandle *handle) {
+    handle->trace.clock_offset_ns = 0;
+    if (handle->rank == 0) {
+        int listen_fd = tcp_listen(service_port(handle, PG_PORT_CLOCK, 0), handle->num_servers);
+        if (listen_fd < 0) return -1;
+        int ret = 0;
+        for (int i = 1; i < handle->num_servers && ret == 0; ++i) {
+            int sock = accept(listen_fd, NULL, NULL);
+            if (sock < 0 || serve_clock_session(sock) != 0) ret = -1;
+            if (sock >= 0) close(sock);
+        }
+        close(listen_fd);
+        return ret;
+    }
+
+    int sock = tcp_connect(handle->servernames[0], service_port(handle, PG_PORT_CLOCK, 0));
+    if (sock < 0) return -1;
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = 0;
+    uint64_t best_rtt = UINT64_MAX;
+    for (int i = 0; i < PG_CLOCK_PINGS && ret == 0; ++i) {
+        char byte = 0;
+        uint64_t remote;
+        uint64_t sent = pg_trace_clock_ns();
+        if (tcp_write_full(sock, &byte, 1) != 0 || tcp_read_full(sock, &remote, sizeof(remote)) != 0) {
+            ret = -1;
+            break;
+        }
+        uint64_t received = pg_trace_clock_ns();
+        if (received - sent < best_rtt) {
+            best_rtt = received - sent;
+            handle->trace.clock_offset_ns = (int64_t)(remote - (sent + (received - sent) / 2));
+        }
+    }
+    close(sock);
+    return ret;
+}
+
+// Helper: Allocate a handle with the explicit configuration, or the defaults
+// with the environment overrides for NULL. The handle owns server_list from
+// here on; it is freed on failure too.
+static PGHandle *create_pg_handle(char **server_list, int size, int rank, const pg_config_t *config) {
+    pg_config_t env_config;
+    PGHandle *handle = NULL;
+    if (!config) {
+        pg_config_init(&env_config);
+        if (pg_config_load_env(&env_config) == 0) config = &env_config;
+    } else if (pg_config_validate(config) != 0) {
+        config = NULL;
+    }
+    if (config && check_port_layout(server_list, size, config) == 0) {
+        handle = allocate_pg_handle(server_list, size, rank, config);
+    }
     if (!handle) {
         for (int i = 0; i < size; ++i) free(server_list[i]);
         free(server_list);
+    }
+    return handle;
+}
+
+// Helper: Last steps of a connect, once the ring QPs are up: resource check,
+// mesh listener, tuning table and thread pinning
+static int finish_connect(PGHandle *handle) {
+    if (final_resource_check(handle) != 0) {
+        fprintf(stderr, "Resource allocation or registration failed\n");
+        return -1;
+    }
+    if (pg_trace_init(handle) != 0) {
+        return -1;
+    }
+    // Peers connect to the mesh on demand; listen for the higher ranks now
+    handle->mesh_listen_fd = tcp_listen(service_port(handle, PG_PORT_MESH, handle->rank), handle->num_servers);
+    if (handle->mesh_listen_fd < 0) {
+        fprintf(stderr, "Warning: rank %d cannot listen on mesh port %d, alltoall unavailable\n",
+                handle->rank, service_port(handle, PG_PORT_MESH, handle->rank));
+    }
+    if (handle->config.tuning_file[0] != '\0' &&
+        pg_tuning_load(handle, handle->config.tuning_file) != 0) {
+        fprintf(stderr, "Warning: ignoring tuning file %s, using built-in heuristics\n",
+                handle->config.tuning_file);
+    }
+    if (handle->config.pin_threads && pg_pin_thread(handle) != 0) {
+        fprintf(stderr, "Warning: could not pin thread to NUMA node %d\n", handle->numa_node);
+    }
+    return 0;
+}
+
+int connect_process_group_ex(char **server_list, int size, void **pg_handle, int rank,
+                             const pg_config_t *config) {
+    PGHandle *handle = create_pg_handle(server_list, size, rank, config);
+    if (!handle) {
         return -1;
     }
     *pg_handle = handle;
+    if (setup_ring_order(handle) != 0) {
+        fprintf(stderr, "Rank %d: Failed to set up the ring order\n", rank);
+        pg_close(handle);
+        return -1;
+    }
     if (setup_rdma_resources(handle) != 0) {
         pg_close(handle);
         return -1;
     }
-    qp_info_t myinfo[2], left_info, right_info;
-    if (exchange_qp_info(handle, myinfo, &left_info, &right_info) != 0) {
+    qp_info_t to_left[PG_NUM_PRIORITIES], to_right[PG_NUM_PRIORITIES];
+    qp_info_t from_left[PG_NUM_PRIORITIES], from_right[PG_NUM_PRIORITIES];
+    if (exchange_qp_info(handle, to_left, to_right, from_left, from_right) != 0) {
         pg_close(handle);
         return -1;
     }
@@ -360,24 +1127,349 @@ int connect_process_group(char **server_list, int size, void **pg_handle, int ra
         pg_close(handle);
         return -1;
     }
-    if (connect_qp(handle->qps[0], &myinfo[0], &left_info)) {
+    for (int c = 0; c < PG_NUM_PRIORITIES; ++c) {
+        if (connect_qp(handle, handle->classes[c].qps[0], &to_left[c], &from_left[c], c)) {
+            pg_close(handle);
+            fprintf(stderr, "Failed to connect left QP\n");
+            return -1;
+        }
+        if (connect_qp(handle, handle->classes[c].qps[1], &to_right[c], &from_right[c], c)) {
+            pg_close(handle);
+            fprintf(stderr, "Failed to connect right QP\n");
+            return -1;
+        }
+    }
+    if (exchange_mr_info(handle) != 0 || finish_connect(handle) != 0) {
         pg_close(handle);
-        fprintf(stderr, "Failed to connect left QP\n");
         return -1;
     }
-    if (connect_qp(handle->qps[1], &myinfo[1], &right_info)) {
-        pg_close(handle);
-        fprintf(stderr, "Failed to connect right QP\n");
+    if (handle->trace.events && sync_trace_clock(handle) != 0) {
+        fprintf(stderr, "Warning: rank %d trace clock not aligned to rank 0\n", rank);
+    }
+    return 0;
+}
+
+////////////////////////// Elastic resize //////////////////////////
+
+// Handshake of a rewired ring link, sent by both ends: the QP of every class
+// facing the other end, and our registered regions
+typedef struct {
+    int rank;
+    qp_info_t qp[PG_NUM_PRIORITIES];
+    mr_info_t mr;
+} link_info_t;
+
+// Slot sequence numbers a joining rank adopts from its left neighbor. Every
+// collective advances them identically on all ranks, so the neighbor's
+// values are the group's.
+typedef struct {
+    uint64_t barrier_seq[PG_MAX_SLOTS * PG_MAX_RINGS];
+    uint64_t xfer_seq[PG_MAX_SLOTS * PG_MAX_RINGS];
+} join_state_t;
+
+static int reset_qp(struct ibv_qp *qp) {
+    struct ibv_qp_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RESET;
+    if (ibv_modify_qp(qp, &attr, IBV_QP_STATE)) {
+        perror("Failed to reset QP");
+        return -1;
+    }
+    return 0;
+}
+
+// Helper: Reconnect the ring QPs of one side (0 = left, 1 = right) of every
+// class over 'sock' to the rank at the other end, and store its regions.
+// The QPs are reset and reused, so their CQs and the registrations stay.
+// Both ends confirm with one byte once in RTS, so nothing is written to a QP
+// before its peer can receive. Returns the peer's rank, or -1.
+static int rewire_side(PGHandle *handle, int sock, int side, int expected_peer) {
+    link_info_t mine, theirs;
+    memset(&mine, 0, sizeof(mine));
+    mine.rank = handle->rank;
+    mine.mr.rkey = handle->mr_recv->rkey;
+    mine.mr.addr = (uintptr_t)handle->recvbuf;
+    mine.mr.ctrl_rkey = handle->mr_ctrl->rkey;
+    mine.mr.ctrl_addr = (uintptr_t)handle->ctrl;
+    mine.mr.send_rkey = handle->mr_send->rkey;
+    mine.mr.send_addr = (uintptr_t)handle->sendbuf;
+    for (int c = 0; c < PG_NUM_PRIORITIES; ++c) {
+        struct ibv_qp *qp = handle->classes[c].qps[side];
+        uint32_t psn = 5000 + handle->rank * 10 + c * 2 + side;
+        if (reset_qp(qp) != 0 || local_qp_info(handle, qp, psn, &mine.qp[c]) != 0) return -1;
+    }
+
+    if (tcp_write_full(sock, &mine, sizeof(mine)) != 0 ||
+        tcp_read_full(sock, &theirs, sizeof(theirs)) != 0) {
+        return -1;
+    }
+    if (theirs.rank < 0 || theirs.rank >= handle->num_servers ||
+        (expected_peer >= 0 && theirs.rank != expected_peer)) {
+        fprintf(stderr, "Rank %d: unexpected ring neighbor %d\n", handle->rank, theirs.rank);
         return -1;
     }
-    if (exchange_mr_info(handle) != 0) {
+    for (int c = 0; c < PG_NUM_PRIORITIES; ++c) {
+        if (connect_qp(handle, handle->classes[c].qps[side], &mine.qp[c], &theirs.qp[c], c) != 0) {
+            return -1;
+        }
+    }
+    int peer = theirs.rank;
+    handle->remote_rkeys[peer] = theirs.mr.rkey;
+    handle->remote_addrs[peer] = theirs.mr.addr;
+    handle->remote_ctrl_rkeys[peer] = theirs.mr.ctrl_rkey;
+    handle->remote_ctrl_addrs[peer] = theirs.mr.ctrl_addr;
+    handle->remote_send_rkeys[peer] = theirs.mr.send_rkey;
+    handle->remote_send_addrs[peer] = theirs.mr.send_addr;
+
+    char ready = 1;
+    if (tcp_write_full(sock, &ready, 1) != 0 || tcp_read_full(sock, &ready, 1) != 0) return -1;
+    return peer;
+}
+
+// Helper: Rewire our right side to 'peer' (we are the left end of the link
+// and connect to the peer's QP port). 'join' also hands the peer the ring
+// order and slot state when it is joining the group.
+static int rewire_right(PGHandle *handle, int peer, int join) {
+    int sock = tcp_connect(handle->servernames[peer], service_port(handle, PG_PORT_QP, peer));
+    if (sock < 0) return -1;
+    int ret = rewire_side(handle, sock, 1, peer) < 0 ? -1 : 0;
+    if (ret == 0 && join) {
+        join_state_t state;
+        for (int i = 0; i < PG_MAX_SLOTS * PG_MAX_RINGS; ++i) {
+            state.barrier_seq[i] = handle->slots[i].barrier_seq;
+            state.xfer_seq[i] = handle->slots[i].xfer_seq;
+        }
+        if (tcp_write_full(sock, handle->ring_order, handle->num_servers * sizeof(int)) != 0 ||
+            tcp_write_full(sock, &state, sizeof(state)) != 0) {
+            ret = -1;
+        }
+    }
+    close(sock);
+    return ret;
+}
+
+// Helper: Accept the left end of a rewired link on our QP port; returns the
+// open socket (the joiner reads its state from it) or -1
+static int accept_left(PGHandle *handle) {
+    int listen_fd = tcp_listen(service_port(handle, PG_PORT_QP, handle->rank), 1);
+    if (listen_fd < 0) {
+        fprintf(stderr, "Rank %d: cannot listen on port %d\n", handle->rank,
+                service_port(handle, PG_PORT_QP, handle->rank));
+        return -1;
+    }
+    int sock = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    return sock;
+}
+
+// Helper: Disconnect the lazy mesh and release its region; its flag blocks
+// are laid out by rank and group size, so it reconnects on next use
+static void drop_mesh(PGHandle *handle) {
+    pthread_mutex_lock(&handle->mesh_lock);
+    for (int p = 0; p < handle->num_servers; ++p) {
+        for (int c = 0; c < PG_NUM_PRIORITIES; ++c) {
+            if (handle->peers[p].qps[c] && ibv_destroy_qp(handle->peers[p].qps[c])) {
+                fprintf(stderr, "Failed to destroy mesh QP %d\n", p);
+            }
+        }
+    }
+    memset(handle->peers, 0, handle->num_servers * sizeof(pg_peer_t));
+    if (handle->mr_mesh && ibv_dereg_mr(handle->mr_mesh)) {
+        fprintf(stderr, "Failed to deregister mesh MR\n");
+    }
+    if (handle->mesh_region) {
+        pg_numa_free(handle->mesh_region, handle->mesh_size);
+    }
+    handle->mr_mesh = NULL;
+    handle->mesh_region = NULL;
+    handle->mesh_ctrl = NULL;
+    handle->mesh_atomic = NULL;
+    handle->mesh_barrier = NULL;
+    if (handle->mesh_listen_fd >= 0) {
+        close(handle->mesh_listen_fd);
+        handle->mesh_listen_fd = -1;
+    }
+    pthread_mutex_unlock(&handle->mesh_lock);
+}
+
+// Helper: Move a per-rank array to a group of new_n ranks. Old rank r keeps
+// its entry at r, minus one above 'removed' (-1 when growing); new entries are zero.
+static int remap_rank_array(void **array, size_t elem, int old_n, int new_n, int removed) {
+    char *old = *array;
+    char *fresh = calloc(new_n, elem);
+    if (!fresh) return -1;
+    for (int r = 0; r < old_n; ++r) {
+        if (r == removed) continue;
+        int to = removed >= 0 && r > removed ? r - 1 : r;
+        memcpy(fresh + (size_t)to * elem, old + (size_t)r * elem, elem);
+    }
+    free(old);
+    *array = fresh;
+    return 0;
+}
+
+// Helper: Renumber every rank-indexed table for the new group size (the mesh
+// must be dropped first), then reload the tuning rules of that size
+static int remap_ranks(PGHandle *handle, int new_n, int removed) {
+    int old_n = handle->num_servers;
+    if (remap_rank_array((void **)&handle->remote_rkeys, sizeof(uint32_t), old_n, new_n, removed) != 0 ||
+        remap_rank_array((void **)&handle->remote_addrs, sizeof(uintptr_t), old_n, new_n, removed) != 0 ||
+        remap_rank_array((void **)&handle->remote_ctrl_rkeys, sizeof(uint32_t), old_n, new_n, removed) != 0 ||
+        remap_rank_array((void **)&handle->remote_ctrl_addrs, sizeof(uintptr_t), old_n, new_n, removed) != 0 ||
+        remap_rank_array((void **)&handle->remote_send_rkeys, sizeof(uint32_t), old_n, new_n, removed) != 0 ||
+        remap_rank_array((void **)&handle->remote_send_addrs, sizeof(uintptr_t), old_n, new_n, removed) != 0 ||
+        remap_rank_array((void **)&handle->peers, sizeof(pg_peer_t), old_n, new_n, removed) != 0) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    handle->num_servers = new_n;
+
+    // Costs were indexed by the old ranks; equal chunks until the next exchange
+    free(handle->balance.costs);
+    memset(&handle->balance, 0, sizeof(handle->balance));
+
+    free(handle->tuning_rules);
+    handle->tuning_rules = NULL;
+    handle->num_tuning_rules = 0;
+    if (handle->config.tuning_file[0] != '\0' &&
+        pg_tuning_load(handle, handle->config.tuning_file) != 0) {
+        fprintf(stderr, "Warning: ignoring tuning file %s, using built-in heuristics\n",
+                handle->config.tuning_file);
+    }
+    return 0;
+}
+
+// Helper: Listen for mesh connections on the (possibly renumbered) rank's port
+static void relisten_mesh(PGHandle *handle) {
+    handle->mesh_listen_fd = tcp_listen(service_port(handle, PG_PORT_MESH, handle->rank), handle->num_servers);
+    if (handle->mesh_listen_fd < 0) {
+        fprintf(stderr, "Warning: rank %d cannot listen on mesh port %d, alltoall unavailable\n",
+                handle->rank, service_port(handle, PG_PORT_MESH, handle->rank));
+    }
+}
+
+int pg_grow(PGHandle *handle, const char *hostname) {
+    if (!handle || !hostname || handle->num_servers < 2) {
+        fprintf(stderr, "Invalid parameters for pg_grow\n");
+        return -1;
+    }
+    int n = handle->num_servers;
+    int joiner = n;
+    int first = handle->ring_order[0];
+    int last = handle->ring_order[n - 1];
+
+    // The joiner takes rank n and the ring position after the last one
+    char **names = realloc(handle->servernames, (n + 1) * sizeof(char *));
+    if (names) handle->servernames = names;
+    int *order = realloc(handle->ring_order, (n + 1) * sizeof(int));
+    if (order) handle->ring_order = order;
+    if (!names || !order || !(names[n] = strdup(hostname))) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    order[n] = joiner;
+
+    drop_mesh(handle);
+    if (remap_ranks(handle, n + 1, -1) != 0 || set_ring_position(handle) != 0) return -1;
+    int ret = 0;
+    if (handle->rank == last) {
+        ret = rewire_right(handle, joiner, 1);
+    } else if (handle->rank == first) {
+        int sock = accept_left(handle);
+        ret = sock < 0 || rewire_side(handle, sock, 0, joiner) < 0 ? -1 : 0;
+        if (sock >= 0) close(sock);
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Rank %d: failed to connect joining rank %d\n", handle->rank, joiner);
+        return -1;
+    }
+    relisten_mesh(handle);
+    return 0;
+}
+
+int pg_join(char **server_list, int size, void **pg_handle, const pg_config_t *config) {
+    int rank = size - 1;
+    PGHandle *handle = create_pg_handle(server_list, size, rank, config);
+    if (!handle) {
+        return -1;
+    }
+    *pg_handle = handle;
+    if (size < 3 || setup_rdma_resources(handle) != 0 || register_buffers(handle) != 0) {
+        fprintf(stderr, "Rank %d: cannot join a group of %d\n", rank, size);
         pg_close(handle);
         return -1;
     }
-    if (final_resource_check(handle) != 0) {
-        fprintf(stderr, "Resource allocation or registration failed\n");
+
+    // Our left neighbor (the group's last ring position) connects first and
+    // sends the ring order and slot state, then we connect to our right
+    join_state_t state;
+    int sock = accept_left(handle);
+    int ret = sock < 0 || rewire_side(handle, sock, 0, -1) < 0 ? -1 : 0;
+    if (ret == 0 && (tcp_read_full(sock, handle->ring_order, size * sizeof(int)) != 0 ||
+                     tcp_read_full(sock, &state, sizeof(state)) != 0)) {
+        ret = -1;
+    }
+    if (sock >= 0) close(sock);
+    if (ret == 0 && set_ring_position(handle) != 0) ret = -1;
+    if (ret == 0) {
+        for (int i = 0; i < PG_MAX_SLOTS * PG_MAX_RINGS; ++i) {
+            // Our flags read as if we had taken part in every collective so far
+            pg_slot_ctrl_t *ctrl = &handle->ctrl[i];
+            handle->slots[i].barrier_seq = state.barrier_seq[i];
+            handle->slots[i].xfer_seq = state.xfer_seq[i];
+            ctrl->barrier_seq = ctrl->barrier_src = state.barrier_seq[i];
+            ctrl->ready_seq = ctrl->ready_src = state.xfer_seq[i];
+            ctrl->consumed_seq = ctrl->consumed_src = state.xfer_seq[i];
+        }
+        ret = rewire_right(handle, handle->right_rank, 0);
+    }
+    if (ret != 0 || finish_connect(handle) != 0) {
+        fprintf(stderr, "Rank %d: failed to join the group\n", rank);
         pg_close(handle);
         return -1;
     }
     return 0;
 }
+
+int pg_shrink(PGHandle *handle, int removed) {
+    if (!handle || removed < 0 || removed >= handle->num_servers || removed == handle->rank ||
+        handle->num_servers < 3) {
+        fprintf(stderr, "Invalid parameters for pg_shrink\n");
+        return -1;
+    }
+    int n = handle->num_servers;
+    int *order = handle->ring_order;
+    int pos = 0;
+    while (order[pos] != removed) pos++;
+    // The neighbors of the removed rank close the gap; renumbered, everyone
+    // above 'removed' moves down by one
+    int left = order[(pos - 1 + n) % n];
+    int right = order[(pos + 1) % n];
+    int old_rank = handle->rank;
+    left -= left > removed;
+    right -= right > removed;
+
+    for (int p = pos; p < n - 1; ++p) order[p] = order[p + 1];
+    for (int p = 0; p < n - 1; ++p) order[p] -= order[p] > removed;
+    free(handle->servernames[removed]);
+    memmove(&handle->servernames[removed], &handle->servernames[removed + 1],
+            (n - 1 - removed) * sizeof(char *));
+    handle->rank -= old_rank > removed;
+
+    drop_mesh(handle);
+    if (remap_ranks(handle, n - 1, removed) != 0 || set_ring_position(handle) != 0) return -1;
+    int ret = 0;
+    if (handle->rank == left) {
+        ret = rewire_right(handle, right, 0);
+    } else if (handle->rank == right) {
+        int sock = accept_left(handle);
+        ret = sock < 0 || rewire_side(handle, sock, 0, left) < 0 ? -1 : 0;
+        if (sock >= 0) close(sock);
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Rank %d: failed to close the ring around rank %d\n", old_rank, removed);
+        return -1;
+    }
+    relisten_mesh(handle);
+    return 0;
+}
@@ -21,22 +21,10 @@ extern "C" {
  */
 
 #include "pg_handle.h"
+#include "pg_config.h"
 #include "pg_close.h"
 #include <stddef.h>
 
-/* Default base ports used for QP and MR exchanges over TCP.
- * The C file referenced QP_EXCHANGE_PORT_BASE and MR_EXCHANGE_PORT_BASE but
- * didn't define them in the snippet you gave; define defaults here.
- * Adjust if your environment uses other ports.
- */
-#ifndef QP_EXCHANGE_PORT_BASE
-#define QP_EXCHANGE_PORT_BASE 18515
-#endif
-
-#ifndef MR_EXCHANGE_PORT_BASE
-#define MR_EXCHANGE_PORT_BASE 18525
-#endif
-
 /* Maximum server name length used in code */
 #define PG_MAX_HOSTNAME_LEN 256
 
@@ -51,10 +39,85 @@ extern "C" {
  * @param pg_handle: pointer to pointer to the process group pg_handle that will be allocated
  * @param rank: the rank of this process in the server_list (0 to size-1)
  * @return 0 on success, -1 on failure
- * @note The caller is responsible for freeing the server_list and its contents after pg_close is called.
+ * @note The handle takes ownership of server_list and its strings (allocated
+ * with malloc): pg_close frees them, and a failed connect frees them before
+ * returning. The caller must not free them.
  */
 int connect_process_group(char **server_list, int size, void **pg_handle, int rank);
 
+/**
+ * @brief connect_process_group with an explicit transport configuration.
+ * Selects the RDMA device and port, GID index (RoCE v2), path MTU, queue depths,
+ * QP timeouts and staging buffer sizes from 'config'. Passing NULL uses the
+ * defaults of pg_config_init with the PG_* environment overrides applied
+ * (this is what connect_process_group does); to combine an explicit config with
+ * environment overrides, call pg_config_load_env on it first.
+ * The path MTU is negotiated per link as the smaller active MTU of both ports,
+ * capped by config->mtu when set.
+ * @param config transport configuration, or NULL
+ * @return 0 on success, -1 on failure
+ */
+int connect_process_group_ex(char **server_list, int size, void **pg_handle, int rank,
+                             const pg_config_t *config);
+
+/**
+ * @brief Connects the mesh QPs of a traffic class to the peers flagged in
+ * 'needed' that are not connected in that class yet. The first call also
+ * registers the handle's mesh region, which both classes share.
+ * Every flagged peer must make a matching call (flagging this rank) at about
+ * the same time, as both sides take part in the handshake. Lower ranks accept
+ * and higher ranks connect, so the handshakes cannot deadlock.
+ * @param handle process group handle
+ * @param needed array of num_servers flags; needed[rank] is ignored
+ * @param priority traffic class of the QPs (their SL, traffic class and CQ)
+ * @return 0 on success, -1 on failure
+ */
+int pg_connect_peers(PGHandle *handle, const char *needed, pg_priority_t priority);
+
+/**
+ * @brief Adds a rank to a connected group without reconnecting it.
+ * Every member calls pg_grow with the newcomer's host name while the
+ * newcomer calls pg_join. The newcomer gets rank num_servers and the ring
+ * position after the last one, so only the ranks at the last and first ring
+ * positions reconnect (their QPs facing the new rank, which are reset and
+ * reused); all other QPs and every registration stay in place. Existing
+ * ranks keep their numbers. The lazily connected mesh is dropped everywhere
+ * and reconnects on next use, and the tuning rules are reloaded for the new
+ * size.
+ * No collective may be in flight on any member. Until every member has
+ * returned, only ring collectives (e.g. pg_all_reduce) may be started; run
+ * one before the first alltoall or atomic all-reduce.
+ * @param handle connected group of at least 2 ranks
+ * @param hostname host of the joining rank
+ * @return 0 on success, -1 on failure (the group must then be closed)
+ */
+int pg_grow(PGHandle *handle, const char *hostname);
+
+/**
+ * @brief The newcomer's side of pg_grow: connects rank size - 1 to a group
+ * whose members call pg_grow. Takes ownership of server_list like
+ * connect_process_group_ex. 'config' must match the members' staging sizes
+ * and slot counts. The ring order and the slot sequence numbers are received
+ * from the left neighbor, so the first collective lines up with the group's.
+ * @param server_list the members' host names followed by ours (size >= 3)
+ * @param config transport configuration, or NULL
+ * @return 0 on success, -1 on failure
+ */
+int pg_join(char **server_list, int size, void **pg_handle, const pg_config_t *config);
+
+/**
+ * @brief Removes a rank from a connected group without reconnecting it.
+ * Every remaining member calls pg_shrink; the removed rank only calls
+ * pg_close (it may do so before or after). The ring neighbors of the removed
+ * rank connect to each other, everyone else keeps its QPs, and every rank
+ * above 'removed' is renumbered one lower (pg_handle->rank changes). The same
+ * rules as for pg_grow apply to the mesh, the tuning rules and collectives in
+ * flight.
+ * @param handle connected group of at least 3 ranks
+ * @param removed rank leaving the group (not our own)
+ * @return 0 on success, -1 on failure (the group must then be closed)
+ */
+int pg_shrink(PGHandle *handle, int removed);
 
 #ifdef __cplusplus
 }
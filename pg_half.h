@@ -0,0 +1,83 @@
+#ifndef PG_HALF_H
+#define PG_HALF_H
+
+/*
+ * pg_half.h
+ *
+ * Inline conversions between float and the FP16 (IEEE half) and BF16 storage
+ * formats, shared by the C reduction kernels and the C++ API so both round
+ * identically. Round-to-nearest-even, bit exact on every host (no F16C or
+ * _Float16 required); NaNs stay NaNs and overflow becomes infinity.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+static inline float pg_half_fp16_to_float(uint16_t h) {
+    const uint32_t shifted_exp = 0x7c00u << 13;
+    uint32_t bits = ((uint32_t)h & 0x7fffu) << 13;
+    uint32_t exp = bits & shifted_exp;
+    bits += (uint32_t)(127 - 15) << 23;
+    float f;
+    if (exp == shifted_exp) {
+        bits += (uint32_t)(128 - 16) << 23;     // Inf / NaN
+    } else if (exp == 0) {
+        // Zero / subnormal: renormalize through a float subtraction
+        const uint32_t magic_bits = 113u << 23;
+        float magic;
+        bits += 1u << 23;
+        memcpy(&f, &bits, sizeof(f));
+        memcpy(&magic, &magic_bits, sizeof(magic));
+        f -= magic;
+        memcpy(&bits, &f, sizeof(bits));
+    }
+    bits |= ((uint32_t)h & 0x8000u) << 16;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16_t pg_half_float_to_fp16(float f) {
+    const uint32_t f32_infinity = 255u << 23;
+    const uint32_t f16_limit = (127u + 16) << 23;
+    const uint32_t denorm_magic_bits = ((127u - 15) + (23 - 10) + 1) << 23;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+    uint16_t out;
+    if (bits >= f16_limit) {
+        out = bits > f32_infinity ? 0x7e00 : 0x7c00;
+    } else if (bits < (113u << 23)) {
+        // Result is subnormal: let the float adder do the rounding
+        float value, magic;
+        memcpy(&value, &bits, sizeof(value));
+        memcpy(&magic, &denorm_magic_bits, sizeof(magic));
+        value += magic;
+        memcpy(&bits, &value, sizeof(bits));
+        out = (uint16_t)(bits - denorm_magic_bits);
+    } else {
+        uint32_t mant_odd = (bits >> 13) & 1;
+        bits += ((uint32_t)(15 - 127) << 23) + 0xfff + mant_odd;
+        out = (uint16_t)(bits >> 13);
+    }
+    return out | (uint16_t)(sign >> 16);
+}
+
+static inline float pg_half_bf16_to_float(uint16_t h) {
+    uint32_t bits = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16_t pg_half_float_to_bf16(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    if ((bits & 0x7fffffffu) > 0x7f800000u) {
+        return (uint16_t)((bits >> 16) | 0x40);   // quiet NaN
+    }
+    bits += 0x7fffu + ((bits >> 16) & 1);
+    return (uint16_t)(bits >> 16);
+}
+
+#endif /* PG_HALF_H */
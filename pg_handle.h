@@ -10,33 +10,338 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include "pg_config.h"
 
 
 #define MAX_WR_ID 1000
 #define RDMA_BUFFER_SIZE (1024 * 1024 * 16)  // 16MB buffer for RDMA operations
 
+/* Staging slots: the send/recv buffers are split into PG_NUM_SLOTS equal
+ * slots so that up to PG_NUM_SLOTS collectives can be in flight at once,
+ * plus PG_NUM_HIGH_SLOTS reserved for high-priority collectives. */
+#define PG_MAX_SLOTS 8
+#define PG_NUM_SLOTS 4
+#define PG_NUM_HIGH_SLOTS 1
+
+/* Rings a large all-reduce can be split over (PG_NUM_RINGS): ring 0 runs
+ * through the ring order, ring 1 through the same links in reverse */
+#define PG_MAX_RINGS 2
+
+/* Most scatter-gather entries per send WR (strided sends), further capped by the device */
+#define PG_MAX_SEND_SGE 16
+
+/* Bytes of inline data requested on mesh QPs (barrier flags) */
+#define PG_MAX_INLINE 64
+
+/* Rounds of the dissemination barrier: ceil(log2(num_servers)) */
+#define PG_BARRIER_MAX_ROUNDS 32
+
+/* User buffers that can be registered with pg_register_buffer at once */
+#define PG_MAX_USER_MRS 16
+
+/* Default capacity of a fused bucket in pg_all_reduce_multi */
+#define PG_FUSION_BUCKET_BYTES (1024 * 1024 * 4)
+
+/* wr_id layout: slot index in the upper bits, WR kind in the low byte.
+ * Completions are demultiplexed to their slot using PG_WR_SLOT(). */
+#define PG_WR_DATA    1
+#define PG_WR_BARRIER 2
+#define PG_WR_READ    3
+#define PG_WR_CTRL    4
+#define PG_WR_MESH    5
+#define PG_WR_ATOMIC  6
+#define PG_WR_ID(slot, kind) (((uint64_t)(slot) << 8) | (uint64_t)(kind))
+#define PG_WR_SLOT(wr_id)    ((int)(((wr_id) >> 8) & 0xff))
+#define PG_WR_KIND(wr_id)    ((int)((wr_id) & 0xff))
+
+/* Timed WRs (PG_WR_LATENCY) carry their post time in the wr_id bits above
+ * the slot, modulo 2^PG_WR_STAMP_BITS clock ticks; 0 = not timed */
+#define PG_WR_STAMP_SHIFT 16
+#define PG_WR_STAMP_BITS  48
+#define PG_WR_STAMP_MASK  ((1ull << PG_WR_STAMP_BITS) - 1)
+#define PG_WR_STAMP(wr_id) ((wr_id) >> PG_WR_STAMP_SHIFT)
+
 typedef enum {
     INT,
-    DOUBLE
+    DOUBLE,
+    FLOAT,
+    INT64,
+    FP16,     /* IEEE half (uint16_t storage), reduced in fp32 */
+    BF16      /* bfloat16 (uint16_t storage), reduced in fp32 */
 } DATATYPE;
 
 typedef enum {
     SUM,
-    MULT
+    MULT,
+    MIN,
+    MAX,
+    BAND,     /* bitwise and, INT and INT64 only */
+    BOR,      /* bitwise or, INT and INT64 only */
+    AVG       /* SUM divided by the number of ranks, floating types only */
 } OPERATION;
 
+/* Caller-supplied element-wise reduction: dst[i] = dst[i] op src[i] for
+ * 'count' elements. Must be associative and commutative. */
+typedef void (*pg_reduce_fn_t)(void *dst, const void *src, int count, void *ctx);
+
+/* Caller-supplied notification of pg_all_reduce_streaming: elements
+ * [offset, offset + count) of 'recvbuf' hold their final value. */
+typedef void (*pg_chunk_ready_fn_t)(void *recvbuf, int offset, int count, void *ctx);
+
 typedef struct {
     uint16_t lid;
     uint32_t qpn;
     uint32_t psn;
+    union ibv_gid gid;    /* valid when the sender uses a GID (RoCE / GRH) */
+    uint8_t mtu;          /* sender port's active MTU (enum ibv_mtu) */
 } qp_info_t;
 
 /* Memory region info exchanged with neighbors (rkey + address) */
 typedef struct {
     uint32_t rkey;
     uintptr_t addr;
+    uint32_t ctrl_rkey;   /* control (flag) region */
+    uintptr_t ctrl_addr;
+    uint32_t send_rkey;   /* send buffer, read by the right neighbor in pull mode */
+    uintptr_t send_addr;
 } mr_info_t;
 
+/* Per-slot control words. One cache line each so concurrent slots never
+ * share a line. The '*_seq' words are written remotely by a neighbor; the
+ * '*_src' words are the local sources of our own flag writes.
+ *   barrier_seq  - ring barrier flag, from the left neighbor (push mode)
+ *   ready_seq    - left neighbor published a segment in its sendbuf (pull mode)
+ *   consumed_seq - right neighbor finished reading our sendbuf (pull mode) */
+typedef struct {
+    volatile uint64_t barrier_seq;
+    volatile uint64_t ready_seq;
+    volatile uint64_t consumed_seq;
+    uint64_t barrier_src;
+    uint64_t ready_src;
+    uint64_t consumed_src;
+    char pad[16];
+} pg_slot_ctrl_t;
+
+/* Per-slot, per-peer flag block of the lazily connected mesh (alltoall).
+ * In block [slot][p] of rank r:
+ *   ready_seq    - chunks p has written into r's staging for this slot
+ *   consumed_seq - chunks of r's that p has copied out of its staging
+ *   ready_src    - chunks r has written to p (source of p's ready_seq)
+ *   consumed_src - chunks of p's that r has copied out (source of p's consumed_seq)
+ * All four only grow, so nothing needs to be reset between collectives. */
+typedef struct {
+    volatile uint64_t ready_seq;
+    volatile uint64_t consumed_seq;
+    uint64_t ready_src;
+    uint64_t consumed_src;
+} pg_peer_ctrl_t;
+
+/* Per-slot area of the atomic all-reduce, inside the mesh region.
+ * On the root, 'acc' and 'arrivals' are targets of remote atomics; on every
+ * rank, 'result' and 'result_seq' are written by the root's broadcast. */
+typedef struct {
+    volatile uint64_t acc[PG_ATOMIC_MAX_COUNT]; /* per-element accumulators (root) */
+    volatile uint64_t arrivals;                 /* ranks whose atomics have landed (root) */
+    uint64_t fetched[PG_ATOMIC_MAX_COUNT];      /* old values returned by our atomics */
+    uint64_t fetched_arrival;
+    int32_t result[PG_ATOMIC_MAX_COUNT];        /* final values (broadcast by the root) */
+    volatile uint64_t result_seq;               /* broadcast sequence number, from the root */
+    uint64_t seq_src;                           /* local count of atomic all-reduces on the slot */
+} pg_atomic_area_t;
+
+/* Per-slot flags of the dissemination barrier, inside the mesh region.
+ * round_seq[k] is written in round k by the rank 2^k below (mod size), with
+ * the number of the barrier it is in; seq_src counts our barriers on the slot.
+ * The flags only grow, so a peer already in the next barrier cannot be lost. */
+typedef struct {
+    volatile uint64_t round_seq[PG_BARRIER_MAX_ROUNDS];
+    uint64_t seq_src;
+    char pad[56];
+} pg_barrier_area_t;
+
+/* Layout of a strided (vector) buffer: 'count' blocks of 'blocklen'
+ * elements, the starts of consecutive blocks 'stride' elements apart
+ * (stride >= blocklen). Element i of the logical vector is at element offset
+ * (i / blocklen) * stride + i % blocklen. */
+typedef struct {
+    int count;
+    int blocklen;
+    int stride;
+} pg_vector_t;
+
+/* A user buffer registered with pg_register_buffer */
+typedef struct {
+    void *addr;
+    size_t length;
+    struct ibv_mr *mr;
+} pg_user_mr_t;
+
+/* Priority classes of collectives. Each class has its own ring QPs, mesh
+ * QPs, CQ and staging slots, so latency-critical collectives neither queue
+ * behind bulk transfers on the NIC nor wait for bulk completions to be polled. */
+typedef enum {
+    PG_PRIORITY_BULK,   /* default class */
+    PG_PRIORITY_HIGH    /* small latency-critical collectives */
+} pg_priority_t;
+#define PG_NUM_PRIORITIES 2
+
+/* Transport resources of one priority class */
+typedef struct {
+    struct ibv_cq *cq;           /* completions of every QP of the class */
+    struct ibv_cq_ex *cq_ex;     /* the same CQ when created with completion timestamps, else NULL */
+    struct ibv_qp *qps[2];       /* ring QPs: [0] = left, [1] = right */
+    pthread_mutex_t post_lock;   /* serializes ibv_post_send on the class QPs */
+    pthread_mutex_t cq_lock;     /* serializes ibv_poll_cq on the class CQ */
+    int sl;                      /* service level of the class QPs */
+    int traffic_class;           /* GRH traffic class of the class QPs */
+} pg_traffic_class_t;
+
+/* A mesh peer; connected per class on first use by pg_connect_peers */
+typedef struct {
+    struct ibv_qp *qps[PG_NUM_PRIORITIES]; /* NULL until connected */
+    int inline_ok[PG_NUM_PRIORITIES];      /* QP takes PG_MAX_INLINE-byte inline writes */
+    uint32_t mesh_rkey;       /* peer's mesh region */
+    uintptr_t mesh_addr;
+} pg_peer_t;
+
+/* All-reduce algorithms selectable per call */
+typedef enum {
+    PG_ALGO_RING,       /* reduce-scatter + allgather around the ring */
+    PG_ALGO_ATOMIC      /* remote atomics into rank 0, then a one-shot broadcast (tiny INT) */
+} pg_algorithm_t;
+
+/* Parameters of one all-reduce call, chosen by pg_tuning_select */
+typedef struct {
+    pg_algorithm_t algorithm;
+    pg_protocol_t protocol;
+    size_t segment_bytes;     /* ring segment size, 0 = whole staging slot */
+} pg_coll_params_t;
+
+/* Per-call options of the _ex collectives */
+typedef struct {
+    int tag;                  /* non-negative, identical on all ranks (see pg_all_reduce_tagged) */
+    pg_priority_t priority;   /* traffic class the collective runs in */
+} pg_op_opts_t;
+
+/* Tuning table rule: params for groups of 'ranks' and min_bytes <= bytes < max_bytes */
+typedef struct {
+    int ranks;
+    size_t min_bytes;
+    size_t max_bytes;
+    pg_coll_params_t params;
+} pg_tuning_rule_t;
+
+/* One ring-step trace record (see pg_trace.h). 'seq' is 1 + the record's
+ * index in the trace; it is cleared while the record is being written. */
+typedef struct {
+    uint64_t seq;
+    uint64_t start_ns;        /* CLOCK_MONOTONIC of the recording rank */
+    uint64_t end_ns;
+    uint64_t bytes;
+    int32_t step;             /* all-reduce ring step, -1 outside one */
+    uint16_t slot;            /* slot (or lane) index, the timeline row */
+    uint8_t phase;            /* pg_trace_phase_t */
+    uint8_t category;         /* pg_trace_category_t */
+} pg_trace_event_t;
+
+/* Lock-free trace ring buffer of a handle; writers claim records with an
+ * atomic increment of 'head' and overwrite the oldest once it wraps */
+typedef struct {
+    pg_trace_event_t *events;  /* NULL = tracing off */
+    uint64_t capacity;         /* records, a power of two */
+    uint64_t head;             /* records claimed so far */
+    int64_t clock_offset_ns;   /* add to local timestamps for rank 0's clock */
+} pg_trace_t;
+
+/* Size classes of the scratch pool: powers of two from 2^PG_POOL_MIN_SHIFT bytes */
+#define PG_POOL_MIN_SHIFT 12
+#define PG_POOL_NUM_CLASSES 20
+
+/* A block of the scratch pool (see pg_pool.h) */
+typedef struct pg_pool_block {
+    struct pg_pool_block *next;   /* next idle block of the class */
+    void *addr;
+    size_t size;                  /* bytes, the class size */
+    uint64_t idle_since_ns;       /* CLOCK_MONOTONIC of its return to the pool */
+} pg_pool_block_t;
+
+/* Scratch memory shared by the collectives of a handle. Blocks
+ * are allocated on first demand, reused per size class, and released once
+ * idle for config.pool_idle_ms; at most config.pool_max_bytes are held. */
+typedef struct {
+    pg_pool_block_t *idle[PG_POOL_NUM_CLASSES]; /* idle blocks per class, newest first */
+    size_t bytes;                 /* allocated blocks, in use or idle */
+    size_t in_use_bytes;
+    size_t peak_bytes;
+    uint64_t hits;                /* requests served by an idle block */
+    uint64_t misses;              /* requests that allocated a new block */
+    uint64_t failures;            /* requests refused at the cap or failed allocation */
+    uint64_t releases;            /* blocks freed while the handle was open */
+    pthread_mutex_t lock;
+} pg_pool_t;
+
+/* One staging slot: a private region of the send/recv buffers plus the
+ * bookkeeping of the collective currently occupying it. */
+typedef struct {
+    int index;
+    int ring;                 /* 0 = forward ring; 1 = reverse lane of slots[index - PG_MAX_SLOTS] */
+    pg_priority_t priority;   /* traffic class whose QPs and CQ the slot uses */
+    int tag;                  /* tag of the collective holding the slot */
+    pthread_mutex_t lock;     /* held for the duration of one collective */
+    void *sendbuf;            /* slot part of the handle sendbuf */
+    void *recvbuf;            /* slot part of the handle recvbuf */
+    size_t offset;            /* offset of the slot inside the buffers */
+    size_t size;              /* staging bytes available to the slot */
+    uint64_t barrier_seq;     /* last barrier sequence number used */
+    uint64_t xfer_seq;        /* last pull transfer sequence number used */
+    int pending;              /* signaled WRs not yet completed */
+    int error;                /* set when one of its WRs failed */
+    int trace_step;           /* all-reduce step being traced, -1 = none */
+    uint64_t busy_ns;         /* staging copies and reductions of the current collective (PG_BALANCE) */
+    uint64_t busy_bytes;      /* bytes received meanwhile */
+} pg_slot_t;
+
+/* Adaptive chunk balancing (PG_BALANCE): all-reduces of at least
+ * PG_BALANCE_MIN_BYTES measure this rank's staging and reduction cost per
+ * byte; every config.balance_interval of them the ranks exchange their costs
+ * and resize the ring chunks for the next ones (see ring_balanced_counts). */
+#define PG_BALANCE_MIN_BYTES (64 * 1024)
+#define PG_BALANCE_MAX_SKEW 4.0   /* largest chunk weight relative to an equal split */
+
+typedef struct {
+    double *costs;            /* ns per byte of every rank at the last exchange, NULL = equal chunks */
+    double local_cost;        /* moving average of this rank's ns per byte, 0 = no sample yet */
+    int calls;                /* measured all-reduces since the last exchange */
+    int exchanging;           /* the exchange's own all-reduce is running */
+} pg_balance_t;
+
+/* Per-WR latency histograms of the ring data transfers (PG_WR_LATENCY, see
+ * pg_latency.h). Bucket b counts latencies in [2^b, 2^(b + 1)) ns; bucket 0
+ * also counts 0 ns. */
+#define PG_LATENCY_BUCKETS 40
+
+typedef struct {
+    uint64_t counts[PG_LATENCY_BUCKETS];
+    uint64_t samples;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} pg_latency_hist_t;
+
+/* Clock the WRs are timed with */
+typedef enum {
+    PG_LATENCY_OFF,
+    PG_LATENCY_SOFTWARE,  /* CLOCK_MONOTONIC at post and at poll */
+    PG_LATENCY_HARDWARE   /* NIC clock at post and in the completion */
+} pg_latency_clock_t;
+
+typedef struct {
+    pg_latency_clock_t clock;
+    double ns_per_tick;          /* NIC clock period (hardware clock) */
+    pg_latency_hist_t wire;      /* post to completion: to poll with the software clock */
+    pg_latency_hist_t poll_delay; /* completion to poll (hardware clock only) */
+} pg_latency_t;
+
 
 
 typedef struct{
@@ -47,11 +352,28 @@ typedef struct{
     /* server names parsed from the server list (array of size 'size') */
     char **servernames; /* owned by handle; freed during pg_close */
 
-    /* RDMA device / protection domain / CQs / QPs */
+    /* ring order (PG_RING_ORDER): ring_order[p] is the rank at ring position
+     * p; left_rank / right_rank are our neighbors around it. Ranks seen by
+     * the caller are unaffected, only who talks to whom changes. */
+    int *ring_order;          /* array size 'size' */
+    int ring_pos;             /* our position, ring_order[ring_pos] == rank */
+    int left_rank;
+    int right_rank;
+    int num_rings;            /* rings of a large all-reduce, 1 or 2 */
+
+    /* transport configuration the group was connected with */
+    pg_config_t config;
+    int gid_index;             /* resolved GID index, -1 = LID addressing */
+    enum ibv_mtu active_mtu;   /* active MTU of the local port */
+    int rd_atomic;             /* max_rd_atomic of every QP (initiator side) */
+    int dest_rd_atomic;        /* max_dest_rd_atomic of every QP (responder side) */
+    int atomic_supported;      /* the device executes remote atomics */
+    int max_send_sge;          /* scatter-gather entries per send WR, at most PG_MAX_SEND_SGE */
+
+    /* RDMA device / protection domain, and the CQ and QPs of every priority class */
     struct ibv_context *ctx;
     struct ibv_pd *pd;
-    struct ibv_cq *cq;
-    struct ibv_qp **qps; /* array of 2 QPs: [0] = left, [1] = right */
+    pg_traffic_class_t classes[PG_NUM_PRIORITIES];
 
     /* Memory regions and buffers */
     void *sendbuf;        /* local send buffer (registered) */
@@ -67,6 +389,67 @@ typedef struct{
     /* remote neighbors' info mapped by rank index */
     uint32_t *remote_rkeys;   /* array size 'size' */
     uintptr_t *remote_addrs;  /* array size 'size' */
+    uint32_t *remote_ctrl_rkeys;   /* array size 'size' */
+    uintptr_t *remote_ctrl_addrs;  /* array size 'size' */
+    uint32_t *remote_send_rkeys;   /* array size 'size' */
+    uintptr_t *remote_send_addrs;  /* array size 'size' */
+
+    /* control region holding one pg_slot_ctrl_t per slot and lane (registered) */
+    pg_slot_ctrl_t *ctrl;
+    size_t ctrl_size;
+    struct ibv_mr *mr_ctrl;
+
+    /* NUMA node the registered buffers live on, -1 = unbound */
+    int numa_node;
+
+    /* staging slots for concurrent collectives: the first num_slots belong
+     * to the bulk class, the next num_high_slots to the high-priority class.
+     * slots[PG_MAX_SLOTS + i] is the reverse-ring lane of slot i, which owns
+     * the second half of its staging while a two-ring all-reduce runs. */
+    pg_slot_t slots[PG_MAX_SLOTS * PG_MAX_RINGS];
+    int num_slots;
+    int num_high_slots;
+
+    /* lazily connected full mesh (alltoall, atomic all-reduce, barrier). The
+     * mesh region holds the flag blocks, atomic areas and barrier flags,
+     * followed by send and recv staging of 'bufsize' bytes each; it is
+     * allocated and registered by the first pg_connect_peers call. */
+    pg_peer_t *peers;              /* array size 'size' */
+    void *mesh_region;
+    size_t mesh_size;
+    size_t mesh_ctrl_size;         /* bytes of flag blocks at the start of the region */
+    struct ibv_mr *mr_mesh;
+    pg_peer_ctrl_t *mesh_ctrl;     /* [PG_MAX_SLOTS][size] flag blocks */
+    pg_atomic_area_t *mesh_atomic; /* [PG_MAX_SLOTS] atomic all-reduce areas, after the flags */
+    size_t mesh_atomic_offset;
+    pg_barrier_area_t *mesh_barrier; /* [PG_MAX_SLOTS] barrier flags, after the atomic areas */
+    size_t mesh_barrier_offset;
+    int mesh_listen_fd;            /* accepts mesh connections from higher ranks */
+    pthread_mutex_t mesh_lock;     /* serializes mesh connection setup */
+
+    /* user buffers registered for direct (multi-SGE) sends */
+    pg_user_mr_t user_mrs[PG_MAX_USER_MRS];
+    int num_user_mrs;
+    pthread_mutex_t user_mr_lock;
+
+    /* capacity of a fused bucket in pg_all_reduce_multi */
+    size_t fusion_bucket_bytes;
+
+    /* per-rank costs that size the ring chunks (PG_BALANCE) */
+    pg_balance_t balance;
+
+    /* scratch memory of the collectives (PG_POOL_MAX_BYTES) */
+    pg_pool_t pool;
+
+    /* ring-step trace (PG_TRACE_EVENTS) */
+    pg_trace_t trace;
+
+    /* per-WR latency of the ring data transfers (PG_WR_LATENCY) */
+    pg_latency_t latency;
+
+    /* tuning table rules for this group size (owned) */
+    pg_tuning_rule_t *tuning_rules;
+    int num_tuning_rules;
 
     /* optional extras that might be useful to keep */
     /* page size or other config values could be added here */
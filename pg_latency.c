@@ -0,0 +1,133 @@
+#include "pg_latency.h"
+#include "pg_trace.h"
+#include <stdio.h>
+#include <string.h>
+
+// Raw NIC clock ticks; 0 if the device cannot be read
+static uint64_t hardware_clock(struct ibv_context *ctx) {
+    struct ibv_values_ex values = {.comp_mask = IBV_VALUES_MASK_RAW_CLOCK};
+    if (ibv_query_rt_values_ex(ctx, &values) != 0) return 0;
+    return (uint64_t)values.raw_clock.tv_sec * 1000000000ull + (uint64_t)values.raw_clock.tv_nsec;
+}
+
+void pg_latency_setup(PGHandle *pg_handle) {
+    pg_latency_t *latency = &pg_handle->latency;
+    latency->clock = PG_LATENCY_OFF;
+    if (!pg_handle->config.wr_latency) return;
+
+    latency->clock = PG_LATENCY_SOFTWARE;
+    struct ibv_device_attr_ex attr;
+    memset(&attr, 0, sizeof(attr));
+    if (ibv_query_device_ex(pg_handle->ctx, NULL, &attr) == 0 && attr.completion_timestamp_mask != 0 &&
+        attr.hca_core_clock != 0 && hardware_clock(pg_handle->ctx) != 0) {
+        latency->clock = PG_LATENCY_HARDWARE;
+        latency->ns_per_tick = 1e6 / attr.hca_core_clock;   // hca_core_clock is in kHz
+    } else {
+        fprintf(stderr, "Rank %d: no completion timestamps on this device, timing WRs in software\n",
+                pg_handle->rank);
+    }
+}
+
+struct ibv_cq *pg_latency_create_cq(PGHandle *pg_handle, pg_traffic_class_t *cls) {
+    cls->cq_ex = NULL;
+    if (pg_handle->latency.clock == PG_LATENCY_HARDWARE) {
+        struct ibv_cq_init_attr_ex attr = {
+            .cqe = pg_handle->config.cq_depth,
+            .wc_flags = IBV_WC_EX_WITH_COMPLETION_TIMESTAMP,
+        };
+        cls->cq_ex = ibv_create_cq_ex(pg_handle->ctx, &attr);
+        if (cls->cq_ex) return ibv_cq_ex_to_cq(cls->cq_ex);
+        // The stamps are per handle, so every class falls back; CQs already
+        // created with timestamps keep working, their timestamps are ignored
+        fprintf(stderr, "Rank %d: cannot create a timestamping CQ, timing WRs in software\n",
+                pg_handle->rank);
+        pg_handle->latency.clock = PG_LATENCY_SOFTWARE;
+    }
+    return ibv_create_cq(pg_handle->ctx, pg_handle->config.cq_depth, NULL, NULL, 0);
+}
+
+uint64_t pg_latency_now(PGHandle *pg_handle) {
+    uint64_t now = pg_handle->latency.clock == PG_LATENCY_HARDWARE ? hardware_clock(pg_handle->ctx)
+                                                                    : pg_trace_clock_ns();
+    return now & PG_WR_STAMP_MASK;
+}
+
+static void hist_add(pg_latency_hist_t *hist, uint64_t ns) {
+    int b = ns ? 63 - __builtin_clzll(ns) : 0;
+    if (b >= PG_LATENCY_BUCKETS) b = PG_LATENCY_BUCKETS - 1;
+    __atomic_add_fetch(&hist->counts[b], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->samples, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->total_ns, ns, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&hist->max_ns, &max, ns, 1, __ATOMIC_RELAXED,
+                                                    __ATOMIC_RELAXED)) {
+    }
+}
+
+// Ticks from 'from' to 'to' on the wrapping stamp clock, in ns
+static uint64_t elapsed_ns(const pg_latency_t *latency, uint64_t from, uint64_t to) {
+    uint64_t ticks = (to - from) & PG_WR_STAMP_MASK;
+    return latency->clock == PG_LATENCY_HARDWARE ? (uint64_t)(ticks * latency->ns_per_tick) : ticks;
+}
+
+void pg_latency_complete(PGHandle *pg_handle, const struct ibv_wc *wc,
+                         const uint64_t *completion_ts, int count) {
+    pg_latency_t *latency = &pg_handle->latency;
+    uint64_t now = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t posted = PG_WR_STAMP(wc[i].wr_id);
+        int kind = PG_WR_KIND(wc[i].wr_id);
+        if ((kind != PG_WR_DATA && kind != PG_WR_READ) || posted == 0 || wc[i].status != IBV_WC_SUCCESS) {
+            continue;
+        }
+        if (now == 0) now = pg_latency_now(pg_handle);
+        if (latency->clock == PG_LATENCY_HARDWARE && completion_ts) {
+            uint64_t completed = completion_ts[i] & PG_WR_STAMP_MASK;
+            hist_add(&latency->wire, elapsed_ns(latency, posted, completed));
+            hist_add(&latency->poll_delay, elapsed_ns(latency, completed, now));
+        } else {
+            hist_add(&latency->wire, elapsed_ns(latency, posted, now));
+        }
+    }
+}
+
+static void hist_copy(pg_latency_hist_t *dst, const pg_latency_hist_t *src) {
+    for (int b = 0; b < PG_LATENCY_BUCKETS; b++) {
+        dst->counts[b] = __atomic_load_n(&src->counts[b], __ATOMIC_RELAXED);
+    }
+    dst->samples = __atomic_load_n(&src->samples, __ATOMIC_RELAXED);
+    dst->total_ns = __atomic_load_n(&src->total_ns, __ATOMIC_RELAXED);
+    dst->max_ns = __atomic_load_n(&src->max_ns, __ATOMIC_RELAXED);
+}
+
+int pg_get_wr_latency(PGHandle *pg_handle, pg_latency_t *stats) {
+    if (!pg_handle || !stats) {
+        fprintf(stderr, "Invalid parameters for pg_get_wr_latency\n");
+        return -1;
+    }
+    stats->clock = pg_handle->latency.clock;
+    stats->ns_per_tick = pg_handle->latency.ns_per_tick;
+    hist_copy(&stats->wire, &pg_handle->latency.wire);
+    hist_copy(&stats->poll_delay, &pg_handle->latency.poll_delay);
+    return 0;
+}
+
+void pg_reset_wr_latency(PGHandle *pg_handle) {
+    if (!pg_handle) return;
+    memset(&pg_handle->latency.wire, 0, sizeof(pg_latency_hist_t));
+    memset(&pg_handle->latency.poll_delay, 0, sizeof(pg_latency_hist_t));
+}
+
+double pg_latency_percentile(const pg_latency_hist_t *hist, double q) {
+    if (!hist || hist->samples == 0) return 0.0;
+    uint64_t rank = (uint64_t)(q * hist->samples);
+    uint64_t seen = 0;
+    for (int b = 0; b < PG_LATENCY_BUCKETS; b++) {
+        seen += hist->counts[b];
+        if (seen > rank) {
+            double upper = (double)(2ull << b);
+            return upper < hist->max_ns ? upper : (double)hist->max_ns;
+        }
+    }
+    return (double)hist->max_ns;
+}
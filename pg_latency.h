@@ -0,0 +1,98 @@
+#ifndef PG_LATENCY_H
+#define PG_LATENCY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_latency.h
+ *
+ * Opt-in latency histograms of the individual RDMA data transfers of the
+ * ring (PG_WR_LATENCY=1): the writes of the push protocol and the reads of
+ * the pull protocol. They tell NIC / fabric time from software overhead
+ * where timing whole calls cannot.
+ *
+ * Every signaled data transfer carries its post time in its wr_id. Where the
+ * device reports completion timestamps, the class CQs are created with
+ * ibv_create_cq_ex(IBV_WC_EX_WITH_COMPLETION_TIMESTAMP) and the post time is
+ * read from the NIC clock, so that
+ *
+ *   wire        post to completion on the NIC clock: doorbell, DMA, wire
+ *               and the remote ack, without any host-side polling
+ *   poll_delay  completion to the poll that saw it: how late software
+ *               noticed the completion
+ *
+ * Without hardware timestamps both ends are CLOCK_MONOTONIC and 'wire' runs
+ * from post to poll, i.e. includes the poll delay; 'poll_delay' stays empty.
+ * The clock in use is reported with the histograms. Timing costs a clock
+ * read per post and per polled batch; with PG_WR_LATENCY=0 a branch.
+ */
+
+#include "pg_handle.h"
+
+/**
+ * @brief Picks the clock of config.wr_latency for the opened device:
+ * hardware when it has completion timestamps and a readable clock,
+ * software otherwise. Called before the CQs are created.
+ */
+void pg_latency_setup(PGHandle *pg_handle);
+
+/**
+ * @brief Creates the CQ of a traffic class, with completion timestamps
+ * (cls->cq_ex) when the hardware clock is in use.
+ * @return The CQ, or NULL on failure.
+ */
+struct ibv_cq *pg_latency_create_cq(PGHandle *pg_handle, pg_traffic_class_t *cls);
+
+/**
+ * @brief Current time of the latency clock, modulo 2^PG_WR_STAMP_BITS.
+ */
+uint64_t pg_latency_now(PGHandle *pg_handle);
+
+/**
+ * @brief Post stamp of a WR: the latency clock, never 0 while timing; 0 when off.
+ */
+static inline uint64_t pg_latency_stamp(PGHandle *pg_handle) {
+    if (pg_handle->latency.clock == PG_LATENCY_OFF) return 0;
+    uint64_t now = pg_latency_now(pg_handle);
+    return now ? now : 1;
+}
+
+/**
+ * @brief Records the timed data transfers of a polled batch.
+ * @param wc Completions of the batch.
+ * @param completion_ts NIC completion timestamps of the batch, or NULL
+ * when the CQ has none.
+ * @param count Completions in the batch.
+ */
+void pg_latency_complete(PGHandle *pg_handle, const struct ibv_wc *wc,
+                         const uint64_t *completion_ts, int count);
+
+/**
+ * @brief Copies the histograms and the clock they were measured with.
+ * @param pg_handle Pointer to the process group handle.
+ * @param stats Output.
+ * @return 0 on success, -1 on invalid arguments.
+ */
+int pg_get_wr_latency(PGHandle *pg_handle, pg_latency_t *stats);
+
+/**
+ * @brief Clears the histograms, e.g. after a warm-up.
+ */
+void pg_reset_wr_latency(PGHandle *pg_handle);
+
+/**
+ * @brief Latency below which a fraction 'q' of the samples lie, to the
+ * resolution of the power-of-two buckets (never above the maximum seen).
+ * @param hist A histogram of pg_get_wr_latency.
+ * @param q Fraction in [0, 1], e.g. 0.5 or 0.99.
+ * @return Nanoseconds, 0 for an empty histogram.
+ */
+double pg_latency_percentile(const pg_latency_hist_t *hist, double q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_LATENCY_H */
@@ -0,0 +1,244 @@
+/**
+ * pg_launch.c
+ *
+ * Single-host launcher: forks N ranks on this machine, all listed under the
+ * same host name, and runs one group per rank count of the sweep over any
+ * local RDMA transport (Soft-RoCE / rxe, siw, or a real NIC in loopback):
+ *
+ *      pg_launch [-ranks 2,4,8,16] [-host <name>] [-max-bytes <bytes>]
+ *                [-iters <n>] [-timeout <seconds>]
+ *
+ * Every group checks a DOUBLE SUM all-reduce over the whole size sweep
+ * against the closed-form result and times it. Rank 0 prints one CSV line
+ * per (ranks, bytes):
+ *
+ *      ranks,bytes,latency_us,algbw_gbps,busbw_gbps,connect_ms,correct
+ *
+ * so latency and bandwidth can be plotted against the group size. Ranks
+ * sharing a host must not share bootstrap ports, so the port stride of the
+ * PG_* environment is raised to the largest rank count of the sweep.
+ * Exits non-zero if a group fails to connect, computes a wrong result or
+ * does not finish within the timeout.
+ */
+
+#include "pg_connect.h"
+#include "pg_allreduce.h"
+#include "pg_close.h"
+#include "pg_config.h"
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LAUNCH_MIN_BYTES 8
+#define LAUNCH_DEFAULT_MAX_BYTES ((size_t)16 << 20)
+#define LAUNCH_DEFAULT_ITERS 5
+#define LAUNCH_DEFAULT_TIMEOUT 300
+#define LAUNCH_MAX_RANK_COUNTS 32
+
+// Value of "-name <value>" on the command line, or NULL
+static const char *option(char *argv[], const char *name) {
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Value every rank contributes at index i; the sum over n ranks is
+// n (n + 1) / 2 + n (i % 7), exact in double
+static double input_value(int rank, int i) {
+    return rank + 1 + i % 7;
+}
+
+// Body of one forked rank: connect, check and time the size sweep
+static int run_rank(const char *host, int num_ranks, int rank, const pg_config_t *config,
+                    size_t max_bytes, int iters) {
+    char **names = calloc(num_ranks, sizeof(char *));
+    if (!names) return -1;
+    int copied = 0;
+    while (copied < num_ranks && (names[copied] = strdup(host)) != NULL) copied++;
+    if (copied < num_ranks) {
+        fprintf(stderr, "Rank %d: memory allocation failed\n", rank);
+        for (int i = 0; i < copied; i++) free(names[i]);
+        free(names);
+        return -1;
+    }
+
+    // The handle owns the names from here on: pg_close frees them, and a
+    // failed connect has already released them
+    double start = now_seconds();
+    void *handle = NULL;
+    if (connect_process_group_ex(names, num_ranks, &handle, rank, config) != 0) {
+        fprintf(stderr, "Rank %d: connect_process_group failed\n", rank);
+        return -1;
+    }
+    PGHandle *pg_handle = (PGHandle *)handle;
+    double connect_local = now_seconds() - start;
+    double connect_time = 0.0;
+    int ret = pg_all_reduce(&connect_local, &connect_time, 1, DOUBLE, MAX, pg_handle);
+
+    int max_count = (int)(max_bytes / sizeof(double));
+    double *sendbuf = malloc(max_count * sizeof(double));
+    double *recvbuf = malloc(max_count * sizeof(double));
+    if (!sendbuf || !recvbuf) ret = -1;
+    for (int i = 0; ret == 0 && i < max_count; i++) sendbuf[i] = input_value(rank, i);
+
+    double base = num_ranks * (num_ranks + 1) / 2.0;
+    for (size_t bytes = LAUNCH_MIN_BYTES; ret == 0 && bytes <= max_bytes; bytes *= 4) {
+        int count = (int)(bytes / sizeof(double));
+
+        // Correctness first, on a cleared output buffer
+        memset(recvbuf, 0, count * sizeof(double));
+        ret = pg_all_reduce(sendbuf, recvbuf, count, DOUBLE, SUM, pg_handle);
+        int errors = 0;
+        for (int i = 0; ret == 0 && i < count; i++) {
+            if (recvbuf[i] != base + num_ranks * (i % 7)) errors++;
+        }
+        int total_errors = 0;
+        if (ret == 0) ret = pg_all_reduce(&errors, &total_errors, 1, INT, SUM, pg_handle);
+
+        // Then the timed calls; the first one warms up
+        double t0 = 0.0;
+        for (int i = 0; i <= iters && ret == 0; i++) {
+            if (i == 1) t0 = now_seconds();
+            ret = pg_all_reduce(sendbuf, recvbuf, count, DOUBLE, SUM, pg_handle);
+        }
+        double local = (now_seconds() - t0) / iters;
+        double total = 0.0;
+        if (ret == 0) ret = pg_all_reduce(&local, &total, 1, DOUBLE, SUM, pg_handle);
+        if (ret == 0 && rank == 0) {
+            // Bus bandwidth: the 2 (n - 1) / n of the data every link carries in a ring all-reduce
+            double latency_us = total / num_ranks * 1e6;
+            double algbw = bytes / (latency_us * 1e3);
+            double busbw = algbw * 2 * (num_ranks - 1) / num_ranks;
+            printf("%d,%zu,%.3f,%.4f,%.4f,%.1f,%s\n", num_ranks, bytes, latency_us, algbw, busbw,
+                   connect_time * 1e3, total_errors == 0 ? "yes" : "no");
+            fflush(stdout);
+        }
+        if (ret == 0 && total_errors != 0) {
+            if (rank == 0) fprintf(stderr, "%d ranks, %zu bytes: %d wrong elements\n", num_ranks, bytes, total_errors);
+            ret = -1;
+        }
+    }
+    if (ret != 0) fprintf(stderr, "Rank %d: all_reduce failed\n", rank);
+
+    free(sendbuf);
+    free(recvbuf);
+    pg_close(pg_handle);
+    return ret;
+}
+
+// Forks the ranks of one group and waits for them; kills the group when a
+// rank fails or the deadline passes
+static int run_group(const char *host, int num_ranks, const pg_config_t *config,
+                     size_t max_bytes, int iters, int timeout) {
+    pid_t *pids = calloc(num_ranks, sizeof(pid_t));
+    if (!pids) return -1;
+    fflush(stdout);
+    fflush(stderr);
+    int ret = 0;
+    int started = 0;
+    for (; started < num_ranks; started++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            ret = -1;
+            break;
+        }
+        if (pid == 0) {
+            int status = run_rank(host, num_ranks, started, config, max_bytes, iters);
+            fflush(stdout);
+            _exit(status == 0 ? 0 : 1);
+        }
+        pids[started] = pid;
+    }
+
+    double deadline = now_seconds() + timeout;
+    int running = started;
+    while (running > 0) {
+        if (ret != 0 || now_seconds() > deadline) {
+            if (ret == 0) fprintf(stderr, "%d ranks: no result after %d s\n", num_ranks, timeout);
+            ret = -1;
+            for (int i = 0; i < started; i++) {
+                if (pids[i] > 0) kill(pids[i], SIGKILL);
+            }
+        }
+        int status;
+        pid_t pid = waitpid(-1, &status, ret != 0 ? 0 : WNOHANG);
+        if (pid == 0) {
+            usleep(10000);
+            continue;
+        }
+        if (pid < 0) break;
+        for (int i = 0; i < started; i++) {
+            if (pids[i] == pid) {
+                pids[i] = 0;
+                running--;
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ret = -1;
+            }
+        }
+    }
+    free(pids);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    pg_config_t config;
+    pg_config_init(&config);
+    if (pg_config_load_env(&config) != 0) {
+        fprintf(stderr, "Invalid PG_* environment\n");
+        return 1;
+    }
+
+    int ranks[LAUNCH_MAX_RANK_COUNTS];
+    int num_counts = 0;
+    int max_ranks = 0;
+    const char *list = option(argv, "-ranks") ? option(argv, "-ranks") : "2,4,8,16";
+    for (char *end; *list != '\0' && num_counts < LAUNCH_MAX_RANK_COUNTS; list = *end == ',' ? end + 1 : end) {
+        long value = strtol(list, &end, 10);
+        if (end == list || value < 2) {
+            fprintf(stderr, "Invalid -ranks list (rank counts of at least 2)\n");
+            return 1;
+        }
+        ranks[num_counts++] = (int)value;
+        if (value > max_ranks) max_ranks = (int)value;
+    }
+    const char *host = option(argv, "-host") ? option(argv, "-host") : "localhost";
+    size_t max_bytes = option(argv, "-max-bytes") ? strtoull(option(argv, "-max-bytes"), NULL, 0)
+                                                  : LAUNCH_DEFAULT_MAX_BYTES;
+    int iters = option(argv, "-iters") ? atoi(option(argv, "-iters")) : LAUNCH_DEFAULT_ITERS;
+    int timeout = option(argv, "-timeout") ? atoi(option(argv, "-timeout")) : LAUNCH_DEFAULT_TIMEOUT;
+    if (max_bytes < LAUNCH_MIN_BYTES || max_bytes > INT32_MAX || iters < 1 || timeout < 1) {
+        fprintf(stderr, "Usage: %s [-ranks <n,n,...>] [-host <name>] [-max-bytes <bytes>] "
+                        "[-iters <n>] [-timeout <seconds>]\n", argv[0]);
+        return 1;
+    }
+
+    // Every rank listens on its own ports
+    if (config.port_stride < max_ranks) config.port_stride = max_ranks;
+    if (pg_config_validate(&config) != 0) {
+        fprintf(stderr, "No port layout for %d ranks from PG_PORT_BASE %d\n", max_ranks, config.port_base);
+        return 1;
+    }
+
+    printf("ranks,bytes,latency_us,algbw_gbps,busbw_gbps,connect_ms,correct\n");
+    int failed = 0;
+    for (int r = 0; r < num_counts; r++) {
+        if (run_group(host, ranks[r], &config, max_bytes, iters, timeout) != 0) {
+            fprintf(stderr, "Group of %d ranks failed\n", ranks[r]);
+            failed = 1;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+#include "pg_numa.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+#define PG_NUMA_MAX_NODES 64
+
+
+
+// Read a small sysfs file into 'buf'; returns 0 on success
+static int read_sysfs(const char *path, char *buf, size_t len) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    size_t n = fread(buf, 1, len - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return n > 0 ? 0 : -1;
+}
+
+int pg_numa_device_node(struct ibv_context *ctx) {
+    char path[256], buf[32];
+    snprintf(path, sizeof(path), "/sys/class/infiniband/%s/device/numa_node",
+             ibv_get_device_name(ctx->device));
+    if (read_sysfs(path, buf, sizeof(buf)) != 0) return -1;
+    int node = atoi(buf);
+    return node >= 0 && node < PG_NUMA_MAX_NODES ? node : -1;
+}
+
+int pg_numa_num_nodes(void) {
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (!dir) return 1;
+    int max_node = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int node;
+        if (sscanf(entry->d_name, "node%d", &node) == 1 && node + 1 > max_node) {
+            max_node = node + 1;
+        }
+    }
+    closedir(dir);
+    return max_node > 0 ? max_node : 1;
+}
+
+void *pg_numa_alloc(size_t size, int node) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return NULL;
+
+    if (node >= 0 && node < PG_NUMA_MAX_NODES) {
+        // Prefer the node (fall back to others when it is full) before first touch
+        unsigned long nodemask = 1UL << node;
+        if (syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, &nodemask,
+                    sizeof(nodemask) * 8, 0) != 0) {
+            fprintf(stderr, "Warning: mbind to NUMA node %d failed, memory is unbound\n", node);
+        }
+    }
+    // First touch places the pages now rather than during registration
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void pg_numa_free(void *ptr, size_t size) {
+    if (ptr) munmap(ptr, size);
+}
+
+int pg_numa_pin_thread(int node) {
+    char path[128], buf[1024];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (read_sysfs(path, buf, sizeof(buf)) != 0) return -1;
+
+    // Parse a cpulist such as "0-15,32-47"
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",\n", &save); tok; tok = strtok_r(NULL, ",\n", &save)) {
+        int first, last;
+        int fields = sscanf(tok, "%d-%d", &first, &last);
+        if (fields < 1) continue;
+        if (fields == 1) last = first;
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (CPU_COUNT(&set) == 0) return -1;
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+}
+
+int pg_pin_thread(PGHandle *pg_handle) {
+    if (!pg_handle || pg_handle->numa_node < 0) return -1;
+    return pg_numa_pin_thread(pg_handle->numa_node);
+}
@@ -0,0 +1,68 @@
+#ifndef PG_NUMA_H
+#define PG_NUMA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_numa.h
+ *
+ * NUMA placement helpers: locate the NUMA node of the RDMA device, allocate
+ * staging memory on a chosen node and pin threads to the cores of a node.
+ * Topology is read from sysfs; memory is bound with mbind(2), so no libnuma
+ * is required. On hosts without NUMA information every helper degrades to
+ * plain, unbound behavior.
+ */
+
+#include <stddef.h>
+#include <infiniband/verbs.h>
+#include "pg_handle.h"
+
+/**
+ * @brief Returns the NUMA node the RDMA device is attached to.
+ * @param ctx Opened device context.
+ * @return Node number, or -1 if unknown (single node or no sysfs information).
+ */
+int pg_numa_device_node(struct ibv_context *ctx);
+
+/**
+ * @brief Returns the number of NUMA nodes of the host (at least 1).
+ */
+int pg_numa_num_nodes(void);
+
+/**
+ * @brief Allocates page-aligned, zeroed memory whose pages are placed on 'node'.
+ * @param size Bytes to allocate.
+ * @param node Target node, or -1 for no placement policy.
+ * @return The memory, or NULL on failure. Release with pg_numa_free.
+ */
+void *pg_numa_alloc(size_t size, int node);
+
+/**
+ * @brief Releases memory returned by pg_numa_alloc.
+ * @param ptr The memory (NULL is ignored).
+ * @param size The size passed to pg_numa_alloc.
+ */
+void pg_numa_free(void *ptr, size_t size);
+
+/**
+ * @brief Pins the calling thread to the CPUs of a NUMA node.
+ * @param node Target node.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_numa_pin_thread(int node);
+
+/**
+ * @brief Pins the calling thread to the CPUs of the node holding the handle's
+ * staging buffers. Call it from every thread that drives collectives.
+ * @param pg_handle Pointer to the process group handle.
+ * @return 0 on success, -1 on failure or when the node is unknown.
+ */
+int pg_pin_thread(PGHandle *pg_handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_NUMA_H */
@@ -0,0 +1,184 @@
+#include "pg_pool.h"
+#include "pg_numa.h"
+#include "pg_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+// Size class of a request: the smallest power of two >= bytes, at least the minimum
+static int pool_class(size_t bytes) {
+    int c = 0;
+    while (c < PG_POOL_NUM_CLASSES && ((size_t)1 << (PG_POOL_MIN_SHIFT + c)) < bytes) c++;
+    return c;
+}
+
+static void release_block(pg_pool_block_t *block) {
+    pg_numa_free(block->addr, block->size);
+    free(block);
+}
+
+// Unlinks idle blocks matching the criteria onto 'out' (lock held).
+// keep_class < 0 and min_idle_ns == 0 take every idle block.
+static size_t unlink_idle(pg_pool_t *pool, int keep_class, uint64_t now_ns, uint64_t min_idle_ns,
+                          pg_pool_block_t **out) {
+    size_t bytes = 0;
+    for (int c = 0; c < PG_POOL_NUM_CLASSES; c++) {
+        if (c == keep_class) continue;
+        pg_pool_block_t **link = &pool->idle[c];
+        while (*link) {
+            pg_pool_block_t *block = *link;
+            if (now_ns - block->idle_since_ns >= min_idle_ns) {
+                *link = block->next;
+                block->next = *out;
+                *out = block;
+                bytes += block->size;
+                pool->bytes -= block->size;
+                pool->releases++;
+            } else {
+                link = &block->next;
+            }
+        }
+    }
+    return bytes;
+}
+
+static void release_list(pg_pool_block_t *list) {
+    while (list) {
+        pg_pool_block_t *next = list->next;
+        release_block(list);
+        list = next;
+    }
+}
+
+void pg_pool_init(PGHandle *pg_handle) {
+    pg_pool_t *pool = &pg_handle->pool;
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+void pg_pool_free(PGHandle *pg_handle) {
+    pg_pool_t *pool = &pg_handle->pool;
+    if (pool->in_use_bytes > 0) {
+        fprintf(stderr, "Rank %d: closing with %zu pool bytes in use\n", pg_handle->rank,
+                pool->in_use_bytes);
+    }
+    pg_pool_block_t *list = NULL;
+    unlink_idle(pool, -1, 0, 0, &list);
+    release_list(list);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+pg_pool_block_t *pg_pool_get(PGHandle *pg_handle, size_t bytes) {
+    pg_pool_t *pool = &pg_handle->pool;
+    int c = pool_class(bytes);
+    if (c == PG_POOL_NUM_CLASSES) {
+        fprintf(stderr, "Rank %d: no pool size class for %zu bytes\n", pg_handle->rank, bytes);
+        return NULL;
+    }
+    size_t size = (size_t)1 << (PG_POOL_MIN_SHIFT + c);
+
+    pthread_mutex_lock(&pool->lock);
+    pg_pool_block_t *block = pool->idle[c];
+    if (block) {
+        pool->idle[c] = block->next;
+        pool->in_use_bytes += size;
+        pool->hits++;
+        pthread_mutex_unlock(&pool->lock);
+        return block;
+    }
+
+    // At the cap, idle blocks of the other classes make room first
+    pg_pool_block_t *released = NULL;
+    if (pool->bytes + size > pg_handle->config.pool_max_bytes) {
+        unlink_idle(pool, c, 0, 0, &released);
+    }
+    if (pool->bytes + size > pg_handle->config.pool_max_bytes) {
+        pool->failures++;
+        pthread_mutex_unlock(&pool->lock);
+        release_list(released);
+        fprintf(stderr, "Rank %d: pool cap of %zu bytes reached (PG_POOL_MAX_BYTES)\n",
+                pg_handle->rank, pg_handle->config.pool_max_bytes);
+        return NULL;
+    }
+    // Reserve the bytes, then allocate without holding the lock
+    pool->bytes += size;
+    pool->in_use_bytes += size;
+    pool->misses++;
+    if (pool->bytes > pool->peak_bytes) pool->peak_bytes = pool->bytes;
+    pthread_mutex_unlock(&pool->lock);
+    release_list(released);
+
+    block = calloc(1, sizeof(*block));
+    if (block) {
+        block->size = size;
+        block->addr = pg_numa_alloc(size, pg_handle->numa_node);
+        if (!block->addr) {
+            free(block);
+            block = NULL;
+        }
+    }
+    if (!block) {
+        fprintf(stderr, "Rank %d: cannot allocate a %zu byte pool block\n", pg_handle->rank, size);
+        pthread_mutex_lock(&pool->lock);
+        pool->bytes -= size;
+        pool->in_use_bytes -= size;
+        pool->failures++;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return block;
+}
+
+void pg_pool_put(PGHandle *pg_handle, pg_pool_block_t *block) {
+    if (!block) return;
+    pg_pool_t *pool = &pg_handle->pool;
+    int c = pool_class(block->size);
+    uint64_t now = pg_trace_clock_ns();
+
+    pthread_mutex_lock(&pool->lock);
+    block->idle_since_ns = now;
+    block->next = pool->idle[c];
+    pool->idle[c] = block;
+    pool->in_use_bytes -= block->size;
+    pg_pool_block_t *released = NULL;
+    unlink_idle(pool, -1, now, (uint64_t)pg_handle->config.pool_idle_ms * 1000000ull, &released);
+    pthread_mutex_unlock(&pool->lock);
+    release_list(released);
+}
+
+size_t pg_pool_trim(PGHandle *pg_handle) {
+    if (!pg_handle) return 0;
+    pg_pool_t *pool = &pg_handle->pool;
+    pg_pool_block_t *released = NULL;
+    pthread_mutex_lock(&pool->lock);
+    size_t bytes = unlink_idle(pool, -1, 0, 0, &released);
+    pthread_mutex_unlock(&pool->lock);
+    release_list(released);
+    return bytes;
+}
+
+int pg_get_mem_stats(PGHandle *pg_handle, pg_mem_stats_t *stats) {
+    if (!pg_handle || !stats) {
+        fprintf(stderr, "Invalid parameters for pg_get_mem_stats\n");
+        return -1;
+    }
+    pg_pool_t *pool = &pg_handle->pool;
+    stats->staging_bytes = (pg_handle->sendbuf ? pg_handle->bufsize : 0) +
+                           (pg_handle->recvbuf ? pg_handle->bufsize : 0) +
+                           (pg_handle->ctrl ? pg_handle->ctrl_size : 0);
+    stats->mesh_bytes = pg_handle->mr_mesh ? pg_handle->mesh_size : 0;
+    stats->pinned_bytes = stats->staging_bytes + stats->mesh_bytes;
+
+    pthread_mutex_lock(&pool->lock);
+    stats->pool_bytes = pool->bytes;
+    stats->pool_in_use_bytes = pool->in_use_bytes;
+    stats->pool_peak_bytes = pool->peak_bytes;
+    stats->pool_max_bytes = pg_handle->config.pool_max_bytes;
+    stats->pool_hits = pool->hits;
+    stats->pool_misses = pool->misses;
+    stats->pool_failures = pool->failures;
+    stats->pool_releases = pool->releases;
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
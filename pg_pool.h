@@ -0,0 +1,95 @@
+#ifndef PG_POOL_H
+#define PG_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_pool.h
+ *
+ * Scratch memory of a handle, shared by all its collectives: the segment a
+ * ring step reduces through, the work blocks of reduce_scatterv and the
+ * buckets of fused all-reduces. The blocks are only touched by the CPU, so
+ * they are not registered with the NIC and pin nothing.
+ *
+ * Requests are rounded up to a power-of-two size class of at least
+ * 2^PG_POOL_MIN_SHIFT bytes. A returned block stays allocated in its class
+ * and serves the next request of that class; a miss allocates a block on the
+ * staging buffers' NUMA node. The pool never holds more than
+ * PG_POOL_MAX_BYTES: at the cap, idle blocks of other classes are released
+ * first, and the request fails when that is not enough. Blocks idle for
+ * PG_POOL_IDLE_MS are released when the pool is next used, or by
+ * pg_pool_trim. A handle that only runs small collectives therefore only
+ * holds small blocks.
+ *
+ * The pool does not change the pinned memory of a handle. That is the send
+ * and recv staging (PG_BUFFER_SIZE each, whatever the size of the
+ * collectives) and the control flags, registered at connect time, plus the
+ * mesh region once connected. Their addresses and rkeys are exchanged with
+ * the peers at connect, so they cannot come from a pool that grows and
+ * shrinks; lower PG_BUFFER_SIZE to pin less. pg_get_mem_stats reports them
+ * (pinned_bytes) next to the pool counters.
+ */
+
+#include "pg_handle.h"
+
+/* Memory of a handle: the regions registered with the NIC (pinned) and the
+ * scratch pool (not registered) */
+typedef struct {
+    size_t pinned_bytes;      /* staging_bytes + mesh_bytes */
+    size_t staging_bytes;     /* send and recv staging plus control flags, registered at connect */
+    size_t mesh_bytes;        /* mesh region, registered by the first pg_connect_peers */
+    size_t pool_bytes;        /* pool blocks, in use or idle */
+    size_t pool_in_use_bytes; /* pool blocks held by running collectives */
+    size_t pool_peak_bytes;   /* largest pool_bytes so far */
+    size_t pool_max_bytes;    /* cap of the pool (PG_POOL_MAX_BYTES) */
+    uint64_t pool_hits;       /* requests served by an idle block */
+    uint64_t pool_misses;     /* requests that allocated a new block */
+    uint64_t pool_failures;   /* requests refused at the cap or failed allocation */
+    uint64_t pool_releases;   /* blocks released after being idle (or to make room) */
+} pg_mem_stats_t;
+
+/**
+ * @brief Initializes the empty pool of a new handle.
+ */
+void pg_pool_init(PGHandle *pg_handle);
+
+/**
+ * @brief Frees every block; called by pg_close.
+ */
+void pg_pool_free(PGHandle *pg_handle);
+
+/**
+ * @brief Takes a block of at least 'bytes' bytes.
+ * @return The block (its memory is not cleared), or NULL at the cap or on
+ * allocation failure. Return it with pg_pool_put.
+ */
+pg_pool_block_t *pg_pool_get(PGHandle *pg_handle, size_t bytes);
+
+/**
+ * @brief Returns a block to the pool (NULL is ignored) and releases blocks
+ * idle for longer than PG_POOL_IDLE_MS.
+ */
+void pg_pool_put(PGHandle *pg_handle, pg_pool_block_t *block);
+
+/**
+ * @brief Releases every idle block of the pool now.
+ * @param pg_handle Pointer to the process group handle.
+ * @return Bytes released.
+ */
+size_t pg_pool_trim(PGHandle *pg_handle);
+
+/**
+ * @brief Reports the memory of a handle.
+ * @param pg_handle Pointer to the process group handle.
+ * @param stats Output.
+ * @return 0 on success, -1 on invalid arguments.
+ */
+int pg_get_mem_stats(PGHandle *pg_handle, pg_mem_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_POOL_H */
@@ -0,0 +1,163 @@
+#include "pg_handle.h"
+#include "pg_allreduce.h"
+#include "pg_repro.h"
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Exponent of a block without a finite non-zero element; loses every MAX
+#define EXP_NONE INT_MIN
+
+// Per-element non-finite flags, OR-ed over the ranks
+#define FLAG_POS_INF 1
+#define FLAG_NEG_INF 2
+#define FLAG_NAN 4
+
+// Unsigned, so that the partial sums wrap instead of overflowing: the final
+// sum fits in the signed range, and wrapped partials add up to it exactly
+typedef unsigned __int128 fixed_t;
+
+static void sum_fixed(void *dst, const void *src, int count, void *ctx) {
+    (void)ctx;
+    fixed_t *d = dst;
+    const fixed_t *s = src;
+    for (int i = 0; i < count; i++) d[i] += s[i];
+}
+
+// Largest frexp exponent of the finite non-zero elements of each block;
+// exps[blocks] is 1 when some element is not finite
+static void block_exponents(const double *x, int count, int *exps, int blocks) {
+    exps[blocks] = 0;
+    for (int b = 0; b < blocks; b++) {
+        int begin = b * PG_REPRO_BLOCK;
+        int end = begin + PG_REPRO_BLOCK < count ? begin + PG_REPRO_BLOCK : count;
+        double max_abs = 0.0;
+        for (int i = begin; i < end; i++) {
+            double a = fabs(x[i]);
+            if (!isfinite(a)) {
+                exps[blocks] = 1;
+            } else if (a > max_abs) {
+                max_abs = a;
+            }
+        }
+        exps[b] = EXP_NONE;
+        if (max_abs > 0.0) frexp(max_abs, &exps[b]);
+    }
+}
+
+// x * 2^(PG_REPRO_FRACTION_BITS - E) rounded to an integer. Scaling by a
+// power of two is exact, so the only rounding is rint's, on a grid fixed by E.
+static void encode(const double *x, int count, const int *exps, int blocks, fixed_t *out) {
+    for (int b = 0; b < blocks; b++) {
+        int begin = b * PG_REPRO_BLOCK;
+        int end = begin + PG_REPRO_BLOCK < count ? begin + PG_REPRO_BLOCK : count;
+        if (exps[b] == EXP_NONE) {
+            memset(out + begin, 0, (end - begin) * sizeof(fixed_t));
+            continue;
+        }
+        int shift = PG_REPRO_FRACTION_BITS - exps[b];
+        // 2^shift itself overflows for blocks of subnormals
+        double scale = shift <= DBL_MAX_EXP - 1 ? ldexp(1.0, shift) : 0.0;
+        for (int i = begin; i < end; i++) {
+            double v = 0.0;
+            if (isfinite(x[i])) v = rint(scale != 0.0 ? x[i] * scale : ldexp(x[i], shift));
+            out[i] = (fixed_t)(__int128)v;
+        }
+    }
+}
+
+// Rounds the exact sums back to double
+static void decode(const fixed_t *sums, int count, const int *exps, int blocks, double *out) {
+    for (int b = 0; b < blocks; b++) {
+        int begin = b * PG_REPRO_BLOCK;
+        int end = begin + PG_REPRO_BLOCK < count ? begin + PG_REPRO_BLOCK : count;
+        if (exps[b] == EXP_NONE) {
+            for (int i = begin; i < end; i++) out[i] = 0.0;
+            continue;
+        }
+        int shift = exps[b] - PG_REPRO_FRACTION_BITS;
+        double scale = shift >= DBL_MIN_EXP - 1 ? ldexp(1.0, shift) : 0.0;
+        for (int i = begin; i < end; i++) {
+            double v = (double)(__int128)sums[i];
+            out[i] = scale != 0.0 ? v * scale : ldexp(v, shift);
+        }
+    }
+}
+
+// Which infinities and NaNs this rank contributes, per element; NULL on allocation failure
+static int *non_finite_flags(const double *x, int count) {
+    int *flags = malloc(count * sizeof(int));
+    if (!flags) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        flags[i] = isnan(x[i]) ? FLAG_NAN : isinf(x[i]) ? (x[i] > 0 ? FLAG_POS_INF : FLAG_NEG_INF) : 0;
+    }
+    return flags;
+}
+
+// Overrides the elements some rank had an infinity or NaN at
+static int merge_non_finite(int *flags, double *recvbuf, int count, const pg_op_opts_t *opts,
+                            PGHandle *pg_handle) {
+    if (pg_all_reduce_ex(flags, flags, count, INT, BOR, opts, pg_handle) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (flags[i] == FLAG_POS_INF) {
+            recvbuf[i] = INFINITY;
+        } else if (flags[i] == FLAG_NEG_INF) {
+            recvbuf[i] = -INFINITY;
+        } else if (flags[i] != 0) {
+            recvbuf[i] = NAN;
+        }
+    }
+    return 0;
+}
+
+int pg_all_reduce_deterministic(const double* sendbuf, double* recvbuf, int count,
+                                const pg_op_opts_t* opts, PGHandle* pg_handle) {
+    if (!sendbuf || !recvbuf || count <= 0 || !pg_handle) {
+        fprintf(stderr, "Invalid parameters for all_reduce_deterministic\n");
+        return -1;
+    }
+    if (pg_handle->num_servers > PG_REPRO_MAX_RANKS) {
+        fprintf(stderr, "Rank %d: deterministic all-reduce supports at most %d ranks\n",
+                pg_handle->rank, PG_REPRO_MAX_RANKS);
+        return -1;
+    }
+    int blocks = (count + PG_REPRO_BLOCK - 1) / PG_REPRO_BLOCK;
+    int *exps = malloc((blocks + 1) * sizeof(int));
+    fixed_t *fixed = malloc((size_t)count * sizeof(fixed_t));
+    if (!exps || !fixed) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(exps);
+        free(fixed);
+        return -1;
+    }
+
+    block_exponents(sendbuf, count, exps, blocks);
+    int ret = pg_all_reduce_ex(exps, exps, blocks + 1, INT, MAX, opts, pg_handle);
+    if (ret == 0) {
+        encode(sendbuf, count, exps, blocks, fixed);
+        ret = pg_all_reduce_custom(fixed, fixed, count, sizeof(fixed_t), sum_fixed, NULL, opts, pg_handle);
+    }
+    // Taken before decoding, which overwrites the inputs of an in-place call
+    int *flags = NULL;
+    if (ret == 0 && exps[blocks] != 0 && !(flags = non_finite_flags(sendbuf, count))) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        decode(fixed, count, exps, blocks, recvbuf);
+    }
+    if (ret == 0 && flags) {
+        ret = merge_non_finite(flags, recvbuf, count, opts, pg_handle);
+    }
+    free(flags);
+    free(exps);
+    free(fixed);
+    return ret;
+}
@@ -0,0 +1,66 @@
+#ifndef PG_REPRO_H
+#define PG_REPRO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_repro.h
+ *
+ * Bitwise-reproducible DOUBLE SUM. The ring reduces each chunk in the order
+ * of its ring positions, so the rounding of an ordinary DOUBLE SUM depends on
+ * the group size, the ring order, the chunk boundaries and the number of
+ * rings. Here the ring carries exact fixed-point values instead, whose sum
+ * does not depend on the order at all:
+ *
+ *   1. every block of PG_REPRO_BLOCK elements gets a common exponent E, the
+ *      largest binary exponent of the block over all ranks (one INT MAX
+ *      all-reduce of count / PG_REPRO_BLOCK values);
+ *   2. each element x becomes the 128-bit integer rint(x * 2^(110 - E)),
+ *      i.e. |x| < 2^E is kept to 110 bits below the block maximum;
+ *   3. the integers are summed exactly on the ring (pg_all_reduce_custom,
+ *      16-byte elements, still segmented and pipelined like any all-reduce);
+ *   4. the sum is rounded back to double once.
+ *
+ * The 16 bits above the 110 fraction bits hold the carries of up to
+ * PG_REPRO_MAX_RANKS ranks. Elements within 57 binades of their block
+ * maximum are converted exactly; smaller ones are rounded on the block's grid
+ * (2^(E - 110)), which is deterministic too. The result is the same on every
+ * rank and for every group layout that holds the same set of inputs, and is
+ * the correctly rounded sum of the (converted) inputs.
+ *
+ * Infinities and NaNs take an extra INT BOR all-reduce of per-element flags,
+ * only when some rank has one: the result is NaN if any rank has a NaN or
+ * both infinities meet, the infinity otherwise.
+ *
+ * The ring moves twice the bytes of a DOUBLE SUM, plus the conversions.
+ * PG_DETERMINISTIC=1 makes pg_all_reduce (and _tagged, _ex, _streaming,
+ * _scaled, _multi, _strided, _sparse, _sparsify) use this path for DOUBLE SUM
+ * and AVG; the sparse calls then always send densely, the strided one packs
+ * the vector first. MIN and MAX are order-independent anyway.
+ */
+
+#include "pg_handle.h"
+
+#define PG_REPRO_BLOCK 256               /* elements sharing one exponent */
+#define PG_REPRO_FRACTION_BITS 110       /* fixed-point bits below the block maximum */
+#define PG_REPRO_MAX_RANKS (1 << 16)     /* carries the 128-bit accumulator can hold */
+
+/**
+ * @brief Bitwise-reproducible DOUBLE SUM all-reduce (see above).
+ * @param sendbuf count doubles; may equal recvbuf.
+ * @param recvbuf count doubles, identical on every rank afterwards.
+ * @param count Number of elements.
+ * @param opts Tag and priority as in pg_all_reduce_ex, or NULL.
+ * @param pg_handle Pointer to the process group handle.
+ * @return 0 on success, -1 on failure (including more than PG_REPRO_MAX_RANKS ranks).
+ */
+int pg_all_reduce_deterministic(const double* sendbuf, double* recvbuf, int count,
+                                const pg_op_opts_t* opts, PGHandle* pg_handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_REPRO_H */
@@ -0,0 +1,200 @@
+#include "pg_handle.h"
+#include "rdma_utils.h"
+#include "pg_scatter.h"
+#include "pg_coll.h"
+#include "pg_tuning.h"
+#include "pg_trace.h"
+#include "pg_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Chunks are numbered by ring position as in the all-reduce: after the
+// reduce-scatter, the rank at position p holds chunk p + 1. Chunk c is
+// therefore the block of the rank at position c - 1.
+static int chunk_owner(const PGHandle *pg_handle, int chunk) {
+    return ring_rank_at(pg_handle, 0, chunk - 1 + pg_handle->num_servers);
+}
+
+// Byte offsets of the rank blocks (prefix sums of counts) and the largest
+// block; -1 on a negative count
+static int block_layout(const PGHandle *pg_handle, const int *counts, size_t elem_size,
+                        size_t *offsets, size_t *max_bytes) {
+    size_t total = 0;
+    *max_bytes = 0;
+    for (int q = 0; q < pg_handle->num_servers; q++) {
+        if (counts[q] < 0) {
+            fprintf(stderr, "Negative count %d for rank %d\n", counts[q], q);
+            return -1;
+        }
+        offsets[q] = total;
+        total += (size_t)counts[q] * elem_size;
+        *max_bytes = MAX(*max_bytes, (size_t)counts[q] * elem_size);
+    }
+    return 0;
+}
+
+// Reduce-scatter steps on an acquired slot. The partial result of a chunk
+// arrives from the left, is reduced with our block of it and goes right on
+// the next step, so two pool blocks alternate; the last step reduces our own
+// block straight into recvbuf.
+static int reduce_scatter_ring(PGHandle *pg_handle, pg_slot_t *slot, const char *sendbuf, char *recvbuf,
+                               const int *counts, const size_t *offsets, size_t max_bytes,
+                               const pg_reducer_t *reducer, const pg_coll_params_t *params) {
+    int n = pg_handle->num_servers;
+    int idx = ring_position(pg_handle, slot);
+    size_t elem_size = reducer->elem_size;
+    size_t seg_size = ring_segment_size(slot, params, elem_size);
+    int num_segments = (int)((max_bytes + seg_size - 1) / seg_size);
+
+    pg_pool_block_t *work[2] = {pg_pool_get(pg_handle, max_bytes), pg_pool_get(pg_handle, max_bytes)};
+    pg_pool_block_t *temp = pg_pool_get(pg_handle, seg_size);
+    if (!work[0] || !work[1] || !temp) {
+        pg_pool_put(pg_handle, work[0]);
+        pg_pool_put(pg_handle, work[1]);
+        pg_pool_put(pg_handle, temp);
+        return -1;
+    }
+
+    int ret = 0;
+    int q = chunk_owner(pg_handle, idx);
+    const char *send_ptr = sendbuf + offsets[q];
+    size_t send_bytes = (size_t)counts[q] * elem_size;
+    for (int step = 0; step < n - 1 && ret == 0; step++) {
+        q = chunk_owner(pg_handle, (idx - step - 1 + n) % n);
+        size_t recv_bytes = (size_t)counts[q] * elem_size;
+        char *dst = step == n - 2 ? recvbuf : work[step % 2]->addr;
+        memcpy(dst, sendbuf + offsets[q], recv_bytes);
+
+        uint64_t t = pg_trace_begin(pg_handle);
+        slot->trace_step = step;
+        if (ring_step_reduce(pg_handle, slot, params->protocol, seg_size, num_segments,
+                             send_ptr, send_bytes, dst, recv_bytes, temp->addr, reducer, step == n - 2) != 0) {
+            ret = -1;
+        }
+        pg_trace_record(pg_handle, slot, PG_TRACE_STEP, t, recv_bytes);
+        send_ptr = dst;
+        send_bytes = recv_bytes;
+    }
+    slot->trace_step = -1;
+    if (ret == 0 && ring_finish(pg_handle, slot) != 0) {
+        ret = -1;
+    }
+    pg_pool_put(pg_handle, temp);
+    pg_pool_put(pg_handle, work[0]);
+    pg_pool_put(pg_handle, work[1]);
+    return ret;
+}
+
+// Allgather steps on an acquired slot, in place in recvbuf: each step
+// forwards the block received on the previous one
+static int allgather_ring(PGHandle *pg_handle, pg_slot_t *slot, char *recvbuf, const int *counts,
+                          const size_t *offsets, size_t max_bytes, size_t elem_size,
+                          const pg_coll_params_t *params) {
+    int n = pg_handle->num_servers;
+    int idx = ring_position(pg_handle, slot);
+    size_t seg_size = ring_segment_size(slot, params, elem_size);
+    int num_segments = (int)((max_bytes + seg_size - 1) / seg_size);
+
+    int ret = 0;
+    for (int step = 0; step < n - 1 && ret == 0; step++) {
+        int send_owner = chunk_owner(pg_handle, (idx - step + n + 1) % n);
+        int recv_owner = chunk_owner(pg_handle, (idx - step + n) % n);
+        size_t recv_bytes = (size_t)counts[recv_owner] * elem_size;
+
+        uint64_t t = pg_trace_begin(pg_handle);
+        slot->trace_step = n - 1 + step;
+        if (ring_step_copy(pg_handle, slot, params->protocol, seg_size, num_segments,
+                           recvbuf + offsets[send_owner], (size_t)counts[send_owner] * elem_size,
+                           recvbuf + offsets[recv_owner], recv_bytes) != 0) {
+            ret = -1;
+        }
+        pg_trace_record(pg_handle, slot, PG_TRACE_STEP, t, recv_bytes);
+    }
+    slot->trace_step = -1;
+    if (ret == 0 && ring_finish(pg_handle, slot) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int pg_reduce_scatterv(const void* sendbuf, void* recvbuf, const int* recvcounts,
+                       DATATYPE datatype, OPERATION op, PGHandle* pg_handle) {
+    if (!sendbuf || !recvbuf || !recvcounts || !pg_handle) {
+        fprintf(stderr, "Invalid parameters for reduce_scatterv\n");
+        return -1;
+    }
+    int n = pg_handle->num_servers;
+    pg_reducer_t reducer;
+    if (group_reducer(&reducer, datatype, op, n) != 0) {
+        return -1;
+    }
+    size_t elem_size = reducer.elem_size;
+    size_t *offsets = malloc(n * sizeof(size_t));
+    size_t max_bytes;
+    if (!offsets) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    if (block_layout(pg_handle, recvcounts, elem_size, offsets, &max_bytes) != 0) {
+        free(offsets);
+        return -1;
+    }
+    if (n == 1) {
+        memcpy(recvbuf, sendbuf, (size_t)recvcounts[0] * elem_size);
+        free(offsets);
+        return 0;
+    }
+
+    pg_coll_params_t params;
+    pg_tuning_select(pg_handle, offsets[n - 1] + (size_t)recvcounts[n - 1] * elem_size, datatype, &params);
+    pg_slot_t *slot = acquire_slot(pg_handle, 0);
+    int ret = -1;
+    if (slot) {
+        ret = reduce_scatter_ring(pg_handle, slot, sendbuf, recvbuf, recvcounts, offsets, max_bytes,
+                                  &reducer, &params);
+        release_slot(pg_handle, slot);
+    }
+    free(offsets);
+    return ret;
+}
+
+int pg_allgatherv(const void* sendbuf, void* recvbuf, const int* recvcounts,
+                  DATATYPE datatype, PGHandle* pg_handle) {
+    if (!sendbuf || !recvbuf || !recvcounts || !pg_handle) {
+        fprintf(stderr, "Invalid parameters for allgatherv\n");
+        return -1;
+    }
+    size_t elem_size = get_datatype_size(datatype);
+    if (elem_size == 0) {
+        fprintf(stderr, "Invalid datatype\n");
+        return -1;
+    }
+    int n = pg_handle->num_servers;
+    size_t *offsets = malloc(n * sizeof(size_t));
+    size_t max_bytes;
+    if (!offsets) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    if (block_layout(pg_handle, recvcounts, elem_size, offsets, &max_bytes) != 0) {
+        free(offsets);
+        return -1;
+    }
+    int rank = pg_handle->rank;
+    memmove((char *)recvbuf + offsets[rank], sendbuf, (size_t)recvcounts[rank] * elem_size);
+
+    int ret = 0;
+    if (n > 1) {
+        pg_coll_params_t params;
+        pg_tuning_select(pg_handle, offsets[n - 1] + (size_t)recvcounts[n - 1] * elem_size, datatype, &params);
+        pg_slot_t *slot = acquire_slot(pg_handle, 0);
+        ret = -1;
+        if (slot) {
+            ret = allgather_ring(pg_handle, slot, recvbuf, recvcounts, offsets, max_bytes, elem_size, &params);
+            release_slot(pg_handle, slot);
+        }
+    }
+    free(offsets);
+    return ret;
+}
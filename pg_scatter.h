@@ -0,0 +1,56 @@
+#ifndef PG_SCATTER_H
+#define PG_SCATTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_scatter.h
+ *
+ * The two halves of the ring all-reduce as collectives of their own, with a
+ * block size per rank: a reduce-scatter leaves rank q with the reduction of
+ * block q, and an allgather gives every rank every rank's block. Blocks may
+ * differ in size (zero included), e.g. to hand slower ranks less work.
+ *
+ * Both run n - 1 ring steps on the bulk slot of tag 0 with the protocol and
+ * segment size of pg_tuning_select. Each step moves the block of one rank,
+ * so a step lasts as long as its largest block: the steps run in lockstep.
+ */
+
+#include "pg_handle.h"
+
+/**
+ * @brief Reduce-scatter with per-rank counts: block q of the result (the
+ * reduction over all ranks of block q of their sendbuf) lands on rank q.
+ * @param sendbuf The blocks of all ranks back to back, in rank order:
+ * sum of recvcounts elements.
+ * @param recvbuf recvcounts[rank] elements; must not overlap sendbuf.
+ * @param recvcounts Elements of each rank's block, identical on all ranks.
+ * @param datatype DATATYPE of the elements.
+ * @param op Reduction operation.
+ * @param pg_handle Pointer to the process group handle.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_reduce_scatterv(const void* sendbuf, void* recvbuf, const int* recvcounts,
+                       DATATYPE datatype, OPERATION op, PGHandle* pg_handle);
+
+/**
+ * @brief Allgather with per-rank counts: every rank receives the blocks of
+ * all ranks, back to back in rank order.
+ * @param sendbuf This rank's block of recvcounts[rank] elements; may be its
+ * own place in recvbuf.
+ * @param recvbuf Sum of recvcounts elements.
+ * @param recvcounts Elements of each rank's block, identical on all ranks.
+ * @param datatype DATATYPE of the elements.
+ * @param pg_handle Pointer to the process group handle.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_allgatherv(const void* sendbuf, void* recvbuf, const int* recvcounts,
+                  DATATYPE datatype, PGHandle* pg_handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_SCATTER_H */
@@ -0,0 +1,822 @@
+#include "pg_sim.h"
+#include "pg_coll.h"
+#include "pg_config.h"
+#include "pg_tuning.h"
+#include "rdma_utils.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// Flags a simulated rank receives: from its ring neighbors, or on the atomic
+// path the arrivals counter of the root and the result sequence of the others
+enum { FLAG_BARRIER, FLAG_READY, FLAG_CONSUMED, FLAG_ARRIVALS, FLAG_RESULT, NUM_FLAGS };
+
+enum {
+    EV_WAKE,      // an actor's busy time is over
+    EV_FLAG,      // a flag write lands: flags[flag] = value
+    EV_COMPLETE,  // a signaled work request of an actor completes
+    EV_READ,      // an RDMA read request reaches the node holding the data
+    EV_ATOMIC     // a remote atomic reaches the root
+};
+
+typedef struct {
+    double time;
+    uint64_t order;           // FIFO among events of the same time
+    int kind;
+    int actor;
+    int flag;
+    uint64_t value;
+    size_t bytes;
+} sim_event_t;
+
+// Ops of the per-rank programs. A ring actor runs its segment program once per
+// segment of every step, then the finish program; an atomic actor runs the
+// root or the contributor program.
+enum {
+    OP_START,                 // initial copy of sendbuf into recvbuf
+    OP_COPY_IN,               // outgoing segment into staging
+    OP_BARRIER_DELAY,         // ring_barrier: new sequence number, fixed sleep
+    OP_BARRIER_WAIT_LEFT,     // ring_barrier: non-starters wait for the left flag
+    OP_BARRIER_SIGNAL,        // ring_barrier: flag write to the right
+    OP_BARRIER_WAIT_STARTER,  // ring_barrier: the starter waits for the wave to return
+    OP_WAIT_COMPLETIONS,      // poll_for_completion
+    OP_WRITE,                 // push: RDMA write of the segment to the right
+    OP_WAIT_CONSUMED,         // pull: the right neighbor has read our previous segment
+    OP_PUBLISH,               // pull: ready flag to the right
+    OP_WAIT_READY,            // pull: the left neighbor's segment is ready
+    OP_READ,                  // pull: RDMA read from the left
+    OP_CONSUME,               // pull: consumed flag to the left
+    OP_RECEIVE,               // reduce or copy the received segment out of staging
+    OP_NEXT_SEGMENT,
+    OP_ATOMIC,                // contributor: one remote atomic per element
+    OP_ARRIVE,                // contributor: count ourselves at the root
+    OP_WAIT_RESULT,           // contributor: the root's result has landed
+    OP_WAIT_ARRIVALS,         // root: every contributor has arrived
+    OP_COMBINE,               // root: add our own elements
+    OP_BROADCAST,             // root: result and sequence to every rank
+    OP_DONE
+};
+
+static const int push_segment[] = {
+    OP_COPY_IN,
+    OP_BARRIER_DELAY, OP_BARRIER_WAIT_LEFT, OP_BARRIER_SIGNAL, OP_WAIT_COMPLETIONS, OP_BARRIER_WAIT_STARTER,
+    OP_WRITE, OP_WAIT_COMPLETIONS,
+    OP_BARRIER_DELAY, OP_BARRIER_WAIT_LEFT, OP_BARRIER_SIGNAL, OP_WAIT_COMPLETIONS, OP_BARRIER_WAIT_STARTER,
+    OP_RECEIVE, OP_NEXT_SEGMENT
+};
+static const int pull_segment[] = {
+    OP_WAIT_CONSUMED, OP_COPY_IN, OP_PUBLISH, OP_WAIT_READY, OP_READ, OP_WAIT_COMPLETIONS,
+    OP_CONSUME, OP_RECEIVE, OP_NEXT_SEGMENT
+};
+static const int ring_start[] = {OP_START};
+static const int ring_finish_ops[] = {OP_WAIT_COMPLETIONS, OP_DONE};
+static const int atomic_contributor[] = {
+    OP_ATOMIC, OP_WAIT_COMPLETIONS, OP_ARRIVE, OP_WAIT_COMPLETIONS, OP_WAIT_RESULT, OP_DONE
+};
+static const int atomic_root[] = {
+    OP_WAIT_ARRIVALS, OP_COMBINE, OP_BROADCAST, OP_WAIT_COMPLETIONS, OP_DONE
+};
+
+// One rank on one ring (lane), or one rank of the atomic path
+typedef struct {
+    int lane;
+    int pos;                  // position on the lane's ring (the rank on the atomic path)
+    int node;                 // NIC port the actor sends and receives through
+    double now;
+    const int *prog;
+    int pc;
+    int step, seg;
+    int counter;              // progress of the looping atomic ops
+    int busy;                 // the op at pc has started its busy time
+    int blocked;              // waiting for a flag or a completion
+    int done;
+    int pending;
+    uint64_t barrier_seq;
+    uint64_t flags[NUM_FLAGS];
+} sim_actor_t;
+
+typedef struct {
+    const pg_sim_model_t *model;
+    int n;
+    int lanes;
+    int atomic;
+    size_t elem_size;
+    DATATYPE datatype;
+    pg_protocol_t protocol;
+    size_t start_bytes;       // bytes of the initial sendbuf copy
+    int count;                // elements (atomic path)
+    const int *chunk_counts[PG_MAX_RINGS];
+    size_t seg_size[PG_MAX_RINGS];
+    int num_segments[PG_MAX_RINGS];
+
+    sim_actor_t *actors;
+    double *tx_free;          // per node: when its transmit side is idle
+    double *rx_free;          // per node: when its receive side is idle
+    double atomic_free;       // when the root's atomic unit is idle
+    uint64_t arrivals;        // atomics counted at the root so far
+
+    sim_event_t *heap;
+    size_t heap_len;
+    size_t heap_cap;
+    uint64_t next_order;
+    uint64_t events;
+    int failed;
+} sim_run_t;
+
+// Microseconds to move 'bytes' at 'gbps' GB/s
+static double bytes_us(size_t bytes, double gbps) {
+    return gbps > 0 ? (double)bytes / (gbps * 1e3) : 0.0;
+}
+
+static int event_before(const sim_event_t *a, const sim_event_t *b) {
+    return a->time < b->time || (a->time == b->time && a->order < b->order);
+}
+
+static void schedule(sim_run_t *r, double time, int kind, int actor, int flag, uint64_t value,
+                     size_t bytes) {
+    if (r->heap_len == r->heap_cap) {
+        size_t cap = r->heap_cap ? 2 * r->heap_cap : 1024;
+        sim_event_t *heap = realloc(r->heap, cap * sizeof(sim_event_t));
+        if (!heap) {
+            r->failed = 1;
+            return;
+        }
+        r->heap = heap;
+        r->heap_cap = cap;
+    }
+    sim_event_t ev = {time, r->next_order++, kind, actor, flag, value, bytes};
+    size_t i = r->heap_len++;
+    while (i > 0 && event_before(&ev, &r->heap[(i - 1) / 2])) {
+        r->heap[i] = r->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    r->heap[i] = ev;
+}
+
+static sim_event_t pop_event(sim_run_t *r) {
+    sim_event_t top = r->heap[0];
+    sim_event_t last = r->heap[--r->heap_len];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= r->heap_len) break;
+        if (child + 1 < r->heap_len && event_before(&r->heap[child + 1], &r->heap[child])) child++;
+        if (!event_before(&r->heap[child], &last)) break;
+        r->heap[i] = r->heap[child];
+        i = child;
+    }
+    if (r->heap_len > 0) r->heap[i] = last;
+    return top;
+}
+
+// A message from node src to node dst that is ready to go at time t: it
+// waits for both ports, occupies them for its wire time and arrives one
+// latency after its last byte left. Returns the arrival time.
+static double transfer(sim_run_t *r, int src, int dst, size_t bytes, double t) {
+    double latency = r->model->latency_us;
+    double wire = bytes_us(bytes, r->model->bandwidth_gbps);
+    double start = MAX(t, MAX(r->tx_free[src], r->rx_free[dst] - latency));
+    r->tx_free[src] = start + wire;
+    r->rx_free[dst] = start + latency + wire;
+    return start + latency + wire;
+}
+
+static int actor_index(const sim_run_t *r, int lane, int pos) {
+    return lane * r->n + (pos + r->n) % r->n;
+}
+
+// Spends 'us' of the actor's time on the op at pc. Returns 1 while the actor
+// is busy (it is woken when the time is over and runs the op again), 0 once
+// the time is spent.
+static int spend(sim_run_t *r, sim_actor_t *a, double us) {
+    if (a->busy) {
+        a->busy = 0;
+        return 0;
+    }
+    if (us <= 0) return 0;
+    a->busy = 1;
+    schedule(r, a->now + us, EV_WAKE, (int)(a - r->actors), 0, 0, 0);
+    return 1;
+}
+
+// Whether flags[flag] >= value; blocks the actor otherwise
+static int flag_reached(sim_actor_t *a, int flag, uint64_t value) {
+    if (a->flags[flag] >= value) return 1;
+    a->blocked = 1;
+    return 0;
+}
+
+// A signaled write of 'bytes' from actor 'a' to actor 'dst', landing a flag
+// write of 'value' behind it when flag >= 0
+static void post_write(sim_run_t *r, sim_actor_t *a, int dst, size_t bytes, int flag, uint64_t value) {
+    double arrival = transfer(r, a->node, r->actors[dst].node, bytes, a->now);
+    if (flag >= 0) {
+        schedule(r, arrival, EV_FLAG, dst, flag, value, 0);
+    }
+    a->pending++;
+    schedule(r, arrival + r->model->latency_us, EV_COMPLETE, (int)(a - r->actors), 0, 0, 0);
+}
+
+// Bytes of segment 'seg' of a message of 'bytes' (segment_bytes in pg_coll.c)
+static size_t segment_part(size_t bytes, size_t seg_size, int seg) {
+    size_t begin = (size_t)seg * seg_size;
+    if (begin >= bytes) return 0;
+    return MIN(seg_size, bytes - begin);
+}
+
+// Bytes the actor sends and receives in the current segment, chunk ids as in
+// ring_all_reduce
+static void segment_sizes(const sim_run_t *r, const sim_actor_t *a, size_t *send, size_t *recv) {
+    int n = r->n;
+    int idx = a->pos;
+    int send_chunk, recv_chunk;
+    if (a->step < n - 1) {
+        send_chunk = (idx - a->step + n) % n;
+        recv_chunk = (idx - a->step - 1 + n) % n;
+    } else {
+        int step = a->step - (n - 1);
+        send_chunk = (idx - step + n + 1) % n;
+        recv_chunk = (idx - step + n) % n;
+    }
+    const int *counts = r->chunk_counts[a->lane];
+    size_t seg_size = r->seg_size[a->lane];
+    *send = segment_part((size_t)counts[send_chunk] * r->elem_size, seg_size, a->seg);
+    *recv = segment_part((size_t)counts[recv_chunk] * r->elem_size, seg_size, a->seg);
+}
+
+// Sequence number of the current segment, as the pull protocol's xfer_seq
+static uint64_t segment_seq(const sim_run_t *r, const sim_actor_t *a) {
+    return (uint64_t)a->step * r->num_segments[a->lane] + a->seg + 1;
+}
+
+static void jump(sim_actor_t *a, const int *prog) {
+    a->prog = prog;
+    a->pc = 0;
+}
+
+// Runs the op at the actor's pc. Returns 1 when it is finished (pc has moved
+// on), 0 when the actor sleeps or blocks on it.
+static int run_op(sim_run_t *r, sim_actor_t *a) {
+    const pg_sim_model_t *m = r->model;
+    int n = r->n;
+    int right = actor_index(r, a->lane, a->pos + 1);
+    int left = actor_index(r, a->lane, a->pos - 1);
+    size_t send, recv;
+
+    switch (a->prog[a->pc]) {
+    case OP_START:
+        if (spend(r, a, bytes_us(r->start_bytes, m->memcpy_gbps))) return 0;
+        if (r->atomic) {
+            jump(a, a->pos == 0 ? atomic_root : atomic_contributor);
+        } else {
+            jump(a, n > 1 ? (r->protocol == PG_PROTOCOL_PULL ? pull_segment : push_segment)
+                          : ring_finish_ops);
+        }
+        return 1;
+    case OP_COPY_IN:
+        segment_sizes(r, a, &send, &recv);
+        if (spend(r, a, bytes_us(send, m->memcpy_gbps))) return 0;
+        break;
+    case OP_BARRIER_DELAY:
+        if (!a->busy) a->barrier_seq++;
+        if (spend(r, a, m->barrier_delay_us)) return 0;
+        break;
+    case OP_BARRIER_WAIT_LEFT:
+        if (a->pos != 0 && !flag_reached(a, FLAG_BARRIER, a->barrier_seq)) return 0;
+        break;
+    case OP_BARRIER_WAIT_STARTER:
+        if (a->pos == 0 && !flag_reached(a, FLAG_BARRIER, a->barrier_seq)) return 0;
+        break;
+    case OP_BARRIER_SIGNAL:
+        if (spend(r, a, m->post_us)) return 0;
+        post_write(r, a, right, sizeof(uint64_t), FLAG_BARRIER, a->barrier_seq);
+        break;
+    case OP_WAIT_COMPLETIONS:
+        if (a->pending > 0) {
+            a->blocked = 1;
+            return 0;
+        }
+        break;
+    case OP_WRITE:
+        if (spend(r, a, m->post_us)) return 0;
+        segment_sizes(r, a, &send, &recv);
+        post_write(r, a, right, send, -1, 0);
+        break;
+    case OP_WAIT_CONSUMED:
+        if (!flag_reached(a, FLAG_CONSUMED, segment_seq(r, a) - 1)) return 0;
+        break;
+    case OP_PUBLISH:
+        if (spend(r, a, m->post_us)) return 0;
+        post_write(r, a, right, sizeof(uint64_t), FLAG_READY, segment_seq(r, a));
+        break;
+    case OP_WAIT_READY:
+        if (!flag_reached(a, FLAG_READY, segment_seq(r, a))) return 0;
+        break;
+    case OP_READ:
+        if (spend(r, a, m->post_us)) return 0;
+        segment_sizes(r, a, &send, &recv);
+        a->pending++;
+        schedule(r, a->now + m->latency_us, EV_READ, (int)(a - r->actors), 0, 0, recv);
+        break;
+    case OP_CONSUME:
+        if (spend(r, a, m->post_us)) return 0;
+        post_write(r, a, left, sizeof(uint64_t), FLAG_CONSUMED, segment_seq(r, a));
+        break;
+    case OP_RECEIVE:
+        segment_sizes(r, a, &send, &recv);
+        // Reduce-scatter steps reduce the segment, in push mode after copying
+        // it to the temporary buffer; allgather steps copy it out
+        if (spend(r, a, a->step < n - 1
+                             ? (r->protocol == PG_PROTOCOL_PULL ? 0.0 : bytes_us(recv, m->memcpy_gbps)) +
+                               bytes_us(recv, m->reduce_gbps[r->datatype])
+                             : bytes_us(recv, m->memcpy_gbps))) {
+            return 0;
+        }
+        break;
+    case OP_NEXT_SEGMENT:
+        if (++a->seg == r->num_segments[a->lane]) {
+            a->seg = 0;
+            a->step++;
+        }
+        if (a->step == 2 * (n - 1)) {
+            jump(a, ring_finish_ops);
+        } else {
+            a->pc = 0;
+        }
+        return 1;
+    case OP_ATOMIC:
+        while (a->counter < r->count) {
+            if (spend(r, a, m->post_us)) return 0;
+            a->counter++;
+            a->pending++;
+            schedule(r, a->now + m->latency_us, EV_ATOMIC, (int)(a - r->actors), -1, 0, 0);
+        }
+        break;
+    case OP_ARRIVE:
+        if (spend(r, a, m->post_us)) return 0;
+        a->pending++;
+        schedule(r, a->now + m->latency_us, EV_ATOMIC, (int)(a - r->actors), FLAG_ARRIVALS, 0, 0);
+        break;
+    case OP_WAIT_RESULT:
+        if (!flag_reached(a, FLAG_RESULT, 1)) return 0;
+        break;
+    case OP_WAIT_ARRIVALS:
+        if (!flag_reached(a, FLAG_ARRIVALS, (uint64_t)(n - 1))) return 0;
+        break;
+    case OP_COMBINE:
+        if (spend(r, a, bytes_us((size_t)r->count * sizeof(int), m->reduce_gbps[INT]))) return 0;
+        break;
+    case OP_BROADCAST:
+        // Result and sequence word are two posts, the second one signaled
+        while (a->counter < n - 1) {
+            if (spend(r, a, 2 * m->post_us)) return 0;
+            int peer = ++a->counter;
+            double arrival = transfer(r, a->node, peer, (size_t)r->count * sizeof(int32_t), a->now);
+            arrival = MAX(arrival, transfer(r, a->node, peer, sizeof(uint64_t), a->now));
+            schedule(r, arrival, EV_FLAG, actor_index(r, 0, peer), FLAG_RESULT, 1, 0);
+            a->pending++;
+            schedule(r, arrival + m->latency_us, EV_COMPLETE, (int)(a - r->actors), 0, 0, 0);
+        }
+        break;
+    case OP_DONE:
+        a->done = 1;
+        return 0;
+    default:
+        r->failed = 1;
+        return 0;
+    }
+    a->pc++;
+    return 1;
+}
+
+// Runs an actor at time t until it sleeps, blocks or is done
+static void run_actor(sim_run_t *r, sim_actor_t *a, double t) {
+    a->now = t;
+    a->blocked = 0;
+    while (!a->done && !r->failed && run_op(r, a)) {
+    }
+}
+
+static void handle_event(sim_run_t *r, const sim_event_t *ev) {
+    sim_actor_t *a = &r->actors[ev->actor];
+    switch (ev->kind) {
+    case EV_WAKE:
+        run_actor(r, a, ev->time);
+        return;
+    case EV_FLAG:
+        a->flags[ev->flag] = MAX(a->flags[ev->flag], ev->value);
+        break;
+    case EV_COMPLETE:
+        a->pending--;
+        break;
+    case EV_READ: {
+        // The data leaves the left neighbor's port; the read completes on arrival
+        sim_actor_t *left = &r->actors[actor_index(r, a->lane, a->pos - 1)];
+        double arrival = transfer(r, left->node, a->node, ev->bytes, ev->time);
+        schedule(r, arrival, EV_COMPLETE, ev->actor, 0, 0, 0);
+        return;
+    }
+    case EV_ATOMIC: {
+        double start = MAX(ev->time, r->atomic_free);
+        r->atomic_free = start + r->model->atomic_us;
+        if (ev->flag >= 0) {
+            schedule(r, r->atomic_free, EV_FLAG, actor_index(r, 0, 0), ev->flag, ++r->arrivals, 0);
+        }
+        schedule(r, r->atomic_free + r->model->latency_us, EV_COMPLETE, ev->actor, 0, 0, 0);
+        return;
+    }
+    default:
+        r->failed = 1;
+        return;
+    }
+    if (a->blocked) run_actor(r, a, ev->time);
+}
+
+// Runs every actor from time 0 to the end; fills the per-rank finish times
+static int simulate(sim_run_t *r, pg_sim_result_t *result) {
+    int n = r->n;
+    int num_actors = r->lanes * n;
+    r->actors = calloc(num_actors, sizeof(sim_actor_t));
+    r->tx_free = calloc(n, sizeof(double));
+    r->rx_free = calloc(n, sizeof(double));
+    double *finish = calloc(n, sizeof(double));
+    int ret = -1;
+    if (!r->actors || !r->tx_free || !r->rx_free || !finish) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto out;
+    }
+
+    for (int i = 0; i < num_actors; i++) {
+        sim_actor_t *a = &r->actors[i];
+        a->lane = i / n;
+        a->pos = i % n;
+        // The reverse ring visits the ranks backwards from the same position 0
+        a->node = a->lane ? (n - a->pos) % n : a->pos;
+        a->prog = ring_start;
+        schedule(r, 0.0, EV_WAKE, i, 0, 0, 0);
+    }
+    while (r->heap_len > 0 && !r->failed) {
+        sim_event_t ev = pop_event(r);
+        r->events++;
+        handle_event(r, &ev);
+    }
+    if (r->failed) {
+        fprintf(stderr, "Simulation failed\n");
+        goto out;
+    }
+
+    for (int i = 0; i < num_actors; i++) {
+        sim_actor_t *a = &r->actors[i];
+        if (!a->done) {
+            fprintf(stderr, "Simulation deadlocked at rank position %d, ring %d\n", a->pos, a->lane);
+            goto out;
+        }
+        finish[a->node] = MAX(finish[a->node], a->now);
+    }
+    result->max_us = 0.0;
+    result->mean_us = 0.0;
+    for (int node = 0; node < n; node++) {
+        result->max_us = MAX(result->max_us, finish[node]);
+        result->mean_us += finish[node] / n;
+    }
+    result->events = r->events;
+    ret = 0;
+
+out:
+    free(r->actors);
+    free(r->tx_free);
+    free(r->rx_free);
+    free(r->heap);
+    free(finish);
+    return ret;
+}
+
+void pg_sim_model_init(pg_sim_model_t *model) {
+    model->latency_us = 1.5;
+    model->bandwidth_gbps = 12.5;
+    model->post_us = 0.2;
+    model->atomic_us = 0.5;
+    model->barrier_delay_us = RING_BARRIER_DELAY_US;
+    model->memcpy_gbps = 10.0;
+    for (int t = 0; t <= BF16; t++) {
+        model->reduce_gbps[t] = 8.0;
+    }
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Throughput in GB/s of memcpy (datatype < 0) or the SUM kernel of 'datatype'
+// over 'bytes', repeated for at least 20 ms after a warm-up pass
+static double measure_gbps(void *dst, void *src, size_t bytes, int datatype) {
+    int count = datatype < 0 ? 0 : (int)(bytes / get_datatype_size((DATATYPE)datatype));
+    double start = 0.0;
+    double elapsed = 0.0;
+    long reps = -1;
+    do {
+        if (reps == 0) start = now_us();
+        if (datatype < 0) {
+            memcpy(dst, src, bytes);
+        } else {
+            perform_operation(dst, src, count, (DATATYPE)datatype, SUM);
+        }
+        reps++;
+        if (reps > 0) elapsed = now_us() - start;
+    } while (reps <= 0 || elapsed < 20000.0);
+    return bytes_us(bytes * reps, 1.0) / elapsed;
+}
+
+int pg_sim_calibrate_host(pg_sim_model_t *model, size_t bytes) {
+    void *dst = calloc(1, bytes);
+    void *src = calloc(1, bytes);
+    if (!dst || !src || bytes == 0) {
+        free(dst);
+        free(src);
+        return -1;
+    }
+    model->memcpy_gbps = measure_gbps(dst, src, bytes, -1);
+    for (int t = 0; t <= BF16; t++) {
+        model->reduce_gbps[t] = measure_gbps(dst, src, bytes, t);
+    }
+    free(dst);
+    free(src);
+    return 0;
+}
+
+int pg_sim_init(pg_sim_t *sim, int num_ranks, const pg_config_t *config,
+                const pg_sim_model_t *model, int atomic_supported) {
+    memset(sim, 0, sizeof(*sim));
+    if (num_ranks < 1 || !config || !model || pg_config_validate(config) != 0) {
+        fprintf(stderr, "Invalid simulated group\n");
+        return -1;
+    }
+    PGHandle *group = &sim->group;
+    group->num_servers = num_ranks;
+    group->config = *config;
+    group->num_rings = config->num_rings;
+    group->atomic_supported = atomic_supported;
+    group->bufsize = config->buffer_size;
+    sim->model = *model;
+
+    // Staging split of pg_connect: equal slots, reverse lanes on their second halves
+    group->num_slots = config->num_slots;
+    group->num_high_slots = config->num_high_slots;
+    size_t slot_size = group->bufsize / (group->num_slots + group->num_high_slots);
+    for (int i = 0; i < group->num_slots + group->num_high_slots; i++) {
+        group->slots[i].index = i;
+        group->slots[i].size = slot_size;
+        group->slots[PG_MAX_SLOTS + i].index = PG_MAX_SLOTS + i;
+        group->slots[PG_MAX_SLOTS + i].ring = 1;
+        group->slots[PG_MAX_SLOTS + i].size = slot_size / 2;
+    }
+
+    if (config->tuning_file[0] != '\0' && pg_tuning_load(group, config->tuning_file) != 0) {
+        fprintf(stderr, "Warning: ignoring tuning file %s, using built-in heuristics\n",
+                config->tuning_file);
+    }
+    return 0;
+}
+
+void pg_sim_free(pg_sim_t *sim) {
+    free(sim->group.tuning_rules);
+    sim->group.tuning_rules = NULL;
+    sim->group.num_tuning_rules = 0;
+}
+
+int pg_sim_all_reduce(const pg_sim_t *sim, int count, DATATYPE datatype,
+                      const pg_coll_params_t *params, pg_sim_result_t *result) {
+    const PGHandle *group = &sim->group;
+    size_t elem_size = get_datatype_size(datatype);
+    if (count <= 0 || elem_size == 0 || !result) {
+        fprintf(stderr, "Invalid parameters for simulated all_reduce\n");
+        return -1;
+    }
+    // Schedules the model does not replay (see pg_sim.h)
+    if (group->config.balance || (group->config.deterministic && datatype == DOUBLE)) {
+        fprintf(stderr, "Simulated all_reduce does not model %s\n",
+                group->config.balance ? "PG_BALANCE" : "PG_DETERMINISTIC");
+        return -1;
+    }
+    int n = group->num_servers;
+    memset(result, 0, sizeof(*result));
+    if (params) {
+        result->params = *params;
+    } else {
+        pg_tuning_select(group, (size_t)count * elem_size, datatype, &result->params);
+    }
+
+    sim_run_t run;
+    memset(&run, 0, sizeof(run));
+    run.model = &sim->model;
+    run.n = n;
+    run.lanes = 1;
+    run.elem_size = elem_size;
+    run.datatype = datatype;
+    run.protocol = result->params.protocol;
+    run.count = count;
+    result->rings = 1;
+
+    if (result->params.algorithm == PG_ALGO_ATOMIC && atomic_applicable(group, count, datatype)) {
+        run.atomic = 1;
+        return simulate(&run, result);
+    }
+
+    // The ring schedule of multi_ring_all_reduce / ring_all_reduce
+    int split = ring_split_count(group, count, elem_size);
+    int *chunk_counts = malloc(2 * n * sizeof(int));
+    if (!chunk_counts) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    for (int k = 0; k < n; k++) {
+        chunk_counts[k] = ring_chunk_count(split, n, k);
+        chunk_counts[n + k] = ring_chunk_count(count - split, n, k);
+    }
+    pg_coll_params_t ring_params = result->params;
+    if (split != count) {
+        const pg_slot_t *lane = &group->slots[PG_MAX_SLOTS];
+        if (ring_params.segment_bytes == 0 || ring_params.segment_bytes > lane->size) {
+            ring_params.segment_bytes = lane->size;
+        }
+        run.lanes = 2;
+        result->rings = 2;
+    }
+    run.start_bytes = (size_t)count * elem_size;
+    for (int lane = 0; lane < run.lanes; lane++) {
+        size_t max_chunk_bytes = 0;
+        for (int k = 0; k < n; k++) {
+            max_chunk_bytes = MAX(max_chunk_bytes, (size_t)chunk_counts[lane * n + k] * elem_size);
+        }
+        run.chunk_counts[lane] = chunk_counts + lane * n;
+        run.seg_size[lane] = ring_segment_size(&group->slots[lane * PG_MAX_SLOTS], &ring_params, elem_size);
+        run.num_segments[lane] = (int)((max_chunk_bytes + run.seg_size[lane] - 1) / run.seg_size[lane]);
+    }
+    result->segments = run.num_segments[0];
+
+    int ret = simulate(&run, result);
+    free(chunk_counts);
+    return ret;
+}
+
+// Fitted parameters: latency, microseconds per byte, posting cost
+#define FIT_PARAMS 3
+
+static void fit_get(const pg_sim_model_t *model, double *theta) {
+    theta[0] = model->latency_us;
+    theta[1] = 1.0 / (model->bandwidth_gbps * 1e3);
+    theta[2] = model->post_us;
+}
+
+static void fit_set(pg_sim_model_t *model, const double *theta) {
+    model->latency_us = theta[0];
+    model->bandwidth_gbps = 1.0 / (theta[1] * 1e3);
+    model->post_us = theta[2];
+}
+
+// Lower bounds: 10 ns latency, 1 TB/s, free posting
+static const double fit_floor[FIT_PARAMS] = {0.01, 1e-6, 0.0};
+
+// Relative errors (predicted / measured - 1) of every sample under 'model'
+static int fit_residuals(const pg_sim_model_t *model, const pg_config_t *config,
+                         const pg_sim_sample_t *samples, int num_samples, double *residuals) {
+    for (int i = 0; i < num_samples; i++) {
+        pg_sim_t sim;
+        pg_sim_result_t result;
+        int count = (int)(samples[i].bytes / sizeof(double));
+        if (pg_sim_init(&sim, samples[i].ranks, config, model, 1) != 0) return -1;
+        int ret = pg_sim_all_reduce(&sim, count > 0 ? count : 1, DOUBLE, NULL, &result);
+        pg_sim_free(&sim);
+        if (ret != 0) return -1;
+        residuals[i] = result.mean_us / samples[i].measured_us - 1.0;
+    }
+    return 0;
+}
+
+static double sum_squares(const double *v, int len) {
+    double s = 0.0;
+    for (int i = 0; i < len; i++) s += v[i] * v[i];
+    return s;
+}
+
+// Solves A x = b (Gaussian elimination, partial pivoting); unknowns without a
+// usable pivot are left at 0
+static void solve(double a[FIT_PARAMS][FIT_PARAMS], double *b, double *x) {
+    int usable[FIT_PARAMS];
+    for (int col = 0; col < FIT_PARAMS; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < FIT_PARAMS; row++) {
+            if (fabs(a[row][col]) > fabs(a[pivot][col])) pivot = row;
+        }
+        for (int k = 0; k < FIT_PARAMS; k++) {
+            double tmp = a[col][k];
+            a[col][k] = a[pivot][k];
+            a[pivot][k] = tmp;
+        }
+        double tmp = b[col];
+        b[col] = b[pivot];
+        b[pivot] = tmp;
+        usable[col] = fabs(a[col][col]) > 1e-300;
+        if (!usable[col]) continue;
+        for (int row = col + 1; row < FIT_PARAMS; row++) {
+            double f = a[row][col] / a[col][col];
+            for (int k = col; k < FIT_PARAMS; k++) a[row][k] -= f * a[col][k];
+            b[row] -= f * b[col];
+        }
+    }
+    for (int col = FIT_PARAMS - 1; col >= 0; col--) {
+        x[col] = 0.0;
+        if (!usable[col]) continue;
+        double s = b[col];
+        for (int k = col + 1; k < FIT_PARAMS; k++) s -= a[col][k] * x[k];
+        x[col] = s / a[col][col];
+    }
+}
+
+int pg_sim_fit(pg_sim_model_t *model, const pg_config_t *config,
+               const pg_sim_sample_t *samples, int num_samples, double *rms_error) {
+    if (num_samples <= 0) return -1;
+    for (int i = 0; i < num_samples; i++) {
+        if (samples[i].ranks < 1 || samples[i].measured_us <= 0) {
+            fprintf(stderr, "Invalid measurement %d for the fit\n", i);
+            return -1;
+        }
+    }
+    double *residuals = malloc(num_samples * sizeof(double));
+    double *trial = malloc(num_samples * sizeof(double));
+    double *jacobian = malloc(FIT_PARAMS * num_samples * sizeof(double));
+    int ret = -1;
+    if (!residuals || !trial || !jacobian) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto out;
+    }
+
+    // Levenberg-Marquardt on the relative errors. The simulated time is
+    // piecewise linear in the parameters, so forward differences are exact
+    // within a piece.
+    double theta[FIT_PARAMS];
+    double lambda = 1e-3;
+    fit_get(model, theta);
+    if (fit_residuals(model, config, samples, num_samples, residuals) != 0) goto out;
+    double error = sum_squares(residuals, num_samples);
+
+    for (int iter = 0; iter < 50 && lambda < 1e12; iter++) {
+        for (int j = 0; j < FIT_PARAMS; j++) {
+            double probe[FIT_PARAMS];
+            memcpy(probe, theta, sizeof(probe));
+            double h = MAX(theta[j] * 0.01, fit_floor[j]);
+            probe[j] += h;
+            pg_sim_model_t moved = *model;
+            fit_set(&moved, probe);
+            if (fit_residuals(&moved, config, samples, num_samples, trial) != 0) goto out;
+            for (int i = 0; i < num_samples; i++) {
+                jacobian[j * num_samples + i] = (trial[i] - residuals[i]) / h;
+            }
+        }
+
+        double a[FIT_PARAMS][FIT_PARAMS], b[FIT_PARAMS], step[FIT_PARAMS];
+        for (int j = 0; j < FIT_PARAMS; j++) {
+            b[j] = 0.0;
+            for (int i = 0; i < num_samples; i++) b[j] -= jacobian[j * num_samples + i] * residuals[i];
+            for (int k = 0; k < FIT_PARAMS; k++) {
+                a[j][k] = 0.0;
+                for (int i = 0; i < num_samples; i++) {
+                    a[j][k] += jacobian[j * num_samples + i] * jacobian[k * num_samples + i];
+                }
+            }
+            a[j][j] *= 1.0 + lambda;
+        }
+        solve(a, b, step);
+
+        double next[FIT_PARAMS];
+        for (int j = 0; j < FIT_PARAMS; j++) next[j] = MAX(theta[j] + step[j], fit_floor[j]);
+        pg_sim_model_t candidate = *model;
+        fit_set(&candidate, next);
+        if (fit_residuals(&candidate, config, samples, num_samples, trial) != 0) goto out;
+        double next_error = sum_squares(trial, num_samples);
+        if (next_error < error) {
+            int converged = error - next_error < 1e-9 * error;
+            memcpy(theta, next, sizeof(theta));
+            memcpy(residuals, trial, num_samples * sizeof(double));
+            *model = candidate;
+            error = next_error;
+            lambda = MAX(lambda / 10, 1e-9);
+            if (converged) break;
+        } else {
+            lambda *= 10;
+        }
+    }
+    if (rms_error) *rms_error = sqrt(error / num_samples);
+    ret = 0;
+
+out:
+    free(residuals);
+    free(trial);
+    free(jacobian);
+    return ret;
+}
@@ -0,0 +1,136 @@
+#ifndef PG_SIM_H
+#define PG_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_sim.h
+ *
+ * Discrete-event model of pg_all_reduce for capacity planning: predicts the
+ * time of an all-reduce on group sizes that are not available (64, 256 ranks)
+ * from a few link and host parameters measured on the ones that are.
+ *
+ * The model replays the schedule the library itself would run. The algorithm,
+ * protocol and segment size come from pg_tuning_select (tuning table
+ * included); chunk sizes from ring_chunk_count (remainder on the last chunk);
+ * the two-ring split from ring_split_count; segments from ring_segment_size.
+ * Every rank (and reverse lane) executes its own copy of the ring step:
+ *
+ *   push: copy-in, ring barrier, RDMA write, completion, ring barrier, reduce
+ *   pull: wait consumed, copy-in, ready flag, wait ready, RDMA read,
+ *         completion, consumed flag, reduce
+ *
+ * with the ring barrier modeled as the wave it is (starter first, each rank
+ * after its left neighbor, including its fixed sleep). The atomic path is
+ * modeled as remote atomics serialized on the root's NIC followed by the
+ * root's result broadcast (one round, i.e. SUM).
+ *
+ * Not modeled, and rejected by pg_sim_all_reduce: the adaptive chunk sizes
+ * and cost exchanges of PG_BALANCE, and the fixed-point DOUBLE path of
+ * PG_DETERMINISTIC (pg_repro.h). Simulate with those options off.
+ *
+ * Every message occupies the sender's transmit side and the receiver's
+ * receive side of a NIC port for bytes / bandwidth, arriving one latency
+ * later; both rings of a two-ring all-reduce share the ports of their ranks.
+ * Copies and reductions cost bytes / throughput on the calling thread.
+ * Contention inside the switch fabric is not modeled.
+ *
+ * Link parameters are fitted to all-reduce times measured on a small live
+ * group (pg_sim_fit); copy and reduction throughput are measured on the local
+ * host (pg_sim_calibrate_host). The pg_simulate tool does both and prints
+ * predicted latency / bandwidth curves.
+ */
+
+#include "pg_handle.h"
+
+/* Parameters of the cost model */
+typedef struct {
+    double latency_us;               /* one-way latency of a message (NIC + wire + switch) */
+    double bandwidth_gbps;           /* bytes per ns (GB/s) of one direction of a NIC port */
+    double post_us;                  /* CPU cost of posting one work request */
+    double atomic_us;                /* root NIC time per remote atomic */
+    double barrier_delay_us;         /* fixed sleep inside ring_barrier */
+    double memcpy_gbps;              /* staging copy throughput (GB/s) */
+    double reduce_gbps[BF16 + 1];    /* reduction throughput per DATATYPE, in bytes received (GB/s) */
+} pg_sim_model_t;
+
+/* A simulated group: the handle state the schedule depends on (size, slots,
+ * rings, configuration and tuning table), without any transport */
+typedef struct {
+    PGHandle group;
+    pg_sim_model_t model;
+} pg_sim_t;
+
+/* Outcome of one simulated all-reduce */
+typedef struct {
+    double max_us;                   /* until the last rank returns */
+    double mean_us;                  /* mean over ranks of the time until each returns */
+    pg_coll_params_t params;         /* parameters the schedule ran with */
+    int rings;                       /* 1, or 2 when the vector was split */
+    int segments;                    /* segments per ring step of ring 0 */
+    uint64_t events;                 /* simulated events */
+} pg_sim_result_t;
+
+/* One measured all-reduce (DOUBLE SUM, out of place), the input of pg_sim_fit */
+typedef struct {
+    int ranks;
+    size_t bytes;
+    double measured_us;              /* mean over ranks */
+} pg_sim_sample_t;
+
+/**
+ * @brief Fills a model with defaults for a 100 Gb/s fabric; the fixed
+ * barrier sleep is the library's.
+ */
+void pg_sim_model_init(pg_sim_model_t *model);
+
+/**
+ * @brief Measures memcpy and reduction throughput on this host over
+ * 'bytes' long buffers (about one staging slot).
+ * @return 0 on success, -1 if the buffers cannot be allocated.
+ */
+int pg_sim_calibrate_host(pg_sim_model_t *model, size_t bytes);
+
+/**
+ * @brief Sets up a simulated group of 'num_ranks' ranks connected with
+ * 'config' (its tuning_file is loaded like connect_process_group does).
+ * @param atomic_supported Whether the simulated devices execute remote atomics.
+ * @return 0 on success, -1 on an invalid size or configuration.
+ */
+int pg_sim_init(pg_sim_t *sim, int num_ranks, const pg_config_t *config,
+                const pg_sim_model_t *model, int atomic_supported);
+
+/**
+ * @brief Releases the tuning table of a simulated group.
+ */
+void pg_sim_free(pg_sim_t *sim);
+
+/**
+ * @brief Simulates pg_all_reduce_ex of 'count' elements (bulk class, out of
+ * place) on the group.
+ * @param params Parameters to run with, or NULL to pick them with
+ * pg_tuning_select as pg_all_reduce does.
+ * @return 0 on success, -1 on invalid arguments, out of memory, or a
+ *         configuration the model does not replay (PG_BALANCE, DOUBLE under
+ *         PG_DETERMINISTIC).
+ */
+int pg_sim_all_reduce(const pg_sim_t *sim, int count, DATATYPE datatype,
+                      const pg_coll_params_t *params, pg_sim_result_t *result);
+
+/**
+ * @brief Fits latency_us, bandwidth_gbps and post_us of 'model' to measured
+ * all-reduce times (least squares of the relative error, Gauss-Newton).
+ * @param config Configuration the measurements ran with.
+ * @param rms_error Optional output: RMS relative error of the fitted model.
+ * @return 0 on success, -1 if a sample cannot be simulated.
+ */
+int pg_sim_fit(pg_sim_model_t *model, const pg_config_t *config,
+               const pg_sim_sample_t *samples, int num_samples, double *rms_error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_SIM_H */
@@ -0,0 +1,309 @@
+/**
+ * pg_simulate.c
+ *
+ * Predicts pg_all_reduce latency and bandwidth on group sizes that are not
+ * available, with the discrete-event model of pg_sim.h.
+ *
+ * 1. Measure on a small live group (run on every host, like the test program):
+ *
+ *      pg_simulate -myindex <rank> -list <server0> <server1> ... [-o <csv>]
+ *                  [-max-bytes <bytes>] [-iters <n>]
+ *
+ *    Rank 0 writes "ranks,bytes,measured_us" lines (DOUBLE SUM, mean over
+ *    ranks, parameters picked by the tuning table as in production).
+ *
+ * 2. Predict, on any machine with the same PG_* environment:
+ *
+ *      pg_simulate [-calibrate <csv>] [-ranks 64,256] [-max-bytes <bytes>]
+ *                  [-datatype double] [-o <csv>] [-latency-us <us>]
+ *                  [-bandwidth-gbps <GB/s>] [-post-us <us>] [-atomic-us <us>]
+ *                  [-no-atomics]
+ *
+ *    Copy and reduction throughput are measured on the local host; latency,
+ *    bandwidth and posting cost are fitted to the measured CSV (or taken from
+ *    the options). Prints one CSV line per (ranks, bytes) with the predicted
+ *    time, algorithm and bus bandwidth, next to the measured time where the
+ *    CSV has one, so both curves can be plotted together.
+ */
+
+#include "pg_connect.h"
+#include "pg_allreduce.h"
+#include "pg_close.h"
+#include "pg_config.h"
+#include "pg_tuning.h"
+#include "pg_coll.h"
+#include "pg_sim.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIMULATE_MIN_BYTES 8
+#define SIMULATE_DEFAULT_MAX_BYTES ((size_t)64 << 20)
+#define SIMULATE_DEFAULT_ITERS 5
+#define SIMULATE_MAX_RANK_COUNTS 32
+#define SIMULATE_MAX_SAMPLES 1024
+
+static const char *datatype_names[] = {"int", "double", "float", "int64", "fp16", "bf16"};
+
+/**
+ * Parses -myindex and -list like the test program.
+ * @return 0 if successful, -1 if error
+ */
+static int parse_args(char *argv[], char ***serverlist, int *myindex, int *num_servers) {
+    *serverlist = NULL;
+    *myindex = -1;
+    *num_servers = 0;
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "-myindex") == 0 && argv[i + 1] != NULL) {
+            *myindex = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-list") == 0) {
+            while (argv[i + 1 + *num_servers] != NULL && argv[i + 1 + *num_servers][0] != '-') {
+                (*num_servers)++;
+            }
+            if (*num_servers == 0) return -1;
+            *serverlist = argv + i + 1;
+            i += *num_servers;
+        }
+    }
+    return (*serverlist && *myindex >= 0 && *myindex < *num_servers) ? 0 : -1;
+}
+
+// Value of "-name <value>" on the command line, or NULL
+static const char *option(char *argv[], const char *name) {
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return NULL;
+}
+
+static int flag(char *argv[], const char *name) {
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Times pg_all_reduce over the size sweep; rank 0 writes the CSV
+static int measure(char **serverlist, int num_servers, int rank, FILE *out, size_t max_bytes, int iters) {
+    char **names = malloc(num_servers * sizeof(char *));
+    if (!names) return -1;
+    for (int i = 0; i < num_servers; i++) names[i] = strdup(serverlist[i]);
+    void *handle = NULL;
+    if (connect_process_group(names, num_servers, &handle, rank) != 0) {
+        fprintf(stderr, "Rank %d: connect_process_group failed\n", rank);
+        return -1;
+    }
+    PGHandle *pg_handle = (PGHandle *)handle;
+
+    int max_count = (int)(max_bytes / sizeof(double));
+    double *sendbuf = malloc(max_count * sizeof(double));
+    double *recvbuf = malloc(max_count * sizeof(double));
+    int ret = sendbuf && recvbuf ? 0 : -1;
+    for (int i = 0; ret == 0 && i < max_count; i++) sendbuf[i] = 1.0;
+
+    if (rank == 0) fprintf(out, "ranks,bytes,measured_us\n");
+    for (size_t bytes = SIMULATE_MIN_BYTES; ret == 0 && bytes <= max_bytes; bytes *= 4) {
+        int count = (int)(bytes / sizeof(double));
+        // One warm-up call, then the timed ones
+        double start = 0.0;
+        for (int i = 0; i <= iters && ret == 0; i++) {
+            if (i == 1) start = now_seconds();
+            ret = pg_all_reduce(sendbuf, recvbuf, count, DOUBLE, SUM, pg_handle);
+        }
+        double local = (now_seconds() - start) / iters;
+        double total = 0.0;
+        if (ret == 0) ret = pg_all_reduce(&local, &total, 1, DOUBLE, SUM, pg_handle);
+        if (ret == 0 && rank == 0) {
+            fprintf(out, "%d,%zu,%.3f\n", num_servers, bytes, total / num_servers * 1e6);
+            fflush(out);
+        }
+    }
+    if (ret != 0) fprintf(stderr, "Rank %d: all_reduce failed\n", rank);
+
+    free(sendbuf);
+    free(recvbuf);
+    pg_close(pg_handle);
+    return ret;
+}
+
+// Reads "ranks,bytes,measured_us" lines; returns the number read or -1
+static int read_samples(const char *path, pg_sim_sample_t *samples, int max_samples) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return -1;
+    }
+    char line[256];
+    int num = 0;
+    while (fgets(line, sizeof(line), f) && num < max_samples) {
+        pg_sim_sample_t s;
+        if (sscanf(line, "%d,%zu,%lf", &s.ranks, &s.bytes, &s.measured_us) == 3) {
+            samples[num++] = s;
+        }
+    }
+    fclose(f);
+    return num;
+}
+
+// Measured time of (ranks, bytes), or a negative value
+static double measured(const pg_sim_sample_t *samples, int num_samples, int ranks, size_t bytes) {
+    for (int i = 0; i < num_samples; i++) {
+        if (samples[i].ranks == ranks && samples[i].bytes == bytes) return samples[i].measured_us;
+    }
+    return -1.0;
+}
+
+// Adds a rank count to the list unless it is already there
+static void add_ranks(int *list, int *num, int ranks) {
+    for (int i = 0; i < *num; i++) {
+        if (list[i] == ranks) return;
+    }
+    if (*num < SIMULATE_MAX_RANK_COUNTS) list[(*num)++] = ranks;
+}
+
+static int predict(char *argv[], FILE *out, size_t max_bytes) {
+    pg_config_t config;
+    pg_config_init(&config);
+    if (pg_config_load_env(&config) != 0 || pg_config_validate(&config) != 0) {
+        fprintf(stderr, "Invalid PG_* environment\n");
+        return -1;
+    }
+    if (config.balance || config.deterministic) {
+        fprintf(stderr, "PG_BALANCE and PG_DETERMINISTIC are not modeled, unset them to predict\n");
+        return -1;
+    }
+
+    DATATYPE datatype = DOUBLE;
+    if (option(argv, "-datatype")) {
+        int found = -1;
+        for (int t = 0; t <= BF16; t++) {
+            if (strcmp(option(argv, "-datatype"), datatype_names[t]) == 0) found = t;
+        }
+        if (found < 0) {
+            fprintf(stderr, "Unknown datatype %s\n", option(argv, "-datatype"));
+            return -1;
+        }
+        datatype = (DATATYPE)found;
+    }
+
+    // Host throughput over one staging slot, link parameters from the options
+    pg_sim_model_t model;
+    pg_sim_model_init(&model);
+    if (pg_sim_calibrate_host(&model, config.buffer_size / (config.num_slots + config.num_high_slots)) != 0) {
+        fprintf(stderr, "Cannot calibrate the host\n");
+        return -1;
+    }
+    if (option(argv, "-latency-us")) model.latency_us = atof(option(argv, "-latency-us"));
+    if (option(argv, "-bandwidth-gbps")) model.bandwidth_gbps = atof(option(argv, "-bandwidth-gbps"));
+    if (option(argv, "-post-us")) model.post_us = atof(option(argv, "-post-us"));
+    if (option(argv, "-atomic-us")) model.atomic_us = atof(option(argv, "-atomic-us"));
+    if (model.latency_us < 0 || model.bandwidth_gbps <= 0 || model.post_us < 0 || model.atomic_us < 0) {
+        fprintf(stderr, "Invalid model parameters\n");
+        return -1;
+    }
+
+    int ranks[SIMULATE_MAX_RANK_COUNTS];
+    int num_ranks = 0;
+    pg_sim_sample_t *samples = calloc(SIMULATE_MAX_SAMPLES, sizeof(pg_sim_sample_t));
+    int num_samples = 0;
+    if (!samples) return -1;
+    if (option(argv, "-calibrate")) {
+        num_samples = read_samples(option(argv, "-calibrate"), samples, SIMULATE_MAX_SAMPLES);
+        double rms = 0.0;
+        if (num_samples <= 0 || pg_sim_fit(&model, &config, samples, num_samples, &rms) != 0) {
+            fprintf(stderr, "Cannot fit the model to %s\n", option(argv, "-calibrate"));
+            free(samples);
+            return -1;
+        }
+        fprintf(out, "# fitted to %d measurements, rms relative error %.1f%%\n", num_samples, rms * 100);
+        for (int i = 0; i < num_samples; i++) add_ranks(ranks, &num_ranks, samples[i].ranks);
+    }
+    const char *list = option(argv, "-ranks") ? option(argv, "-ranks") : "64,256";
+    for (char *end; *list != '\0'; list = *end == ',' ? end + 1 : end) {
+        long value = strtol(list, &end, 10);
+        if (end == list || value < 1) {
+            fprintf(stderr, "Invalid -ranks list\n");
+            free(samples);
+            return -1;
+        }
+        add_ranks(ranks, &num_ranks, (int)value);
+    }
+
+    fprintf(out, "# model: latency_us=%.3f bandwidth_gbps=%.3f post_us=%.3f atomic_us=%.3f "
+                 "barrier_delay_us=%.0f memcpy_gbps=%.2f reduce_gbps=%.2f\n",
+            model.latency_us, model.bandwidth_gbps, model.post_us, model.atomic_us,
+            model.barrier_delay_us, model.memcpy_gbps, model.reduce_gbps[datatype]);
+    fprintf(out, "ranks,bytes,algorithm,protocol,segment_bytes,rings,predicted_us,algbw_gbps,busbw_gbps,measured_us\n");
+
+    size_t elem_size = get_datatype_size(datatype);
+    int ret = 0;
+    for (int r = 0; r < num_ranks && ret == 0; r++) {
+        pg_sim_t sim;
+        if (pg_sim_init(&sim, ranks[r], &config, &model, !flag(argv, "-no-atomics")) != 0) {
+            ret = -1;
+            break;
+        }
+        for (size_t bytes = SIMULATE_MIN_BYTES; bytes <= max_bytes; bytes *= 4) {
+            int count = bytes >= elem_size ? (int)(bytes / elem_size) : 1;
+            pg_sim_result_t result;
+            if (pg_sim_all_reduce(&sim, count, datatype, NULL, &result) != 0) {
+                ret = -1;
+                break;
+            }
+            // Bus bandwidth: the 2 (n - 1) / n of the data every link carries in a ring all-reduce
+            double algbw = bytes / (result.mean_us * 1e3);
+            double busbw = algbw * 2 * (ranks[r] - 1) / ranks[r];
+            fprintf(out, "%d,%zu,%s,%s,%zu,%d,%.3f,%.4f,%.4f,", ranks[r], bytes,
+                    pg_algorithm_name(result.params.algorithm), pg_protocol_name(result.params.protocol),
+                    result.params.segment_bytes, result.rings, result.mean_us, algbw, busbw);
+            double m = measured(samples, num_samples, ranks[r], bytes);
+            if (m >= 0 && datatype == DOUBLE) fprintf(out, "%.3f", m);
+            fprintf(out, "\n");
+        }
+        pg_sim_free(&sim);
+    }
+    free(samples);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    char **serverlist = NULL;
+    int rank = 0, num_servers = 0;
+    int live = option(argv, "-list") != NULL;
+    if (live && (argc < 3 || parse_args(argv, &serverlist, &rank, &num_servers) != 0)) {
+        fprintf(stderr, "Usage: %s -myindex <rank> -list <server0> <server1> ... "
+                        "[-o <csv>] [-max-bytes <bytes>] [-iters <n>]\n"
+                        "       %s [-calibrate <csv>] [-ranks <n,n,...>] [-max-bytes <bytes>] "
+                        "[-datatype <type>] [-o <csv>] [-latency-us <us>] [-bandwidth-gbps <GB/s>] "
+                        "[-post-us <us>] [-atomic-us <us>] [-no-atomics]\n", argv[0], argv[0]);
+        return 1;
+    }
+    size_t max_bytes = option(argv, "-max-bytes") ? strtoull(option(argv, "-max-bytes"), NULL, 0)
+                                                  : SIMULATE_DEFAULT_MAX_BYTES;
+    int iters = option(argv, "-iters") ? atoi(option(argv, "-iters")) : SIMULATE_DEFAULT_ITERS;
+    if (max_bytes < SIMULATE_MIN_BYTES || max_bytes > INT32_MAX || iters < 1) {
+        fprintf(stderr, "Invalid -max-bytes or -iters\n");
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (option(argv, "-o") && (!live || rank == 0)) {
+        out = fopen(option(argv, "-o"), "w");
+        if (!out) {
+            perror("Failed to open output file");
+            return 1;
+        }
+    }
+    int ret = live ? measure(serverlist, num_servers, rank, out, max_bytes, iters)
+                   : predict(argv, out, max_bytes);
+    if (out != stdout && fclose(out) != 0) ret = -1;
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,328 @@
+#include "pg_handle.h"
+#include "rdma_utils.h"
+#include "pg_allreduce.h"
+#include "pg_coll.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sparse all-reduce: every rank's (index, value) list is circulated around the
+// ring (a sparse allgather) and merged into the dense result on arrival. A list
+// is packed as its sorted indices (padded to 8 bytes) followed by its values.
+
+// Bytes of a packed list of 'nnz' entries
+static size_t list_bytes(size_t nnz, size_t dtype_size) {
+    size_t index_bytes = (nnz * sizeof(int) + 7) & ~(size_t)7;
+    return index_bytes + nnz * dtype_size;
+}
+
+// dst[indices[i]] += values[i] for entries [first, last) of a list
+#define SCATTER_ADD(T)                                                         \
+    do {                                                                       \
+        T *d = (T *)dst;                                                       \
+        const T *v = (const T *)values;                                        \
+        for (int i = first; i < last; i++) d[indices[i]] += v[i];              \
+    } while (0)
+
+static void scatter_add(void *dst, const int *indices, const void *values, int first, int last,
+                        DATATYPE datatype) {
+    uint16_t *h = (uint16_t *)dst;
+    const uint16_t *hv = (const uint16_t *)values;
+    switch (datatype) {
+        case INT: SCATTER_ADD(int); break;
+        case DOUBLE: SCATTER_ADD(double); break;
+        case FLOAT: SCATTER_ADD(float); break;
+        case INT64: SCATTER_ADD(int64_t); break;
+        // Added in fp32 and rounded once, like the dense kernels
+        case FP16:
+            for (int i = first; i < last; i++) {
+                h[indices[i]] = pg_float_to_fp16(pg_fp16_to_float(h[indices[i]]) + pg_fp16_to_float(hv[i]));
+            }
+            break;
+        case BF16:
+            for (int i = first; i < last; i++) {
+                h[indices[i]] = pg_float_to_bf16(pg_bf16_to_float(h[indices[i]]) + pg_bf16_to_float(hv[i]));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Position in 'indices[first, nnz)' of the first entry >= 'bound'
+static int lower_bound(const int *indices, int first, int nnz, int bound) {
+    while (first < nnz && indices[first] < bound) first++;
+    return first;
+}
+
+typedef struct {
+    int index;
+    int position;
+} sparse_entry_t;
+
+// Sorts by index; entries with equal indices keep their input order
+static int compare_entries(const void *a, const void *b) {
+    const sparse_entry_t *x = (const sparse_entry_t *)a;
+    const sparse_entry_t *y = (const sparse_entry_t *)b;
+    if (x->index != y->index) return x->index < y->index ? -1 : 1;
+    return x->position < y->position ? -1 : (x->position > y->position);
+}
+
+// Packs (indices, values) into 'packed' sorted by index, summing duplicates in
+// input order. Returns the number of distinct indices.
+static int pack_list(const int *indices, const void *values, int nnz, DATATYPE datatype,
+                     void *packed, sparse_entry_t *order) {
+    size_t dtype_size = get_datatype_size(datatype);
+    for (int i = 0; i < nnz; i++) {
+        order[i].index = indices[i];
+        order[i].position = i;
+    }
+    qsort(order, nnz, sizeof(sparse_entry_t), compare_entries);
+
+    int *out_indices = (int *)packed;
+    int out = 0;
+    for (int i = 0; i < nnz; i++) {
+        if (out > 0 && out_indices[out - 1] == order[i].index) continue;
+        out_indices[out++] = order[i].index;
+    }
+    char *out_values = (char *)packed + list_bytes(out, dtype_size) - out * dtype_size;
+    memset(out_values, 0, out * dtype_size);
+    for (int i = 0, j = -1; i < nnz; i++) {
+        if (j < 0 || out_indices[j] != order[i].index) j++;
+        perform_operation(out_values + j * dtype_size,
+                          (const char *)values + (size_t)order[i].position * dtype_size,
+                          1, datatype, SUM);
+    }
+    return out;
+}
+
+// Ring allgather of the packed lists into 'lists' (list q at offsets[q]); the
+// local list must already be in place
+static int sparse_allgather(PGHandle *pg_handle, char *lists, const size_t *offsets,
+                            const size_t *sizes, size_t max_size) {
+    int n = pg_handle->num_servers;
+    pg_coll_params_t params = {PG_ALGO_RING, pg_handle->config.protocol, 0};
+
+    pg_slot_t *slot = acquire_slot(pg_handle, 0);
+    if (!slot) return -1;
+    int idx = ring_position(pg_handle, slot);
+    size_t seg_size = ring_segment_size(slot, &params, 1);
+    int num_segments = (int)((max_size + seg_size - 1) / seg_size);
+
+    int ret = 0;
+    for (int step = 0; step < n - 1 && ret == 0; step++) {
+        // Lists travel with their owner's ring position
+        int send_id = ring_rank_at(pg_handle, 0, idx - step + n);
+        int recv_id = ring_rank_at(pg_handle, 0, idx - step - 1 + n);
+        if (ring_step_copy(pg_handle, slot, params.protocol, seg_size, num_segments,
+                           lists + offsets[send_id], sizes[send_id],
+                           lists + offsets[recv_id], sizes[recv_id]) != 0) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && ring_finish(pg_handle, slot) != 0) {
+        ret = -1;
+    }
+    release_slot(pg_handle, slot);
+    return ret;
+}
+
+// Dense result from all lists. Chunk c of a dense ring all-reduce is
+// accumulated in the order of ring positions c, c+1, ..., c-1 of its ring (and
+// a large vector may be split over two rings); the lists are merged in the
+// same order per chunk, on the same chunk boundaries (balanced ones under
+// PG_BALANCE, like a dense call on tag 0), so results are bitwise identical
+// to pg_all_reduce. 'chunk_counts' is scratch for 2 * num_servers counts.
+static void merge_lists(PGHandle *pg_handle, void *recvbuf, int count, DATATYPE datatype,
+                        const char *lists, const size_t *offsets, const int *nnz, int *cursor,
+                        int *chunk_counts) {
+    size_t dtype_size = get_datatype_size(datatype);
+    int n = pg_handle->num_servers;
+    int split = ring_split_count(pg_handle, count, dtype_size);
+    for (int ring = 0; ring < 2; ring++) {
+        int ring_count = ring ? count - split : split;
+        if (pg_handle->config.balance) {
+            ring_balanced_counts(pg_handle, ring, ring_count, chunk_counts + ring * n);
+        } else {
+            for (int k = 0; k < n; k++) chunk_counts[ring * n + k] = ring_chunk_count(ring_count, n, k);
+        }
+    }
+    memset(recvbuf, 0, (size_t)count * dtype_size);
+    memset(cursor, 0, n * sizeof(int));
+    int end = 0;
+    for (int c = 0; c < 2 * n; c++) {
+        int ring = c / n;
+        int begin = end;
+        end = begin + chunk_counts[c];
+        if (end <= begin) continue;
+        for (int k = 0; k < n; k++) {
+            int q = ring_rank_at(pg_handle, ring, c % n + k);
+            const int *indices = (const int *)(lists + offsets[q]);
+            const char *values = lists + offsets[q] + list_bytes(nnz[q], dtype_size) - nnz[q] * dtype_size;
+            int last = lower_bound(indices, cursor[q], nnz[q], end);
+            scatter_add(recvbuf, indices, values, cursor[q], last, datatype);
+            cursor[q] = last;
+        }
+    }
+}
+
+// Sparse all-reduce of a packed local list of 'local_nnz' entries, or a dense
+// all-reduce of 'dense_sendbuf' (rebuilt from the list when NULL) when the
+// merged density may exceed 'density_threshold' or the break-even point, and
+// for DOUBLE under PG_DETERMINISTIC.
+static int sparse_all_reduce(void *packed, int local_nnz, void *dense_sendbuf, void *recvbuf,
+                             int count, DATATYPE datatype, double density_threshold,
+                             PGHandle *pg_handle) {
+    size_t dtype_size = get_datatype_size(datatype);
+    int n = pg_handle->num_servers;
+    int ret = -1;
+    char *lists = NULL;
+    size_t *offsets = malloc(n * sizeof(size_t));
+    size_t *sizes = malloc(n * sizeof(size_t));
+    int *nnz = calloc(n, sizeof(int));
+    int *all_nnz = calloc(n, sizeof(int));
+    int *chunk_counts = malloc(2 * n * sizeof(int));
+    if (!offsets || !sizes || !nnz || !all_nnz || !chunk_counts) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto out;
+    }
+
+    // Under PG_DETERMINISTIC a dense DOUBLE SUM is exact (pg_repro.h), which
+    // merging the lists in ring order would not reproduce: always go dense
+    int dense = pg_handle->config.deterministic && datatype == DOUBLE;
+
+    // Everyone learns everyone's list size
+    nnz[pg_handle->rank] = local_nnz;
+    if (!dense && pg_all_reduce(nnz, all_nnz, n, INT, SUM, pg_handle) != 0) goto out;
+
+    size_t total_nnz = 0, total_bytes = 0, max_size = 0;
+    for (int q = 0; q < n; q++) {
+        offsets[q] = total_bytes;
+        sizes[q] = list_bytes(all_nnz[q], dtype_size);
+        total_nnz += all_nnz[q];
+        total_bytes += sizes[q];
+        max_size = MAX(max_size, sizes[q]);
+    }
+
+    // Every rank receives (n-1)/n of the lists, against 2(n-1)/n of the dense
+    // vector for the ring. The decision only uses global values, so all ranks
+    // take the same path.
+    size_t dense_bytes = (size_t)count * dtype_size;
+    if (dense || (double)total_nnz > density_threshold * count || total_bytes >= 2 * dense_bytes) {
+        if (dense_sendbuf) {
+            ret = pg_all_reduce(dense_sendbuf, recvbuf, count, datatype, SUM, pg_handle);
+        } else {
+            memset(recvbuf, 0, dense_bytes);
+            scatter_add(recvbuf, (int *)packed,
+                        (char *)packed + list_bytes(local_nnz, dtype_size) - local_nnz * dtype_size,
+                        0, local_nnz, datatype);
+            ret = pg_all_reduce(recvbuf, recvbuf, count, datatype, SUM, pg_handle);
+        }
+        goto out;
+    }
+
+    lists = malloc(total_bytes > 0 ? total_bytes : 1);
+    if (!lists) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto out;
+    }
+    memcpy(lists + offsets[pg_handle->rank], packed, sizes[pg_handle->rank]);
+    if (sparse_allgather(pg_handle, lists, offsets, sizes, max_size) != 0) goto out;
+    merge_lists(pg_handle, recvbuf, count, datatype, lists, offsets, all_nnz, nnz, chunk_counts);
+    ret = 0;
+
+out:
+    free(lists);
+    free(offsets);
+    free(sizes);
+    free(nnz);
+    free(all_nnz);
+    free(chunk_counts);
+    return ret;
+}
+
+int pg_all_reduce_sparse(const int* indices, const void* values, int nnz, void* recvbuf, int count,
+                         DATATYPE datatype, OPERATION op, PGHandle* pg_handle) {
+    if ((nnz > 0 && (!indices || !values)) || nnz < 0 || !recvbuf || count <= 0 || !pg_handle) {
+        fprintf(stderr, "Invalid parameters for all_reduce_sparse\n");
+        return -1;
+    }
+    size_t dtype_size = get_datatype_size(datatype);
+    if (dtype_size == 0 || op != SUM) {
+        fprintf(stderr, "Sparse all-reduce supports SUM only\n");
+        return -1;
+    }
+    for (int i = 0; i < nnz; i++) {
+        if (indices[i] < 0 || indices[i] >= count) {
+            fprintf(stderr, "Sparse index %d out of range [0, %d)\n", indices[i], count);
+            return -1;
+        }
+    }
+
+    void *packed = malloc(list_bytes(nnz, dtype_size) + 1);
+    sparse_entry_t *order = malloc((nnz + 1) * sizeof(sparse_entry_t));
+    if (!packed || !order) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(packed);
+        free(order);
+        return -1;
+    }
+    int distinct = pack_list(indices, values, nnz, datatype, packed, order);
+    free(order);
+
+    int ret = sparse_all_reduce(packed, distinct, NULL, recvbuf, count, datatype, 1.0, pg_handle);
+    free(packed);
+    return ret;
+}
+
+// Non-zero test of element i of a dense buffer
+static int is_nonzero(const void *buf, int i, DATATYPE datatype) {
+    switch (datatype) {
+        case INT: return ((const int *)buf)[i] != 0;
+        case FLOAT: return ((const float *)buf)[i] != 0.0f;
+        case INT64: return ((const int64_t *)buf)[i] != 0;
+        case FP16:
+        case BF16: return (((const uint16_t *)buf)[i] & 0x7fff) != 0;   // +0 and -0
+        default: return ((const double *)buf)[i] != 0.0;
+    }
+}
+
+int pg_all_reduce_sparsify(void* sendbuf, void* recvbuf, int count, DATATYPE datatype, OPERATION op,
+                           double density_threshold, PGHandle* pg_handle) {
+    if (!sendbuf || !recvbuf || count <= 0 || !pg_handle) {
+        fprintf(stderr, "Invalid parameters for all_reduce_sparsify\n");
+        return -1;
+    }
+    size_t dtype_size = get_datatype_size(datatype);
+    if (dtype_size == 0) {
+        fprintf(stderr, "Invalid datatype\n");
+        return -1;
+    }
+    // Zeros are only the identity of SUM
+    if (op != SUM) {
+        return pg_all_reduce(sendbuf, recvbuf, count, datatype, op, pg_handle);
+    }
+
+    int local_nnz = 0;
+    for (int i = 0; i < count; i++) {
+        local_nnz += is_nonzero(sendbuf, i, datatype);
+    }
+    void *packed = malloc(list_bytes(local_nnz, dtype_size) + 1);
+    if (!packed) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    int *indices = (int *)packed;
+    char *values = (char *)packed + list_bytes(local_nnz, dtype_size) - local_nnz * dtype_size;
+    for (int i = 0, j = 0; i < count; i++) {
+        if (!is_nonzero(sendbuf, i, datatype)) continue;
+        indices[j] = i;
+        memcpy(values + j * dtype_size, (char *)sendbuf + (size_t)i * dtype_size, dtype_size);
+        j++;
+    }
+
+    int ret = sparse_all_reduce(packed, local_nnz, sendbuf, recvbuf, count, datatype,
+                                density_threshold, pg_handle);
+    free(packed);
+    return ret;
+}
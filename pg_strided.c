@@ -0,0 +1,368 @@
+#include "pg_handle.h"
+#include "rdma_utils.h"
+#include "pg_allreduce.h"
+#include "pg_tuning.h"
+#include "pg_coll.h"
+#include "pg_repro.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Strided all-reduce: the logical vector of layout->count * layout->blocklen
+// elements is reduced in place in the strided recvbuf, with the same chunks
+// (balanced under PG_BALANCE) and rank order as the contiguous ring on tag 0,
+// so results are bitwise identical to pg_all_reduce of the packed vector (on
+// one ring; it never splits over PG_NUM_RINGS). Nothing is ever packed:
+//  - when the blocks are at least config.sge_min_bytes long, a segment is
+//    written straight from user memory with one SGE per run of elements;
+//  - shorter runs are gathered into the staging slot, which is the one copy
+//    the contiguous path makes as well;
+//  - received segments are reduced or copied into the runs directly.
+// Always uses the push protocol: a gather write needs the receiver's
+// contiguous staging slot as its destination.
+
+// Walks the runs (contiguous pieces of blocks) of logical elements [elem, end)
+typedef struct {
+    const pg_vector_t *layout;
+    size_t elem;
+    size_t end;
+} run_iter_t;
+
+// Length in elements of the next run and its element offset in the buffer; 0 when done
+static size_t next_run(run_iter_t *it, size_t *offset) {
+    if (it->elem >= it->end) return 0;
+    size_t blocklen = it->layout->blocklen;
+    size_t block = it->elem / blocklen;
+    size_t within = it->elem % blocklen;
+    size_t run = MIN(blocklen - within, it->end - it->elem);
+    *offset = block * it->layout->stride + within;
+    it->elem += run;
+    return run;
+}
+
+// Elements the layout spans from its first to its last element
+static size_t layout_extent(const pg_vector_t *layout) {
+    return (size_t)(layout->count - 1) * layout->stride + layout->blocklen;
+}
+
+// Logical elements [first, first + count) of 'base' into contiguous 'dst'
+static void strided_gather(void *dst, const void *base, const pg_vector_t *layout,
+                           size_t first, size_t count, size_t elem_size) {
+    run_iter_t it = {layout, first, first + count};
+    size_t offset, run;
+    char *out = (char *)dst;
+    while ((run = next_run(&it, &offset)) > 0) {
+        memcpy(out, (const char *)base + offset * elem_size, run * elem_size);
+        out += run * elem_size;
+    }
+}
+
+// Contiguous 'src' into logical elements [first, first + count) of 'base'
+static void strided_scatter(void *base, const void *src, const pg_vector_t *layout,
+                            size_t first, size_t count, size_t elem_size) {
+    run_iter_t it = {layout, first, first + count};
+    size_t offset, run;
+    const char *in = (const char *)src;
+    while ((run = next_run(&it, &offset)) > 0) {
+        memcpy((char *)base + offset * elem_size, in, run * elem_size);
+        in += run * elem_size;
+    }
+}
+
+// Logical elements [first, first + count) of 'base' op= contiguous 'src'
+static void strided_reduce(void *base, const void *src, const pg_vector_t *layout,
+                           size_t first, size_t count, DATATYPE datatype, OPERATION op) {
+    size_t elem_size = get_datatype_size(datatype);
+    run_iter_t it = {layout, first, first + count};
+    size_t offset, run;
+    const char *in = (const char *)src;
+    while ((run = next_run(&it, &offset)) > 0) {
+        perform_operation((char *)base + offset * elem_size, in, (int)run, datatype, op);
+        in += run * elem_size;
+    }
+}
+
+// Registered user buffer containing [addr, addr + length), or NULL
+static struct ibv_mr *find_user_mr(PGHandle *pg_handle, const void *addr, size_t length) {
+    struct ibv_mr *mr = NULL;
+    pthread_mutex_lock(&pg_handle->user_mr_lock);
+    for (int i = 0; i < pg_handle->num_user_mrs; i++) {
+        pg_user_mr_t *m = &pg_handle->user_mrs[i];
+        if ((const char *)addr >= (char *)m->addr &&
+            (const char *)addr + length <= (char *)m->addr + m->length) {
+            mr = m->mr;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pg_handle->user_mr_lock);
+    return mr;
+}
+
+// Send logical elements [first, first + count) of 'buf' into the right
+// neighbor's slot: straight from user memory when 'mr' is given, through our
+// staging slot otherwise. Completes before returning.
+static int send_segment(PGHandle *pg_handle, pg_slot_t *slot, const pg_vector_t *layout, void *buf,
+                        size_t first, size_t count, size_t elem_size, struct ibv_mr *mr) {
+    if (count == 0) return 0;
+    if (!mr) {
+        strided_gather(slot->sendbuf, buf, layout, first, count, elem_size);
+        if (rdma_write_to_right(pg_handle, slot, count * elem_size) != 0) return 1;
+        return poll_for_completion(pg_handle, slot);
+    }
+
+    // One SGE per run, max_send_sge runs per WR. Only the last WR of every
+    // batch is signaled, and the batch drains before the next one is posted,
+    // so the send queue never holds more than 'batch' of our WRs.
+    struct ibv_sge sges[PG_MAX_SEND_SGE];
+    int batch = MAX(pg_handle->config.qp_depth / 2, 1);
+    int num_sge = 0;
+    int wrs = 0;
+    size_t remote = 0;
+    size_t wr_bytes = 0;
+    size_t offset, run;
+    run_iter_t it = {layout, first, first + count};
+    while ((run = next_run(&it, &offset)) > 0) {
+        sges[num_sge].addr = (uintptr_t)buf + offset * elem_size;
+        sges[num_sge].length = run * elem_size;
+        sges[num_sge].lkey = mr->lkey;
+        num_sge++;
+        wr_bytes += run * elem_size;
+
+        int last = it.elem >= it.end;
+        if (num_sge < pg_handle->max_send_sge && !last) continue;
+        int signaled = last || ++wrs % batch == 0;
+        if (rdma_write_sge_to_right(pg_handle, slot, sges, num_sge, remote, signaled) != 0) return 1;
+        remote += wr_bytes;
+        wr_bytes = 0;
+        num_sge = 0;
+        if (signaled && poll_for_completion(pg_handle, slot) != 0) return 1;
+    }
+    return 0;
+}
+
+// Elements of the [seg * seg_elems, (seg + 1) * seg_elems) window inside a range of 'count'
+static size_t segment_elems(size_t count, size_t seg_elems, int seg) {
+    size_t begin = (size_t)seg * seg_elems;
+    if (begin >= count) return 0;
+    return MIN(seg_elems, count - begin);
+}
+
+// One push ring step on logical element ranges: send [send_first, +send_count),
+// receive into [recv_first, +recv_count), reducing when 'reduce' is set
+static int strided_step(PGHandle *pg_handle, pg_slot_t *slot, const pg_vector_t *layout, void *buf,
+                        DATATYPE datatype, OPERATION op, size_t seg_elems, int num_segments,
+                        size_t send_first, size_t send_count, size_t recv_first, size_t recv_count,
+                        int reduce, struct ibv_mr *mr) {
+    size_t elem_size = get_datatype_size(datatype);
+    for (int seg = 0; seg < num_segments; seg++) {
+        size_t seg_send = segment_elems(send_count, seg_elems, seg);
+        size_t seg_recv = segment_elems(recv_count, seg_elems, seg);
+        size_t seg_offset = (size_t)seg * seg_elems;
+
+        // Same fencing as the contiguous push protocol: the first barrier
+        // frees the receiver's slot, the second says our data has landed
+        if (ring_barrier(pg_handle, slot) != 0 ||
+            send_segment(pg_handle, slot, layout, buf, send_first + seg_offset, seg_send,
+                         elem_size, mr) != 0 ||
+            ring_barrier(pg_handle, slot) != 0) {
+            fprintf(stderr, "Rank %d: strided ring step failed\n", pg_handle->rank);
+            return 1;
+        }
+
+        if (reduce) {
+            strided_reduce(buf, slot->recvbuf, layout, recv_first + seg_offset, seg_recv, datatype, op);
+        } else {
+            strided_scatter(buf, slot->recvbuf, layout, recv_first + seg_offset, seg_recv, elem_size);
+        }
+    }
+    return 0;
+}
+
+// Ring all-reduce of the strided 'buf' in place on an acquired slot
+static int strided_ring(PGHandle *pg_handle, pg_slot_t *slot, void *buf, const pg_vector_t *layout,
+                        int count, DATATYPE datatype, OPERATION op, const pg_coll_params_t *params) {
+    size_t elem_size = get_datatype_size(datatype);
+    int n = pg_handle->num_servers;
+    int idx = ring_position(pg_handle, slot);
+    size_t *chunk_first = malloc((n + 1) * sizeof(size_t));
+    int *chunk_counts = malloc(n * sizeof(int));
+    if (!chunk_first || !chunk_counts) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(chunk_first);
+        free(chunk_counts);
+        return -1;
+    }
+    // The chunks of a dense call on tag 0: balanced ones under PG_BALANCE
+    if (pg_handle->config.balance) {
+        ring_balanced_counts(pg_handle, 0, count, chunk_counts);
+    } else {
+        for (int k = 0; k < n; k++) chunk_counts[k] = ring_chunk_count(count, n, k);
+    }
+    size_t max_chunk = 0;
+    chunk_first[0] = 0;
+    for (int k = 0; k < n; k++) {
+        size_t elems = chunk_counts[k];
+        chunk_first[k + 1] = chunk_first[k] + elems;
+        max_chunk = MAX(max_chunk, elems);
+    }
+    size_t seg_elems = ring_segment_size(slot, params, elem_size) / elem_size;
+    int num_segments = (int)((max_chunk + seg_elems - 1) / seg_elems);
+
+    // Long blocks go straight from user memory: use the caller's registration,
+    // or register the buffer for this call
+    struct ibv_mr *mr = NULL;
+    struct ibv_mr *call_mr = NULL;
+    size_t extent = layout_extent(layout) * elem_size;
+    if ((size_t)layout->blocklen * elem_size >= pg_handle->config.sge_min_bytes) {
+        mr = find_user_mr(pg_handle, buf, extent);
+        if (!mr) {
+            mr = call_mr = ibv_reg_mr(pg_handle->pd, buf, extent, IBV_ACCESS_LOCAL_WRITE);
+        }
+    }
+
+    int ret = 0;
+    // Phase 1: reduce-scatter
+    for (int step = 0; step < n - 1 && ret == 0; step++) {
+        int send_chunk_id = (idx - step + n) % n;
+        int recv_chunk_id = (idx - step - 1 + n) % n;
+        if (strided_step(pg_handle, slot, layout, buf, datatype, op, seg_elems, num_segments,
+                         chunk_first[send_chunk_id],
+                         chunk_first[send_chunk_id + 1] - chunk_first[send_chunk_id],
+                         chunk_first[recv_chunk_id],
+                         chunk_first[recv_chunk_id + 1] - chunk_first[recv_chunk_id], 1, mr) != 0) {
+            ret = -1;
+        }
+    }
+    // Phase 2: allgather
+    for (int step = 0; step < n - 1 && ret == 0; step++) {
+        int send_chunk_id = (idx - step + n + 1) % n;
+        int recv_chunk_id = (idx - step + n) % n;
+        if (strided_step(pg_handle, slot, layout, buf, datatype, op, seg_elems, num_segments,
+                         chunk_first[send_chunk_id],
+                         chunk_first[send_chunk_id + 1] - chunk_first[send_chunk_id],
+                         chunk_first[recv_chunk_id],
+                         chunk_first[recv_chunk_id + 1] - chunk_first[recv_chunk_id], 0, mr) != 0) {
+            ret = -1;
+        }
+    }
+
+    if (call_mr && ibv_dereg_mr(call_mr)) {
+        fprintf(stderr, "Rank %d: Failed to deregister strided buffer\n", pg_handle->rank);
+    }
+    free(chunk_first);
+    free(chunk_counts);
+    return ret;
+}
+
+int pg_all_reduce_strided(void* sendbuf, void* recvbuf, const pg_vector_t* layout,
+                          DATATYPE datatype, OPERATION op, PGHandle* pg_handle) {
+    if (!sendbuf || !recvbuf || !layout || !pg_handle || layout->count <= 0 ||
+        layout->blocklen <= 0 || layout->stride < layout->blocklen) {
+        fprintf(stderr, "Invalid parameters for strided all_reduce\n");
+        return -1;
+    }
+    size_t dtype_size = get_datatype_size(datatype);
+    if (dtype_size == 0) {
+        fprintf(stderr, "Invalid datatype\n");
+        return -1;
+    }
+    if (!reduction_supported(datatype, op)) {
+        fprintf(stderr, "Operation %d is not defined on datatype %d\n", op, datatype);
+        return -1;
+    }
+    if ((size_t)layout->count * layout->blocklen > INT_MAX) {
+        fprintf(stderr, "Strided all_reduce of more than INT_MAX elements\n");
+        return -1;
+    }
+    int count = layout->count * layout->blocklen;
+
+    // Exact sums like pg_all_reduce under PG_DETERMINISTIC: the fixed-point
+    // ring needs the packed vector
+    if (pg_handle->config.deterministic && datatype == DOUBLE && op == SUM) {
+        double *packed = malloc((size_t)count * sizeof(double));
+        if (!packed) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return -1;
+        }
+        strided_gather(packed, sendbuf, layout, 0, count, dtype_size);
+        int ret = pg_all_reduce_deterministic(packed, packed, count, NULL, pg_handle);
+        if (ret == 0) {
+            strided_scatter(recvbuf, packed, layout, 0, count, dtype_size);
+        }
+        free(packed);
+        return ret;
+    }
+
+    // Reduce in place in recvbuf, which takes the input block by block
+    if (recvbuf != sendbuf) {
+        for (int b = 0; b < layout->count; b++) {
+            size_t offset = (size_t)b * layout->stride * dtype_size;
+            memmove((char *)recvbuf + offset, (const char *)sendbuf + offset, layout->blocklen * dtype_size);
+        }
+    }
+
+    pg_coll_params_t params;
+    pg_tuning_select(pg_handle, (size_t)count * dtype_size, datatype, &params);
+    pg_slot_t *slot = acquire_slot(pg_handle, 0);
+    if (!slot) return -1;
+
+    int ret;
+    if (params.algorithm == PG_ALGO_ATOMIC && atomic_applicable(pg_handle, count, datatype)) {
+        // At most PG_ATOMIC_MAX_COUNT elements: cheaper to gather than to fence a ring
+        int values[PG_ATOMIC_MAX_COUNT];
+        strided_gather(values, recvbuf, layout, 0, count, dtype_size);
+        ret = atomic_all_reduce(pg_handle, slot, values, values, count, op);
+        if (ret == 0) {
+            strided_scatter(recvbuf, values, layout, 0, count, dtype_size);
+        }
+    } else {
+        ret = strided_ring(pg_handle, slot, recvbuf, layout, count, datatype, op, &params);
+    }
+    release_slot(pg_handle, slot);
+    return ret;
+}
+
+int pg_register_buffer(PGHandle* pg_handle, void* addr, size_t length) {
+    if (!pg_handle || !addr || length == 0) {
+        fprintf(stderr, "Invalid parameters for buffer registration\n");
+        return -1;
+    }
+    int ret = -1;
+    pthread_mutex_lock(&pg_handle->user_mr_lock);
+    if (pg_handle->num_user_mrs == PG_MAX_USER_MRS) {
+        fprintf(stderr, "Rank %d: more than %d registered buffers\n", pg_handle->rank, PG_MAX_USER_MRS);
+    } else {
+        struct ibv_mr *mr = ibv_reg_mr(pg_handle->pd, addr, length, IBV_ACCESS_LOCAL_WRITE);
+        if (!mr) {
+            fprintf(stderr, "Rank %d: failed to register user buffer\n", pg_handle->rank);
+        } else {
+            pg_user_mr_t *m = &pg_handle->user_mrs[pg_handle->num_user_mrs++];
+            m->addr = addr;
+            m->length = length;
+            m->mr = mr;
+            ret = 0;
+        }
+    }
+    pthread_mutex_unlock(&pg_handle->user_mr_lock);
+    return ret;
+}
+
+int pg_deregister_buffer(PGHandle* pg_handle, void* addr) {
+    if (!pg_handle) return -1;
+    int ret = -1;
+    pthread_mutex_lock(&pg_handle->user_mr_lock);
+    for (int i = 0; i < pg_handle->num_user_mrs; i++) {
+        if (pg_handle->user_mrs[i].addr != addr) continue;
+        if (ibv_dereg_mr(pg_handle->user_mrs[i].mr) == 0) {
+            pg_handle->user_mrs[i] = pg_handle->user_mrs[--pg_handle->num_user_mrs];
+            ret = 0;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&pg_handle->user_mr_lock);
+    if (ret != 0) {
+        fprintf(stderr, "Rank %d: failed to deregister user buffer\n", pg_handle->rank);
+    }
+    return ret;
+}
@@ -0,0 +1,136 @@
+#include "pg_topology.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/* Maximum length of a host name or location in the topology file */
+#define PG_TOPOLOGY_MAX_TOKEN 256
+
+// A rank and its location, sorted to build the order
+typedef struct {
+    int rank;
+    const char *location;   /* NULL = not in the file */
+} ranked_location_t;
+
+static int compare_locations(const void *a, const void *b) {
+    const ranked_location_t *x = (const ranked_location_t *)a;
+    const ranked_location_t *y = (const ranked_location_t *)b;
+    if (!x->location != !y->location) return x->location ? -1 : 1;
+    if (x->location) {
+        int c = strcmp(x->location, y->location);
+        if (c != 0) return c;
+    }
+    return x->rank - y->rank;
+}
+
+// Host names match exactly, or by their first label (node07 vs node07.cluster)
+static int same_host(const char *a, const char *b) {
+    size_t la = strcspn(a, "."), lb = strcspn(b, ".");
+    return strcmp(a, b) == 0 || (la == lb && strncmp(a, b, la) == 0);
+}
+
+int pg_topology_order_from_file(const char *path, char **servernames, int size, int *order) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open topology file %s\n", path);
+        return -1;
+    }
+
+    char **locations = calloc(size, sizeof(char *));
+    ranked_location_t *ranked = malloc(size * sizeof(ranked_location_t));
+    if (!locations || !ranked) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(locations);
+        free(ranked);
+        fclose(f);
+        return -1;
+    }
+
+    int ret = 0;
+    int line_no = 0;
+    char line[2 * PG_TOPOLOGY_MAX_TOKEN + 64];
+    while (ret == 0 && fgets(line, sizeof(line), f)) {
+        line_no++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char host[PG_TOPOLOGY_MAX_TOKEN], location[PG_TOPOLOGY_MAX_TOKEN];
+        int fields = sscanf(line, "%255s %255s", host, location);
+        if (fields <= 0) continue;
+        if (fields != 2) {
+            fprintf(stderr, "%s:%d: expected 'hostname location'\n", path, line_no);
+            ret = -1;
+            break;
+        }
+        for (int r = 0; r < size; r++) {
+            if (!locations[r] && same_host(servernames[r], host)) {
+                locations[r] = strdup(location);
+                if (!locations[r]) ret = -1;
+            }
+        }
+    }
+    fclose(f);
+
+    if (ret == 0) {
+        for (int r = 0; r < size; r++) {
+            ranked[r].rank = r;
+            ranked[r].location = locations[r];
+        }
+        qsort(ranked, size, sizeof(ranked_location_t), compare_locations);
+        for (int p = 0; p < size; p++) {
+            order[p] = ranked[p].rank;
+        }
+    }
+
+    for (int r = 0; r < size; r++) free(locations[r]);
+    free(locations);
+    free(ranked);
+    return ret;
+}
+
+void pg_topology_order_from_costs(const double *cost, int size, int *order) {
+    char *used = calloc(size, 1);
+    if (!used) {
+        for (int p = 0; p < size; p++) order[p] = p;
+        return;
+    }
+
+    // Nearest neighbor tour from rank 0 (ties go to the lower rank)
+    order[0] = 0;
+    used[0] = 1;
+    for (int p = 1; p < size; p++) {
+        int prev = order[p - 1], best = -1;
+        for (int r = 0; r < size; r++) {
+            if (!used[r] && (best < 0 || cost[prev * size + r] < cost[prev * size + best])) {
+                best = r;
+            }
+        }
+        order[p] = best;
+        used[best] = 1;
+    }
+    free(used);
+
+    // 2-opt: replace links a-b and c-d by a-c and b-d (reversing b..c) while
+    // that shortens the ring. Position 0 never moves.
+    for (int round = 0; round < 100; round++) {
+        int improved = 0;
+        for (int i = 0; i < size - 2; i++) {
+            for (int j = i + 2; j < size; j++) {
+                int a = order[i], b = order[i + 1], c = order[j], d = order[(j + 1) % size];
+                if (d == a) continue;
+                double delta = cost[a * size + c] + cost[b * size + d] -
+                               cost[a * size + b] - cost[c * size + d];
+                if (delta < -1e-9) {
+                    for (int lo = i + 1, hi = j; lo < hi; lo++, hi--) {
+                        int t = order[lo];
+                        order[lo] = order[hi];
+                        order[hi] = t;
+                    }
+                    improved = 1;
+                }
+            }
+        }
+        if (!improved) break;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef PG_TOPOLOGY_H
+#define PG_TOPOLOGY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_topology.h
+ *
+ * Ring ordering: where each rank sits around the ring. Every ring step sends
+ * over all n links at once, so a step is as slow as its slowest link; an
+ * order that keeps hosts of the same switch next to each other crosses the
+ * switch fabric only once per switch instead of on most links.
+ *
+ * The order is computed identically on every rank, either from a topology
+ * file or from a cost matrix measured at connect time (see PG_RING_ORDER).
+ * Ranks as seen by the caller never change.
+ *
+ * Topology file format, one host per line ('#' starts a comment):
+ *
+ *   node07   spine0/leaf1
+ *   node08   spine0/leaf1
+ *   node12   spine0/leaf2
+ *
+ * The location is a '/' separated path from the top of the fabric down to
+ * the host's switch. Ranks are ordered by location, so hosts of one switch
+ * (and switches under one spine) end up adjacent, and by rank within a
+ * switch. Hosts missing from the file go last, in rank order.
+ */
+
+#include "pg_handle.h"
+
+/**
+ * @brief Ring order from a topology file.
+ * @param path Topology file.
+ * @param servernames Host name of every rank (matched exactly or by its first label).
+ * @param size Number of ranks.
+ * @param order Receives the rank at every ring position.
+ * @return 0 on success, -1 if the file cannot be read or is malformed.
+ */
+int pg_topology_order_from_file(const char *path, char **servernames, int size, int *order);
+
+/**
+ * @brief Short ring over a symmetric cost matrix: nearest neighbor from rank 0,
+ * improved with 2-opt moves. Deterministic for a given matrix.
+ * @param cost size x size matrix, cost[i * size + j] of the link between ranks i and j.
+ * @param size Number of ranks.
+ * @param order Receives the rank at every ring position (order[0] == 0).
+ */
+void pg_topology_order_from_costs(const double *cost, int size, int *order);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_TOPOLOGY_H */
@@ -0,0 +1,159 @@
+#include "pg_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+static const char *phase_names[PG_TRACE_NUM_PHASES] = {
+    "step", "copy_in", "post", "completion", "barrier", "reduce", "copy_out"
+};
+
+static const char *category_names[] = {"ring", "reduce_scatter", "allgather"};
+
+/* Longest line of a trace file (one event per line) */
+#define PG_TRACE_MAX_LINE 1024
+
+int pg_trace_init(PGHandle *pg_handle) {
+    pg_trace_t *trace = &pg_handle->trace;
+    size_t wanted = pg_handle->config.trace_events;
+    if (wanted == 0) return 0;
+
+    uint64_t capacity = 1;
+    while (capacity < wanted) capacity <<= 1;
+    trace->events = calloc(capacity, sizeof(pg_trace_event_t));
+    if (!trace->events) {
+        fprintf(stderr, "Rank %d: cannot allocate %lu trace records\n", pg_handle->rank,
+                (unsigned long)capacity);
+        return -1;
+    }
+    trace->capacity = capacity;
+    trace->head = 0;
+    return 0;
+}
+
+void pg_trace_free(PGHandle *pg_handle) {
+    free(pg_handle->trace.events);
+    pg_handle->trace.events = NULL;
+    pg_handle->trace.capacity = 0;
+}
+
+void pg_trace_record(PGHandle *pg_handle, const pg_slot_t *slot, pg_trace_phase_t phase,
+                     uint64_t start_ns, size_t bytes) {
+    pg_trace_t *trace = &pg_handle->trace;
+    if (!trace->events) return;
+    uint64_t end_ns = pg_trace_clock_ns();
+
+    int n = pg_handle->num_servers;
+    int step = slot->trace_step;
+    uint64_t index = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+    pg_trace_event_t *event = &trace->events[index & (trace->capacity - 1)];
+
+    // Seqlock-style: readers skip a record whose seq is not its index + 1
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event->start_ns = start_ns;
+    event->end_ns = end_ns;
+    event->bytes = bytes;
+    event->step = step;
+    event->slot = (uint16_t)slot->index;
+    event->phase = (uint8_t)phase;
+    event->category = step < 0 ? PG_TRACE_RING : step < n - 1 ? PG_TRACE_REDUCE_SCATTER : PG_TRACE_ALLGATHER;
+    __atomic_store_n(&event->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+// Expand a '%d' in 'pattern' to the rank
+static void trace_path(char *out, size_t size, const char *pattern, int rank) {
+    const char *mark = strstr(pattern, "%d");
+    if (!mark) {
+        snprintf(out, size, "%s", pattern);
+        return;
+    }
+    snprintf(out, size, "%.*s%d%s", (int)(mark - pattern), pattern, rank, mark + 2);
+}
+
+int pg_trace_dump(const PGHandle *pg_handle, const char *path) {
+    const pg_trace_t *trace = &pg_handle->trace;
+    if (!trace->events || !path) {
+        fprintf(stderr, "Rank %d: tracing is off (set PG_TRACE_EVENTS)\n", pg_handle->rank);
+        return -1;
+    }
+    char file_path[PG_MAX_PATH + 16];
+    trace_path(file_path, sizeof(file_path), path, pg_handle->rank);
+    FILE *f = fopen(file_path, "w");
+    if (!f) {
+        fprintf(stderr, "Rank %d: cannot write trace file %s\n", pg_handle->rank, file_path);
+        return -1;
+    }
+
+    // One event per line, so per-rank files can be merged line by line
+    int rank = pg_handle->rank;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d (%s)\"}}",
+            rank, rank, pg_handle->servernames[rank]);
+    fprintf(f, ",\n{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"sort_index\":%d}}",
+            rank, rank);
+    for (int i = 0; i < PG_MAX_SLOTS * PG_MAX_RINGS; i++) {
+        if (i % PG_MAX_SLOTS >= pg_handle->num_slots + pg_handle->num_high_slots) continue;
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                   "\"args\":{\"name\":\"slot %d%s\"}}",
+                rank, i, i % PG_MAX_SLOTS, i >= PG_MAX_SLOTS ? " reverse" : "");
+    }
+
+    uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > trace->capacity ? head - trace->capacity : 0;
+    int64_t offset = trace->clock_offset_ns;
+    for (uint64_t index = first; index < head; index++) {
+        const pg_trace_event_t *slot_event = &trace->events[index & (trace->capacity - 1)];
+        if (__atomic_load_n(&slot_event->seq, __ATOMIC_ACQUIRE) != index + 1) continue;
+        pg_trace_event_t event = *slot_event;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot_event->seq, __ATOMIC_RELAXED) != index + 1) continue;
+        if (event.phase >= PG_TRACE_NUM_PHASES) continue;
+
+        // Timestamps in microseconds on rank 0's clock
+        double ts = ((double)event.start_ns + (double)offset) / 1e3;
+        double dur = (double)(event.end_ns - event.start_ns) / 1e3;
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"pid\":%d,\"tid\":%u,\"args\":{\"step\":%d,\"bytes\":%lu}}",
+                phase_names[event.phase], category_names[event.category], ts, dur,
+                rank, (unsigned)event.slot, event.step, (unsigned long)event.bytes);
+    }
+    fprintf(f, "\n]}\n");
+    if (head > trace->capacity) {
+        fprintf(stderr, "Rank %d: trace kept the last %lu of %lu records\n", rank,
+                (unsigned long)trace->capacity, (unsigned long)head);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+int pg_trace_merge(const char *out_path, char **in_paths, int num_inputs) {
+    FILE *out = fopen(out_path, "w");
+    if (!out) {
+        fprintf(stderr, "Cannot write trace file %s\n", out_path);
+        return -1;
+    }
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    int ret = 0;
+    int written = 0;
+    char line[PG_TRACE_MAX_LINE];
+    for (int i = 0; i < num_inputs && ret == 0; i++) {
+        FILE *in = fopen(in_paths[i], "r");
+        if (!in) {
+            fprintf(stderr, "Cannot open trace file %s\n", in_paths[i]);
+            ret = -1;
+            break;
+        }
+        // Event lines are the ones holding an object; drop the separators
+        while (fgets(line, sizeof(line), in)) {
+            size_t len = strcspn(line, "\n");
+            if (len > 0 && line[len - 1] == ',') len--;
+            if (line[0] != '{' || strncmp(line, "{\"displayTimeUnit\"", 18) == 0) continue;
+            fprintf(out, "%s\n%.*s", written++ ? "," : "", (int)len, line);
+        }
+        fclose(in);
+    }
+    fprintf(out, "\n]}\n");
+    if (fclose(out) != 0) ret = -1;
+    return ret;
+}
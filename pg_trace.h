@@ -0,0 +1,101 @@
+#ifndef PG_TRACE_H
+#define PG_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_trace.h
+ *
+ * Opt-in timeline of the ring steps (PG_TRACE_EVENTS > 0). Every step of an
+ * all-reduce and the parts it is made of (staging copy, RDMA post, completion
+ * wait, barrier / flag wait, reduce) are recorded as begin/end pairs into a
+ * lock-free ring buffer per handle, which keeps the newest records. Recording
+ * costs two clock reads and an atomic increment; with tracing off, a branch.
+ *
+ * At connect time every rank measures the offset of its clock to rank 0's
+ * over TCP (best of a few round trips), so the timelines of all ranks share
+ * one time axis to within the round-trip asymmetry (microseconds).
+ *
+ * pg_trace_dump writes a rank's records as Chrome trace JSON (one process per
+ * rank, one row per slot); pg_trace_merge (or the pg_trace_merge tool)
+ * combines the per-rank files into one for chrome://tracing or Perfetto.
+ */
+
+#include <time.h>
+#include "pg_handle.h"
+
+/* What a trace record covers */
+typedef enum {
+    PG_TRACE_STEP,        /* one whole ring step */
+    PG_TRACE_COPY_IN,     /* copy of the outgoing segment into staging */
+    PG_TRACE_POST,        /* posting an RDMA write / read / flag write */
+    PG_TRACE_COMPLETION,  /* waiting for the slot's completions */
+    PG_TRACE_BARRIER,     /* ring barrier or neighbor flag wait */
+    PG_TRACE_REDUCE,      /* reducing a received segment */
+    PG_TRACE_COPY_OUT,    /* copy of a received segment out of staging */
+    PG_TRACE_NUM_PHASES
+} pg_trace_phase_t;
+
+/* Which part of a collective a record belongs to */
+typedef enum {
+    PG_TRACE_RING,            /* ring step outside an all-reduce */
+    PG_TRACE_REDUCE_SCATTER,
+    PG_TRACE_ALLGATHER
+} pg_trace_category_t;
+
+static inline uint64_t pg_trace_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Start time of a record, 0 when tracing is off.
+ */
+static inline uint64_t pg_trace_begin(const PGHandle *pg_handle) {
+    return pg_handle->trace.events ? pg_trace_clock_ns() : 0;
+}
+
+/**
+ * @brief Allocates the trace buffer of config.trace_events records (none when 0).
+ * @return 0 on success, -1 if the buffer cannot be allocated.
+ */
+int pg_trace_init(PGHandle *pg_handle);
+
+/**
+ * @brief Releases the trace buffer.
+ */
+void pg_trace_free(PGHandle *pg_handle);
+
+/**
+ * @brief Records 'phase' from 'start_ns' (pg_trace_begin) until now on the
+ * slot's row, labeled with the slot's current step. Safe to call from any
+ * thread; a no-op when tracing is off.
+ */
+void pg_trace_record(PGHandle *pg_handle, const pg_slot_t *slot, pg_trace_phase_t phase,
+                     uint64_t start_ns, size_t bytes);
+
+/**
+ * @brief Writes this rank's trace as Chrome trace JSON, timestamps on rank 0's
+ * clock. Call while no collective runs; records overwritten meanwhile are skipped.
+ * @param path Output file; a '%d' in it is replaced by the rank.
+ * @return 0 on success, -1 if tracing is off or the file cannot be written.
+ */
+int pg_trace_dump(const PGHandle *pg_handle, const char *path);
+
+/**
+ * @brief Merges Chrome trace files written by pg_trace_dump into one.
+ * @param out_path Merged file.
+ * @param in_paths Per-rank files.
+ * @param num_inputs Number of per-rank files.
+ * @return 0 on success, -1 if a file cannot be read or written.
+ */
+int pg_trace_merge(const char *out_path, char **in_paths, int num_inputs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_TRACE_H */
@@ -0,0 +1,25 @@
+/**
+ * pg_trace_merge.c
+ *
+ * Combines the per-rank Chrome traces written with PG_TRACE_FILE (or
+ * pg_trace_dump) into one file, so every rank shows up as its own process
+ * on a shared time axis in chrome://tracing or Perfetto:
+ *
+ *   PG_TRACE_EVENTS=65536 PG_TRACE_FILE=/shared/trace.%d.json ./test_allreduce ...
+ *   pg_trace_merge trace.json /shared/trace.*.json
+ */
+
+#include "pg_trace.h"
+#include <stdio.h>
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <merged.json> <rank trace.json> ...\n", argv[0]);
+        return 1;
+    }
+    if (pg_trace_merge(argv[1], argv + 2, argc - 2) != 0) {
+        return 1;
+    }
+    printf("Merged %d rank traces into %s\n", argc - 2, argv[1]);
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include "pg_tuning.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+static const char *algorithm_names[] = {"ring", "atomic"};
+static const char *protocol_names[] = {"push", "pull"};
+
+const char *pg_algorithm_name(pg_algorithm_t algorithm) {
+    if ((int)algorithm < 0 || (size_t)algorithm >= sizeof(algorithm_names) / sizeof(algorithm_names[0])) {
+        return "unknown";
+    }
+    return algorithm_names[algorithm];
+}
+
+const char *pg_protocol_name(pg_protocol_t protocol) {
+    if ((int)protocol < 0 || (size_t)protocol >= sizeof(protocol_names) / sizeof(protocol_names[0])) {
+        return "unknown";
+    }
+    return protocol_names[protocol];
+}
+
+// Look a name up in a table; returns its index or -1
+static int lookup_name(const char *name, const char **names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+int pg_tuning_load(PGHandle *pg_handle, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    pg_tuning_rule_t *rules = calloc(PG_TUNING_MAX_RULES, sizeof(pg_tuning_rule_t));
+    if (!rules) {
+        fclose(f);
+        return -1;
+    }
+
+    char line[512];
+    int num_rules = 0;
+    int line_no = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        int ranks;
+        unsigned long long min_bytes, max_bytes, segment_bytes;
+        char algorithm[32], protocol[32];
+        int fields = sscanf(line, "%d %llu %llu %31s %31s %llu", &ranks, &min_bytes, &max_bytes,
+                            algorithm, protocol, &segment_bytes);
+        if (fields <= 0) continue; // blank or comment line
+
+        int algo_idx = lookup_name(algorithm, algorithm_names,
+                                   sizeof(algorithm_names) / sizeof(algorithm_names[0]));
+        int proto_idx = lookup_name(protocol, protocol_names,
+                                    sizeof(protocol_names) / sizeof(protocol_names[0]));
+        if (fields != 6 || algo_idx < 0 || proto_idx < 0 || min_bytes >= max_bytes) {
+            fprintf(stderr, "%s:%d: malformed tuning rule\n", path, line_no);
+            free(rules);
+            fclose(f);
+            return -1;
+        }
+        if (ranks != pg_handle->num_servers) continue;
+        if (num_rules == PG_TUNING_MAX_RULES) {
+            fprintf(stderr, "%s: more than %d rules, ignoring the rest\n", path, PG_TUNING_MAX_RULES);
+            break;
+        }
+
+        pg_tuning_rule_t *rule = &rules[num_rules++];
+        rule->ranks = ranks;
+        rule->min_bytes = min_bytes;
+        rule->max_bytes = max_bytes;
+        rule->params.algorithm = (pg_algorithm_t)algo_idx;
+        rule->params.protocol = (pg_protocol_t)proto_idx;
+        rule->params.segment_bytes = segment_bytes;
+    }
+    fclose(f);
+
+    free(pg_handle->tuning_rules);
+    pg_handle->tuning_rules = rules;
+    pg_handle->num_tuning_rules = num_rules;
+    return 0;
+}
+
+void pg_tuning_select(const PGHandle *pg_handle, size_t bytes, DATATYPE datatype,
+                      pg_coll_params_t *params) {
+    params->protocol = pg_handle->config.protocol;
+    params->segment_bytes = 0;
+
+    // Tiny INT vectors: a single round of remote atomics beats any ring
+    if (datatype == INT && pg_handle->atomic_supported &&
+        bytes <= (size_t)pg_handle->config.atomic_max_count * sizeof(int)) {
+        params->algorithm = PG_ALGO_ATOMIC;
+        return;
+    }
+
+    for (int i = 0; i < pg_handle->num_tuning_rules; i++) {
+        const pg_tuning_rule_t *rule = &pg_handle->tuning_rules[i];
+        if (bytes >= rule->min_bytes && bytes < rule->max_bytes) {
+            *params = rule->params;
+            return;
+        }
+    }
+
+    // Built-in heuristics: the configured protocol with whole-slot segments
+    params->algorithm = PG_ALGO_RING;
+}
+
+int pg_tuning_save(const char *path, const pg_tuning_rule_t *rules, int num_rules) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("Failed to open tuning file");
+        return -1;
+    }
+    fprintf(f, "# pg_allreduce tuning table (generated by pg_autotune)\n");
+    fprintf(f, "# ranks min_bytes max_bytes algorithm protocol segment_bytes\n");
+    for (int i = 0; i < num_rules; i++) {
+        const pg_tuning_rule_t *rule = &rules[i];
+        fprintf(f, "%d %zu %zu %s %s %zu\n", rule->ranks, rule->min_bytes, rule->max_bytes,
+                pg_algorithm_name(rule->params.algorithm), pg_protocol_name(rule->params.protocol),
+                rule->params.segment_bytes);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
@@ -0,0 +1,76 @@
+#ifndef PG_TUNING_H
+#define PG_TUNING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * pg_tuning.h
+ *
+ * Per-call selection of the all-reduce algorithm, transfer protocol and
+ * segment size from a tuning table. The table is produced on the live
+ * cluster by the pg_autotune tool and loaded by connect_process_group from
+ * the file named by PG_TUNING_FILE (default "pg_tuning.conf"). Without a
+ * table, or for message sizes it does not cover, built-in heuristics apply.
+ *
+ * File format, one rule per line ('#' starts a comment):
+ *
+ *   <ranks> <min_bytes> <max_bytes> <algorithm> <protocol> <segment_bytes>
+ *
+ * A rule applies to groups of exactly <ranks> ranks and messages of
+ * min_bytes <= bytes < max_bytes. Every rank must load the same table,
+ * since all ranks of a collective must make the same choice.
+ */
+
+#include <stddef.h>
+#include "pg_handle.h"
+
+/* Default tuning file, relative to the working directory */
+#define PG_TUNING_FILE "pg_tuning.conf"
+
+/* Maximum number of rules kept from a tuning file */
+#define PG_TUNING_MAX_RULES 256
+
+/**
+ * @brief Parses a tuning file and keeps the rules matching the group size.
+ * A missing file is not an error: the handle keeps using the heuristics.
+ * @param pg_handle Pointer to the process group handle.
+ * @param path Tuning file path.
+ * @return 0 on success or missing file, -1 on a malformed file.
+ */
+int pg_tuning_load(PGHandle *pg_handle, const char *path);
+
+/**
+ * @brief Picks the parameters of an all-reduce of 'bytes' bytes.
+ * INT vectors of at most config.atomic_max_count elements use the atomic
+ * algorithm when the device supports remote atomics; the table and the
+ * heuristics decide otherwise.
+ * @param pg_handle Pointer to the process group handle.
+ * @param bytes Message size in bytes.
+ * @param datatype Element type.
+ * @param params Output parameters.
+ */
+void pg_tuning_select(const PGHandle *pg_handle, size_t bytes, DATATYPE datatype,
+                      pg_coll_params_t *params);
+
+/**
+ * @brief Writes a tuning table.
+ * @param path Output file path.
+ * @param rules Rules to write.
+ * @param num_rules Number of rules.
+ * @return 0 on success, -1 on failure.
+ */
+int pg_tuning_save(const char *path, const pg_tuning_rule_t *rules, int num_rules);
+
+/**
+ * @brief Name of an algorithm / protocol as used in tuning files.
+ */
+const char *pg_algorithm_name(pg_algorithm_t algorithm);
+const char *pg_protocol_name(pg_protocol_t protocol);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PG_TUNING_H */
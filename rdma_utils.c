@@ -1,145 +1,481 @@
 #include "rdma_utils.h"
+#include "pg_latency.h"
+#include <errno.h>
 
 
 
-int rdma_write_to_right(PGHandle *pg_handle, size_t actual_size) {   
+// The transport resources a slot posts and polls on
+static pg_traffic_class_t *slot_class(PGHandle *pg_handle, const pg_slot_t *slot) {
+    return &pg_handle->classes[slot->priority];
+}
+
+// Class QP index of the slot's left (side 0) or right (side 1) neighbor:
+// qps[0] leads to left_rank and qps[1] to right_rank, and the reverse ring
+// runs over the same links the other way around
+static int side_qp(const pg_slot_t *slot, int side) {
+    return slot->ring ? 1 - side : side;
+}
+
+// Rank of the slot's left (side 0) or right (side 1) neighbor
+static int side_rank(const PGHandle *pg_handle, const pg_slot_t *slot, int side) {
+    return side_qp(slot, side) ? pg_handle->right_rank : pg_handle->left_rank;
+}
+
+pg_slot_t *acquire_slot(PGHandle *pg_handle, int tag) {
+    return acquire_slot_priority(pg_handle, tag, PG_PRIORITY_BULK);
+}
+
+pg_slot_t *acquire_slot_priority(PGHandle *pg_handle, int tag, pg_priority_t priority) {
+    if (tag < 0 || pg_handle->num_slots <= 0) {
+        fprintf(stderr, "Rank %d: Invalid operation tag %d\n", pg_handle->rank, tag);
+        return NULL;
+    }
+    // Every tag gets a slot of its own: two tags sharing one would be paired
+    // in whichever order each rank happened to take the slot
+    int high = priority == PG_PRIORITY_HIGH && pg_handle->num_high_slots > 0;
+    int slots = high ? pg_handle->num_high_slots : pg_handle->num_slots;
+    if (tag >= slots) {
+        fprintf(stderr, "Rank %d: operation tag %d out of range, the %s class has %d slots\n",
+                pg_handle->rank, tag, high ? "high-priority" : "bulk", slots);
+        return NULL;
+    }
+    pg_slot_t *slot = &pg_handle->slots[(high ? pg_handle->num_slots : 0) + tag];
+    pthread_mutex_lock(&slot->lock);
+    slot->tag = tag;
+    slot->error = 0;
+    slot->trace_step = -1;
+    return slot;
+}
+
+void release_slot(PGHandle *pg_handle, pg_slot_t *slot) {
+    (void)pg_handle;
+    slot->tag = -1;
+    pthread_mutex_unlock(&slot->lock);
+}
+
+int post_slot_send(PGHandle *pg_handle, pg_slot_t *slot, struct ibv_qp *qp, struct ibv_send_wr *wr) {
+    int signaled = 0;
+    for (struct ibv_send_wr *w = wr; w; w = w->next) {
+        if (w->send_flags & IBV_SEND_SIGNALED) signaled++;
+    }
+
+    // Count the completions before posting so a fast completion polled by
+    // another thread can never drive the counter negative
+    __atomic_add_fetch(&slot->pending, signaled, __ATOMIC_RELEASE);
+
+    struct ibv_send_wr *bad_wr;
+    pg_traffic_class_t *cls = slot_class(pg_handle, slot);
+    pthread_mutex_lock(&cls->post_lock);
+    int ret = ibv_post_send(qp, wr, &bad_wr);
+    pthread_mutex_unlock(&cls->post_lock);
+    if (ret != 0) {
+        __atomic_sub_fetch(&slot->pending, signaled, __ATOMIC_RELEASE);
+        return 1;
+    }
+    return 0;
+}
+
+int rdma_write_to_right(PGHandle *pg_handle, pg_slot_t *slot, size_t actual_size) {
     // Get neighbors (ring topology)
     int rank = pg_handle->rank;
-    int right_neighbor = (rank + 1) % pg_handle->num_servers;
+    int right_neighbor = side_rank(pg_handle, slot, 1);
+
+    if (actual_size == 0) {
+        return 0;
+    }
 
     // Send message to right neighbor using RDMA Write
-    // We write to the right neighbor's receive buffer
+    // We write to the same slot of the right neighbor's receive buffer
     struct ibv_sge sge = {
-        .addr = (uintptr_t)pg_handle->sendbuf,
+        .addr = (uintptr_t)slot->sendbuf,
         .length = actual_size,
         .lkey = pg_handle->mr_send->lkey
     };
-    
+
     struct ibv_send_wr wr = {
-        .wr_id = rank,
+        .wr_id = PG_WR_ID(slot->index, PG_WR_DATA) | pg_latency_stamp(pg_handle) << PG_WR_STAMP_SHIFT,
         .sg_list = &sge,
         .num_sge = 1,
         .opcode = IBV_WR_RDMA_WRITE,
         .send_flags = IBV_SEND_SIGNALED,
         .wr.rdma = {
-            .remote_addr = pg_handle->remote_addrs[right_neighbor],
+            .remote_addr = pg_handle->remote_addrs[right_neighbor] + slot->offset,
             .rkey = pg_handle->remote_rkeys[right_neighbor]
         },
         .next = NULL
     };
-    
-    struct ibv_send_wr *bad_wr;
-    if (ibv_post_send(pg_handle->qps[1], &wr, &bad_wr) != 0) {
+
+    if (post_slot_send(pg_handle, slot, slot_class(pg_handle, slot)->qps[side_qp(slot, 1)], &wr) != 0) {
         fprintf(stderr, "Rank %d: Failed to post RDMA write\n", rank);
         return 1;
     }
-    
+
     return 0;
 }
 
-int poll_for_completion(PGHandle *pg_handle) {
+int rdma_write_sge_to_right(PGHandle *pg_handle, pg_slot_t *slot, struct ibv_sge *sges, int num_sge,
+                            size_t remote_offset, int signaled) {
     int rank = pg_handle->rank;
-    struct ibv_wc wc;
-    int ne;
+    int right_neighbor = side_rank(pg_handle, slot, 1);
+
+    // The entries are gathered into one contiguous range of the right
+    // neighbor's slot, starting 'remote_offset' bytes in
+    struct ibv_send_wr wr = {
+        .wr_id = PG_WR_ID(slot->index, PG_WR_DATA) | (signaled ? pg_latency_stamp(pg_handle) : 0) << PG_WR_STAMP_SHIFT,
+        .sg_list = sges,
+        .num_sge = num_sge,
+        .opcode = IBV_WR_RDMA_WRITE,
+        .send_flags = signaled ? IBV_SEND_SIGNALED : 0,
+        .wr.rdma = {
+            .remote_addr = pg_handle->remote_addrs[right_neighbor] + slot->offset + remote_offset,
+            .rkey = pg_handle->remote_rkeys[right_neighbor]
+        },
+        .next = NULL
+    };
+
+    if (post_slot_send(pg_handle, slot, slot_class(pg_handle, slot)->qps[side_qp(slot, 1)], &wr) != 0) {
+        fprintf(stderr, "Rank %d: Failed to post gather RDMA write\n", rank);
+        return 1;
+    }
+    return 0;
+}
+
+int rdma_read_from_left(PGHandle *pg_handle, pg_slot_t *slot, size_t actual_size) {
+    int rank = pg_handle->rank;
+    int left_neighbor = side_rank(pg_handle, slot, 0);
+
+    if (actual_size == 0) {
+        return 0;
+    }
+
+    // Read the segment the left neighbor published in the same slot of its send buffer
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)slot->recvbuf,
+        .length = actual_size,
+        .lkey = pg_handle->mr_recv->lkey
+    };
+
+    struct ibv_send_wr wr = {
+        .wr_id = PG_WR_ID(slot->index, PG_WR_READ) | pg_latency_stamp(pg_handle) << PG_WR_STAMP_SHIFT,
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_RDMA_READ,
+        .send_flags = IBV_SEND_SIGNALED,
+        .wr.rdma = {
+            .remote_addr = pg_handle->remote_send_addrs[left_neighbor] + slot->offset,
+            .rkey = pg_handle->remote_send_rkeys[left_neighbor]
+        },
+        .next = NULL
+    };
+
+    if (post_slot_send(pg_handle, slot, slot_class(pg_handle, slot)->qps[side_qp(slot, 0)], &wr) != 0) {
+        fprintf(stderr, "Rank %d: Failed to post RDMA read\n", rank);
+        return 1;
+    }
+
+    return 0;
+}
+
+int ctrl_write(PGHandle *pg_handle, pg_slot_t *slot, int qp_idx, size_t src_offset, size_t dst_offset) {
+    int rank = pg_handle->rank;
+    int peer = side_rank(pg_handle, slot, qp_idx);
+    size_t block = slot->index * sizeof(pg_slot_ctrl_t);
+
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)pg_handle->ctrl + block + src_offset,
+        .length = sizeof(uint64_t),
+        .lkey = pg_handle->mr_ctrl->lkey
+    };
+
+    struct ibv_send_wr wr = {
+        .wr_id = PG_WR_ID(slot->index, PG_WR_CTRL),
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_RDMA_WRITE,
+        .send_flags = IBV_SEND_SIGNALED,
+        .wr.rdma = {
+            .remote_addr = pg_handle->remote_ctrl_addrs[peer] + block + dst_offset,
+            .rkey = pg_handle->remote_ctrl_rkeys[peer]
+        },
+        .next = NULL
+    };
+
+    if (post_slot_send(pg_handle, slot, slot_class(pg_handle, slot)->qps[side_qp(slot, qp_idx)], &wr) != 0) {
+        fprintf(stderr, "Rank %d: Failed to post control write\n", rank);
+        return 1;
+    }
+    return 0;
+}
+
+int rdma_write_to_peer(PGHandle *pg_handle, pg_slot_t *slot, int peer, const void *local,
+                       size_t length, size_t remote_offset, int kind, int signaled) {
+    if (length == 0) {
+        return 0;
+    }
+    pg_peer_t *p = &pg_handle->peers[peer];
+
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)local,
+        .length = length,
+        .lkey = pg_handle->mr_mesh->lkey
+    };
+
+    struct ibv_send_wr wr = {
+        .wr_id = PG_WR_ID(slot->index, kind),
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_RDMA_WRITE,
+        .send_flags = signaled ? IBV_SEND_SIGNALED : 0,
+        .wr.rdma = {
+            .remote_addr = p->mesh_addr + remote_offset,
+            .rkey = p->mesh_rkey
+        },
+        .next = NULL
+    };
+
+    if (post_slot_send(pg_handle, slot, p->qps[slot->priority], &wr) != 0) {
+        fprintf(stderr, "Rank %d: Failed to post RDMA write to peer %d\n", pg_handle->rank, peer);
+        return 1;
+    }
+    return 0;
+}
+
+int rdma_write_inline_to_peer(PGHandle *pg_handle, pg_slot_t *slot, int peer, const void *local,
+                              size_t length, size_t remote_offset, int kind) {
+    pg_peer_t *p = &pg_handle->peers[peer];
+    if (length > PG_MAX_INLINE || !p->inline_ok[slot->priority]) {
+        fprintf(stderr, "Rank %d: %zu bytes do not fit an inline write to peer %d\n",
+                pg_handle->rank, length, peer);
+        return 1;
+    }
+
+    // Inline data is read at post time; the lkey is not used
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)local,
+        .length = length,
+        .lkey = 0
+    };
+
+    struct ibv_send_wr wr = {
+        .wr_id = PG_WR_ID(slot->index, kind),
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_RDMA_WRITE,
+        .send_flags = IBV_SEND_SIGNALED | IBV_SEND_INLINE,
+        .wr.rdma = {
+            .remote_addr = p->mesh_addr + remote_offset,
+            .rkey = p->mesh_rkey
+        },
+        .next = NULL
+    };
+
+    if (post_slot_send(pg_handle, slot, p->qps[slot->priority], &wr) != 0) {
+        fprintf(stderr, "Rank %d: Failed to post inline write to peer %d\n", pg_handle->rank, peer);
+        return 1;
+    }
+    return 0;
+}
+
+int rdma_atomic_to_peer(PGHandle *pg_handle, pg_slot_t *slot, int peer, uint64_t *fetched,
+                        size_t remote_offset, int cmp_swap, uint64_t compare_add, uint64_t swap) {
+    pg_peer_t *p = &pg_handle->peers[peer];
+
+    // The old value of the remote word lands in 'fetched'
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)fetched,
+        .length = sizeof(uint64_t),
+        .lkey = pg_handle->mr_mesh->lkey
+    };
+
+    struct ibv_send_wr wr = {
+        .wr_id = PG_WR_ID(slot->index, PG_WR_ATOMIC),
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = cmp_swap ? IBV_WR_ATOMIC_CMP_AND_SWP : IBV_WR_ATOMIC_FETCH_AND_ADD,
+        .send_flags = IBV_SEND_SIGNALED,
+        .wr.atomic = {
+            .remote_addr = p->mesh_addr + remote_offset,
+            .compare_add = compare_add,
+            .swap = swap,
+            .rkey = p->mesh_rkey
+        },
+        .next = NULL
+    };
+
+    if (post_slot_send(pg_handle, slot, p->qps[slot->priority], &wr) != 0) {
+        fprintf(stderr, "Rank %d: Failed to post atomic to peer %d\n", pg_handle->rank, peer);
+        return 1;
+    }
+    return 0;
+}
+
+int wait_ctrl_word(PGHandle *pg_handle, volatile uint64_t *word, uint64_t seq) {
+    uint64_t timeout = 0;
+    while (__atomic_load_n(word, __ATOMIC_ACQUIRE) < seq) {
+        timeout++;
+        if (timeout > MAX_TIMEOUT) {
+            fprintf(stderr, "Rank %d: Timeout waiting for neighbor flag %lu (flag=%lu)\n",
+                    pg_handle->rank, (unsigned long)seq, (unsigned long)*word);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Polls up to PG_POLL_BATCH completions of a CQ created with completion
+// timestamps; only wr_id and status of 'wc' are filled in
+static int poll_cq_ex(struct ibv_cq_ex *cq, struct ibv_wc *wc, uint64_t *completion_ts) {
+    struct ibv_poll_cq_attr attr = {.comp_mask = 0};
+    int ret = ibv_start_poll(cq, &attr);
+    if (ret == ENOENT) return 0;
+    if (ret != 0) return -1;
+    int ne = 0;
     do {
-        ne = ibv_poll_cq(pg_handle->cq, 1, &wc);
-        if (ne < 0) {
-            fprintf(stderr, "Rank %d: Failed to poll CQ\n", rank);
+        wc[ne].wr_id = cq->wr_id;
+        wc[ne].status = cq->status;
+        completion_ts[ne] = ibv_wc_read_completion_ts(cq);
+        ne++;
+    } while (ne < PG_POLL_BATCH && (ret = ibv_next_poll(cq)) == 0);
+    ibv_end_poll(cq);
+    return ret == 0 || ret == ENOENT ? ne : -1;
+}
+
+int poll_cq_once(PGHandle *pg_handle, pg_priority_t priority) {
+    int rank = pg_handle->rank;
+    pg_traffic_class_t *cls = &pg_handle->classes[priority];
+    struct ibv_wc wc[PG_POLL_BATCH];
+    uint64_t completion_ts[PG_POLL_BATCH];
+
+    pthread_mutex_lock(&cls->cq_lock);
+    int ne = cls->cq_ex ? poll_cq_ex(cls->cq_ex, wc, completion_ts) : ibv_poll_cq(cls->cq, PG_POLL_BATCH, wc);
+    pthread_mutex_unlock(&cls->cq_lock);
+    if (ne < 0) {
+        fprintf(stderr, "Rank %d: Failed to poll CQ\n", rank);
+        return -1;
+    }
+    if (ne > 0 && pg_handle->latency.clock != PG_LATENCY_OFF) {
+        pg_latency_complete(pg_handle, wc, cls->cq_ex ? completion_ts : NULL, ne);
+    }
+
+    // Credit every completion to the slot that posted it
+    for (int i = 0; i < ne; i++) {
+        int owner_idx = PG_WR_SLOT(wc[i].wr_id);
+        if (owner_idx < 0 || owner_idx >= PG_MAX_SLOTS * PG_MAX_RINGS ||
+            owner_idx % PG_MAX_SLOTS >= pg_handle->num_slots + pg_handle->num_high_slots) {
+            fprintf(stderr, "Rank %d: Completion with unknown wr_id %lu\n",
+                    rank, (unsigned long)wc[i].wr_id);
+            continue;
+        }
+        pg_slot_t *owner = &pg_handle->slots[owner_idx];
+        if (wc[i].status != IBV_WC_SUCCESS) {
+            fprintf(stderr, "Rank %d: Work completion failed with status %s\n",
+                    rank, ibv_wc_status_str(wc[i].status));
+            __atomic_store_n(&owner->error, 1, __ATOMIC_RELEASE);
+        }
+        __atomic_sub_fetch(&owner->pending, 1, __ATOMIC_RELEASE);
+    }
+    return ne;
+}
+
+int reserve_completion(PGHandle *pg_handle, pg_slot_t *slot) {
+    int budget = MAX(pg_handle->config.cq_depth / 2, 1);
+    while (__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE) >= budget) {
+        if (poll_cq_once(pg_handle, slot->priority) < 0) return 1;
+    }
+    return 0;
+}
+
+int poll_for_completion(PGHandle *pg_handle, pg_slot_t *slot) {
+    while (__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE) > 0) {
+        if (poll_cq_once(pg_handle, slot->priority) < 0) {
             return 1;
         }
-    } while (ne == 0);
-    
-    if (wc.status != IBV_WC_SUCCESS) {
-        fprintf(stderr, "Rank %d: Work completion failed with status %s\n", 
-                rank, ibv_wc_status_str(wc.status));
+    }
+
+    if (__atomic_exchange_n(&slot->error, 0, __ATOMIC_ACQ_REL)) {
         return 1;
     }
-    
     return 0;
 }
 
 // Ring barrier synchronization
-// Uses the last 4 bytes of the recvbuf as a sync flag location
-int ring_barrier(PGHandle *pg_handle) {
+// Uses the slot's control word as a sequence-numbered sync flag, so flags
+// never need to be reset and concurrent slots never share a flag. The rank at
+// ring position 0 (position 0 of both directions) starts the wave.
+int ring_barrier(PGHandle *pg_handle, pg_slot_t *slot) {
     int rank = pg_handle->rank;
-    int right_neighbor = (rank + 1) % pg_handle->num_servers;
-    
-    // Sync flag is stored at the end of the receive buffer
-    size_t sync_offset = pg_handle->bufsize - sizeof(int);
-    volatile int *local_sync_ptr = (volatile int *)((char *)pg_handle->recvbuf + sync_offset);
-    
-    
-    // Step 1: Set our local sync flag to 1 (so we can write it to neighbor)
-    int sync_flag = -1;
-    int *sync_source = (int *)((char *)pg_handle->sendbuf + sync_offset);
-    *sync_source = sync_flag;
-    
+    int right_neighbor = side_rank(pg_handle, slot, 1);
+    int starter = pg_handle->ring_pos == 0;
+
+    pg_slot_ctrl_t *ctrl = &pg_handle->ctrl[slot->index];
+    uint64_t seq = ++slot->barrier_seq;
+
+    // Step 1: Prepare the flag value we write to our right neighbor
+    ctrl->barrier_src = seq;
+
     // sleep for a second to ensure the value is set before we start
-    usleep(10000);
-    if (rank != 0) {
-        // Spin on our local recvbuf sync location
-        u_int64_t timeout = 0;
-        
-        while (*local_sync_ptr != sync_flag) {
+    usleep(RING_BARRIER_DELAY_US);
+    if (!starter) {
+        // Spin on our local sync word until the left neighbor reached this barrier
+        uint64_t timeout = 0;
+
+        while (__atomic_load_n(&ctrl->barrier_seq, __ATOMIC_ACQUIRE) < seq) {
             timeout++;
             if (timeout > MAX_TIMEOUT) {
-                fprintf(stderr, "Rank %d: Barrier timeout - left neighbor didn't signal (flag=%d)\n", 
-                        rank, *local_sync_ptr);
+                fprintf(stderr, "Rank %d: Barrier timeout - left neighbor didn't signal (flag=%lu)\n",
+                        rank, (unsigned long)ctrl->barrier_seq);
                 return 1;
             }
         }
     }
-    
-    // Step 2: Write sync flag to right neighbor's recvbuf at sync_offset
+
+    // Step 2: Write sync flag to the same slot word of the right neighbor
     struct ibv_sge sge = {
-        .addr = (uintptr_t)sync_source,
-        .length = sizeof(int),
-        .lkey = pg_handle->mr_send->lkey
+        .addr = (uintptr_t)&ctrl->barrier_src,
+        .length = sizeof(uint64_t),
+        .lkey = pg_handle->mr_ctrl->lkey
     };
-    
+
     struct ibv_send_wr wr = {
-        .wr_id = rank + 1000,  // Different wr_id to distinguish from data transfers
+        .wr_id = PG_WR_ID(slot->index, PG_WR_BARRIER),  // Different kind to distinguish from data transfers
         .sg_list = &sge,
         .num_sge = 1,
         .opcode = IBV_WR_RDMA_WRITE,
         .send_flags = IBV_SEND_SIGNALED,
         .wr.rdma = {
-            .remote_addr = pg_handle->remote_addrs[right_neighbor] + sync_offset,
-            .rkey = pg_handle->remote_rkeys[right_neighbor]
+            .remote_addr = pg_handle->remote_ctrl_addrs[right_neighbor] +
+                           slot->index * sizeof(pg_slot_ctrl_t) +
+                           offsetof(pg_slot_ctrl_t, barrier_seq),
+            .rkey = pg_handle->remote_ctrl_rkeys[right_neighbor]
         },
         .next = NULL
     };
-    
-    struct ibv_send_wr *bad_wr;
-    if (ibv_post_send(pg_handle->qps[1], &wr, &bad_wr) != 0) {
+
+    if (post_slot_send(pg_handle, slot, slot_class(pg_handle, slot)->qps[side_qp(slot, 1)], &wr) != 0) {
         fprintf(stderr, "Rank %d: Failed to post barrier sync write\n", rank);
         return 1;
     }
-    
+
     // Step 3: Wait for our write completion
-    if (poll_for_completion(pg_handle) != 0) {
+    if (poll_for_completion(pg_handle, slot) != 0) {
         fprintf(stderr, "Rank %d: Barrier write completion failed\n", rank);
         return 1;
     }
-    
-    // Step 4: Wait for left neighbor to write to our buffer
-    if (rank == 0) {
-        // Spin on our local recvbuf sync location
+
+    // Step 4: Wait for left neighbor to write to our control word
+    if (starter) {
         uint64_t timeout = 0;
-        uint64_t max_timeout = MAX_TIMEOUT * 1000; // Longer timeout for rank 0
-        
-        while (*local_sync_ptr != sync_flag) {
+        uint64_t max_timeout = MAX_TIMEOUT * 1000; // Longer timeout for the starter
+
+        while (__atomic_load_n(&ctrl->barrier_seq, __ATOMIC_ACQUIRE) < seq) {
             timeout++;
             if (timeout > max_timeout) {
-                fprintf(stderr, "Rank %d: Barrier timeout - left neighbor didn't signal (flag=%d)\n", 
-                        rank, *local_sync_ptr);
+                fprintf(stderr, "Rank %d: Barrier timeout - left neighbor didn't signal (flag=%lu)\n",
+                        rank, (unsigned long)ctrl->barrier_seq);
                 return 1;
             }
         }
     }
-    
-    // Step 5: Reset the flag for next barrier
-    *local_sync_ptr = 0;
-    
+
     return 0;
-}
\ No newline at end of file
+}
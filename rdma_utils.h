@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/param.h>
@@ -21,27 +22,194 @@
 
 #define MAX_TIMEOUT 100000000000 // 100 million iterations
 
+/* Number of work completions drained per ibv_poll_cq call */
+#define PG_POLL_BATCH 16
+
+/**
+ * Takes the staging slot of a tagged collective (slot 'tag', tag < num_slots).
+ * Blocks while another collective of the same tag holds it.
+ * @param pg_handle Pointer to the process group handle.
+ * @param tag Non-negative operation tag, identical on all ranks.
+ * @return The locked slot, or NULL on an invalid tag.
+ */
+pg_slot_t *acquire_slot(PGHandle *pg_handle, int tag);
+
+/**
+ * Takes a staging slot of a priority class: high-priority collectives use the
+ * reserved slots (tag < num_high_slots), whose WRs go to the high-priority
+ * QPs and CQ. Without reserved slots every collective uses the bulk slots.
+ * A tag outside its class's slots is rejected on every rank alike: tags
+ * sharing a slot could be paired with different collectives on different ranks.
+ * @param pg_handle Pointer to the process group handle.
+ * @param tag Non-negative operation tag, identical on all ranks.
+ * @param priority Traffic class of the collective.
+ * @return The locked slot, or NULL on an invalid tag.
+ */
+pg_slot_t *acquire_slot_priority(PGHandle *pg_handle, int tag, pg_priority_t priority);
+
+/**
+ * Releases a slot taken with acquire_slot.
+ * @param pg_handle Pointer to the process group handle.
+ * @param slot The slot to release.
+ */
+void release_slot(PGHandle *pg_handle, pg_slot_t *slot);
+
+/**
+ * Posts a send WR on behalf of a slot. Signaled WRs are counted in the
+ * slot's pending completions. Safe to call from several threads.
+ * @param pg_handle Pointer to the process group handle.
+ * @param slot The slot the WR belongs to.
+ * @param qp The QP to post on (a QP of the slot's traffic class).
+ * @param wr The work request (wr_id must be built with PG_WR_ID).
+ * @return 0 on success, 1 on failure.
+ */
+int post_slot_send(PGHandle *pg_handle, pg_slot_t *slot, struct ibv_qp *qp, struct ibv_send_wr *wr);
+
+/**
+ * RDMA-Writes the slot's send buf to the same slot of the right neighbor in a ring topology.
+ * Left and right are taken along the slot's ring: the ring order for ring 0,
+ * the reverse for a ring 1 lane.
+ * @note Requires that the slot sendbuf is already populated with the message to send.
+ * @param pg_handle Pointer to the process group handle.
+ * @param slot The staging slot of the collective.
+ * @param actual_size Number of bytes to write (0 posts nothing).
+ * @return 0 on success, 1 on failure.
+ */
+int rdma_write_to_right(PGHandle *pg_handle, pg_slot_t *slot, size_t actual_size);
+
+/**
+ * RDMA-Writes a gather list of local (registered) memory into the same slot
+ * of the right neighbor's receive buffer, contiguously from 'remote_offset'.
+ * An unsignaled write must be followed by a signaled one on the same slot.
+ * @param pg_handle Pointer to the process group handle.
+ * @param slot The staging slot of the collective.
+ * @param sges Gather list, at most pg_handle->max_send_sge entries.
+ * @param num_sge Number of entries.
+ * @param remote_offset Destination offset inside the neighbor's slot.
+ * @param signaled Whether the write generates a completion on the slot.
+ * @return 0 on success, 1 on failure.
+ */
+int rdma_write_sge_to_right(PGHandle *pg_handle, pg_slot_t *slot, struct ibv_sge *sges, int num_sge,
+                            size_t remote_offset, int signaled);
+
+/**
+ * RDMA-Reads 'actual_size' bytes from the same slot of the left neighbor's send
+ * buffer into the slot's recv buffer (pull mode). Signaled on the slot.
+ * @param pg_handle Pointer to the process group handle.
+ * @param slot The staging slot of the collective.
+ * @param actual_size Number of bytes to read (0 posts nothing).
+ * @return 0 on success, 1 on failure.
+ */
+int rdma_read_from_left(PGHandle *pg_handle, pg_slot_t *slot, size_t actual_size);
+
+/**
+ * Writes one of the slot's local control source words into the same word of a
+ * neighbor's slot control block. Signaled on the slot; the source word must not
+ * change until the slot's completions have been polled.
+ * @param pg_handle Pointer to the process group handle.
+ * @param slot The staging slot of the collective.
+ * @param qp_idx 0 to write to the left neighbor, 1 to the right neighbor (along the slot's ring).
+ * @param src_offset offsetof() the local source word in pg_slot_ctrl_t.
+ * @param dst_offset offsetof() the remote destination word in pg_slot_ctrl_t.
+ * @return 0 on success, 1 on failure.
+ */
+int ctrl_write(PGHandle *pg_handle, pg_slot_t *slot, int qp_idx, size_t src_offset, size_t dst_offset);
+
+/**
+ * RDMA-Writes 'length' bytes of the mesh region to a connected mesh peer.
+ * An unsignaled write must be followed by a signaled one on the same peer.
+ * @param pg_handle Pointer to the process group handle.
+ * @param slot The staging slot of the collective.
+ * @param peer Destination rank (connected in the slot's class with pg_connect_peers).
+ * @param local Source address inside the local mesh region.
+ * @param length Number of bytes to write (0 posts nothing).
+ * @param remote_offset Destination offset inside the peer's mesh region.
+ * @param kind WR kind for the wr_id (PG_WR_MESH or PG_WR_CTRL).
+ * @param signaled Whether the write generates a completion on the slot.
+ * @return 0 on success, 1 on failure.
+ */
+int rdma_write_to_peer(PGHandle *pg_handle, pg_slot_t *slot, int peer, const void *local,
+                       size_t length, size_t remote_offset, int kind, int signaled);
+
 /**
- * RDMA-Writes the send buf to the right neighbor in a ring topology using RDMA Write.
- * @note Requires that the sendbuf is already populated with the message to send.
+ * RDMA-Writes up to PG_MAX_INLINE bytes to a connected mesh peer inline: the
+ * data is copied into the WQE, so 'local' may be any memory and is free
+ * again when the call returns. Signaled on the slot. Fails on a peer whose
+ * QP was created without inline support (pg_peer_t.inline_ok).
  * @param pg_handle Pointer to the process group handle.
+ * @param slot The staging slot of the collective.
+ * @param peer Destination rank (connected in the slot's class with pg_connect_peers).
+ * @param local Source address (need not be registered).
+ * @param length Number of bytes to write, at most PG_MAX_INLINE.
+ * @param remote_offset Destination offset inside the peer's mesh region.
+ * @param kind WR kind for the wr_id.
  * @return 0 on success, 1 on failure.
  */
-int rdma_write_to_right(PGHandle *pg_handle, size_t actual_size);  
+int rdma_write_inline_to_peer(PGHandle *pg_handle, pg_slot_t *slot, int peer, const void *local,
+                              size_t length, size_t remote_offset, int kind);
 
 /**
- * Polls the completion queue for a work completion.
+ * Posts a remote atomic on a 64-bit word of a connected mesh peer's mesh region.
+ * Signaled on the slot.
  * @param pg_handle Pointer to the process group handle.
+ * @param slot The staging slot of the collective.
+ * @param peer Target rank (connected in the slot's class with pg_connect_peers).
+ * @param fetched Local word inside the mesh region receiving the old value.
+ * @param remote_offset 8-byte aligned offset of the target word in the peer's mesh region.
+ * @param cmp_swap 1 for compare-and-swap, 0 for fetch-and-add.
+ * @param compare_add Value to add (fetch-and-add) or to compare with (compare-and-swap).
+ * @param swap Value stored on a successful compare-and-swap.
  * @return 0 on success, 1 on failure.
  */
-int poll_for_completion(PGHandle *pg_handle);
+int rdma_atomic_to_peer(PGHandle *pg_handle, pg_slot_t *slot, int peer, uint64_t *fetched,
+                        size_t remote_offset, int cmp_swap, uint64_t compare_add, uint64_t swap);
+
+/**
+ * Spins until a control word written by a neighbor reaches 'seq'.
+ * @param pg_handle Pointer to the process group handle.
+ * @param word The local control word.
+ * @param seq The sequence number to wait for.
+ * @return 0 on success, 1 on timeout.
+ */
+int wait_ctrl_word(PGHandle *pg_handle, volatile uint64_t *word, uint64_t seq);
+
+/**
+ * Polls one batch of completions from a traffic class's CQ and credits each
+ * to the slot that posted it. Classes never poll each other's CQs.
+ * @param pg_handle Pointer to the process group handle.
+ * @param priority The class whose CQ to poll.
+ * @return Number of completions polled, -1 on failure.
+ */
+int poll_cq_once(PGHandle *pg_handle, pg_priority_t priority);
+
+/**
+ * Polls until the slot has fewer outstanding signaled WRs than its share of
+ * the CQ (half the CQ depth), so one more can be posted without overflowing it.
+ * @param pg_handle Pointer to the process group handle.
+ * @param slot The slot about to post.
+ * @return 0 on success, 1 on failure.
+ */
+int reserve_completion(PGHandle *pg_handle, pg_slot_t *slot);
+
+/**
+ * Waits until every signaled WR of the slot has completed.
+ * Completions of other slots found on the way are credited to their owners.
+ * @param pg_handle Pointer to the process group handle.
+ * @param slot The slot whose completions to wait for.
+ * @return 0 on success, 1 on failure.
+ */
+int poll_for_completion(PGHandle *pg_handle, pg_slot_t *slot);
+
+/* Sleep at the start of every ring barrier (microseconds) */
+#define RING_BARRIER_DELAY_US 10000
 
 /**
  * Simple ring barrier using RDMA Write to signal readiness.
- * Each process writes a sync flag to its right neighbor and waits for
- * the left neighbor to write its flag.
+ * Each process writes a sequence-numbered flag to the slot control word of its
+ * right neighbor and waits for the left neighbor to write its flag.
  * @param pg_handle Pointer to the process group handle.
+ * @param slot The staging slot of the collective.
  * @return 0 on success, 1 on failure.
  */
-int ring_barrier(PGHandle *pg_handle);
+int ring_barrier(PGHandle *pg_handle, pg_slot_t *slot);
 #endif // RDMA_UTILS_H
\ No newline at end of file
@@ -11,13 +11,25 @@
 #include "pg_connect.h"
 #include "rdma_utils.h"
 #include "pg_allreduce.h"
+#include "pg_alltoall.h"
 #include "pg_close.h"
+#include "pg_numa.h"
+#include "pg_trace.h"
+#include "pg_sim.h"
+#include "pg_tuning.h"
+#include "pg_pool.h"
+#include "pg_scatter.h"
+#include "pg_repro.h"
+#include "pg_barrier.h"
+#include "pg_latency.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <time.h>
+#include <pthread.h>
 
 #define PRIME_SUM_RESULT_INT 17
 #define PRIME_SUM_RESULT_DOUBLE 17.0
@@ -68,9 +80,9 @@ int convert_args_to_serverlist(char *argv[], char ***serverlist, int *myindex, i
 
             // build list
             for (int k = 0; k < *num_servers; k++) {
-                (*serverlist)[k] = argv[i + 1 + k];
+                (*serverlist)[k] = strdup(argv[i + 1 + k]); // owned by the handle
             }
-            break;
+            i += *num_servers; // Options may follow the list
         }
     }
 
@@ -187,9 +199,1202 @@ bool test_case(PGHandle* pg_handle, int vector_size, DATATYPE datatype, OPERATIO
     return result;
 }
 
+/* Arguments of one concurrent collective in test_concurrent */
+typedef struct {
+    PGHandle* pg_handle;
+    int vector_size;
+    DATATYPE datatype;
+    OPERATION op;
+    int tag;
+    bool passed;
+} concurrent_arg_t;
+
+static void* concurrent_worker(void* arg) {
+    concurrent_arg_t* a = (concurrent_arg_t*)arg;
+    size_t bytes = a->vector_size * (a->datatype == INT ? sizeof(int) : sizeof(double));
+    void* sendbuf = malloc(bytes);
+    void* recvbuf = malloc(bytes);
+    a->passed = false;
+    if (sendbuf && recvbuf) {
+        fill_vector(sendbuf, a->vector_size, a->datatype, a->pg_handle->rank);
+        if (pg_all_reduce_tagged(sendbuf, recvbuf, a->vector_size, a->datatype, a->op,
+                                 a->tag, a->pg_handle) == 0) {
+            a->passed = compare_result(recvbuf, a->vector_size, a->datatype, a->op);
+        }
+    }
+    free(sendbuf);
+    free(recvbuf);
+    return NULL;
+}
+
+/**
+ * Runs several tagged all-reduces concurrently from different threads
+ * on the same handle and checks every result.
+ * @return true if all of them produced the expected result
+ */
+bool test_concurrent(PGHandle* pg_handle, int vector_size) {
+    concurrent_arg_t args[] = {
+        {pg_handle, vector_size, INT, SUM, 1, false},
+        {pg_handle, vector_size, DOUBLE, MULT, 2, false},
+        {pg_handle, vector_size / 2 + 1, DOUBLE, SUM, 3, false},
+    };
+    int num = sizeof(args) / sizeof(args[0]);
+    pthread_t threads[sizeof(args) / sizeof(args[0])];
+
+    for (int i = 0; i < num; i++) {
+        pthread_create(&threads[i], NULL, concurrent_worker, &args[i]);
+    }
+    bool result = true;
+    for (int i = 0; i < num; i++) {
+        pthread_join(threads[i], NULL);
+        result = result && args[i].passed;
+    }
+
+    // A tag past the slots would share one with another tag: rejected
+    int probe = 0;
+    if (pg_all_reduce_tagged(&probe, &probe, 1, INT, SUM, pg_handle->num_slots, pg_handle) == 0) {
+        fprintf(stderr, "Rank %d: tag %d beyond the slots was accepted\n", pg_handle->rank, pg_handle->num_slots);
+        result = false;
+    }
+    return result;
+}
+
+/**
+ * All-reduces many small DOUBLE tensors with pg_all_reduce_multi (using a small
+ * bucket so several buckets are formed) and checks the results are bitwise
+ * identical to per-tensor pg_all_reduce calls.
+ * @return true if every fused result matches its per-tensor result
+ */
+bool test_multi(PGHandle* pg_handle, int num_tensors) {
+    void** sendbufs = calloc(num_tensors, sizeof(void*));
+    void** fused = calloc(num_tensors, sizeof(void*));
+    void** single = calloc(num_tensors, sizeof(void*));
+    int* counts = calloc(num_tensors, sizeof(int));
+    bool result = sendbufs && fused && single && counts;
+
+    for (int t = 0; result && t < num_tensors; t++) {
+        counts[t] = 1 + (t * 37) % 3000;
+        sendbufs[t] = malloc(counts[t] * sizeof(double));
+        fused[t] = malloc(counts[t] * sizeof(double));
+        single[t] = malloc(counts[t] * sizeof(double));
+        if (!sendbufs[t] || !fused[t] || !single[t]) {
+            result = false;
+            break;
+        }
+        // Values whose sum depends on the accumulation order
+        for (int i = 0; i < counts[t]; i++) {
+            ((double*)sendbufs[t])[i] = 0.1 * (pg_handle->rank + 1) + 1e-7 * (i + t);
+        }
+    }
+
+    if (result) {
+        pg_set_fusion_bucket_size(pg_handle, 64 * 1024);
+        result = pg_all_reduce_multi(sendbufs, fused, counts, num_tensors, DOUBLE, SUM, pg_handle) == 0;
+        pg_set_fusion_bucket_size(pg_handle, PG_FUSION_BUCKET_BYTES);
+    }
+    for (int t = 0; result && t < num_tensors; t++) {
+        result = pg_all_reduce(sendbufs[t], single[t], counts[t], DOUBLE, SUM, pg_handle) == 0 &&
+                 memcmp(fused[t], single[t], counts[t] * sizeof(double)) == 0;
+    }
+
+    for (int t = 0; t < num_tensors; t++) {
+        if (sendbufs) free(sendbufs[t]);
+        if (fused) free(fused[t]);
+        if (single) free(single[t]);
+    }
+    free(sendbufs);
+    free(fused);
+    free(single);
+    free(counts);
+    return result;
+}
+
+// Turns PG_BALANCE on with the same skewed costs on every rank and no
+// measurements or exchanges, so the chunks differ from an equal split
+static void force_balance(PGHandle* pg_handle, pg_balance_t* saved, int* saved_on, double* costs) {
+    *saved = pg_handle->balance;
+    *saved_on = pg_handle->config.balance;
+    for (int q = 0; q < pg_handle->num_servers; q++) costs[q] = 1.0 + q % 3;
+    pg_handle->balance.costs = costs;
+    pg_handle->balance.exchanging = 1;
+    pg_handle->config.balance = 1;
+}
+
+static void restore_balance(PGHandle* pg_handle, const pg_balance_t* saved, int saved_on) {
+    pg_handle->balance = *saved;
+    pg_handle->config.balance = saved_on;
+}
+
+/**
+ * All-reduces a DOUBLE vector with about 'nnz' non-zeros per rank through
+ * pg_all_reduce_sparse, and through pg_all_reduce_sparsify with thresholds
+ * that force the sparse and the dense path, and checks every result is
+ * bitwise identical to pg_all_reduce of the dense vector, also on balanced
+ * chunks.
+ * @return true if all sparse results match the dense result
+ */
+bool test_sparse(PGHandle* pg_handle, int count, int nnz) {
+    double* dense = calloc(count, sizeof(double));
+    double* expected = malloc(count * sizeof(double));
+    double* result = malloc(count * sizeof(double));
+    int* indices = malloc(nnz * sizeof(int));
+    double* values = malloc(nnz * sizeof(double));
+    bool ok = dense && expected && result && indices && values;
+
+    // Ranks overlap on some indices so sums depend on the accumulation order
+    for (int i = 0; ok && i < nnz; i++) {
+        indices[i] = (int)(((long)i * 7919 + pg_handle->rank * (i % 2) * 13) % count);
+        values[i] = 0.1 * (pg_handle->rank + 1) + 1e-7 * i;
+        dense[indices[i]] += values[i];
+    }
+
+    ok = ok && pg_all_reduce(dense, expected, count, DOUBLE, SUM, pg_handle) == 0;
+    ok = ok && pg_all_reduce_sparse(indices, values, nnz, result, count, DOUBLE, SUM, pg_handle) == 0 &&
+         memcmp(result, expected, count * sizeof(double)) == 0;
+    ok = ok && pg_all_reduce_sparsify(dense, result, count, DOUBLE, SUM, 1.0, pg_handle) == 0 &&
+         memcmp(result, expected, count * sizeof(double)) == 0;
+    ok = ok && pg_all_reduce_sparsify(dense, result, count, DOUBLE, SUM, 0.0, pg_handle) == 0 &&
+         memcmp(result, expected, count * sizeof(double)) == 0;
+
+    pg_balance_t saved;
+    int saved_on = 0;
+    double* costs = malloc(pg_handle->num_servers * sizeof(double));
+    ok = ok && costs;
+    if (ok) {
+        force_balance(pg_handle, &saved, &saved_on, costs);
+        ok = pg_all_reduce(dense, expected, count, DOUBLE, SUM, pg_handle) == 0 &&
+             pg_all_reduce_sparse(indices, values, nnz, result, count, DOUBLE, SUM, pg_handle) == 0 &&
+             memcmp(result, expected, count * sizeof(double)) == 0;
+        restore_balance(pg_handle, &saved, saved_on);
+    }
+
+    free(costs);
+    free(dense);
+    free(expected);
+    free(result);
+    free(indices);
+    free(values);
+    return ok;
+}
+
+/**
+ * Runs pg_alltoall with blocks larger than a peer's staging share (so they
+ * move in several chunks), then pg_alltoallv where each rank only exchanges
+ * with its successor, and checks every received element.
+ * @return true if both exchanges deliver the expected data
+ */
+bool test_alltoall(PGHandle* pg_handle, int count) {
+    int n = pg_handle->num_servers;
+    int rank = pg_handle->rank;
+    int* sendbuf = calloc((size_t)n * count, sizeof(int));
+    int* recvbuf = malloc((size_t)n * count * sizeof(int));
+    int* sendcounts = calloc(n, sizeof(int));
+    int* recvcounts = calloc(n, sizeof(int));
+    int* displs = calloc(n, sizeof(int));
+    bool ok = sendbuf && recvbuf && sendcounts && recvcounts && displs;
+
+    // Element i of the block from rank q to rank p is q * 1000000 + p * 1000 + i % 1000
+    for (int p = 0; ok && p < n; p++) {
+        for (int i = 0; i < count; i++) {
+            sendbuf[(size_t)p * count + i] = rank * 1000000 + p * 1000 + i % 1000;
+        }
+    }
+    ok = ok && pg_alltoall(sendbuf, recvbuf, count, INT, pg_handle) == 0;
+    for (int q = 0; ok && q < n; q++) {
+        for (int i = 0; i < count; i++) {
+            if (recvbuf[(size_t)q * count + i] != q * 1000000 + rank * 1000 + i % 1000) {
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    // Ring-shaped alltoallv: only the successor is contacted
+    int right = (rank + 1) % n;
+    int left = (rank - 1 + n) % n;
+    if (ok) {
+        sendcounts[right] = count;
+        displs[right] = 0;
+        recvcounts[left] += count;
+        for (int i = 0; i < count; i++) sendbuf[i] = rank * 1000000 + i;
+        memset(recvbuf, 0, (size_t)count * sizeof(int));
+        ok = pg_alltoallv(sendbuf, sendcounts, displs, recvbuf, recvcounts, displs, INT, pg_handle) == 0;
+    }
+    for (int i = 0; ok && i < count; i++) {
+        ok = recvbuf[i] == left * 1000000 + i;
+    }
+
+    free(sendbuf);
+    free(recvbuf);
+    free(sendcounts);
+    free(recvcounts);
+    free(displs);
+    return ok;
+}
+
+/**
+ * Forces the atomic algorithm for INT SUM and MULT vectors of 1 to
+ * PG_ATOMIC_MAX_COUNT elements and compares against the ring algorithm.
+ * Passes trivially on devices without remote atomics (the ring is used).
+ * @return true if both algorithms agree for every count
+ */
+bool test_atomic(PGHandle* pg_handle) {
+    const OPERATION ops[] = {SUM, MULT};
+    int sendbuf[PG_ATOMIC_MAX_COUNT], atomic[PG_ATOMIC_MAX_COUNT], ring[PG_ATOMIC_MAX_COUNT];
+    pg_coll_params_t atomic_params = {PG_ALGO_ATOMIC, PG_PROTOCOL_PUSH, 0};
+    pg_coll_params_t ring_params = {PG_ALGO_RING, PG_PROTOCOL_PUSH, 0};
+
+    for (int o = 0; o < 2; o++) {
+        for (int count = 1; count <= PG_ATOMIC_MAX_COUNT; count++) {
+            for (int i = 0; i < count; i++) {
+                sendbuf[i] = (pg_handle->rank + 2) * (i - 3);
+            }
+            if (pg_all_reduce_with_params(sendbuf, atomic, count, INT, ops[o], 0, &atomic_params, pg_handle) != 0 ||
+                pg_all_reduce_with_params(sendbuf, ring, count, INT, ops[o], 0, &ring_params, pg_handle) != 0 ||
+                memcmp(atomic, ring, count * sizeof(int)) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * All-reduces strided DOUBLE views (long blocks sent with multi-SGE writes,
+ * once registered per call and once with pg_register_buffer, and single
+ * element blocks gathered into staging) and compares them bitwise with
+ * pg_all_reduce of the packed vectors, the last one on balanced chunks. The
+ * gaps between blocks must stay untouched.
+ * @return true if every strided result matches and no gap was written
+ */
+bool test_strided(PGHandle* pg_handle) {
+    const pg_vector_t layouts[] = {{1000, 300, 512}, {1000, 300, 512}, {50000, 1, 3}, {1000, 300, 512}};
+    bool result = true;
+    pg_balance_t saved;
+    int saved_on = 0;
+    double* costs = malloc(pg_handle->num_servers * sizeof(double));
+    if (!costs) return false;
+
+    for (int l = 0; l < 4 && result; l++) {
+        const pg_vector_t* layout = &layouts[l];
+        size_t extent = (size_t)(layout->count - 1) * layout->stride + layout->blocklen;
+        int count = layout->count * layout->blocklen;
+        double* sendbuf = malloc(extent * sizeof(double));
+        double* recvbuf = malloc(extent * sizeof(double));
+        double* packed = malloc(count * sizeof(double));
+        double* expected = malloc(count * sizeof(double));
+        result = sendbuf && recvbuf && packed && expected;
+
+        for (size_t i = 0; result && i < extent; i++) {
+            sendbuf[i] = (pg_handle->rank + 1) * 0.1 + i * 1e-3;
+            recvbuf[i] = -1.0;
+        }
+        for (int i = 0; result && i < count; i++) {
+            packed[i] = sendbuf[(size_t)(i / layout->blocklen) * layout->stride + i % layout->blocklen];
+        }
+        bool registered = l == 1 && result && pg_register_buffer(pg_handle, recvbuf, extent * sizeof(double)) == 0;
+        if (l == 3) force_balance(pg_handle, &saved, &saved_on, costs);
+        result = result &&
+                 pg_all_reduce(packed, expected, count, DOUBLE, SUM, pg_handle) == 0 &&
+                 pg_all_reduce_strided(sendbuf, recvbuf, layout, DOUBLE, SUM, pg_handle) == 0;
+        if (l == 3) restore_balance(pg_handle, &saved, saved_on);
+        if (registered) {
+            pg_deregister_buffer(pg_handle, recvbuf);
+        }
+
+        for (size_t i = 0; result && i < extent; i++) {
+            size_t block = i / layout->stride;
+            size_t within = i % layout->stride;
+            if (within < (size_t)layout->blocklen) {
+                result = memcmp(&recvbuf[i], &expected[block * layout->blocklen + within], sizeof(double)) == 0;
+            } else {
+                result = recvbuf[i] == -1.0;
+            }
+        }
+        free(sendbuf);
+        free(recvbuf);
+        free(packed);
+        free(expected);
+    }
+    free(costs);
+    return result;
+}
+
+/**
+ * Runs a large bulk all-reduce in a second thread while this thread issues
+ * small high-priority all-reduces, and reports their latency.
+ * @return true if the bulk and every high-priority result are correct
+ */
+bool test_priority(PGHandle* pg_handle, int bulk_size, int iterations) {
+    concurrent_arg_t bulk = {pg_handle, bulk_size, DOUBLE, SUM, 1, false};
+    pthread_t thread;
+    pthread_create(&thread, NULL, concurrent_worker, &bulk);
+
+    pg_op_opts_t opts = {0, PG_PRIORITY_HIGH};
+    double sendbuf[64], recvbuf[64];
+    fill_vector(sendbuf, 64, DOUBLE, pg_handle->rank);
+    bool result = true;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < iterations && result; i++) {
+        result = pg_all_reduce_ex(sendbuf, recvbuf, 64, DOUBLE, SUM, &opts, pg_handle) == 0 &&
+                 compare_result(recvbuf, 64, DOUBLE, SUM);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Rank %d: high-priority all-reduce latency under bulk load: %.1f us\n", pg_handle->rank,
+           ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / iterations);
+
+    pthread_join(thread, NULL);
+    return result && bulk.passed;
+}
+
+/**
+ * Checks whether a flag is present on the command line.
+ * @return true if argv contains 'flag'
+ */
+bool has_flag(char *argv[], const char *flag) {
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], flag) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Average time of 'iterations' DOUBLE SUM all-reduces of 'count' elements (after one warm-up call).
+ * @return seconds per call, or a negative value on failure
+ */
+double time_all_reduce(PGHandle* pg_handle, int count, int iterations) {
+    double* sendbuf = malloc(count * sizeof(double));
+    double* recvbuf = malloc(count * sizeof(double));
+    double result = -1.0;
+    if (sendbuf && recvbuf) {
+        fill_vector(sendbuf, count, DOUBLE, pg_handle->rank);
+        if (pg_all_reduce(sendbuf, recvbuf, count, DOUBLE, SUM, pg_handle) == 0) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            int i;
+            for (i = 0; i < iterations; i++) {
+                if (pg_all_reduce(sendbuf, recvbuf, count, DOUBLE, SUM, pg_handle) != 0) break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (i == iterations) {
+                result = ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9) / iterations;
+            }
+        }
+    }
+    free(sendbuf);
+    free(recvbuf);
+    return result;
+}
+
+/* Element sizes and names of every datatype, in DATATYPE order */
+static const size_t dtype_sizes[] = {sizeof(int), sizeof(double), sizeof(float), sizeof(int64_t),
+                                     sizeof(uint16_t), sizeof(uint16_t)};
+static const char* dtype_names[] = {"INT", "DOUBLE", "FLOAT", "INT64", "FP16", "BF16"};
+static const char* op_names[] = {"SUM", "MULT", "MIN", "MAX", "BAND", "BOR"};
+
+/* Input of element i on a rank. Every value and every partial result is
+ * exact in all datatypes (small integers for SUM / MIN / MAX, powers of two
+ * for MULT with -1 in place of 0.5 on the integer types, bit masks for the
+ * bitwise ops), so results compare exactly. */
+static double datatype_input(int rank, int i, DATATYPE datatype, OPERATION op) {
+    bool integer = datatype == INT || datatype == INT64;
+    switch (op) {
+        case SUM: return (double)((rank * 7 + i) % 8);
+        case MULT: return ((rank + i) % 3 == 0) ? (integer ? -1.0 : 0.5) : ((rank + i) % 3 == 1 ? 1.0 : 2.0);
+        case MIN:
+        case MAX: return (double)((rank * 13 + i * 5) % 64) - 32.0;
+        default:
+            // Two bits per rank; INT64 sets bits above 32 as well
+            return (double)((1LL << ((rank + i) % 30)) | (1LL << (i % 7)) |
+                            (datatype == INT64 ? 1LL << (33 + rank % 16) : 0));
+    }
+}
+
+static void store_elem(void* buf, int i, DATATYPE datatype, double value) {
+    switch (datatype) {
+        case INT: ((int*)buf)[i] = (int)value; break;
+        case DOUBLE: ((double*)buf)[i] = value; break;
+        case FLOAT: ((float*)buf)[i] = (float)value; break;
+        case INT64: ((int64_t*)buf)[i] = (int64_t)value; break;
+        case FP16: ((uint16_t*)buf)[i] = pg_float_to_fp16((float)value); break;
+        case BF16: ((uint16_t*)buf)[i] = pg_float_to_bf16((float)value); break;
+    }
+}
+
+static double load_elem(const void* buf, int i, DATATYPE datatype) {
+    switch (datatype) {
+        case INT: return ((const int*)buf)[i];
+        case DOUBLE: return ((const double*)buf)[i];
+        case FLOAT: return ((const float*)buf)[i];
+        case INT64: return (double)((const int64_t*)buf)[i];
+        case FP16: return pg_fp16_to_float(((const uint16_t*)buf)[i]);
+        case BF16: return pg_bf16_to_float(((const uint16_t*)buf)[i]);
+    }
+    return 0.0;
+}
+
+static double combine_expected(double a, double b, OPERATION op) {
+    switch (op) {
+        case SUM:
+        case AVG: return a + b;
+        case MULT: return a * b;
+        case MIN: return b < a ? b : a;
+        case MAX: return b > a ? b : a;
+        case BAND: return (double)((int64_t)a & (int64_t)b);
+        case BOR: return (double)((int64_t)a | (int64_t)b);
+    }
+    return 0.0;
+}
+
+/**
+ * All-reduces every supported (datatype, op) combination at a tiny count
+ * (the atomic path for INT) and a multi-segment count, and checks every
+ * element against the reduction of all ranks' inputs computed locally.
+ * Unsupported combinations (bitwise ops on floating types) must be rejected.
+ * @param pg_handle: process group handle
+ * @param count: elements of the large case
+ * @return true if all combinations pass
+ */
+bool test_datatypes(PGHandle* pg_handle, int count) {
+    int n = pg_handle->num_servers;
+    int counts[] = {5, count};
+    bool passed = true;
+    void* buf = malloc((size_t)count * sizeof(double));
+    if (!buf) return false;
+
+    for (int dt = INT; dt <= BF16; dt++) {
+        for (int op = SUM; op <= BOR; op++) {
+            bool bitwise = op == BAND || op == BOR;
+            bool supported = !bitwise || dt == INT || dt == INT64;
+            if (!supported) {
+                if (pg_all_reduce(buf, buf, 5, (DATATYPE)dt, (OPERATION)op, pg_handle) == 0) {
+                    fprintf(stderr, "Rank %d: %s %s should be rejected\n", pg_handle->rank,
+                            dtype_names[dt], op_names[op]);
+                    passed = false;
+                }
+                continue;
+            }
+            for (int c = 0; c < 2; c++) {
+                for (int i = 0; i < counts[c]; i++) {
+                    store_elem(buf, i, (DATATYPE)dt, datatype_input(pg_handle->rank, i, (DATATYPE)dt, (OPERATION)op));
+                }
+                if (pg_all_reduce(buf, buf, counts[c], (DATATYPE)dt, (OPERATION)op, pg_handle) != 0) {
+                    fprintf(stderr, "Rank %d: %s %s all-reduce failed\n", pg_handle->rank,
+                            dtype_names[dt], op_names[op]);
+                    passed = false;
+                    continue;
+                }
+                for (int i = 0; i < counts[c]; i++) {
+                    double expected = datatype_input(0, i, (DATATYPE)dt, (OPERATION)op);
+                    for (int r = 1; r < n; r++) {
+                        expected = combine_expected(expected, datatype_input(r, i, (DATATYPE)dt, (OPERATION)op),
+                                                    (OPERATION)op);
+                    }
+                    if (load_elem(buf, i, (DATATYPE)dt) != expected) {
+                        fprintf(stderr, "Rank %d: %s %s count %d mismatch at %d: %f != %f\n",
+                                pg_handle->rank, dtype_names[dt], op_names[op], counts[c], i,
+                                load_elem(buf, i, (DATATYPE)dt), expected);
+                        passed = false;
+                        break;
+                    }
+                }
+            }
+            printf("Rank %d: %s %s (%zu-byte elements) done\n", pg_handle->rank,
+                   dtype_names[dt], op_names[op], dtype_sizes[dt]);
+        }
+    }
+    free(buf);
+    return passed;
+}
+
+/**
+ * Checks an all-reduce on the configured ring order (PG_RING_ORDER) and ring
+ * count (PG_NUM_RINGS): the result must not depend on where ranks sit.
+ * @param pg_handle: process group handle
+ * @param count: DOUBLE elements; large enough to be split over two rings
+ * @return true if every element has the expected sum
+ */
+bool test_ring_order(PGHandle* pg_handle, int count) {
+    int n = pg_handle->num_servers;
+    printf("Rank %d: ring position %d of %d, left %d, right %d, %d ring(s)\n", pg_handle->rank,
+           pg_handle->ring_pos, n, pg_handle->left_rank, pg_handle->right_rank, pg_handle->num_rings);
+
+    double* buf = malloc((size_t)count * sizeof(double));
+    if (!buf) return false;
+    for (int i = 0; i < count; i++) {
+        buf[i] = (double)(i % 97) + pg_handle->rank;
+    }
+
+    bool passed = pg_all_reduce(buf, buf, count, DOUBLE, SUM, pg_handle) == 0;
+    for (int i = 0; passed && i < count; i++) {
+        if (buf[i] != (double)n * (i % 97) + n * (n - 1) / 2) {
+            fprintf(stderr, "Rank %d: ring order mismatch at %d: %f\n", pg_handle->rank, i, buf[i]);
+            passed = false;
+        }
+    }
+    free(buf);
+    return passed;
+}
+
+/**
+ * With PG_TRACE_EVENTS set, checks that every ring step of an all-reduce
+ * leaves a trace record and dumps the trace to /tmp/pg_trace.<rank>.json.
+ * @return true if the steps were recorded (trivially with tracing off)
+ */
+bool test_trace(PGHandle* pg_handle, int count) {
+    if (!pg_handle->trace.events) {
+        printf("Rank %d: tracing off, skipped\n", pg_handle->rank);
+        return true;
+    }
+    int* buf = malloc((size_t)count * sizeof(int));
+    if (!buf) return false;
+    for (int i = 0; i < count; i++) buf[i] = 1;
+
+    uint64_t before = pg_handle->trace.head;
+    bool passed = pg_all_reduce(buf, buf, count, INT, SUM, pg_handle) == 0;
+    uint64_t records = pg_handle->trace.head - before;
+    free(buf);
+    if (passed && records < 2 * (uint64_t)(pg_handle->num_servers - 1)) {
+        fprintf(stderr, "Rank %d: only %lu trace records\n", pg_handle->rank, (unsigned long)records);
+        passed = false;
+    }
+    return passed && pg_trace_dump(pg_handle, "/tmp/pg_trace.%d.json") == 0;
+}
+
+// Keeps the element with the larger magnitude (ties to the larger value)
+static void abs_max_kernel(void* dst, const void* src, int count, void* ctx) {
+    (void)ctx;
+    int* d = (int*)dst;
+    const int* s = (const int*)src;
+    for (int i = 0; i < count; i++) {
+        int ad = abs(d[i]), as = abs(s[i]);
+        if (as > ad || (as == ad && s[i] > d[i])) d[i] = s[i];
+    }
+}
+
+/**
+ * All-reduces INT elements with pg_all_reduce_custom and a user kernel that
+ * keeps the value of largest magnitude (ties to the positive one).
+ * @return true if every element holds the value of the rank it is largest on
+ */
+bool test_custom(PGHandle* pg_handle, int count) {
+    int n = pg_handle->num_servers;
+    int* buf = malloc((size_t)count * sizeof(int));
+    if (!buf) return false;
+    // Element i is largest in magnitude on rank i % n, negative on odd ranks
+    for (int i = 0; i < count; i++) {
+        int sign = (pg_handle->rank % 2) ? -1 : 1;
+        buf[i] = sign * (pg_handle->rank == i % n ? 1000 + i % 97 : pg_handle->rank + 1);
+    }
+
+    bool passed = pg_all_reduce_custom(buf, buf, count, sizeof(int), abs_max_kernel, NULL, NULL,
+                                       pg_handle) == 0;
+    for (int i = 0; passed && i < count; i++) {
+        int expected = ((i % n) % 2 ? -1 : 1) * (1000 + i % 97);
+        if (buf[i] != expected) {
+            fprintf(stderr, "Rank %d: custom reduction mismatch at %d: %d != %d\n",
+                    pg_handle->rank, i, buf[i], expected);
+            passed = false;
+        }
+    }
+    free(buf);
+    return passed;
+}
+
+// Chunk-ready bookkeeping of test_streaming
+typedef struct {
+    int expected;
+    char* seen;               // times each element was reported
+    int calls;
+    int early_wrong;          // reported elements that did not hold the result yet
+} streaming_state_t;
+
+static void on_chunk_ready(void* recvbuf, int offset, int count, void* ctx) {
+    streaming_state_t* state = (streaming_state_t*)ctx;
+    const int* buf = (const int*)recvbuf;
+    __atomic_fetch_add(&state->calls, 1, __ATOMIC_RELAXED);
+    for (int i = offset; i < offset + count; i++) {
+        state->seen[i]++;
+        if (buf[i] != state->expected) __atomic_fetch_add(&state->early_wrong, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * All-reduces through pg_all_reduce_streaming and checks the callback sees
+ * every element exactly once, already holding its final value.
+ * @return true if every element was reported once with the expected sum
+ */
+bool test_streaming(PGHandle* pg_handle, int count) {
+    int n = pg_handle->num_servers;
+    int* sendbuf = malloc((size_t)count * sizeof(int));
+    int* recvbuf = malloc((size_t)count * sizeof(int));
+    streaming_state_t state = {n * (n + 1) / 2, calloc(count, 1), 0, 0};
+    if (!sendbuf || !recvbuf || !state.seen) {
+        free(sendbuf);
+        free(recvbuf);
+        free(state.seen);
+        return false;
+    }
+    for (int i = 0; i < count; i++) sendbuf[i] = pg_handle->rank + 1;
+
+    bool passed = pg_all_reduce_streaming(sendbuf, recvbuf, count, INT, SUM, NULL, on_chunk_ready,
+                                          &state, pg_handle) == 0;
+    for (int i = 0; passed && i < count; i++) {
+        if (state.seen[i] != 1 || recvbuf[i] != state.expected) {
+            fprintf(stderr, "Rank %d: element %d reported %d times, value %d\n", pg_handle->rank, i,
+                    state.seen[i], recvbuf[i]);
+            passed = false;
+        }
+    }
+    if (passed && state.early_wrong > 0) {
+        fprintf(stderr, "Rank %d: %d elements reported before they were final\n", pg_handle->rank,
+                state.early_wrong);
+        passed = false;
+    }
+    if (passed) {
+        printf("Rank %d: %d elements reported in %d chunks\n", pg_handle->rank, count, state.calls);
+    }
+    free(sendbuf);
+    free(recvbuf);
+    free(state.seen);
+    return passed;
+}
+
+/**
+ * Simulates an all-reduce of this group with the default link parameters and
+ * prints the prediction next to the measured time; the model is uncalibrated,
+ * so the two are not compared. PG_BALANCE must be rejected by the simulator.
+ * @return true if the all-reduce succeeds and the prediction is well formed
+ */
+bool test_sim(PGHandle* pg_handle, int count) {
+    double* buf = malloc((size_t)count * sizeof(double));
+    if (!buf) return false;
+    for (int i = 0; i < count; i++) buf[i] = 1.0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool passed = pg_all_reduce(buf, buf, count, DOUBLE, SUM, pg_handle) == 0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(buf);
+
+    // Balanced and deterministic schedules are not modeled: they must be
+    // rejected, and the plain ring is simulated instead
+    pg_sim_model_t model;
+    pg_sim_model_init(&model);
+    pg_sim_t sim;
+    pg_sim_result_t result;
+    pg_config_t config = pg_handle->config;
+    config.balance = 1;
+    if (!passed || pg_sim_init(&sim, pg_handle->num_servers, &config, &model,
+                               pg_handle->atomic_supported) != 0) {
+        return false;
+    }
+    passed = pg_sim_all_reduce(&sim, count, DOUBLE, NULL, &result) != 0;
+    pg_sim_free(&sim);
+    config.balance = 0;
+    config.deterministic = 0;
+    if (!passed || pg_sim_init(&sim, pg_handle->num_servers, &config, &model,
+                               pg_handle->atomic_supported) != 0) {
+        return false;
+    }
+    passed = pg_sim_all_reduce(&sim, count, DOUBLE, NULL, &result) == 0 &&
+             result.mean_us > 0 && result.mean_us <= result.max_us;
+    pg_sim_free(&sim);
+    if (passed) {
+        double measured_us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+        printf("Rank %d: %d doubles predicted %.1f us (%s, %d ring(s), %d segment(s)), measured %.1f us\n",
+               pg_handle->rank, count, result.mean_us, pg_protocol_name(result.params.protocol),
+               result.rings, result.segments, measured_us);
+    }
+    return passed;
+}
+
+/**
+ * Repeats an all-reduce: the second one must take the scratch block of the
+ * first from the pool and give it back, and trimming must release it.
+ * @return true if the pool statistics show the reuse and the release
+ */
+bool test_pool(PGHandle* pg_handle, int count) {
+    int* buf = malloc((size_t)count * sizeof(int));
+    if (!buf) return false;
+    for (int i = 0; i < count; i++) buf[i] = 1;
+    pg_mem_stats_t before, after;
+    bool passed = pg_all_reduce(buf, buf, count, INT, SUM, pg_handle) == 0 &&
+                  pg_get_mem_stats(pg_handle, &before) == 0 &&
+                  pg_all_reduce(buf, buf, count, INT, SUM, pg_handle) == 0 &&
+                  pg_get_mem_stats(pg_handle, &after) == 0;
+    free(buf);
+    if (passed && (after.pool_misses != before.pool_misses || after.pool_hits <= before.pool_hits ||
+                   after.pool_in_use_bytes != 0 || after.pool_bytes > after.pool_max_bytes)) {
+        fprintf(stderr, "Rank %d: pool misses %lu -> %lu, hits %lu -> %lu, %zu bytes in use\n",
+                pg_handle->rank, (unsigned long)before.pool_misses, (unsigned long)after.pool_misses,
+                (unsigned long)before.pool_hits, (unsigned long)after.pool_hits, after.pool_in_use_bytes);
+        passed = false;
+    }
+    size_t trimmed = passed ? pg_pool_trim(pg_handle) : 0;
+    if (passed && (pg_get_mem_stats(pg_handle, &after) != 0 || after.pool_bytes != 0 ||
+                   trimmed != before.pool_bytes)) {
+        fprintf(stderr, "Rank %d: %zu pool bytes left after trimming %zu\n", pg_handle->rank,
+                after.pool_bytes, trimmed);
+        passed = false;
+    }
+    if (passed) {
+        printf("Rank %d: pinned %zu bytes, pool peak %zu bytes, %zu bytes trimmed\n", pg_handle->rank,
+               after.pinned_bytes, after.pool_peak_bytes, trimmed);
+    }
+    return passed;
+}
+
+/**
+ * Reduce-scatters blocks of (q + 1) * base elements to every rank q > 0 and
+ * none to rank 0, then gathers them back into the full vector.
+ * @return true if every block and the gathered vector hold the expected sums
+ */
+bool test_scatterv(PGHandle* pg_handle, int base) {
+    int n = pg_handle->num_servers;
+    int rank = pg_handle->rank;
+    int* counts = malloc(n * sizeof(int));
+    int total = 0;
+    for (int q = 0; counts && q < n; q++) {
+        counts[q] = q == 0 ? 0 : (q + 1) * base;
+        total += counts[q];
+    }
+    int* sendbuf = malloc((size_t)total * sizeof(int));
+    int* block = malloc((size_t)(counts ? counts[rank] : 0) * sizeof(int) + 1);
+    int* gathered = malloc((size_t)total * sizeof(int));
+    bool passed = counts && sendbuf && block && gathered;
+    for (int i = 0; passed && i < total; i++) sendbuf[i] = rank + 1 + i % 5;
+
+    passed = passed && pg_reduce_scatterv(sendbuf, block, counts, INT, SUM, pg_handle) == 0 &&
+             pg_allgatherv(block, gathered, counts, INT, pg_handle) == 0;
+    for (int i = 0; passed && i < total; i++) {
+        int expected = n * (n + 1) / 2 + n * (i % 5);
+        if (gathered[i] != expected) {
+            fprintf(stderr, "Rank %d: element %d is %d, expected %d\n", rank, i, gathered[i], expected);
+            passed = false;
+        }
+    }
+
+    // The all-reduce chunking always covers the vector
+    int chunk_total = 0;
+    if (passed && pg_get_chunk_counts(pg_handle, total, counts) == 0) {
+        for (int k = 0; k < n; k++) chunk_total += counts[k];
+    }
+    if (passed && chunk_total != total) {
+        fprintf(stderr, "Rank %d: chunks cover %d of %d elements\n", rank, chunk_total, total);
+        passed = false;
+    }
+    free(counts);
+    free(sendbuf);
+    free(block);
+    free(gathered);
+    return passed;
+}
+
+// Input of the deterministic test at element i: catastrophic cancellation
+// (i % 4 == 0), exact powers of two (1, 3), and decimals whose rounded sum
+// depends on the summation order (2)
+static double det_input(int rank, int n, int i) {
+    if (i % 4 == 0) {
+        int up = i % n, down = (i + 1) % n;
+        return (rank == up ? 9007199254740992.0 : 0.0) - (rank == down ? 9007199254740992.0 : 0.0) +
+               (rank != up && rank != down ? 1.0 : 0.0);
+    }
+    if (i % 4 == 2) return 0.1 * (rank + 1) + 1e-3 * i;
+    return (rank + 1) * ldexp(1.0, i % 41 - 20);
+}
+
+/**
+ * Checks pg_all_reduce_deterministic against exact sums, across ranks, against
+ * a call split at a different chunking, and through PG_DETERMINISTIC, where
+ * the multi-tensor, strided and sparse calls must match the plain ones.
+ * @return true if every result is exact and bitwise reproducible
+ */
+bool test_deterministic(PGHandle* pg_handle, int count) {
+    int n = pg_handle->num_servers;
+    int rank = pg_handle->rank;
+    double* sendbuf = malloc((size_t)count * sizeof(double));
+    double* result = malloc((size_t)count * sizeof(double));
+    double* other = malloc((size_t)count * sizeof(double));
+    int64_t* bits = malloc((size_t)count * sizeof(int64_t));
+    bool passed = sendbuf && result && other && bits;
+    for (int i = 0; passed && i < count; i++) sendbuf[i] = det_input(rank, n, i);
+    if (passed) {
+        sendbuf[1] = rank == 0 ? INFINITY : sendbuf[1];
+        sendbuf[3] = rank == n - 1 ? NAN : sendbuf[3];
+    }
+
+    passed = passed && pg_all_reduce_deterministic(sendbuf, result, count, NULL, pg_handle) == 0;
+    for (int i = 0; passed && i < count; i++) {
+        double expected;
+        if (i == 1 || i == 3) {
+            expected = i == 1 ? INFINITY : NAN;
+        } else if (i % 4 == 0) {
+            expected = n - (i % n == (i + 1) % n ? 1 : 2);
+        } else if (i % 4 == 2) {
+            continue;
+        } else {
+            expected = n * (n + 1) / 2 * ldexp(1.0, i % 41 - 20);
+        }
+        if (!(result[i] == expected || (isnan(result[i]) && isnan(expected)))) {
+            fprintf(stderr, "Rank %d: deterministic element %d is %.17g, expected %.17g\n",
+                    rank, i, result[i], expected);
+            passed = false;
+        }
+    }
+
+    // Every rank holds the same bits
+    if (passed) {
+        memcpy(bits, result, (size_t)count * sizeof(int64_t));
+        passed = pg_all_reduce(bits, bits, count, INT64, MAX, pg_handle) == 0 &&
+                 memcmp(bits, result, (size_t)count * sizeof(int64_t)) == 0;
+        if (!passed) fprintf(stderr, "Rank %d: deterministic results differ between ranks\n", rank);
+    }
+
+    // Other chunk boundaries, same exponent blocks: same bits
+    int half = count / 2 / PG_REPRO_BLOCK * PG_REPRO_BLOCK;
+    passed = passed && half > 0 &&
+             pg_all_reduce_deterministic(sendbuf, other, half, NULL, pg_handle) == 0 &&
+             pg_all_reduce_deterministic(sendbuf + half, other + half, count - half, NULL, pg_handle) == 0;
+    if (passed && memcmp(other, result, (size_t)count * sizeof(double)) != 0) {
+        fprintf(stderr, "Rank %d: deterministic result depends on the chunking\n", rank);
+        passed = false;
+    }
+
+    // PG_DETERMINISTIC routes pg_all_reduce, in place
+    if (passed) {
+        int saved = pg_handle->config.deterministic;
+        pg_handle->config.deterministic = 1;
+        memcpy(other, sendbuf, (size_t)count * sizeof(double));
+        passed = pg_all_reduce(other, other, count, DOUBLE, SUM, pg_handle) == 0 &&
+                 memcmp(other, result, (size_t)count * sizeof(double)) == 0;
+        if (!passed) fprintf(stderr, "Rank %d: PG_DETERMINISTIC all-reduce differs\n", rank);
+
+        // Fused tensors that straddle exponent blocks: the bits of their own calls
+        int sizes[] = {300, 1000, 77};
+        void* sends[3];
+        void* recvs[3];
+        size_t offset = 0;
+        for (int t = 0; t < 3; t++) {
+            sends[t] = sendbuf + offset;
+            recvs[t] = other + offset;
+            offset += sizes[t];
+        }
+        passed = passed && pg_all_reduce_multi(sends, recvs, sizes, 3, DOUBLE, SUM, pg_handle) == 0;
+        for (int t = 0; passed && t < 3; t++) {
+            passed = pg_all_reduce_deterministic(sends[t], (double*)bits, sizes[t], NULL, pg_handle) == 0 &&
+                     memcmp(bits, recvs[t], sizes[t] * sizeof(double)) == 0;
+            if (!passed) fprintf(stderr, "Rank %d: PG_DETERMINISTIC multi tensor %d differs\n", rank, t);
+        }
+
+        // Every other element as a strided view: the bits of the packed call
+        pg_vector_t layout = {count / 2, 1, 2};
+        double* packed = (double*)bits;
+        for (int i = 0; i < count / 2; i++) packed[i] = sendbuf[2 * i];
+        memcpy(other, sendbuf, (size_t)count * sizeof(double));
+        passed = passed && pg_all_reduce_strided(sendbuf, other, &layout, DOUBLE, SUM, pg_handle) == 0 &&
+                 pg_all_reduce_deterministic(packed, packed, count / 2, NULL, pg_handle) == 0;
+        for (int i = 0; passed && i < count / 2; i++) {
+            passed = memcmp(&other[2 * i], &packed[i], sizeof(double)) == 0 &&
+                     memcmp(&other[2 * i + 1], &sendbuf[2 * i + 1], sizeof(double)) == 0;
+            if (!passed) fprintf(stderr, "Rank %d: PG_DETERMINISTIC strided element %d differs\n", rank, i);
+        }
+
+        // Every 8th element as a sparse list: the bits of the dense call
+        int nnz = (count + 7) / 8;
+        int* indices = malloc(nnz * sizeof(int));
+        passed = passed && indices;
+        for (int i = 0; passed && i < count; i++) result[i] = i % 8 ? 0.0 : sendbuf[i];
+        for (int j = 0; passed && j < nnz; j++) {
+            indices[j] = 8 * j;
+            packed[j] = sendbuf[8 * j];
+        }
+        passed = passed && pg_all_reduce_sparse(indices, packed, nnz, other, count, DOUBLE, SUM, pg_handle) == 0 &&
+                 pg_all_reduce_deterministic(result, result, count, NULL, pg_handle) == 0 &&
+                 memcmp(other, result, (size_t)count * sizeof(double)) == 0;
+        if (!passed) fprintf(stderr, "Rank %d: PG_DETERMINISTIC sparse all-reduce differs\n", rank);
+        free(indices);
+        pg_handle->config.deterministic = saved;
+    }
+    free(sendbuf);
+    free(result);
+    free(other);
+    free(bits);
+    return passed;
+}
+
+/**
+ * Times the data transfers of an all-reduce in software (or on the NIC clock
+ * under PG_WR_LATENCY=1).
+ * @return true if the histograms add up to the transfers counted
+ */
+bool test_wr_latency(PGHandle* pg_handle, int count) {
+    int rank = pg_handle->rank;
+    pg_latency_clock_t saved = pg_handle->latency.clock;
+    if (saved == PG_LATENCY_OFF) pg_handle->latency.clock = PG_LATENCY_SOFTWARE;
+    pg_reset_wr_latency(pg_handle);
+
+    double* buf = malloc((size_t)count * sizeof(double));
+    bool passed = buf != NULL;
+    for (int i = 0; passed && i < count; i++) buf[i] = rank + 1;
+    passed = passed && pg_all_reduce(buf, buf, count, DOUBLE, SUM, pg_handle) == 0;
+    pg_latency_t stats;
+    passed = passed && pg_get_wr_latency(pg_handle, &stats) == 0;
+    pg_handle->latency.clock = saved;
+
+    uint64_t bucketed = 0;
+    for (int b = 0; passed && b < PG_LATENCY_BUCKETS; b++) bucketed += stats.wire.counts[b];
+    if (passed && (pg_handle->num_servers > 1 ? stats.wire.samples == 0 : stats.wire.samples != 0)) {
+        fprintf(stderr, "Rank %d: %lu timed writes\n", rank, (unsigned long)stats.wire.samples);
+        passed = false;
+    }
+    if (passed && (bucketed != stats.wire.samples ||
+                   pg_latency_percentile(&stats.wire, 0.5) > pg_latency_percentile(&stats.wire, 0.99) ||
+                   pg_latency_percentile(&stats.wire, 0.99) > stats.wire.max_ns)) {
+        fprintf(stderr, "Rank %d: inconsistent latency histogram\n", rank);
+        passed = false;
+    }
+    if (passed) {
+        printf("Rank %d: %s clock, %lu writes, wire p50 %.0f ns p99 %.0f ns max %lu ns, poll delay p50 %.0f ns\n",
+               rank, stats.clock == PG_LATENCY_HARDWARE ? "NIC" : "software", (unsigned long)stats.wire.samples,
+               pg_latency_percentile(&stats.wire, 0.5), pg_latency_percentile(&stats.wire, 0.99),
+               (unsigned long)stats.wire.max_ns, pg_latency_percentile(&stats.poll_delay, 0.5));
+    }
+    free(buf);
+    return passed;
+}
+
+/**
+ * Checks AVG on every floating type, in and out of place, pg_all_reduce_scaled
+ * with both factors, reduce_scatterv with AVG, and that AVG on INT is rejected.
+ * The inputs are small integers; results carry one rounding of the 1 / n scaling.
+ * @return true if every result is within the tolerance of its datatype
+ */
+bool test_average(PGHandle* pg_handle, int count) {
+    int n = pg_handle->num_servers;
+    int rank = pg_handle->rank;
+    DATATYPE types[] = {DOUBLE, FLOAT, FP16, BF16};
+    double tolerance[] = {1e-12, 1e-6, 1e-3, 1e-2};
+    void* sendbuf = malloc((size_t)count * sizeof(double));
+    void* recvbuf = malloc((size_t)count * sizeof(double));
+    bool passed = sendbuf && recvbuf;
+
+    for (int t = 0; passed && t < 4; t++) {
+        for (int in_place = 0; passed && in_place < 2; in_place++) {
+            void* dst = in_place ? sendbuf : recvbuf;
+            for (int i = 0; i < count; i++) store_elem(sendbuf, i, types[t], (double)(rank + i % 16));
+            passed = pg_all_reduce(sendbuf, dst, count, types[t], AVG, pg_handle) == 0;
+            for (int i = 0; passed && i < count; i++) {
+                double expected = i % 16 + (n - 1) / 2.0;
+                double got = load_elem(dst, i, types[t]);
+                if (fabs(got - expected) > tolerance[t] * expected + tolerance[t]) {
+                    fprintf(stderr, "Rank %d: %s AVG element %d is %g, expected %g\n",
+                            rank, dtype_names[types[t]], i, got, expected);
+                    passed = false;
+                }
+            }
+        }
+    }
+
+    // Powers of two scale exactly: 4 * sum(x / 2) == 2 * sum(x)
+    for (int i = 0; passed && i < count; i++) ((float*)sendbuf)[i] = (float)(rank + 1 + i % 8);
+    passed = passed && pg_all_reduce_scaled(sendbuf, recvbuf, count, FLOAT, SUM, 0.5, 4.0, NULL, pg_handle) == 0;
+    for (int i = 0; passed && i < count; i++) {
+        float expected = 2.0f * (n * (n + 1) / 2 + n * (i % 8));
+        if (((float*)recvbuf)[i] != expected) {
+            fprintf(stderr, "Rank %d: scaled element %d is %g, expected %g\n",
+                    rank, i, ((float*)recvbuf)[i], expected);
+            passed = false;
+        }
+    }
+
+    // reduce_scatterv: each rank's block of the average
+    int* counts = malloc(n * sizeof(int));
+    int block = count / n;
+    passed = passed && counts != NULL;
+    for (int q = 0; passed && q < n; q++) counts[q] = block;
+    for (int i = 0; passed && i < block * n; i++) ((double*)sendbuf)[i] = 2.0 * rank + i % 16;
+    passed = passed && pg_reduce_scatterv(sendbuf, recvbuf, counts, DOUBLE, AVG, pg_handle) == 0;
+    for (int i = 0; passed && i < block; i++) {
+        double expected = (rank * block + i) % 16 + (n - 1);
+        if (fabs(((double*)recvbuf)[i] - expected) > 1e-12 * expected) {
+            fprintf(stderr, "Rank %d: reduce_scatterv AVG element %d is %g, expected %g\n",
+                    rank, i, ((double*)recvbuf)[i], expected);
+            passed = false;
+        }
+    }
+
+    // Integer averages would have to round; they are rejected on every rank
+    if (passed && (pg_all_reduce(sendbuf, recvbuf, count, INT, AVG, pg_handle) == 0 ||
+                   pg_all_reduce_scaled(sendbuf, recvbuf, count, INT, SUM, 2.0, 1.0, NULL, pg_handle) == 0)) {
+        fprintf(stderr, "Rank %d: integer AVG / scaling was accepted\n", rank);
+        passed = false;
+    }
+    free(counts);
+    free(sendbuf);
+    free(recvbuf);
+    return passed;
+}
+
+/**
+ * Delays the last rank's entry into pg_barrier and checks nobody leaves before
+ * it entered, then times back-to-back barriers.
+ * @return true if no rank left early and every barrier succeeded
+ */
+bool test_barrier(PGHandle* pg_handle, int iterations) {
+    int rank = pg_handle->rank;
+    int n = pg_handle->num_servers;
+    const useconds_t late_us = 20000;
+    bool passed = pg_barrier(pg_handle) == 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (rank == n - 1) usleep(late_us);
+    passed = passed && pg_barrier(pg_handle) == 0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double waited_us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    // Allow for the ranks leaving the first barrier up to a few ms apart
+    if (passed && n > 1 && waited_us < late_us / 2) {
+        fprintf(stderr, "Rank %d: left the barrier after %.0f us, before the last rank entered\n",
+                rank, waited_us);
+        passed = false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; passed && i < iterations; i++) {
+        passed = pg_barrier(pg_handle) == 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (passed) {
+        double total_us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+        printf("Rank %d: %d barriers, %.2f us each\n", rank, iterations, total_us / iterations);
+    }
+
+    // A barrier on another tag and the bulk class
+    pg_op_opts_t opts = {1, PG_PRIORITY_BULK};
+    passed = passed && pg_barrier_ex(&opts, pg_handle) == 0;
+    return passed;
+}
+
+/**
+ * Removes rank 1 from the group (the last test, so the others keep running
+ * on the full group) and checks an all-reduce over the renumbered ranks.
+ * Passes trivially on groups of fewer than 3 ranks.
+ * @return true if the shrink succeeds and every element has the expected sum
+ */
+bool test_shrink(PGHandle* pg_handle, int count) {
+    int n = pg_handle->num_servers;
+    if (n < 3 || pg_handle->rank == 1) {
+        return true;   // too small to shrink, or we are the rank leaving
+    }
+    if (pg_shrink(pg_handle, 1) != 0) {
+        return false;
+    }
+    int rank = pg_handle->rank;
+    printf("Rank %d: now rank %d of %d, left %d, right %d\n", rank + (rank >= 1), rank,
+           pg_handle->num_servers, pg_handle->left_rank, pg_handle->right_rank);
+
+    int* buf = malloc((size_t)count * sizeof(int));
+    if (!buf) return false;
+    for (int i = 0; i < count; i++) {
+        buf[i] = rank + 1;
+    }
+    bool passed = pg_all_reduce(buf, buf, count, INT, SUM, pg_handle) == 0;
+    int expected = (n - 1) * n / 2;
+    for (int i = 0; passed && i < count; i++) {
+        if (buf[i] != expected) {
+            fprintf(stderr, "Rank %d: shrunk group mismatch at %d: %d != %d\n", rank, i, buf[i], expected);
+            passed = false;
+        }
+    }
+    free(buf);
+    return passed;
+}
+
+/**
+ * NUMA benchmark mode (-numa-bench): connects the group once with staging
+ * memory on the NIC's NUMA node and once on a remote node, pins the thread to
+ * the buffer node each time, and reports all-reduce latency and bandwidth.
+ * @return 0 on success, 1 on failure
+ */
+int run_numa_bench(char** serverlist, int num_servers, int rank) {
+    const pg_numa_placement_t placements[] = {PG_NUMA_LOCAL, PG_NUMA_REMOTE};
+    const char* names[] = {"local", "remote"};
+
+    for (int p = 0; p < 2; p++) {
+        pg_config_t config;
+        pg_config_init(&config);
+        if (pg_config_load_env(&config) != 0) return 1;
+        config.numa_placement = placements[p];
+        config.pin_threads = 1;
+
+        // The handle owns its server list, so every connection gets a copy
+        char** names_copy = malloc(num_servers * sizeof(char*));
+        if (!names_copy) return 1;
+        for (int i = 0; i < num_servers; i++) names_copy[i] = strdup(serverlist[i]);
+
+        void* handle_void = NULL;
+        if (connect_process_group_ex(names_copy, num_servers, &handle_void, rank, &config) != 0) {
+            fprintf(stderr, "Rank %d: connect_process_group_ex failed (numa=%s)\n", rank, names[p]);
+            return 1;
+        }
+        PGHandle* pg_handle = (PGHandle*)handle_void;
+        printf("Rank %d: numa=%s buffers on node %d\n", rank, names[p], pg_handle->numa_node);
+        for (int count = 1024; count <= (1 << 22); count *= 4) {
+            double seconds = time_all_reduce(pg_handle, count, 10);
+            if (seconds < 0) {
+                fprintf(stderr, "Rank %d: all-reduce failed (numa=%s)\n", rank, names[p]);
+                pg_close(pg_handle);
+                return 1;
+            }
+            printf("Rank %d: numa=%-6s bytes=%-10zu latency=%10.1f us  bandwidth=%8.3f GB/s\n",
+                   rank, names[p], count * sizeof(double), seconds * 1e6,
+                   count * sizeof(double) / seconds / 1e9);
+        }
+        pg_close(pg_handle);
+    }
+    return 0;
+}
+
+/**
+ * Deterministic benchmark mode (-det-bench): times DOUBLE SUM all-reduces
+ * with and without PG_DETERMINISTIC on one connection and reports the
+ * overhead of the reproducible mode per size.
+ * @return 0 on success, 1 on failure
+ */
+int run_det_bench(char** serverlist, int num_servers, int rank) {
+    void* handle_void = NULL;
+    if (connect_process_group(serverlist, num_servers, &handle_void, rank) != 0) {
+        fprintf(stderr, "Rank %d: connect_process_group failed\n", rank);
+        return 1;
+    }
+    PGHandle* pg_handle = (PGHandle*)handle_void;
+    int ret = 0;
+    for (int count = 1024; ret == 0 && count <= (1 << 22); count *= 4) {
+        double seconds[2];
+        for (int mode = 0; mode < 2; mode++) {
+            pg_handle->config.deterministic = mode;
+            seconds[mode] = time_all_reduce(pg_handle, count, 10);
+            if (seconds[mode] < 0) {
+                fprintf(stderr, "Rank %d: all-reduce failed (deterministic=%d)\n", rank, mode);
+                ret = 1;
+                break;
+            }
+        }
+        if (ret == 0) {
+            printf("Rank %d: bytes=%-10zu default=%10.1f us  deterministic=%10.1f us  overhead=%6.2fx\n",
+                   rank, count * sizeof(double), seconds[0] * 1e6, seconds[1] * 1e6, seconds[1] / seconds[0]);
+        }
+    }
+    pg_close(pg_handle);
+    return ret;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 3) {
-        fprintf(stderr, "Usage: %s -myindex <rank> -list <server0> <server1> ...\n", argv[0]);
+        fprintf(stderr, "Usage: %s -myindex <rank> -list <server0> <server1> ... [-numa-bench | -det-bench]\n", argv[0]);
         return 1;
     }
 
@@ -201,6 +1406,16 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (has_flag(argv, "-numa-bench")) {
+        int ret = run_numa_bench(serverlist, num_servers, rank);
+        for (int i = 0; i < num_servers; i++) free(serverlist[i]);
+        free(serverlist);
+        return ret;
+    }
+    if (has_flag(argv, "-det-bench")) {
+        return run_det_bench(serverlist, num_servers, rank);
+    }
+
     void *pg_handle_void = NULL;
 
     printf("Rank %d: Connecting to process group...\n", rank);
@@ -233,4 +1448,104 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "Rank %d: Test case failed for size %d, DOUBLE,MULT\n", rank, size);
         }
     }
+
+    printf("Rank %d: Testing concurrent tagged all-reduces...\n", rank);
+    if (!test_concurrent(pg_handle, 1 << 16)) {
+        fprintf(stderr, "Rank %d: Concurrent test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing fused multi-tensor all-reduce...\n", rank);
+    if (!test_multi(pg_handle, 100)) {
+        fprintf(stderr, "Rank %d: Fused multi-tensor test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing sparse all-reduce...\n", rank);
+    if (!test_sparse(pg_handle, 1 << 20, 1000)) {
+        fprintf(stderr, "Rank %d: Sparse test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing alltoall...\n", rank);
+    if (!test_alltoall(pg_handle, 1 << 18)) {
+        fprintf(stderr, "Rank %d: Alltoall test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing atomic all-reduce...\n", rank);
+    if (!test_atomic(pg_handle)) {
+        fprintf(stderr, "Rank %d: Atomic test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing strided all-reduce...\n", rank);
+    if (!test_strided(pg_handle)) {
+        fprintf(stderr, "Rank %d: Strided test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing high-priority all-reduce under bulk load...\n", rank);
+    if (!test_priority(pg_handle, 1 << 22, 100)) {
+        fprintf(stderr, "Rank %d: Priority test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing every datatype and operation...\n", rank);
+    if (!test_datatypes(pg_handle, 1 << 18)) {
+        fprintf(stderr, "Rank %d: Datatype test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing all-reduce on the configured ring order...\n", rank);
+    if (!test_ring_order(pg_handle, 1 << 21)) {
+        fprintf(stderr, "Rank %d: Ring order test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing ring-step tracing...\n", rank);
+    if (!test_trace(pg_handle, 1 << 20)) {
+        fprintf(stderr, "Rank %d: Trace test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing all-reduce with a custom reduction...\n", rank);
+    if (!test_custom(pg_handle, 1 << 18)) {
+        fprintf(stderr, "Rank %d: Custom reduction test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing streaming chunk-ready callbacks...\n", rank);
+    if (!test_streaming(pg_handle, 1 << 20)) {
+        fprintf(stderr, "Rank %d: Streaming test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing the all-reduce simulator...\n", rank);
+    if (!test_sim(pg_handle, 1 << 20)) {
+        fprintf(stderr, "Rank %d: Simulator test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing the scratch pool...\n", rank);
+    if (!test_pool(pg_handle, 1 << 20)) {
+        fprintf(stderr, "Rank %d: Scratch pool test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing reduce_scatterv / allgatherv with uneven blocks...\n", rank);
+    if (!test_scatterv(pg_handle, 1000)) {
+        fprintf(stderr, "Rank %d: reduce_scatterv / allgatherv test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing deterministic DOUBLE SUM...\n", rank);
+    if (!test_deterministic(pg_handle, 1 << 18)) {
+        fprintf(stderr, "Rank %d: Deterministic test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing per-WR latency histograms...\n", rank);
+    if (!test_wr_latency(pg_handle, 1 << 20)) {
+        fprintf(stderr, "Rank %d: WR latency test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing AVG and pre/post scale factors...\n", rank);
+    if (!test_average(pg_handle, 1 << 16)) {
+        fprintf(stderr, "Rank %d: AVG test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing the dissemination barrier...\n", rank);
+    if (!test_barrier(pg_handle, 10000)) {
+        fprintf(stderr, "Rank %d: Barrier test case failed\n", rank);
+    }
+
+    printf("Rank %d: Testing removing rank 1 from the group...\n", rank);
+    if (!test_shrink(pg_handle, 1 << 16)) {
+        fprintf(stderr, "Rank %d: Shrink test case failed\n", rank);
+    }
 }